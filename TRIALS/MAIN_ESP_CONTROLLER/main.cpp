@@ -2,16 +2,32 @@
 // Reliable TCP streamer for I2S microphone (INMP441) -> PC
 // Improvements: microsecond timestamps, 64-bit sample index, static buffers,
 // APLL for stable sample clock, better header, no malloc in audio loop.
+// Optional UDP mode: smaller datagrams, each a whole ESP2 packet, with an XOR parity
+// packet per group so the receiver can rebuild a lost one without a retransmit.
+// Optional payload coding (PAYLOAD_FORMAT) cuts the air time per node.
+// Capture and network run as separate tasks on separate cores, joined by a ring of
+// packet slots in PSRAM, so a Wi-Fi stall of several seconds never stalls i2s_read.
+// Over TCP each connection opens with a session hello (esp2_wire_header.h): sent slots
+// stay in the ring until the receiver acks them, and after a reconnect the receiver
+// says where to resume, so a dropped connection loses nothing the ring could hold.
 
 #include <Arduino.h>
 #include <WiFi.h>
+#include <WiFiUdp.h>
 #include "driver/i2s.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "esp_heap_caps.h"
+#include "esp2_wire_header.h"   // include/: ESP2 packet header shared with the receiver
+#include "esp2_payload_codec.h"  // include/: payload encoders (the receiver has the decoders)
 
 // ---------- CONFIG (edit for your network / receiver) ----------
 const char* WIFI_SSID = "94 Pembroke Street - 2"; // <- REPLACE
 const char* WIFI_PASS = "welcomehome";           // <- REPLACE
 const char* PC_IP      = "192.168.2.133";         // <- REPLACE with your PC IP
-const uint16_t PC_PORT = 7000;                   // <- PC listening TCP port
+const uint16_t PC_PORT = 7000;                   // <- PC listening TCP port (the UDP port has the same number)
+const bool USE_UDP_TRANSPORT = false;            // true: unreliable UDP datagrams + FEC instead of TCP
+const bool USE_SESSION_HANDSHAKE = true;         // TCP: resumable sessions (falls back for older receivers)
 // ----------------------------------------------------------------
 
 // I2S pins (set to your wiring)
@@ -22,35 +38,126 @@ const int PIN_DATA = 16;  // SD
 // Capture parameters (tweak for quality vs bandwidth)
 const int SAMPLE_RATE = 48000;                       // 48 kHz for media
 const i2s_bits_per_sample_t I2S_BITS = I2S_BITS_PER_SAMPLE_32BIT; // 32-bit slots (24-bit left-aligned audio)
-const int CHANNELS = 1;                              // mono microphone (mic in right slot)
+const int CHANNELS = 1;                              // mono microphone (mic in right slot); 2 = stereo pair
 const int FRAMES_PER_PACKET = 1024;                  // samples per packet (per channel)
 const int BYTES_PER_SAMPLE = 4;                      // 32-bit words
-
-// Header: new self-describing layout (little-endian)
- // layout (bytes):
- // [0..3]   : uint32_t magic (ASCII tag)
- // [4..7]   : uint32_t seq
- // [8..15]  : uint64_t first_sample_index  (index of first sample in payload)
- // [16..23] : uint64_t timestamp_us        (esp_timer_get_time() for first sample)
- // [24..25] : uint16_t frames
- // [26]     : uint8_t  channels
- // [27]     : uint8_t  bytes_per_sample
- // [28..31] : uint32_t sample_rate
- // [32..33] : uint16_t format_id
-const int HEADER_SIZE = 34;
-const uint32_t HEADER_MAGIC = 0x45535032; // 'E' 'S' 'P' '2'
-const uint16_t FORMAT_INT32_LEFT24 = 1;   // format id: int32 left-aligned 24-bit
+// Payload on the wire: ESP2_FORMAT_INT32_LEFT24 (192 KB/s), ESP2_FORMAT_PACKED24 (-25%, free),
+// ESP2_FORMAT_RICE24 (lossless, typically 30-50% of int32, ~1 ms of the network task per packet at most),
+// ESP2_FORMAT_IMA_ADPCM (16-bit 4:1, monitoring grade), ESP2_FORMAT_INT16 (16-bit PCM, -50%)
+// With the session handshake this is the preference; the receiver may pick another.
+const uint8_t PAYLOAD_FORMAT = ESP2_FORMAT_INT32_LEFT24;
+const uint32_t ENCODABLE_FORMAT_MASK = esp2_session_format_bit(ESP2_FORMAT_INT32_LEFT24) | esp2_session_format_bit(ESP2_FORMAT_PACKED24) |
+                                       esp2_session_format_bit(ESP2_FORMAT_RICE24) | esp2_session_format_bit(ESP2_FORMAT_IMA_ADPCM) |
+                                       esp2_session_format_bit(ESP2_FORMAT_INT16);
+
+// UDP mode: one I2S read is split into datagrams that fit a 1500-byte MTU
+const int UDP_FRAMES_PER_DATAGRAM = 256;             // 46 + 1024 bytes per datagram
+const int FEC_GROUP_PACKETS = 4;                     // a parity packet after every 4 datagrams (0 = none)
+
+// Capture ring between the two tasks: one slot per I2S read. PSRAM holds seconds of
+// audio (the 8 MB gen4_r8n16 module); without PSRAM a short internal-RAM ring is used.
+const int CAPTURE_RING_SLOTS = 512;                  // ~11 s at 1024 frames / 48 kHz, 2 MB of PSRAM
+const int CAPTURE_RING_SLOTS_INTERNAL = 8;           // fallback when PSRAM is missing
+const int CAPTURE_CORE = 1;                          // with the Arduino loop; Wi-Fi and lwIP live on core 0
+const int NETWORK_CORE = 0;
+
+// Packet header: esp2_wire_header (layout and versioning in include/esp2_wire_header.h)
+
+// TCP mode: packets framed back to back into one buffer and written with one call, so
+// lwIP sees whole segments rather than a tiny header segment per packet (Nagle is off)
+const int PACKETS_PER_WRITE = 1;                     // 1 = lowest latency; each extra packet adds ~21 ms
+                                                     // of latency and saves a write and its segments
+// Reconnects back off exponentially, with jitter so a room of nodes does not retry in step
+const uint32_t RECONNECT_BACKOFF_INITIAL_MS = 10;
+const uint32_t RECONNECT_BACKOFF_MAX_MS = 2000;
+const int32_t TCP_CONNECT_TIMEOUT_MS = 1000;
+const uint32_t SESSION_WELCOME_TIMEOUT_MS = 1000;
+const int SESSION_HELLO_CLOSES_BEFORE_FALLBACK = 5;  // consecutive closes on the hello that mean a
+                                                     // receiver without sessions, not a restarting one
+const uint32_t TCP_IDLE_WAIT_MS = 20;                // longest wait for a slot before acks are read again
 
 // Global WiFi client
 WiFiClient tcpClient;
+WiFiUDP udpSocket;
 
 // Sequence counter and sample index
 volatile uint32_t seq_counter = 0;
-uint64_t global_sample_index = 0; // absolute sample index (increments by frames sent)
+// Absolute index of the next frame to be captured (advances by frames captured, sent or
+// dropped). The capture task owns the count; other tasks read this published copy
+// through currentSampleIndex(): a 64-bit access is two 32-bit ones on the ESP32, so
+// an unguarded read on the other core could see a torn value (every 2^32 frames).
+static portMUX_TYPE sample_index_mux = portMUX_INITIALIZER_UNLOCKED;
+static uint64_t published_sample_index = 0;
+
+static void publishSampleIndex(uint64_t sample_index) {
+  portENTER_CRITICAL(&sample_index_mux);
+  published_sample_index = sample_index;
+  portEXIT_CRITICAL(&sample_index_mux);
+}
+
+uint64_t currentSampleIndex() {
+  portENTER_CRITICAL(&sample_index_mux);
+  uint64_t sample_index = published_sample_index;
+  portEXIT_CRITICAL(&sample_index_mux);
+  return sample_index;
+}
 
-// Static buffers (allocated in bss, no malloc inside audioTask)
-static uint32_t i2s_words[FRAMES_PER_PACKET * 2];   // stereo slots: L0,R0,L1,R1...
-static uint32_t payload_words[FRAMES_PER_PACKET];   // right-channel words to send
+// One captured I2S read, waiting for the network task
+struct capture_slot {
+  uint64_t first_sample_index;
+  uint64_t timestamp_us;
+  uint32_t overrun_frames;                          // frames dropped just before this slot (ring was full)
+  uint16_t frames;
+  uint32_t payload_words[FRAMES_PER_PACKET * CHANNELS]; // I2S words to send, written by i2s_read in place
+};
+
+// Capture ring: slots are allocated once at setup; the queues pass slot indices
+// (free: network -> capture, filled: capture -> network, in capture order)
+static capture_slot* capture_slots = NULL;
+static int capture_slot_count = 0;
+static QueueHandle_t free_slot_queue = NULL;
+static QueueHandle_t filled_slot_queue = NULL;
+volatile uint32_t capture_overruns = 0;             // I2S reads dropped because every slot was in flight
+volatile uint32_t capture_overrun_frames = 0;
+
+// Static buffers (allocated in bss, no malloc inside the tasks)
+static uint32_t overrun_words[FRAMES_PER_PACKET * CHANNELS]; // drains the DMA while every slot is in flight
+static uint8_t coded_payload[FRAMES_PER_PACKET * CHANNELS * 3]; // packed24 is the largest coded size
+static esp2_ima_adpcm_state adpcm_states[CHANNELS]; // carried across packets
+
+// UDP mode: one datagram and the open FEC group's parity packet
+const size_t UDP_PAYLOAD_BYTES = (size_t)UDP_FRAMES_PER_DATAGRAM * CHANNELS * BYTES_PER_SAMPLE;
+const size_t FEC_BLOCK_BYTES = ESP2_FEC_BLOCK_PREFIX_BYTES + UDP_PAYLOAD_BYTES;
+static uint8_t udp_datagram[ESP2_WIRE_HEADER_MAX_BYTES + UDP_PAYLOAD_BYTES];
+static uint8_t fec_parity_datagram[ESP2_WIRE_FEC_HEADER_BYTES + FEC_BLOCK_BYTES];
+static uint32_t fec_group_first_seq = 0;
+static int fec_group_count = 0;                     // data packets in the open group
+static size_t fec_group_block_bytes = 0;            // longest block of the open group
+volatile uint32_t udp_send_failures = 0;            // datagrams the stack refused (counted as lost)
+
+// TCP mode: slots taken from the filled queue are retained, in capture order, until
+// the receiver has them: acked (session) or written (without one). The first
+// retained_sent of them went out on the current connection; the batch being written
+// is the tcp_tx_slot_count after those. A failed write only drops the framed bytes,
+// so the next connection frames the same slots again.
+const size_t TCP_PACKET_MAX_BYTES = ESP2_WIRE_HEADER_MAX_BYTES + (size_t)FRAMES_PER_PACKET * CHANNELS * BYTES_PER_SAMPLE;
+static uint8_t tcp_tx_buffer[PACKETS_PER_WRITE * TCP_PACKET_MAX_BYTES];
+static size_t tcp_tx_bytes = 0;
+static int tcp_tx_slot_count = 0;
+static uint16_t retained_slots[CAPTURE_RING_SLOTS];
+static int retained_head = 0;
+static int retained_count = 0;
+static int retained_sent = 0;
+
+// TCP session: this boot's identity, and whether the receiver speaks the protocol
+static uint64_t session_device_id = 0;
+static uint32_t session_id = 0;
+static bool session_active = false;                 // the current connection has a session
+static bool receiver_has_sessions = true;           // cleared after repeated closes on our hello
+static int session_hello_closes = 0;                // consecutive closes without a welcome byte
+static uint8_t payload_format = PAYLOAD_FORMAT;     // negotiated
+static uint32_t reconnect_backoff_ms = RECONNECT_BACKOFF_INITIAL_MS;
+volatile uint32_t session_resumes = 0;
 
 // Helper: connect WiFi (blocking, with simple retry)
 void wifiConnect() {
@@ -72,13 +179,16 @@ void wifiConnect() {
   Serial.print("[WIFI] connected, IP: "); Serial.println(WiFi.localIP());
 }
 
-// Initialize I2S for INMP441 (right-channel mono mic)
+// Initialize I2S for INMP441 (right-channel mono mic). The DMA delivers only the slots
+// we send: the right one for a mono mic (half the DMA traffic of reading both), both
+// for a stereo pair, already interleaved L,R as the payload expects. i2s_read then
+// copies straight into a ring slot with no deinterleave pass.
 void i2sInit() {
   i2s_config_t i2s_config = {
     .mode = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_RX),
     .sample_rate = SAMPLE_RATE,
     .bits_per_sample = I2S_BITS,
-    .channel_format = I2S_CHANNEL_FMT_RIGHT_LEFT, // read stereo slots; mic uses RIGHT
+    .channel_format = CHANNELS == 1 ? I2S_CHANNEL_FMT_ONLY_RIGHT : I2S_CHANNEL_FMT_RIGHT_LEFT,
     .communication_format = (i2s_comm_format_t)(I2S_COMM_FORMAT_I2S | I2S_COMM_FORMAT_I2S_MSB),
     .intr_alloc_flags = 0,
     .dma_buf_count = 6,        // several DMA buffers (robustness)
@@ -109,152 +219,407 @@ void i2sInit() {
   Serial.println("[I2S] initialized (APLL enabled)");
 }
 
-// Build and send one framed packet over TCP (blocking writes, loop handles partial writes)
-bool sendPacketTCP(WiFiClient &client,
-                   uint32_t seq,
-                   uint64_t first_sample_index,
-                   uint64_t timestamp_us,
-                   const uint32_t* payload_words_ptr,
-                   uint16_t frames) {
-  if (!client || !client.connected()) return false;
-
-  // Build header (little-endian)
-  uint8_t header[HEADER_SIZE];
-  // magic
-  header[0] = (uint8_t)(HEADER_MAGIC & 0xFF);
-  header[1] = (uint8_t)((HEADER_MAGIC >> 8) & 0xFF);
-  header[2] = (uint8_t)((HEADER_MAGIC >> 16) & 0xFF);
-  header[3] = (uint8_t)((HEADER_MAGIC >> 24) & 0xFF);
-  // seq
-  header[4] = (uint8_t)(seq & 0xFF);
-  header[5] = (uint8_t)((seq >> 8) & 0xFF);
-  header[6] = (uint8_t)((seq >> 16) & 0xFF);
-  header[7] = (uint8_t)((seq >> 24) & 0xFF);
-  // first_sample_index (8 bytes)
-  for (int i = 0; i < 8; ++i) header[8 + i] = (uint8_t)((first_sample_index >> (8*i)) & 0xFF);
-  // timestamp_us (8 bytes)
-  for (int i = 0; i < 8; ++i) header[16 + i] = (uint8_t)((timestamp_us >> (8*i)) & 0xFF);
-  // frames (uint16)
-  header[24] = (uint8_t)(frames & 0xFF);
-  header[25] = (uint8_t)((frames >> 8) & 0xFF);
-  // channels (1 byte)
-  header[26] = (uint8_t)CHANNELS;
-  // bytes_per_sample (1 byte)
-  header[27] = (uint8_t)BYTES_PER_SAMPLE;
-  // sample_rate (uint32)
-  header[28] = (uint8_t)(SAMPLE_RATE & 0xFF);
-  header[29] = (uint8_t)((SAMPLE_RATE >> 8) & 0xFF);
-  header[30] = (uint8_t)((SAMPLE_RATE >> 16) & 0xFF);
-  header[31] = (uint8_t)((SAMPLE_RATE >> 24) & 0xFF);
-  // format_id (uint16)
-  header[32] = (uint8_t)(FORMAT_INT32_LEFT24 & 0xFF);
-  header[33] = (uint8_t)((FORMAT_INT32_LEFT24 >> 8) & 0xFF);
-
-  // write header
-  size_t hsent = 0;
-  while (hsent < HEADER_SIZE) {
-    int w = client.write(header + hsent, HEADER_SIZE - hsent);
-    if (w <= 0) return false;
-    hsent += (size_t)w;
+// Code `frames` words in payload_format. Returns the payload (the words themselves for
+// int32) and sets its length and the format actually used: a Rice packet that would
+// not beat packed 24-bit (noise, clipping) goes out as packed 24-bit.
+const uint8_t* encodePayload(const uint32_t* words, uint16_t frames, size_t* payload_bytes, uint8_t* format) {
+  const int32_t* samples = (const int32_t*)words;
+  size_t sample_count = (size_t)frames * CHANNELS;
+  *format = payload_format;
+  switch (payload_format) {
+    case ESP2_FORMAT_RICE24:
+      *payload_bytes = esp2_rice24_encode(samples, frames, CHANNELS, coded_payload, sample_count * 3);
+      if (*payload_bytes != 0) return coded_payload;
+      *format = ESP2_FORMAT_PACKED24;
+      // fall through
+    case ESP2_FORMAT_PACKED24:
+      *payload_bytes = esp2_packed24_encode(samples, sample_count, coded_payload);
+      return coded_payload;
+    case ESP2_FORMAT_IMA_ADPCM:
+      *payload_bytes = esp2_ima_adpcm_encode(samples, frames, CHANNELS, adpcm_states, coded_payload);
+      return coded_payload;
+    case ESP2_FORMAT_INT16:
+      *payload_bytes = esp2_int16_encode(samples, sample_count, coded_payload);
+      return coded_payload;
+    default:
+      *format = ESP2_FORMAT_INT32_LEFT24;
+      *payload_bytes = sample_count * BYTES_PER_SAMPLE;
+      return (const uint8_t*)words;
   }
+}
 
-  // payload: write frames * BYTES_PER_SAMPLE bytes
-  size_t payload_bytes = (size_t)frames * CHANNELS * BYTES_PER_SAMPLE;
-  const uint8_t* p = (const uint8_t*)payload_words_ptr; // payload_words_ptr is an array of uint32
+// Frame one packet (header, then payload) at out, which has TCP_PACKET_MAX_BYTES;
+// returns its length. Coded formats announce their payload length.
+size_t framePacketTCP(uint8_t* out,
+                      uint32_t seq,
+                      uint64_t first_sample_index,
+                      uint64_t timestamp_us,
+                      const uint32_t* payload_words_ptr,
+                      uint16_t frames,
+                      uint32_t overrun_frames) {
+  size_t payload_bytes = 0;
+  uint8_t format = ESP2_FORMAT_INT32_LEFT24;
+  const uint8_t* payload = encodePayload(payload_words_ptr, frames, &payload_bytes, &format);
+
+  // Build header (little-endian, current version)
+  ((esp2_wire_header*)out)->set(seq, first_sample_index, timestamp_us, frames, (uint8_t)CHANNELS,
+                                esp2_format_bytes_per_sample(format), (uint32_t)SAMPLE_RATE, format);
+  size_t header_length = ESP2_WIRE_HEADER_BYTES;
+  if (format == ESP2_FORMAT_RICE24) header_length = esp2_append_payload_length(out, (uint32_t)payload_bytes);
+  if (overrun_frames != 0) header_length = esp2_append_capture_overrun(out, overrun_frames);
+
+  memcpy(out + header_length, payload, payload_bytes);
+  return header_length + payload_bytes;
+}
+
+// Write a whole buffer (blocking; the loop handles partial writes)
+bool writeAllTCP(WiFiClient &client, const uint8_t* bytes, size_t byte_count) {
+  if (!client || !client.connected()) return false;
   size_t sent = 0;
-  while (sent < payload_bytes) {
-    int w = client.write(p + sent, payload_bytes - sent);
+  while (sent < byte_count) {
+    int w = client.write(bytes + sent, byte_count - sent);
     if (w <= 0) return false;
     sent += (size_t)w;
-    // yield occasionally to keep RTOS happy if sending large payloads
-    if ((sent % 1024) == 0) taskYIELD();
   }
-
   // do not call client.flush() here; flushing may block indefinitely under congestion.
   return true;
 }
 
-// audioTask: read I2S frames and send via TCP
-void audioTask(void *pv) {
+// Fill an ESP2 header; with FEC on it carries the extension for the given group slot
+static size_t buildUdpHeader(uint8_t* datagram, uint32_t seq, uint64_t first_sample_index, uint64_t timestamp_us,
+                             uint16_t frames, uint8_t channels, uint8_t sample_bytes, uint8_t format, uint16_t flags,
+                             uint8_t index_in_group) {
+  esp2_wire_header* header = (esp2_wire_header*)datagram;
+  header->set(seq, first_sample_index, timestamp_us, frames, channels, sample_bytes, (uint32_t)SAMPLE_RATE,
+              format, flags);
+  if (!(flags & ESP2_FLAG_FEC)) return ESP2_WIRE_HEADER_BYTES;
+  esp2_store_le(header->header_bytes_bytes, ESP2_WIRE_FEC_HEADER_BYTES, 2);
+  ((esp2_fec_extension*)(datagram + ESP2_WIRE_HEADER_BYTES))->set(fec_group_first_seq, (uint8_t)FEC_GROUP_PACKETS, index_in_group);
+  return ESP2_WIRE_FEC_HEADER_BYTES;
+}
+
+static bool sendDatagram(const uint8_t* bytes, size_t byte_count) {
+  if (!udpSocket.beginPacket(PC_IP, PC_PORT)) return false;
+  udpSocket.write(bytes, byte_count);
+  return udpSocket.endPacket() == 1;
+}
+
+// Send one I2S read as UDP datagrams of UDP_FRAMES_PER_DATAGRAM frames, each with its own
+// sequence number, plus a parity packet whenever an FEC group fills. A refused datagram
+// is not retried: it is lost, like one dropped on the air.
+void sendPacketsUDP(uint64_t first_sample_index, uint64_t timestamp_us, const uint32_t* payload_words_ptr, uint16_t frames,
+                    uint32_t overrun_frames) {
+  for (uint16_t offset = 0; offset < frames; offset += UDP_FRAMES_PER_DATAGRAM) {
+    uint16_t datagram_frames = (uint16_t)min((int)(frames - offset), UDP_FRAMES_PER_DATAGRAM);
+    uint64_t datagram_first_sample = first_sample_index + offset;
+    uint64_t datagram_ts_us = timestamp_us + (uint64_t)offset * 1000000ull / SAMPLE_RATE;
+    uint32_t seq = ++seq_counter;
+    if (FEC_GROUP_PACKETS > 0 && fec_group_count == 0) fec_group_first_seq = seq;
+
+    size_t payload_bytes = 0;
+    uint8_t format = ESP2_FORMAT_INT32_LEFT24;
+    const uint8_t* payload = encodePayload(payload_words_ptr + (size_t)offset * CHANNELS, datagram_frames, &payload_bytes, &format);
+    uint16_t flags = FEC_GROUP_PACKETS > 0 ? ESP2_FLAG_FEC : 0;
+    size_t header_bytes = buildUdpHeader(udp_datagram, seq, datagram_first_sample, datagram_ts_us, datagram_frames,
+                                         (uint8_t)CHANNELS, esp2_format_bytes_per_sample(format), format, flags,
+                                         (uint8_t)fec_group_count);
+    if (format == ESP2_FORMAT_RICE24) header_bytes = esp2_append_payload_length(udp_datagram, (uint32_t)payload_bytes);
+    if (offset == 0 && overrun_frames != 0) header_bytes = esp2_append_capture_overrun(udp_datagram, overrun_frames);
+    memcpy(udp_datagram + header_bytes, payload, payload_bytes);
+    if (!sendDatagram(udp_datagram, header_bytes + payload_bytes)) udp_send_failures++;
+    if (FEC_GROUP_PACKETS == 0) continue;
+
+    esp2_fec_accumulate(fec_parity_datagram + ESP2_WIRE_FEC_HEADER_BYTES, *(const esp2_wire_header*)udp_datagram,
+                        payload, payload_bytes);
+    if (ESP2_FEC_BLOCK_PREFIX_BYTES + payload_bytes > fec_group_block_bytes) fec_group_block_bytes = ESP2_FEC_BLOCK_PREFIX_BYTES + payload_bytes;
+    if (++fec_group_count < FEC_GROUP_PACKETS) continue;
+
+    // parity: its payload is described in bytes (1 channel x 1 byte), sequence = the group's first
+    buildUdpHeader(fec_parity_datagram, fec_group_first_seq, 0, 0, (uint16_t)fec_group_block_bytes, 1, 1,
+                   ESP2_FORMAT_INT32_LEFT24, ESP2_FLAG_FEC | ESP2_FLAG_FEC_PARITY, (uint8_t)FEC_GROUP_PACKETS);
+    if (!sendDatagram(fec_parity_datagram, ESP2_WIRE_FEC_HEADER_BYTES + fec_group_block_bytes)) udp_send_failures++;
+    memset(fec_parity_datagram + ESP2_WIRE_FEC_HEADER_BYTES, 0, fec_group_block_bytes);
+    fec_group_count = 0;
+    fec_group_block_bytes = 0;
+  }
+}
+
+// Allocate the capture ring (setup only): PSRAM when present, a short internal ring otherwise
+bool captureRingInit() {
+  capture_slot_count = CAPTURE_RING_SLOTS;
+  capture_slots = (capture_slot*)heap_caps_malloc(sizeof(capture_slot) * CAPTURE_RING_SLOTS, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (!capture_slots) {
+    Serial.println("[RING] no PSRAM, using a short internal ring");
+    capture_slot_count = CAPTURE_RING_SLOTS_INTERNAL;
+    capture_slots = (capture_slot*)heap_caps_malloc(sizeof(capture_slot) * CAPTURE_RING_SLOTS_INTERNAL, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (!capture_slots) return false;
+  }
+  free_slot_queue = xQueueCreate(capture_slot_count, sizeof(uint16_t));
+  filled_slot_queue = xQueueCreate(capture_slot_count, sizeof(uint16_t));
+  if (!free_slot_queue || !filled_slot_queue) return false;
+  for (uint16_t i = 0; i < capture_slot_count; ++i) xQueueSend(free_slot_queue, &i, 0);
+  Serial.printf("[RING] %d capture slots (%u bytes)\n", capture_slot_count, (unsigned)(sizeof(capture_slot) * capture_slot_count));
+  return true;
+}
+
+// captureTask: read I2S frames straight into free ring slots. Never waits on the
+// network: with every slot in flight the read goes to a scratch buffer, its frames
+// still advance the sample index (the receiver sees a gap) and the next slot reports
+// them as a capture overrun.
+void captureTask(void *pv) {
   (void)pv;
 
-  // Precomputed sizes
-  const size_t bytesToRead = (size_t)FRAMES_PER_PACKET * BYTES_PER_SAMPLE * 2; // stereo slots in bytes
-  const size_t payload_bytes = (size_t)FRAMES_PER_PACKET * BYTES_PER_SAMPLE * CHANNELS;
+  const size_t bytesToRead = (size_t)FRAMES_PER_PACKET * BYTES_PER_SAMPLE * CHANNELS;
+  uint32_t pending_overrun_frames = 0;
+  uint64_t sample_index = 0;  // published for the other tasks after every advance
 
-  Serial.printf("[TASK] starting audioTask: FRAMES=%u bytesToRead=%u payload=%u\n",
-                FRAMES_PER_PACKET, (unsigned)bytesToRead, (unsigned)payload_bytes);
+  Serial.printf("[TASK] starting captureTask: FRAMES=%u bytesToRead=%u\n", FRAMES_PER_PACKET, (unsigned)bytesToRead);
 
   while (true) {
-    // Ensure TCP connection
-    if (!tcpClient || !tcpClient.connected()) {
-      Serial.println("[TCP] connecting to server...");
-      if (tcpClient.connect(PC_IP, PC_PORT)) {
-        tcpClient.setNoDelay(true); // disable Nagle to reduce latency
-        Serial.println("[TCP] connected");
-        // On new session, you might want to reset indices or handshake; here we continue indices.
-      } else {
-        Serial.println("[TCP] connect failed, retry in 1s");
-        delay(1000);
-        continue;
-      }
-    }
+    uint16_t slot_index = 0;
+    bool have_slot = xQueueReceive(free_slot_queue, &slot_index, 0) == pdTRUE;
+    uint32_t* words = have_slot ? capture_slots[slot_index].payload_words : overrun_words;
 
     // Block until i2s buffer filled for requested bytes
     size_t bytes_read = 0;
-    esp_err_t res = i2s_read(I2S_NUM_0, (void*)i2s_words, bytesToRead, &bytes_read, portMAX_DELAY);
+    esp_err_t res = i2s_read(I2S_NUM_0, (void*)words, bytesToRead, &bytes_read, portMAX_DELAY);
     if (res != ESP_OK || bytes_read == 0) {
       Serial.printf("[I2S] read err %d bytes=%u\n", res, (unsigned)bytes_read);
+      if (have_slot) xQueueSend(free_slot_queue, &slot_index, 0);
       // brief delay to avoid tight loop on persistent error
       delay(10);
       continue;
     }
+    uint64_t ts_us = (uint64_t)esp_timer_get_time(); // microseconds since boot
+
+    // a partial read sends only what it got
+    size_t avail_frames = bytes_read / ((size_t)BYTES_PER_SAMPLE * CHANNELS);
+
+    if (!have_slot) {
+      capture_overruns++;
+      capture_overrun_frames += (uint32_t)avail_frames;
+      pending_overrun_frames += (uint32_t)avail_frames;
+      sample_index += (uint64_t)avail_frames;
+      publishSampleIndex(sample_index);
+      continue;
+    }
+    capture_slot& slot = capture_slots[slot_index];
+    slot.first_sample_index = sample_index;
+    slot.timestamp_us = ts_us;
+    slot.frames = (uint16_t)avail_frames;
+    slot.overrun_frames = pending_overrun_frames;
+    pending_overrun_frames = 0;
+    xQueueSend(filled_slot_queue, &slot_index, 0); // cannot fail: the queue holds every slot
+
+    // advance the sample index by frames actually captured
+    sample_index += (uint64_t)avail_frames;
+    publishSampleIndex(sample_index);
+  }
+
+  // never reached
+  vTaskDelete(NULL);
+}
+
+static uint16_t retainedSlotAt(int position) {
+  return retained_slots[(retained_head + position) % capture_slot_count];
+}
+
+// Return retained slots that end at or before end_index to the capture task, oldest
+// first; sent_only stops at the first slot not yet sent on this connection
+void releaseRetainedThrough(uint64_t end_index, bool sent_only) {
+  while (retained_count > 0 && (!sent_only || retained_sent > 0)) {
+    uint16_t slot_index = retainedSlotAt(0);
+    const capture_slot& slot = capture_slots[slot_index];
+    if (slot.first_sample_index + slot.frames > end_index) break;
+    xQueueSend(free_slot_queue, &slot_index, 0);
+    retained_head = (retained_head + 1) % capture_slot_count;
+    retained_count--;
+    if (retained_sent > 0) retained_sent--;
+  }
+}
 
-    // words contains 32-bit words L0,R0,L1,R1...
-    size_t word_count = bytes_read / 4;
-    size_t need_words = (size_t)FRAMES_PER_PACKET * 2;
-    size_t avail_frames = 0;
-    if (word_count >= need_words) {
-      // Extract right channel words for FRAMES_PER_PACKET frames
-      for (size_t i = 0; i < FRAMES_PER_PACKET; ++i) {
-        payload_words[i] = i2s_words[i*2 + 1];
+// Frame the next PACKETS_PER_WRITE unsent slots into the TCP batch: retained ones first
+// (a replay after a reconnect), then newly filled ones. Returns with an empty batch
+// if nothing was captured for TCP_IDLE_WAIT_MS, so acks are still read.
+void assembleTcpBatch() {
+  tcp_tx_bytes = 0;
+  tcp_tx_slot_count = 0;
+  while (tcp_tx_slot_count < PACKETS_PER_WRITE) {
+    int position = retained_sent + tcp_tx_slot_count;
+    if (position == retained_count) {
+      uint16_t filled_index = 0;
+      if (xQueueReceive(filled_slot_queue, &filled_index, pdMS_TO_TICKS(TCP_IDLE_WAIT_MS)) != pdTRUE) {
+        if (tcp_tx_slot_count == 0) return;
+        continue;
       }
-      avail_frames = FRAMES_PER_PACKET;
+      retained_slots[(retained_head + retained_count) % capture_slot_count] = filled_index;
+      retained_count++;
+    }
+    const capture_slot& slot = capture_slots[retainedSlotAt(position)];
+    uint32_t seq = ++seq_counter;
+    tcp_tx_bytes += framePacketTCP(tcp_tx_buffer + tcp_tx_bytes, seq, slot.first_sample_index, slot.timestamp_us,
+                                   slot.payload_words, slot.frames, slot.overrun_frames);
+    tcp_tx_slot_count++;
+  }
+}
+
+// Free what the receiver has acknowledged (session connections)
+void readSessionAcks() {
+  while (tcpClient.available() >= (int)sizeof(esp2_session_ack)) {
+    esp2_session_ack ack;
+    tcpClient.read((uint8_t*)&ack, sizeof(ack));
+    if (ack.magic() != ESP2_SESSION_ACK_MAGIC) {
+      Serial.println("[TCP] bad ack, will reconnect");
+      tcpClient.stop();
+      return;
+    }
+    releaseRetainedThrough(ack.acked_end_index(), true);
+  }
+}
+
+// Sleep before the next connect attempt and lengthen the one after
+void backOffBeforeReconnect() {
+  uint32_t wait_ms = reconnect_backoff_ms / 2 + esp_random() % (reconnect_backoff_ms / 2 + 1);
+  delay(wait_ms);
+  reconnect_backoff_ms = reconnect_backoff_ms * 2 > RECONNECT_BACKOFF_MAX_MS ? RECONNECT_BACKOFF_MAX_MS : reconnect_backoff_ms * 2;
+}
+
+// Send the hello and read the welcome. Returns 1 for a session, 0 if the receiver
+// closed without a reply (it predates sessions, or is restarting), -1 on any other failure.
+int openSession() {
+  // the oldest frame still held: the first retained slot, else the next one captured.
+  // The index is read first, so a slot filled meanwhile cannot put oldest past it.
+  uint64_t next_index = currentSampleIndex();
+  uint64_t oldest_index = next_index;
+  uint16_t next_filled = 0;
+  if (retained_count > 0) {
+    oldest_index = capture_slots[retainedSlotAt(0)].first_sample_index;
+  } else if (xQueuePeek(filled_slot_queue, &next_filled, 0) == pdTRUE) {
+    oldest_index = capture_slots[next_filled].first_sample_index;
+  }
+  esp2_session_hello hello;
+  hello.set(session_device_id, session_id, (uint32_t)SAMPLE_RATE, (uint8_t)CHANNELS, ENCODABLE_FORMAT_MASK, PAYLOAD_FORMAT,
+            oldest_index, next_index);
+  if (!writeAllTCP(tcpClient, (const uint8_t*)&hello, sizeof(hello))) return -1;
+
+  esp2_session_welcome welcome;
+  size_t received = 0;
+  uint32_t start_ms = millis();
+  while (received < sizeof(welcome)) {
+    if (tcpClient.available()) {
+      int r = tcpClient.read((uint8_t*)&welcome + received, sizeof(welcome) - received);
+      if (r > 0) received += (size_t)r;
+    } else if (!tcpClient.connected()) {
+      return received == 0 ? 0 : -1;
+    } else if (millis() - start_ms > SESSION_WELCOME_TIMEOUT_MS) {
+      return -1;
     } else {
-      // Partial read: extract what we can and zero-fill the remainder
-      size_t maxFrames = word_count / 2;
-      for (size_t i = 0; i < maxFrames; ++i) payload_words[i] = i2s_words[i*2 + 1];
-      for (size_t i = maxFrames; i < FRAMES_PER_PACKET; ++i) payload_words[i] = 0;
-      avail_frames = maxFrames;
+      delay(1);
     }
+  }
+  if (welcome.magic() != ESP2_SESSION_WELCOME_MAGIC || welcome.result() == ESP2_SESSION_REJECTED ||
+      !(ENCODABLE_FORMAT_MASK & esp2_session_format_bit(welcome.format()))) {
+    Serial.printf("[TCP] session refused (result %u)\n", (unsigned)welcome.result());
+    return -1;
+  }
 
-    // Prepare header info
-    uint32_t seq = ++seq_counter;
-    uint64_t first_sample_index = global_sample_index;
-    uint64_t ts_us = (uint64_t)esp_timer_get_time(); // microseconds since boot
-    // send packet
-    bool ok = sendPacketTCP(tcpClient, seq, first_sample_index, ts_us, payload_words, (uint16_t)avail_frames);
-    if (!ok) {
-      Serial.println("[TCP] send failed, will reconnect");
+  // the receiver has everything before the resume index; the rest is sent (again)
+  payload_format = welcome.format();
+  releaseRetainedThrough(welcome.resume_sample_index(), false);
+  retained_sent = 0;
+  if (welcome.result() == ESP2_SESSION_RESUMED) session_resumes++;
+  Serial.printf("[TCP] session %s as stream %u, format %u, from sample %llu (%d packets to replay)\n",
+                welcome.result() == ESP2_SESSION_RESUMED ? "resumed" : "started", (unsigned)welcome.stream_id(),
+                (unsigned)payload_format, (unsigned long long)welcome.resume_sample_index(), retained_count);
+  return 1;
+}
+
+// Connect and, when the receiver takes it, open the session. False: back off and retry.
+bool connectTCP() {
+  tcpClient.stop();
+  tcp_tx_slot_count = 0;  // a batch is framed again for the new connection
+  tcp_tx_bytes = 0;
+  session_active = false;
+  Serial.println("[TCP] connecting to server...");
+  if (!tcpClient.connect(PC_IP, PC_PORT, TCP_CONNECT_TIMEOUT_MS)) {
+    Serial.printf("[TCP] connect failed, retry in ~%u ms\n", (unsigned)reconnect_backoff_ms);
+    return false;
+  }
+  tcpClient.setNoDelay(true); // disable Nagle to reduce latency
+  if (USE_SESSION_HANDSHAKE && receiver_has_sessions) {
+    // a close on the hello is also what a restarting or overloaded receiver does, so
+    // only a run of them drops the handshake; any welcome ends the run
+    int result = openSession();
+    if (result == 0 && ++session_hello_closes >= SESSION_HELLO_CLOSES_BEFORE_FALLBACK) {
+      Serial.printf("[TCP] receiver closed on %d hellos in a row, streaming without sessions\n", session_hello_closes);
+      receiver_has_sessions = false;
+    } else if (result == 0) {
+      Serial.printf("[TCP] receiver closed on the hello (%d in a row), retrying\n", session_hello_closes);
+    }
+    if (result != 1) {
       tcpClient.stop();
-      delay(50);
-      continue;
+      return false;
     }
+    session_hello_closes = 0;
+    session_active = true;
+    return true;
+  }
+  // without a session nothing is retained beyond the unsent slots
+  retained_sent = 0;
+  payload_format = PAYLOAD_FORMAT;
+  Serial.println("[TCP] connected");
+  return true;
+}
 
-    // advance global sample index by frames actually packaged
-    global_sample_index += (uint64_t)avail_frames;
+// networkTask: send filled slots in capture order over TCP (or UDP). A slot is returned
+// to the capture task only once the receiver has it (acked, or written without a session).
+void networkTask(void *pv) {
+  (void)pv;
 
-    // keep audio task tight for low latency
-    taskYIELD();
+  Serial.printf("[TASK] starting networkTask: payload=%u packets_per_write=%d\n",
+                (unsigned)((size_t)FRAMES_PER_PACKET * BYTES_PER_SAMPLE * CHANNELS), PACKETS_PER_WRITE);
+
+  while (true) {
+    // Ensure TCP connection
+    if (!USE_UDP_TRANSPORT && (!tcpClient || !tcpClient.connected())) {
+      if (!connectTCP()) {
+        backOffBeforeReconnect();
+        continue;
+      }
+    }
+
+    if (USE_UDP_TRANSPORT) {
+      uint16_t slot_index = 0;
+      if (xQueueReceive(filled_slot_queue, &slot_index, portMAX_DELAY) != pdTRUE) continue;
+      const capture_slot& slot = capture_slots[slot_index];
+      sendPacketsUDP(slot.first_sample_index, slot.timestamp_us, slot.payload_words, slot.frames, slot.overrun_frames);
+      xQueueSend(free_slot_queue, &slot_index, 0);
+      continue;
+    }
+
+    if (session_active) readSessionAcks();
+    if (tcp_tx_slot_count == 0) assembleTcpBatch();
+    if (tcp_tx_slot_count == 0) continue;
+    if (!writeAllTCP(tcpClient, tcp_tx_buffer, tcp_tx_bytes)) {
+      Serial.println("[TCP] send failed, will reconnect");
+      tcpClient.stop();  // the batch's slots stay retained and go out again
+      continue;
+    }
+    retained_sent += tcp_tx_slot_count;
+    tcp_tx_slot_count = 0;
+    tcp_tx_bytes = 0;
+    reconnect_backoff_ms = RECONNECT_BACKOFF_INITIAL_MS;
+    if (!session_active) releaseRetainedThrough(UINT64_MAX, true);
   }
 
   // never reached
   vTaskDelete(NULL);
 }
 
-void startAudioTask() {
-  // larger stack because we use buffers and networking inside task
-  xTaskCreatePinnedToCore(audioTask, "audioTask", 8192, NULL, 6, NULL, 1);
+void startStreamingTasks() {
+  // capture outranks everything on its core; the network task's stack holds the TCP/UDP call chains
+  xTaskCreatePinnedToCore(captureTask, "captureTask", 4096, NULL, 10, NULL, CAPTURE_CORE);
+  xTaskCreatePinnedToCore(networkTask, "networkTask", 8192, NULL, 5, NULL, NETWORK_CORE);
 }
 
 void setup() {
@@ -263,10 +628,16 @@ void setup() {
   Serial.println("\n=== ESP32 I2S -> TCP streamer (high-quality, sample-indexed) ===");
 
   wifiConnect();
+  session_device_id = ESP.getEfuseMac();  // stable per chip
+  session_id = esp_random();              // new every boot, like the sample index
+  if (!captureRingInit()) {
+    Serial.println("[RING] allocation failed");
+    while (1) delay(500);
+  }
   i2sInit();
 
-  // Start audio task
-  startAudioTask();
+  // Start capture and network tasks
+  startStreamingTasks();
 
   Serial.println("[SETUP] done");
 }
@@ -276,11 +647,14 @@ void loop() {
   static unsigned long last = 0;
   if (millis() - last > 2000) {
     last = millis();
-    Serial.printf("[STAT] WiFi=%s TCP=%s seq=%u sample_idx=%llu\n",
+    Serial.printf("[STAT] WiFi=%s %s seq=%u sample_idx=%llu ring=%u/%d unacked=%d resumes=%u overruns=%u (%u frames) udp_send_failures=%u\n",
                   WiFi.isConnected() ? "OK" : "NO",
-                  tcpClient.connected() ? "OK" : "NO",
+                  USE_UDP_TRANSPORT ? "UDP" : (tcpClient.connected() ? "TCP=OK" : "TCP=NO"),
                   (unsigned)seq_counter,
-                  (unsigned long long)global_sample_index);
+                  (unsigned long long)currentSampleIndex(),
+                  (unsigned)uxQueueMessagesWaiting(filled_slot_queue), capture_slot_count, retained_count, (unsigned)session_resumes,
+                  (unsigned)capture_overruns, (unsigned)capture_overrun_frames,
+                  (unsigned)udp_send_failures);
   }
   delay(100);
 }
@@ -37,7 +37,13 @@ PLAYOUT_LATENCY_FRAMES = int(PLAYOUT_LATENCY_SECONDS * SAMPLE_RATE)
 
 # Header constants (must match ESP header)
 HEADER_MAGIC = 0x45535032  # 'ESP2' low-endian encoded by ESP
-HEADER_SIZE = 34
+HEADER_SIZE = 34          # legacy (version 0) header; see include/esp2_wire_header.h
+HEADER_VERSION = 1        # newest header version understood here
+HEADER_V1_SIZE = 38       # version 1 fixed part; header_bytes may announce appended fields
+FLAG_FEC = 0x0001         # 8-byte FEC extension follows the fixed part
+FLAG_PAYLOAD_LENGTH = 0x0004  # u32 payload length follows (variable-length formats)
+FORMAT_INT32_LEFT24 = 1
+FORMAT_PACKED24 = 2
 FORMAT_INT32_LEFT24 = 1
 
 # Output file
@@ -122,6 +128,17 @@ def handle_client_connection(client_sock, client_addr):
                 # try to re-sync: continue (could read again)
                 continue
 
+            header_version = header[33]
+            if header_version > HEADER_VERSION:
+                raise IOError("Unsupported header version %d" % header_version)
+            if header_version >= 1:
+                header += recvall(client_sock, HEADER_V1_SIZE - HEADER_SIZE)
+                header_bytes = int.from_bytes(header[36:38], 'little', signed=False)
+                if len(header) != HEADER_V1_SIZE or header_bytes < HEADER_V1_SIZE:
+                    raise IOError("Bad versioned header")
+                extension = recvall(client_sock, header_bytes - HEADER_V1_SIZE)
+                flags = int.from_bytes(header[34:36], 'little', signed=False)
+
             seq = int.from_bytes(header[4:8], 'little', signed=False)
             first_sample_index = int.from_bytes(header[8:16], 'little', signed=False)
             timestamp_us = int.from_bytes(header[16:24], 'little', signed=False)
@@ -129,7 +146,7 @@ def handle_client_connection(client_sock, client_addr):
             channels = header[26]
             bytes_per_sample = header[27]
             sample_rate = int.from_bytes(header[28:32], 'little', signed=False)
-            format_id = int.from_bytes(header[32:34], 'little', signed=False)
+            format_id = header[32]
 
             # basic checks
             if sample_rate != SAMPLE_RATE:
@@ -141,9 +158,20 @@ def handle_client_connection(client_sock, client_addr):
 
             # compute payload size
             payload_bytes = frames * channels * bytes_per_sample
+            if header_version >= 1 and flags & FLAG_PAYLOAD_LENGTH:
+                offset = 8 if flags & FLAG_FEC else 0
+                payload_bytes = int.from_bytes(extension[offset:offset + 4], 'little', signed=False)
+            elif format_id == 4:  # IMA ADPCM: 4-byte block header + nibbles per channel
+                payload_bytes = channels * (4 + (frames + 1) // 2)
 
             # receive payload
             payload = recvall(client_sock, payload_bytes)
+            if format_id == FORMAT_PACKED24:
+                b = np.frombuffer(payload, dtype=np.uint8).reshape(-1, 3).astype(np.int32)
+                payload = ((b[:, 0] << 8) | (b[:, 1] << 16) | (b[:, 2] << 24)).astype('<i4').tobytes()
+            elif format_id != FORMAT_INT32_LEFT24:
+                log("Skipping packet %d with format_id %d (decoded by audio_process_server)", seq, format_id)
+                continue
 
             # Convert payload (32-bit little endian words containing left-aligned 24-bit samples)
             # payload is consecutive int32 for each sample (mono). We'll interpret as little-endian int32 array.
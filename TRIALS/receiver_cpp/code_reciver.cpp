@@ -26,16 +26,13 @@
 #include <thread>
 #include <vector>      // <-- needed for std::vector
 
+#include "../../include/esp2_wire_header.h" // ESP2 packet header shared with the ESP firmware
+
 // ----------------- Config -----------------
 static const char* LISTEN_ADDR = "0.0.0.0";
 static const uint16_t LISTEN_PORT = 7000; // match ESP PC_PORT
 static const uint16_t HTTP_PORT = 8080;   // control UI
 
-// Must match ESP header layout
-static const uint32_t HEADER_MAGIC = 0x45535032; // 'ESP2'
-static const int HEADER_SIZE = 34;
-static const uint16_t FORMAT_INT32_LEFT24 = 1u;
-
 // Audio params (must align with ESP streamer)
 static const uint32_t SAMPLE_RATE = 48000;
 static const uint8_t CHANNELS    = 1;   // we're receiving only the mic channel
@@ -213,31 +210,36 @@ void tcp_server_loop() {
 
         bool conn_ok = true;
         // allocate a buffer for headers and payload
-        uint8_t hdr[HEADER_SIZE];
+        uint8_t hdr[ESP2_WIRE_HEADER_MAX_BYTES];
 
         while (g_running.load() && conn_ok) {
-            // read header
-            if (!recv_all(cli_fd, hdr, HEADER_SIZE)) {
+            // read header: legacy headers stop at 34 bytes, versioned ones say how long they are
+            size_t header_size = 0;
+            size_t required_bytes = ESP2_WIRE_LEGACY_HEADER_BYTES;
+            esp2_header_status status = esp2_header_status::need_more_bytes;
+            while (status == esp2_header_status::need_more_bytes) {
+                if (!recv_all(cli_fd, hdr + header_size, required_bytes - header_size)) break;
+                header_size = required_bytes;
+                status = esp2_check_wire_header(hdr, header_size, &required_bytes);
+            }
+            if (status == esp2_header_status::need_more_bytes) {
                 std::cout << "[TCP] header recv failed or connection closed\n";
                 break;
             }
-            // parse header (little-endian)
-            uint32_t magic = (uint32_t)hdr[0] | ((uint32_t)hdr[1] << 8) | ((uint32_t)hdr[2] << 16) | ((uint32_t)hdr[3] << 24);
-            if (magic != HEADER_MAGIC) {
-                std::cerr << "[TCP] bad magic: " << std::hex << magic << std::dec << std::endl;
+            const esp2_wire_header* header = esp2_wire_header_view(hdr, header_size);
+            if (!header) {
+                std::cerr << "[TCP] bad header (magic " << std::hex << esp2_load_le32(hdr) << std::dec << ")" << std::endl;
                 conn_ok = false;
                 break;
             }
-            uint32_t seq = (uint32_t)hdr[4] | ((uint32_t)hdr[5] << 8) | ((uint32_t)hdr[6] << 16) | ((uint32_t)hdr[7] << 24);
-            uint64_t first_sample_index = 0;
-            for (int i = 0; i < 8; ++i) first_sample_index |= ((uint64_t)hdr[8 + i]) << (8 * i);
-            uint64_t timestamp_us = 0;
-            for (int i = 0; i < 8; ++i) timestamp_us |= ((uint64_t)hdr[16 + i]) << (8 * i);
-            uint16_t frames = (uint16_t)hdr[24] | ((uint16_t)hdr[25] << 8);
-            uint8_t channels = hdr[26];
-            uint8_t bytes_per_sample = hdr[27];
-            uint32_t sample_rate = (uint32_t)hdr[28] | ((uint32_t)hdr[29] << 8) | ((uint32_t)hdr[30] << 16) | ((uint32_t)hdr[31] << 24);
-            uint16_t format_id = (uint16_t)hdr[32] | ((uint16_t)hdr[33] << 8);
+            uint32_t seq = header->sequence();
+            uint64_t first_sample_index = header->first_sample_index();
+            uint64_t timestamp_us = header->timestamp_us();
+            uint16_t frames = header->frames();
+            uint8_t channels = header->channels();
+            uint8_t bytes_per_sample = header->bytes_per_sample();
+            uint32_t sample_rate = header->sample_rate();
+            uint8_t format_id = header->format_id();
 
             // validate basic fields (warn, not fatal)
             if (sample_rate != SAMPLE_RATE) {
@@ -249,11 +251,8 @@ void tcp_server_loop() {
             if (bytes_per_sample != IN_BYTES_PER_SAMPLE) {
                 std::cerr << "[TCP] warning bytes_per_sample mismatch: " << int(bytes_per_sample) << " != " << int(IN_BYTES_PER_SAMPLE) << std::endl;
             }
-            if (format_id != FORMAT_INT32_LEFT24) {
-                std::cerr << "[TCP] warning format_id mismatch: " << format_id << std::endl;
-            }
 
-            size_t payload_bytes = (size_t)frames * (size_t)channels * (size_t)bytes_per_sample;
+            size_t payload_bytes = header->payload_bytes();
             if (payload_bytes == 0) {
                 std::cerr << "[TCP] zero payload\n";
                 continue;
@@ -266,6 +265,11 @@ void tcp_server_loop() {
                 conn_ok = false;
                 break;
             }
+            if (format_id != ESP2_FORMAT_INT32_LEFT24) {
+                // coded payloads (packed24/rice/adpcm) are decoded by audio_process_server only
+                std::cerr << "[TCP] skipping packet with format_id " << int(format_id) << std::endl;
+                continue;
+            }
 
             // Convert and write to WAV: for each frame, convert int32->24bit (3 bytes), apply gain.
             // We'll multiply int32 value by gain then shift; keep in int64 to avoid overflow.
@@ -0,0 +1,530 @@
+// esp_receiver_benchmarks.cpp
+// Microbenchmarks for the receiver's hot paths, with the plain reference version of
+// each next to the optimized one:
+//
+//   convert   int32-left24 -> packed 24-bit with gain: double/llround reference,
+//             scalar fixed point, and every SIMD kernel this CPU runs; then the
+//             per-stream converters (channel 0 of mono/stereo int32, packed24, int16)
+//   levels    peak + sum of squares over packed 24-bit (DSP stage meter)
+//   resample  drift resampler, one output per input
+//   dsp       the DSP stage's processing chain on int32-left24: high-pass alone, and
+//             high-pass + gate + AGC + limiter (selected SIMD kernels)
+//   decode    coded payloads -> int32-left24: packed 24-bit (portable loop vs the
+//             receiver's dispatch), Rice and IMA ADPCM; encode runs the firmware's
+//             encoders on the same tone (host-side proxy for the audioTask budget)
+//   header    ESP2 header decode: byte-shift loop vs memcpy loads vs the shared
+//             bounds-checked esp2_wire_header view
+//   wav       per-packet fwrite + fflush (the original receiver) vs per-packet
+//             pwrite vs batched_wav_sink (pwrite or io_uring, as built)
+//   trace     the tracing counter read alone, the ring stores alone, one whole span
+//             (what each ESP_TRACE_SPAN costs in an ESP_RECEIVER_TRACING build) and
+//             one span of a chain (ESP_TRACE_CHAINED_SPAN, one counter read), then
+//             the 20 ns span budget against each kind's floor of counter reads
+//
+// Each case runs for --min-time seconds per repetition after a warm-up, on the CPU
+// given by --cpu (pinned with sched_setaffinity), and reports the median of
+// --repetitions runs as ns per sample (or per header) and GB/s of input.
+//
+//   esp_receiver_benchmarks --cpu 2 --filter convert
+#include <fcntl.h>
+#include <getopt.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "drift_resampler.h"
+#include "dsp_chain.h"
+#include "esp2_payload_codec.h"
+#include "esp2_wire_header.h"
+#include "sample_convert.h"
+#include "trace_spans.h"
+#include "wav_writer.h"
+
+// ----------------- Harness -----------------
+
+struct benchmark_options {
+    int cpu = -1;                  // -1 = the CPU we start on
+    double min_time_seconds = 0.25;
+    int repetitions = 5;
+    std::string filter;            // run only cases whose name contains this
+    std::string directory = "/tmp"; // where the wav cases write their files
+    size_t wav_megabytes = 64;     // audio written per wav repetition
+};
+
+// Keep the compiler from discarding a result
+static inline void do_not_optimize(const void* pointer) {
+    asm volatile("" : : "g"(pointer) : "memory");
+}
+
+struct benchmark_result {
+    bool ran = false;              // false when --filter skipped the case
+    double ns_per_item = 0.0;
+};
+
+// Run body (one iteration = items_per_iteration items, bytes_per_iteration input bytes)
+// and print ns/item and GB/s
+static benchmark_result run_benchmark(const benchmark_options& options, const std::string& name, const char* item_unit,
+                                      size_t items_per_iteration, size_t bytes_per_iteration, const std::function<void()>& body) {
+    if (!options.filter.empty() && name.find(options.filter) == std::string::npos) return benchmark_result();
+    using clock = std::chrono::steady_clock;
+
+    // warm-up, and pick an iteration count that fills min_time
+    size_t iterations = 1;
+    while (true) {
+        auto start = clock::now();
+        for (size_t i = 0; i < iterations; ++i) body();
+        double elapsed = std::chrono::duration<double>(clock::now() - start).count();
+        if (elapsed >= options.min_time_seconds / 4 || iterations >= ((size_t)1 << 30)) {
+            iterations = std::max<size_t>(1, (size_t)(iterations * options.min_time_seconds / std::max(elapsed, 1e-9)));
+            break;
+        }
+        iterations *= 4;
+    }
+
+    std::vector<double> seconds_per_iteration;
+    for (int repetition = 0; repetition < options.repetitions; ++repetition) {
+        auto start = clock::now();
+        for (size_t i = 0; i < iterations; ++i) body();
+        seconds_per_iteration.push_back(std::chrono::duration<double>(clock::now() - start).count() / (double)iterations);
+    }
+    std::sort(seconds_per_iteration.begin(), seconds_per_iteration.end());
+    double median = seconds_per_iteration[seconds_per_iteration.size() / 2];
+    std::printf("%-56s %10.3f ns/%-7s %8.2f GB/s  (%zu iterations x %d)\n", name.c_str(),
+                median * 1e9 / (double)items_per_iteration, item_unit, (double)bytes_per_iteration / median / 1e9,
+                iterations, options.repetitions);
+    benchmark_result result;
+    result.ran = true;
+    result.ns_per_item = median * 1e9 / (double)items_per_iteration;
+    return result;
+}
+
+static bool pin_to_cpu(int cpu) {
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpu, &cpu_set);
+    if (sched_setaffinity(0, sizeof(cpu_set), &cpu_set) != 0) {
+        perror("sched_setaffinity");
+        return false;
+    }
+    return true;
+}
+
+// ----------------- convert / levels / resample -----------------
+
+static const size_t BENCH_PACKET_FRAMES = 1024; // firmware FRAMES_PER_PACKET
+
+static std::vector<uint8_t> make_int32_left24_input(size_t sample_count) {
+    std::mt19937 rng(7);
+    std::vector<uint8_t> input(sample_count * 4);
+    for (size_t i = 0; i < sample_count; ++i) {
+        int32_t sample = (int32_t)(rng() & 0xFFFFFF00u);
+        memcpy(&input[i * 4], &sample, 4);
+    }
+    return input;
+}
+
+static void benchmark_conversion(const benchmark_options& options) {
+    std::vector<uint8_t> input = make_int32_left24_input(BENCH_PACKET_FRAMES);
+    std::vector<uint8_t> output(BENCH_PACKET_FRAMES * 3);
+    const int32_t gain_q16 = quantize_gain_to_q16(1.5);
+
+    run_benchmark(options, "convert/reference (double+llround)", "sample", BENCH_PACKET_FRAMES, input.size(), [&] {
+        convert_int32_left24_to_packed24_reference(input.data(), output.data(), BENCH_PACKET_FRAMES, gain_q16);
+        do_not_optimize(output.data());
+    });
+    packed24_convert_kernel_info kernels[8];
+    size_t kernel_count = available_packed24_convert_kernels(kernels, 8);
+    for (size_t kernel_index = 0; kernel_index < kernel_count; ++kernel_index) {
+        packed24_convert_kernel kernel = kernels[kernel_index].kernel;
+        run_benchmark(options, std::string("convert/") + kernels[kernel_index].name, "sample", BENCH_PACKET_FRAMES, input.size(), [&] {
+            kernel(input.data(), output.data(), BENCH_PACKET_FRAMES, gain_q16);
+            do_not_optimize(output.data());
+        });
+    }
+
+    // whole-packet stream converters, as the DSP stage runs them (selected kernel)
+    std::vector<int32_t> stereo_left24(BENCH_PACKET_FRAMES * 2);
+    memcpy(stereo_left24.data(), input.data(), BENCH_PACKET_FRAMES * 4);
+    memcpy(stereo_left24.data() + BENCH_PACKET_FRAMES, input.data(), BENCH_PACKET_FRAMES * 4);
+    std::vector<uint8_t> stream_payload(BENCH_PACKET_FRAMES * 2 * 4);
+    std::vector<int32_t> scratch_left24(BENCH_PACKET_FRAMES * 2);
+    const packed24_convert_kernel selected = select_packed24_convert_kernel();
+    const uint8_t stream_formats[] = {ESP2_FORMAT_INT32_LEFT24, ESP2_FORMAT_PACKED24, ESP2_FORMAT_INT16};
+    for (uint8_t format_id : stream_formats) {
+        for (uint8_t channels = 1; channels <= 2; ++channels) {
+            const stream_converter_info* converter =
+                find_stream_converter(format_id, channels, esp2_format_bytes_per_sample(format_id));
+            size_t sample_count = BENCH_PACKET_FRAMES * channels;
+            size_t payload_bytes = format_id == ESP2_FORMAT_PACKED24 ? esp2_packed24_encode(stereo_left24.data(), sample_count, stream_payload.data())
+                                 : format_id == ESP2_FORMAT_INT16   ? esp2_int16_encode(stereo_left24.data(), sample_count, stream_payload.data())
+                                 : sample_count * 4;
+            if (format_id == ESP2_FORMAT_INT32_LEFT24) memcpy(stream_payload.data(), stereo_left24.data(), payload_bytes);
+            run_benchmark(options, std::string("convert/stream ") + converter->name, "frame", BENCH_PACKET_FRAMES, payload_bytes, [&] {
+                converter->convert(stream_payload.data(), payload_bytes, BENCH_PACKET_FRAMES, gain_q16, selected,
+                                   scratch_left24.data(), output.data());
+                do_not_optimize(output.data());
+            });
+        }
+    }
+
+    // the per-sample inline helpers the packet loop was built from
+    run_benchmark(options, "convert/le_bytes_to_int32+int32_left24_to_3bytes_le", "sample", BENCH_PACKET_FRAMES, input.size(), [&] {
+        for (size_t i = 0; i < BENCH_PACKET_FRAMES; ++i) {
+            int32_left24_to_3bytes_le(le_bytes_to_int32(input.data() + i * 4), output.data() + i * 3);
+        }
+        do_not_optimize(output.data());
+    });
+
+    convert_int32_left24_to_packed24_scalar(input.data(), output.data(), BENCH_PACKET_FRAMES, SAMPLE_GAIN_Q16_ONE);
+    run_benchmark(options, "levels/measure_packed24_levels", "sample", BENCH_PACKET_FRAMES, output.size(), [&] {
+        uint32_t peak = 0;
+        uint64_t sum_squares = 0;
+        measure_packed24_levels(output.data(), BENCH_PACKET_FRAMES, peak, sum_squares);
+        do_not_optimize(&peak);
+        do_not_optimize(&sum_squares);
+    });
+
+    drift_resampler resampler;
+    if (resampler.initialize()) {
+        resampler.restart(0, 0);
+        run_benchmark(options, std::string("resample/") + selected_resampler_kernel_name() + " (64 taps)", "sample",
+                      BENCH_PACKET_FRAMES, output.size(), [&] {
+                          resampler.process(output.data(), BENCH_PACKET_FRAMES, 1.0 + 20e-6,
+                                            [](uint64_t, const uint8_t* bytes, size_t) { do_not_optimize(bytes); });
+                      });
+    }
+}
+
+// ----------------- dsp -----------------
+
+static void benchmark_dsp_chain(const benchmark_options& options) {
+    std::vector<uint8_t> input = make_int32_left24_input(BENCH_PACKET_FRAMES);
+    std::vector<int32_t> output(BENCH_PACKET_FRAMES);
+    std::vector<float> work(BENCH_PACKET_FRAMES * 2);
+
+    dsp_chain_config highpass_only;
+    highpass_only.highpass_enabled = true;
+    dsp_chain_config every_stage = highpass_only;
+    every_stage.gate_enabled = true;
+    every_stage.agc_enabled = true;
+    every_stage.limiter_enabled = true;
+    const struct {
+        const char* name;
+        dsp_chain_config config;
+    } cases[] = {{"highpass", highpass_only}, {"highpass+gate+agc+limiter", every_stage}};
+    for (const auto& chain_case : cases) {
+        dsp_chain_coefficients coefficients;
+        prepare_dsp_chain(chain_case.config, 48000, coefficients);
+        stream_dsp_chain chain;
+        run_benchmark(options, std::string("dsp/") + chain_case.name + " (" + selected_dsp_chain_kernel_name() + ")", "sample",
+                      BENCH_PACKET_FRAMES, input.size(), [&] {
+                          chain.process(input.data(), output.data(), BENCH_PACKET_FRAMES, coefficients, 1.0f, work.data());
+                          do_not_optimize(output.data());
+                      });
+    }
+}
+
+// ----------------- coded payloads -----------------
+
+static void benchmark_payload_codecs(const benchmark_options& options) {
+    // a tone with a little noise: what the Rice predictor sees from a real microphone
+    std::mt19937 rng(11);
+    std::vector<int32_t> samples(BENCH_PACKET_FRAMES);
+    for (size_t i = 0; i < BENCH_PACKET_FRAMES; ++i) {
+        double value = 0.25 * std::sin(2.0 * M_PI * 440.0 * (double)i / 48000.0) * 8388607.0 + (double)(rng() % 256) - 128.0;
+        samples[i] = (int32_t)((uint32_t)(int32_t)std::lround(value) << 8);
+    }
+    std::vector<int32_t> decoded(BENCH_PACKET_FRAMES);
+    const size_t int32_bytes = BENCH_PACKET_FRAMES * 4;
+
+    std::vector<uint8_t> packed24(BENCH_PACKET_FRAMES * 3);
+    esp2_packed24_encode(samples.data(), BENCH_PACKET_FRAMES, packed24.data());
+    run_benchmark(options, "decode/packed24 portable loop", "sample", BENCH_PACKET_FRAMES, packed24.size(), [&] {
+        esp2_packed24_decode(packed24.data(), BENCH_PACKET_FRAMES, decoded.data());
+        do_not_optimize(decoded.data());
+    });
+    run_benchmark(options, "decode/packed24 receiver dispatch", "sample", BENCH_PACKET_FRAMES, packed24.size(), [&] {
+        decode_payload_to_int32_left24(ESP2_FORMAT_PACKED24, packed24.data(), packed24.size(), BENCH_PACKET_FRAMES, 1, decoded.data());
+        do_not_optimize(decoded.data());
+    });
+
+    std::vector<uint8_t> rice(BENCH_PACKET_FRAMES * 3);
+    size_t rice_bytes = esp2_rice24_encode(samples.data(), BENCH_PACKET_FRAMES, 1, rice.data(), rice.size());
+    run_benchmark(options, "encode/rice24", "sample", BENCH_PACKET_FRAMES, int32_bytes, [&] {
+        do_not_optimize(rice.data() + esp2_rice24_encode(samples.data(), BENCH_PACKET_FRAMES, 1, rice.data(), rice.size()));
+    });
+    if (rice_bytes > 0) {
+        std::printf("(rice24 packet: %zu of %zu int32 bytes)\n", rice_bytes, int32_bytes);
+        run_benchmark(options, "decode/rice24", "sample", BENCH_PACKET_FRAMES, rice_bytes, [&] {
+            esp2_rice24_decode(rice.data(), rice_bytes, BENCH_PACKET_FRAMES, 1, decoded.data());
+            do_not_optimize(decoded.data());
+        });
+    }
+
+    std::vector<uint8_t> adpcm(esp2_ima_adpcm_payload_bytes(BENCH_PACKET_FRAMES, 1));
+    esp2_ima_adpcm_state adpcm_state;
+    run_benchmark(options, "encode/ima_adpcm", "sample", BENCH_PACKET_FRAMES, int32_bytes, [&] {
+        esp2_ima_adpcm_encode(samples.data(), BENCH_PACKET_FRAMES, 1, &adpcm_state, adpcm.data());
+        do_not_optimize(adpcm.data());
+    });
+    run_benchmark(options, "decode/ima_adpcm", "sample", BENCH_PACKET_FRAMES, adpcm.size(), [&] {
+        esp2_ima_adpcm_decode(adpcm.data(), adpcm.size(), BENCH_PACKET_FRAMES, 1, decoded.data());
+        do_not_optimize(decoded.data());
+    });
+}
+
+// ----------------- header decode -----------------
+
+static constexpr size_t BENCH_HEADER_SIZE = 34;
+
+struct decoded_esp2_header {
+    uint32_t magic;
+    uint32_t sequence_number;
+    uint64_t first_sample_index;
+    uint64_t timestamp_microseconds;
+    uint16_t frames_in_packet;
+    uint8_t channels_in_packet;
+    uint8_t bytes_per_sample_in_packet;
+    uint32_t sample_rate_in_packet;
+    uint16_t format_id_in_packet;
+};
+
+// Reference: the receiver's original byte-shift decode
+static void decode_header_byte_loop(const uint8_t* header_buffer, decoded_esp2_header& header) {
+    header.magic = (uint32_t)header_buffer[0] | ((uint32_t)header_buffer[1] << 8) |
+                   ((uint32_t)header_buffer[2] << 16) | ((uint32_t)header_buffer[3] << 24);
+    header.sequence_number = (uint32_t)header_buffer[4] | ((uint32_t)header_buffer[5] << 8) |
+                             ((uint32_t)header_buffer[6] << 16) | ((uint32_t)header_buffer[7] << 24);
+    header.first_sample_index = 0;
+    for (int i = 0; i < 8; ++i) header.first_sample_index |= ((uint64_t)header_buffer[8 + i]) << (8 * i);
+    header.timestamp_microseconds = 0;
+    for (int i = 0; i < 8; ++i) header.timestamp_microseconds |= ((uint64_t)header_buffer[16 + i]) << (8 * i);
+    header.frames_in_packet = (uint16_t)header_buffer[24] | ((uint16_t)header_buffer[25] << 8);
+    header.channels_in_packet = header_buffer[26];
+    header.bytes_per_sample_in_packet = header_buffer[27];
+    header.sample_rate_in_packet = (uint32_t)header_buffer[28] | ((uint32_t)header_buffer[29] << 8) |
+                                   ((uint32_t)header_buffer[30] << 16) | ((uint32_t)header_buffer[31] << 24);
+    header.format_id_in_packet = (uint16_t)header_buffer[32] | ((uint16_t)header_buffer[33] << 8);
+}
+
+// Unaligned native loads (little-endian hosts)
+static void decode_header_memcpy(const uint8_t* header_buffer, decoded_esp2_header& header) {
+    memcpy(&header.magic, header_buffer + 0, 4);
+    memcpy(&header.sequence_number, header_buffer + 4, 4);
+    memcpy(&header.first_sample_index, header_buffer + 8, 8);
+    memcpy(&header.timestamp_microseconds, header_buffer + 16, 8);
+    memcpy(&header.frames_in_packet, header_buffer + 24, 2);
+    header.channels_in_packet = header_buffer[26];
+    header.bytes_per_sample_in_packet = header_buffer[27];
+    memcpy(&header.sample_rate_in_packet, header_buffer + 28, 4);
+    memcpy(&header.format_id_in_packet, header_buffer + 32, 2);
+}
+
+static void benchmark_header_decode(const benchmark_options& options) {
+    // a batch of distinct headers so the decode cannot be hoisted out of the loop
+    static const size_t HEADER_BATCH = 256;
+    std::vector<uint8_t> headers(HEADER_BATCH * BENCH_HEADER_SIZE);
+    std::mt19937 rng(3);
+    for (uint8_t& byte : headers) byte = (uint8_t)rng();
+    std::vector<decoded_esp2_header> decoded(HEADER_BATCH);
+
+    run_benchmark(options, "header/byte-shift loop (reference)", "header", HEADER_BATCH, headers.size(), [&] {
+        for (size_t i = 0; i < HEADER_BATCH; ++i) decode_header_byte_loop(headers.data() + i * BENCH_HEADER_SIZE, decoded[i]);
+        do_not_optimize(decoded.data());
+    });
+    run_benchmark(options, "header/memcpy loads", "header", HEADER_BATCH, headers.size(), [&] {
+        for (size_t i = 0; i < HEADER_BATCH; ++i) decode_header_memcpy(headers.data() + i * BENCH_HEADER_SIZE, decoded[i]);
+        do_not_optimize(decoded.data());
+    });
+
+    // the receiver's path: validate (magic, version, length), then decode through the accessors
+    std::vector<uint8_t> wire_headers(HEADER_BATCH * ESP2_WIRE_HEADER_BYTES);
+    for (size_t i = 0; i < HEADER_BATCH; ++i) {
+        reinterpret_cast<esp2_wire_header*>(wire_headers.data() + i * ESP2_WIRE_HEADER_BYTES)
+            ->set((uint32_t)rng(), rng(), rng(), 1024, 1, 4, 48000, ESP2_FORMAT_INT32_LEFT24);
+    }
+    run_benchmark(options, "header/esp2_wire_header_view + accessors", "header", HEADER_BATCH, wire_headers.size(), [&] {
+        for (size_t i = 0; i < HEADER_BATCH; ++i) {
+            const esp2_wire_header* wire = esp2_wire_header_view(wire_headers.data() + i * ESP2_WIRE_HEADER_BYTES, ESP2_WIRE_HEADER_BYTES);
+            if (!wire) continue;
+            decoded_esp2_header& header = decoded[i];
+            header.magic = wire->magic();
+            header.sequence_number = wire->sequence();
+            header.first_sample_index = wire->first_sample_index();
+            header.timestamp_microseconds = wire->timestamp_us();
+            header.frames_in_packet = wire->frames();
+            header.channels_in_packet = wire->channels();
+            header.bytes_per_sample_in_packet = wire->bytes_per_sample();
+            header.sample_rate_in_packet = wire->sample_rate();
+            header.format_id_in_packet = wire->format_id();
+        }
+        do_not_optimize(decoded.data());
+    });
+}
+
+// ----------------- WAV write -----------------
+
+static void benchmark_wav_write(const benchmark_options& options) {
+    const size_t packet_bytes = BENCH_PACKET_FRAMES * 3;
+    const size_t packets = std::max<size_t>(1, options.wav_megabytes * 1024 * 1024 / packet_bytes);
+    const size_t total_bytes = packets * packet_bytes;
+    std::vector<uint8_t> packet(packet_bytes, 0x5A);
+    const std::string path = options.directory + "/esp_receiver_benchmark_" + std::to_string(getpid()) + ".wav";
+
+    // one iteration = a whole file, so page-cache growth is part of what is measured
+    run_benchmark(options, "wav/fwrite+fflush per packet (reference)", "sample", packets * BENCH_PACKET_FRAMES, total_bytes, [&] {
+        FILE* file = fopen(path.c_str(), "wb");
+        if (!file) return;
+        uint8_t header[WAV_HEADER_BYTES];
+        build_wav_header(header, 48000, 1, 3, 0, false);
+        fwrite(header, 1, sizeof(header), file);
+        for (size_t i = 0; i < packets; ++i) {
+            fwrite(packet.data(), 1, packet_bytes, file);
+            fflush(file);
+        }
+        fclose(file);
+        unlink(path.c_str());
+    });
+    run_benchmark(options, "wav/pwrite per packet", "sample", packets * BENCH_PACKET_FRAMES, total_bytes, [&] {
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) return;
+        off_t offset = WAV_HEADER_BYTES;
+        for (size_t i = 0; i < packets; ++i) {
+            if (pwrite(fd, packet.data(), packet_bytes, offset) < 0) break;
+            offset += (off_t)packet_bytes;
+        }
+        close(fd);
+        unlink(path.c_str());
+    });
+    wav_writer_policy policy;
+    policy.durability_interval_ms = 0; // data path only; the fdatasync at close is included
+    run_benchmark(options, std::string("wav/batched_wav_sink (") + wav_writer_backend_name() + ", 256 KiB batches)", "sample",
+                  packets * BENCH_PACKET_FRAMES, total_bytes, [&] {
+                      batched_wav_sink sink;
+                      if (!sink.open(path, 48000, 1, 3, policy)) return;
+                      auto now = batched_wav_sink::clock::now();
+                      for (size_t i = 0; i < packets; ++i) sink.append(packet.data(), packet_bytes, now);
+                      sink.close();
+                      unlink(path.c_str());
+                  });
+}
+
+// ----------------- trace spans -----------------
+
+static void benchmark_trace_spans(const benchmark_options& options) {
+    // the recorder is always built; registering is all the macros add in a tracing build
+    trace_register_current_thread("benchmark");
+    static const size_t SPAN_BATCH = 256;
+    std::vector<uint64_t> ticks(SPAN_BATCH);
+
+    benchmark_result counter_read = run_benchmark(options, "trace/trace_ticks", "read", SPAN_BATCH, 0, [&] {
+        for (size_t i = 0; i < SPAN_BATCH; ++i) ticks[i] = trace_ticks();
+        do_not_optimize(ticks.data());
+    });
+    // the ring stores alone, timestamps already in hand
+    trace_thread_ring& ring = *global_this_thread_trace_ring;
+    uint64_t sample_index = 0;
+    benchmark_result record_only = run_benchmark(options, "trace/ring record (no counter reads)", "span", SPAN_BATCH, 0, [&] {
+        for (size_t i = 0; i < SPAN_BATCH; ++i) {
+            ring.record(trace_span_kind::convert, sample_index, sample_index + 100, 1, sample_index);
+            sample_index += 256;
+        }
+    });
+    benchmark_result whole_span = run_benchmark(options, "trace/scoped span into the thread ring", "span", SPAN_BATCH, 0, [&] {
+        for (size_t i = 0; i < SPAN_BATCH; ++i) {
+            trace_scoped_span span(trace_span_kind::convert, 1, sample_index);
+            sample_index += 256;
+        }
+    });
+    benchmark_result chained_span = run_benchmark(options, "trace/chained span into the thread ring", "span", SPAN_BATCH, 0, [&] {
+        trace_span_chain chain;
+        for (size_t i = 0; i < SPAN_BATCH; ++i) {
+            trace_scoped_span span(trace_span_kind::convert, 1, sample_index, chain);
+            sample_index += 256;
+        }
+    });
+
+    // A span cannot cost less than its counter reads: two alone, one in a chain. The
+    // 20 ns budget is checked for both kinds and for the recorder's own share (measured
+    // directly above, and as the span less the floor: back-to-back reads overlap in the
+    // pipeline, so that difference can come out below the direct figure), so a slow
+    // counter (a VM that traps rdtsc, say) is told apart from a slow recorder
+    static const double SPAN_BUDGET_NS = 20.0;
+    if (counter_read.ran && record_only.ran && whole_span.ran) {
+        double floor_ns = 2.0 * counter_read.ns_per_item;
+        std::printf("trace/span budget %.0f ns: whole span %.3f ns (%s), floor of 2 counter reads %.3f ns, "
+                    "recorder %.3f ns (%s; span - floor = %.3f ns)%s\n",
+                    SPAN_BUDGET_NS, whole_span.ns_per_item, whole_span.ns_per_item < SPAN_BUDGET_NS ? "within" : "OVER",
+                    floor_ns, record_only.ns_per_item, record_only.ns_per_item < SPAN_BUDGET_NS ? "within" : "OVER",
+                    whole_span.ns_per_item - floor_ns,
+                    floor_ns >= SPAN_BUDGET_NS ? "; the counter alone exceeds the budget on this CPU" : "");
+    }
+    if (counter_read.ran && chained_span.ran) {
+        std::printf("trace/span budget %.0f ns: chained span %.3f ns (%s), floor of 1 counter read %.3f ns%s\n",
+                    SPAN_BUDGET_NS, chained_span.ns_per_item, chained_span.ns_per_item < SPAN_BUDGET_NS ? "within" : "OVER",
+                    counter_read.ns_per_item,
+                    counter_read.ns_per_item >= SPAN_BUDGET_NS ? "; the counter alone exceeds the budget on this CPU" : "");
+    }
+}
+
+// ----------------- main -----------------
+
+static bool parse_options(int argc, char** argv, benchmark_options& options) {
+    enum option_id { cpu = 1, min_time, repetitions, filter, directory, wav_megabytes, help };
+    static const struct option long_options[] = {
+        {"cpu", required_argument, nullptr, cpu},
+        {"min-time", required_argument, nullptr, min_time},
+        {"repetitions", required_argument, nullptr, repetitions},
+        {"filter", required_argument, nullptr, filter},
+        {"dir", required_argument, nullptr, directory},
+        {"wav-mb", required_argument, nullptr, wav_megabytes},
+        {"help", no_argument, nullptr, help},
+        {nullptr, 0, nullptr, 0},
+    };
+    int option;
+    while ((option = getopt_long(argc, argv, "", long_options, nullptr)) != -1) {
+        switch (option) {
+        case cpu: options.cpu = std::atoi(optarg); break;
+        case min_time: options.min_time_seconds = std::atof(optarg); break;
+        case repetitions: options.repetitions = std::max(1, std::atoi(optarg)); break;
+        case filter: options.filter = optarg; break;
+        case directory: options.directory = optarg; break;
+        case wav_megabytes: options.wav_megabytes = (size_t)std::max(1, std::atoi(optarg)); break;
+        default:
+            std::cout << "usage: " << argv[0] << " [--cpu N] [--min-time S] [--repetitions N] [--filter SUBSTRING]"
+                      << " [--dir PATH] [--wav-mb N]\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    benchmark_options options;
+    if (!parse_options(argc, argv, options)) return 2;
+    if (options.cpu < 0) options.cpu = sched_getcpu();
+    if (!pin_to_cpu(options.cpu)) return 1;
+    std::printf("pinned to CPU %d, median of %d x %.2f s, selected conversion kernel: %s\n\n", options.cpu,
+                options.repetitions, options.min_time_seconds, selected_packed24_convert_kernel_name());
+
+    benchmark_conversion(options);
+    benchmark_dsp_chain(options);
+    benchmark_payload_codecs(options);
+    benchmark_header_decode(options);
+    benchmark_wav_write(options);
+    benchmark_trace_spans(options);
+    return 0;
+}
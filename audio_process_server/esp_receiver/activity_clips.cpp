@@ -0,0 +1,274 @@
+// activity_clips.cpp
+// Activity detector, clip gate and clip index (see activity_clips.h).
+#include "activity_clips.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <new>
+
+static const float ACTIVITY_LEVEL_SILENCE_DBFS = -200.0f;
+// bin power (full-scale sine: ~4096) below which a rise is not counted, about -110 dBFS
+static const float ACTIVITY_BIN_POWER_FLOOR = 4096.0f * 1e-11f;
+
+static float packed24_to_float(const uint8_t* bytes) {
+    int32_t sample = (int32_t)(((uint32_t)bytes[0] << 8) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 24)) >> 8;
+    return (float)sample * (1.0f / 8388608.0f);
+}
+
+static float power_to_db(double power) {
+    return power > 0.0 ? (float)(10.0 * std::log10(power)) : ACTIVITY_LEVEL_SILENCE_DBFS;
+}
+
+// ----------------- Hop spectrum -----------------
+
+// Hann window, bit reversal and twiddles of the ACTIVITY_HOP_FRAMES-point FFT, shared by all detectors
+struct activity_fft_tables {
+    float window[ACTIVITY_HOP_FRAMES];
+    uint16_t bit_reversed[ACTIVITY_HOP_FRAMES];
+    float twiddle_cos[ACTIVITY_HOP_FRAMES / 2];
+    float twiddle_sin[ACTIVITY_HOP_FRAMES / 2];
+
+    activity_fft_tables() {
+        const double pi = 3.14159265358979323846;
+        unsigned bits = 0;
+        while (((size_t)1 << bits) < ACTIVITY_HOP_FRAMES) ++bits;
+        for (size_t i = 0; i < ACTIVITY_HOP_FRAMES; ++i) {
+            window[i] = (float)(0.5 - 0.5 * std::cos(2.0 * pi * (double)i / (double)ACTIVITY_HOP_FRAMES));
+            unsigned reversed = 0;
+            for (unsigned bit = 0; bit < bits; ++bit) reversed |= (unsigned)((i >> bit) & 1u) << (bits - 1 - bit);
+            bit_reversed[i] = (uint16_t)reversed;
+        }
+        for (size_t k = 0; k < ACTIVITY_HOP_FRAMES / 2; ++k) {
+            twiddle_cos[k] = (float)std::cos(2.0 * pi * (double)k / (double)ACTIVITY_HOP_FRAMES);
+            twiddle_sin[k] = (float)-std::sin(2.0 * pi * (double)k / (double)ACTIVITY_HOP_FRAMES);
+        }
+    }
+};
+
+static const activity_fft_tables& fft_tables() {
+    static const activity_fft_tables tables;
+    return tables;
+}
+
+// Power of bins 0 .. N/2-1 of the windowed hop (iterative radix-2, real input in the real parts)
+static void compute_hop_power_spectrum(const float* samples, float* power_out) {
+    const activity_fft_tables& tables = fft_tables();
+    float real[ACTIVITY_HOP_FRAMES];
+    float imag[ACTIVITY_HOP_FRAMES];
+    for (size_t i = 0; i < ACTIVITY_HOP_FRAMES; ++i) {
+        size_t j = tables.bit_reversed[i];
+        real[j] = samples[i] * tables.window[i];
+        imag[j] = 0.0f;
+    }
+    for (size_t span = 1; span < ACTIVITY_HOP_FRAMES; span <<= 1) {
+        size_t twiddle_stride = ACTIVITY_HOP_FRAMES / (2 * span);
+        for (size_t start = 0; start < ACTIVITY_HOP_FRAMES; start += 2 * span) {
+            for (size_t k = 0; k < span; ++k) {
+                float w_real = tables.twiddle_cos[k * twiddle_stride];
+                float w_imag = tables.twiddle_sin[k * twiddle_stride];
+                size_t a = start + k;
+                size_t b = a + span;
+                float t_real = real[b] * w_real - imag[b] * w_imag;
+                float t_imag = real[b] * w_imag + imag[b] * w_real;
+                real[b] = real[a] - t_real;
+                imag[b] = imag[a] - t_imag;
+                real[a] += t_real;
+                imag[a] += t_imag;
+            }
+        }
+    }
+    for (size_t k = 0; k < ACTIVITY_HOP_FRAMES / 2; ++k) power_out[k] = real[k] * real[k] + imag[k] * imag[k];
+}
+
+// ----------------- acoustic_activity_detector -----------------
+
+void acoustic_activity_detector::configure(uint32_t sample_rate, const activity_detector_config& config) {
+    config_ = config;
+    double hop_ms = 1000.0 * (double)ACTIVITY_HOP_FRAMES / (double)sample_rate;
+    floor_fall_coefficient_ = (float)(1.0 - std::exp(-hop_ms / ACTIVITY_FLOOR_FALL_MS));
+    floor_rise_per_hop_db_ = config.floor_rise_db_per_second * (float)(hop_ms / 1000.0);
+    background_coefficient_ = (float)(1.0 - std::exp(-hop_ms / ACTIVITY_BACKGROUND_SPECTRUM_MS));
+    background_warmup_hops_ = (uint32_t)std::ceil(1.0f / background_coefficient_);
+    flux_bin_ratio_ = std::pow(10.0f, config.flux_bin_margin_db / 10.0f);
+    hop_fill_ = 0;
+    background_hops_ = 0;
+    started_ = false;
+    active_ = false;
+    (void)fft_tables(); // build the shared tables here, not on the first hop
+}
+
+bool acoustic_activity_detector::add_frames(const uint8_t* packed24, size_t frame_count) {
+    for (size_t i = 0; i < frame_count && hop_fill_ < ACTIVITY_HOP_FRAMES; ++i) {
+        hop_samples_[hop_fill_++] = packed24_to_float(packed24 + i * 3);
+    }
+    if (hop_fill_ < ACTIVITY_HOP_FRAMES) return false;
+    analyze_hop();
+    hop_fill_ = 0;
+    return true;
+}
+
+void acoustic_activity_detector::analyze_hop() {
+    double sum_squares = 0.0;
+    float peak = 0.0f;
+    for (float sample : hop_samples_) {
+        sum_squares += (double)sample * sample;
+        peak = std::max(peak, std::fabs(sample));
+    }
+    level_dbfs_ = power_to_db(sum_squares / (double)ACTIVITY_HOP_FRAMES);
+    peak_dbfs_ = power_to_db((double)peak * peak);
+    bool audible = level_dbfs_ > config_.min_level_dbfs;
+
+    // spectral flux against the background spectrum: the bins above DC that rose
+    // flux_bin_margin_db over their running average. Each bin is compared with itself,
+    // so coloured noise (rumble, hiss) is as quiet here as white noise.
+    float power[ACTIVITY_HOP_FRAMES / 2];
+    compute_hop_power_spectrum(hop_samples_, power);
+    flux_bins_ = 0;
+    if (audible && background_hops_ >= background_warmup_hops_) {
+        for (size_t k = 1; k < ACTIVITY_HOP_FRAMES / 2; ++k) {
+            if (power[k] > flux_bin_ratio_ * background_power_[k] + ACTIVITY_BIN_POWER_FLOOR) ++flux_bins_;
+        }
+    }
+
+    if (!started_) {
+        // the first audible hop is the best guess of the background there is
+        active_ = false;
+        if (!audible) return;
+        started_ = true;
+        noise_floor_dbfs_ = level_dbfs_;
+        for (size_t k = 0; k < ACTIVITY_HOP_FRAMES / 2; ++k) background_power_[k] = power[k];
+        background_hops_ = 1;
+        return;
+    }
+
+    bool level_active = level_dbfs_ > noise_floor_dbfs_ + config_.level_margin_db;
+    bool flux_active = flux_bins_ >= config_.flux_min_bins;
+    active_ = audible && (level_active || flux_active);
+
+    // background spectrum: every audible hop, so a new steady sound stops counting as
+    // an onset after about ACTIVITY_BACKGROUND_SPECTRUM_MS. For the first time constant
+    // a plain mean of the hops so far instead, and no flux: a few hops of noise are no
+    // estimate of a bin (some bins come out far too low and then keep "rising").
+    if (audible) {
+        float coefficient = std::max(background_coefficient_, 1.0f / (float)(background_hops_ + 1));
+        for (size_t k = 0; k < ACTIVITY_HOP_FRAMES / 2; ++k) {
+            background_power_[k] += (power[k] - background_power_[k]) * coefficient;
+        }
+        if (background_hops_ < background_warmup_hops_) ++background_hops_;
+    }
+
+    // noise floor: towards quieter hops within ACTIVITY_FLOOR_FALL_MS, slowly up
+    // otherwise. Held through inaudible hops, so a zero-filled gap does not make the
+    // background behind it look like an event.
+    if (audible) {
+        if (level_dbfs_ < noise_floor_dbfs_) {
+            noise_floor_dbfs_ += (level_dbfs_ - noise_floor_dbfs_) * floor_fall_coefficient_;
+        } else {
+            noise_floor_dbfs_ = std::min(noise_floor_dbfs_ + floor_rise_per_hop_db_, level_dbfs_);
+        }
+    }
+}
+
+// ----------------- activity_clip_gate -----------------
+
+bool activity_clip_gate::initialize(uint32_t sample_rate, const activity_detector_config& detector_config,
+                                    const activity_clip_policy& policy) {
+    detector_.configure(sample_rate, detector_config);
+    pre_roll_frames_ = (size_t)((uint64_t)sample_rate * policy.pre_roll_ms / 1000);
+    post_roll_frames_ = (size_t)((uint64_t)sample_rate * policy.post_roll_ms / 1000);
+    // the pre-roll plus the hop that triggers the clip
+    held_capacity_frames_ = pre_roll_frames_ + ACTIVITY_HOP_FRAMES;
+    try {
+        held_bytes_.assign(held_capacity_frames_ * 3, 0);
+    } catch (const std::bad_alloc&) {
+        return false;
+    }
+    held_start_ = 0;
+    held_frames_ = 0;
+    timeline_started_ = false;
+    in_clip_ = false;
+    inactive_frames_ = 0;
+    return true;
+}
+
+void activity_clip_gate::hold_frames(uint64_t first_sample_index, const uint8_t* packed24, size_t frame_count) {
+    if (held_frames_ == 0) {
+        held_start_ = 0;
+        held_first_index_ = first_sample_index;
+    }
+    while (frame_count > 0) {
+        size_t write_position = (held_start_ + held_frames_) % held_capacity_frames_;
+        size_t run_frames = held_capacity_frames_ - write_position;
+        if (run_frames > frame_count) run_frames = frame_count;
+        memcpy(held_bytes_.data() + write_position * 3, packed24, run_frames * 3);
+        held_frames_ += run_frames;
+        if (held_frames_ > held_capacity_frames_) {
+            // full: the oldest frames make room
+            size_t overwritten_frames = held_frames_ - held_capacity_frames_;
+            held_start_ = (held_start_ + overwritten_frames) % held_capacity_frames_;
+            held_first_index_ += overwritten_frames;
+            held_frames_ = held_capacity_frames_;
+        }
+        packed24 += run_frames * 3;
+        frame_count -= run_frames;
+    }
+}
+
+void activity_clip_gate::publish_detector_readings() {
+    counters_.level_dbfs.store(detector_.level_dbfs(), std::memory_order_relaxed);
+    counters_.noise_floor_dbfs.store(detector_.noise_floor_dbfs(), std::memory_order_relaxed);
+    counters_.flux_bins.store(detector_.flux_bins(), std::memory_order_relaxed);
+}
+
+// ----------------- activity_clip_index -----------------
+
+void activity_clip_index::configure(const char* path) {
+    close();
+    snprintf(path_, sizeof(path_), "%s", path);
+}
+
+// Copy text into a JSON string body; the names here are plain, this only guards quotes
+static void append_json_escaped(char*& out, const char* end, const char* text) {
+    for (; *text && out + 2 < end; ++text) {
+        if (*text == '"' || *text == '\\') *out++ = '\\';
+        *out++ = *text;
+    }
+}
+
+bool activity_clip_index::append(const char* segment_filename, const activity_clip_event& clip, uint32_t sample_rate,
+                                 int64_t start_unix_us) {
+    if (fd_ < 0) {
+        if (path_[0] == '\0') return false;
+        fd_ = ::open(path_, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd_ < 0) {
+            std::cerr << "[WAV] could not open clip index " << path_ << ": " << strerror(errno) << "\n";
+            path_[0] = '\0'; // do not retry on every clip
+            return false;
+        }
+    }
+    char line[1024];
+    char* out = line;
+    const char* end = line + sizeof(line);
+    out += snprintf(out, (size_t)(end - out), "{\"file\":\"");
+    append_json_escaped(out, end - 256, segment_filename);
+    out += snprintf(out, (size_t)(end - out),
+                    "\",\"first_sample_index\":%llu,\"frames\":%llu,\"duration_ms\":%llu,\"start_unix_us\":%lld,\"peak_dbfs\":%.1f}\n",
+                    (unsigned long long)clip.first_sample_index, (unsigned long long)clip.frame_count,
+                    (unsigned long long)(clip.frame_count * 1000 / sample_rate), (long long)start_unix_us,
+                    (double)clip.peak_dbfs);
+    size_t line_bytes = std::min((size_t)(out - line), sizeof(line) - 1);
+    // O_APPEND: one write per line keeps lines whole
+    return ::write(fd_, line, line_bytes) == (ssize_t)line_bytes;
+}
+
+void activity_clip_index::close() {
+    if (fd_ >= 0) ::close(fd_);
+    fd_ = -1;
+}
@@ -0,0 +1,259 @@
+// activity_clips.h
+// Activity-triggered recording for the writer stage: only the stretches of a stream
+// with something in them reach the segment recorder, each as its own clip.
+//
+// acoustic_activity_detector looks at every ACTIVITY_HOP_FRAMES hop of packed 24-bit
+// mono audio, independent of how the audio was split into packets or runs:
+//   level  hop RMS (dBFS) against a noise floor that follows the level down within
+//          about ACTIVITY_FLOOR_FALL_MS and creeps up at floor_rise_db_per_second,
+//          so a steady background becomes the floor but a word does not
+//   flux   spectral flux against the background: how many bins of the Hann-windowed
+//          spectrum rose flux_bin_margin_db over their own running average. Each bin
+//          is its own reference, so it does not depend on the level or colour of the
+//          background, and a new tone or transient counts even when it adds little to
+//          the total level. (For stationary noise a bin is 10 dB over its mean with
+//          probability e^-10, so flux_min_bins of them are practically never chance.)
+// A hop is active when it is above min_level_dbfs and the level clears the floor by
+// level_margin_db or at least flux_min_bins bins rose.
+//
+// activity_clip_gate holds the most recent pre-roll of audio while idle. When a hop
+// goes active, the held audio and everything after it are passed on until post-roll
+// worth of hops in a row has been inactive; then the clip ends. A clip therefore
+// starts pre_roll ahead of the first active hop, which covers the detector's hop of
+// latency and a quiet lead-in, so onsets are never cut. A sample-index discontinuity
+// ends a clip (the recorder would start a new file there anyway).
+//
+// activity_clip_index appends one JSON line per finished clip to an index file
+// (segment file, first_sample_index, frames, wall-clock start, peak).
+//
+// Everything is owned by one thread (the writer); only the counters and the published
+// detector readings are read elsewhere. Nothing here allocates after initialize().
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+static constexpr size_t ACTIVITY_HOP_FRAMES = 256;         // 5.3 ms at 48 kHz; also the FFT size
+static constexpr float ACTIVITY_FLOOR_FALL_MS = 250.0f;    // noise floor time constant towards quieter hops
+static constexpr float ACTIVITY_BACKGROUND_SPECTRUM_MS = 1000.0f; // time constant of the per-bin background
+
+struct activity_detector_config {
+    float min_level_dbfs = -70.0f;           // never active below this (silence, zero-filled gaps)
+    float level_margin_db = 10.0f;           // active when the level is this far above the noise floor
+    float flux_bin_margin_db = 10.0f;        // ...or enough bins rose this far over their background
+    uint32_t flux_min_bins = 3;
+    float floor_rise_db_per_second = 1.0f;
+};
+
+struct activity_clip_policy {
+    uint32_t pre_roll_ms = 1000;
+    uint32_t post_roll_ms = 2000;
+};
+
+class acoustic_activity_detector {
+public:
+    void configure(uint32_t sample_rate, const activity_detector_config& config);
+
+    size_t frames_to_hop_end() const { return ACTIVITY_HOP_FRAMES - hop_fill_; }
+    // Take up to frames_to_hop_end() frames; true when they completed a hop, whose
+    // verdict is then in active()
+    bool add_frames(const uint8_t* packed24, size_t frame_count);
+    // Drop a partly filled hop (the next frames do not continue it)
+    void discard_partial_hop() { hop_fill_ = 0; }
+
+    bool active() const { return active_; }
+    float level_dbfs() const { return level_dbfs_; }
+    float peak_dbfs() const { return peak_dbfs_; }
+    float noise_floor_dbfs() const { return noise_floor_dbfs_; }
+    uint32_t flux_bins() const { return flux_bins_; }
+
+private:
+    void analyze_hop();
+
+    activity_detector_config config_;
+    float floor_fall_coefficient_ = 1.0f;    // one-pole step per hop
+    float floor_rise_per_hop_db_ = 0.0f;
+    float background_coefficient_ = 1.0f;
+    uint32_t background_warmup_hops_ = 1;   // hops averaged before flux counts: one time constant
+    float flux_bin_ratio_ = 10.0f;
+
+    float hop_samples_[ACTIVITY_HOP_FRAMES] = {};
+    size_t hop_fill_ = 0;
+    float background_power_[ACTIVITY_HOP_FRAMES / 2] = {};
+    uint32_t background_hops_ = 0;          // audible hops averaged so far, up to background_warmup_hops_
+    bool started_ = false;
+
+    bool active_ = false;
+    float level_dbfs_ = -200.0f;
+    float peak_dbfs_ = -200.0f;
+    float noise_floor_dbfs_ = -200.0f;
+    uint32_t flux_bins_ = 0;
+};
+
+// Counters and detector readings for /status and /metrics (writer thread writes)
+struct activity_clip_counters {
+    std::atomic<uint64_t> frames_seen{0};
+    std::atomic<uint64_t> frames_passed{0};    // written as part of a clip
+    std::atomic<uint64_t> clips_started{0};
+    std::atomic<uint64_t> clips_finished{0};
+    std::atomic<bool> in_clip{false};
+    std::atomic<float> level_dbfs{-200.0f};
+    std::atomic<float> noise_floor_dbfs{-200.0f};
+    std::atomic<uint32_t> flux_bins{0};
+};
+
+struct activity_clip_event {
+    uint64_t first_sample_index = 0;  // includes the pre-roll
+    uint64_t frame_count = 0;
+    float peak_dbfs = -200.0f;        // loudest hop peak in the clip
+};
+
+class activity_clip_gate {
+public:
+    // Size the pre-roll ring. Returns false on allocation failure.
+    bool initialize(uint32_t sample_rate, const activity_detector_config& detector_config, const activity_clip_policy& policy);
+    bool is_initialized() const { return !held_bytes_.empty(); }
+
+    // Feed a contiguous run of packed 24-bit mono frames. clip_sink(first_sample_index,
+    // bytes, frame_count) receives the audio of clips, in order; clip_events(event,
+    // bool started) is called when a clip starts (before its first audio; frame_count
+    // is 0) and when it ends (after its last audio).
+    template <typename clip_sink, typename clip_event_sink>
+    void process(uint64_t first_sample_index, const uint8_t* packed24, size_t frame_count, clip_sink&& sink,
+                 clip_event_sink&& events);
+
+    // End the clip in progress, if any, and forget the held pre-roll (stream end, or
+    // activity recording switched off)
+    template <typename clip_event_sink>
+    void finish(clip_event_sink&& events);
+
+    bool in_clip() const { return in_clip_; }
+    const activity_clip_counters& counters() const { return counters_; }
+
+private:
+    void hold_frames(uint64_t first_sample_index, const uint8_t* packed24, size_t frame_count);
+    template <typename clip_sink>
+    void release_held_frames(clip_sink&& sink);
+    void publish_detector_readings();
+
+    acoustic_activity_detector detector_;
+    size_t pre_roll_frames_ = 0;
+    size_t post_roll_frames_ = 0;
+
+    // pre-roll ring (packed 24-bit): the newest held_frames_ frames, the oldest at index held_first_index_
+    std::vector<uint8_t> held_bytes_;
+    size_t held_capacity_frames_ = 0;
+    size_t held_start_ = 0;            // ring position of the oldest held frame
+    size_t held_frames_ = 0;
+    uint64_t held_first_index_ = 0;
+
+    bool timeline_started_ = false;
+    uint64_t next_index_ = 0;          // index that continues the last run
+    bool in_clip_ = false;
+    size_t inactive_frames_ = 0;       // consecutive inactive frames in the current clip
+    activity_clip_event clip_;
+
+    activity_clip_counters counters_;
+};
+
+// Append-only JSON Lines index of finished clips, one file per device
+class activity_clip_index {
+public:
+    activity_clip_index() = default;
+    ~activity_clip_index() { close(); }
+    activity_clip_index(const activity_clip_index&) = delete;
+    activity_clip_index& operator=(const activity_clip_index&) = delete;
+
+    // Opened lazily by the first append(); path is e.g. "received_audio_esp32_10.0.0.7_clips.jsonl"
+    void configure(const char* path);
+    bool append(const char* segment_filename, const activity_clip_event& clip, uint32_t sample_rate, int64_t start_unix_us);
+    void close();
+
+private:
+    char path_[512] = {};
+    int fd_ = -1;
+};
+
+// ----------------- activity_clip_gate templates -----------------
+
+template <typename clip_sink, typename clip_event_sink>
+void activity_clip_gate::process(uint64_t first_sample_index, const uint8_t* packed24, size_t frame_count,
+                                 clip_sink&& sink, clip_event_sink&& events) {
+    if (!is_initialized() || frame_count == 0) return;
+    counters_.frames_seen.fetch_add(frame_count, std::memory_order_relaxed);
+    if (timeline_started_ && first_sample_index != next_index_) {
+        if (in_clip_) finish(events);
+        held_frames_ = 0;
+        detector_.discard_partial_hop();
+    }
+    timeline_started_ = true;
+    next_index_ = first_sample_index + frame_count;
+
+    while (frame_count > 0) {
+        size_t piece_frames = detector_.frames_to_hop_end();
+        if (piece_frames > frame_count) piece_frames = frame_count;
+        bool hop_completed = detector_.add_frames(packed24, piece_frames);
+        if (in_clip_) {
+            sink(first_sample_index, packed24, piece_frames);
+            clip_.frame_count += piece_frames;
+            counters_.frames_passed.fetch_add(piece_frames, std::memory_order_relaxed);
+        } else {
+            hold_frames(first_sample_index, packed24, piece_frames);
+        }
+
+        if (hop_completed) {
+            publish_detector_readings();
+            if (detector_.active()) {
+                if (!in_clip_) {
+                    // the clip starts with the held pre-roll, which ends with this hop
+                    in_clip_ = true;
+                    clip_ = activity_clip_event();
+                    clip_.first_sample_index = held_first_index_;
+                    counters_.clips_started.fetch_add(1, std::memory_order_relaxed);
+                    counters_.in_clip.store(true, std::memory_order_relaxed);
+                    events(clip_, true);
+                    size_t released_frames = held_frames_;
+                    release_held_frames(sink);
+                    clip_.frame_count += released_frames;
+                    counters_.frames_passed.fetch_add(released_frames, std::memory_order_relaxed);
+                }
+                inactive_frames_ = 0;
+                if (detector_.peak_dbfs() > clip_.peak_dbfs) clip_.peak_dbfs = detector_.peak_dbfs();
+            } else if (in_clip_) {
+                inactive_frames_ += ACTIVITY_HOP_FRAMES;
+                if (inactive_frames_ >= post_roll_frames_) finish(events);
+            }
+        }
+        first_sample_index += piece_frames;
+        packed24 += piece_frames * 3;
+        frame_count -= piece_frames;
+    }
+}
+
+template <typename clip_event_sink>
+void activity_clip_gate::finish(clip_event_sink&& events) {
+    held_frames_ = 0;
+    if (!in_clip_) return;
+    in_clip_ = false;
+    inactive_frames_ = 0;
+    counters_.clips_finished.fetch_add(1, std::memory_order_relaxed);
+    counters_.in_clip.store(false, std::memory_order_relaxed);
+    events(clip_, false);
+}
+
+template <typename clip_sink>
+void activity_clip_gate::release_held_frames(clip_sink&& sink) {
+    // at most two runs: up to the physical end of the ring, then from its start
+    uint64_t index = held_first_index_;
+    while (held_frames_ > 0) {
+        size_t run_frames = held_capacity_frames_ - held_start_;
+        if (run_frames > held_frames_) run_frames = held_frames_;
+        sink(index, held_bytes_.data() + held_start_ * 3, run_frames);
+        index += run_frames;
+        held_start_ = (held_start_ + run_frames) % held_capacity_frames_;
+        held_frames_ -= run_frames;
+    }
+    held_start_ = 0;
+}
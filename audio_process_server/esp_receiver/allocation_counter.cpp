@@ -0,0 +1,52 @@
+// allocation_counter.cpp
+// Replaces the (non-aligned) global operator new/delete family with malloc/free
+// wrappers that bump a counter when the calling thread has opted in.
+// Threads that never opt in (Drogon's) only pay one thread-local flag test.
+#include "allocation_counter.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<uint64_t> global_packet_path_heap_allocations{0};
+static thread_local bool thread_is_packet_path = false;
+
+void mark_current_thread_as_packet_path() {
+    thread_is_packet_path = true;
+}
+
+uint64_t packet_path_heap_allocation_count() {
+    return global_packet_path_heap_allocations.load(std::memory_order_relaxed);
+}
+
+static void* counted_malloc(std::size_t size_bytes) {
+    if (thread_is_packet_path) global_packet_path_heap_allocations.fetch_add(1, std::memory_order_relaxed);
+    return std::malloc(size_bytes ? size_bytes : 1);
+}
+
+void* operator new(std::size_t size_bytes) {
+    void* memory = counted_malloc(size_bytes);
+    if (!memory) throw std::bad_alloc();
+    return memory;
+}
+
+void* operator new[](std::size_t size_bytes) {
+    void* memory = counted_malloc(size_bytes);
+    if (!memory) throw std::bad_alloc();
+    return memory;
+}
+
+void* operator new(std::size_t size_bytes, const std::nothrow_t&) noexcept {
+    return counted_malloc(size_bytes);
+}
+
+void* operator new[](std::size_t size_bytes, const std::nothrow_t&) noexcept {
+    return counted_malloc(size_bytes);
+}
+
+void operator delete(void* memory) noexcept { std::free(memory); }
+void operator delete[](void* memory) noexcept { std::free(memory); }
+void operator delete(void* memory, std::size_t) noexcept { std::free(memory); }
+void operator delete[](void* memory, std::size_t) noexcept { std::free(memory); }
+void operator delete(void* memory, const std::nothrow_t&) noexcept { std::free(memory); }
+void operator delete[](void* memory, const std::nothrow_t&) noexcept { std::free(memory); }
@@ -0,0 +1,13 @@
+// allocation_counter.h
+// Counts heap allocations (global operator new) made by threads that opted in.
+// The packet pipeline threads opt in so /status can show that the steady-state
+// receive -> convert -> write path performs no allocations at all.
+#pragma once
+
+#include <cstdint>
+
+// Count every subsequent operator new on the calling thread
+void mark_current_thread_as_packet_path();
+
+// Total allocations made so far by all opted-in threads
+uint64_t packet_path_heap_allocation_count();
@@ -0,0 +1,394 @@
+// archive_overview.cpp
+// Incremental overview pyramid of an archive (see archive_overview.h).
+#include "archive_overview.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "stream_archive.h"
+
+// completed bins buffered per level between flushes (level 0 fills ~47 a second at 48 kHz)
+static const size_t OVERVIEW_PENDING_RECORDS = 256;
+// one-sided spectrum power of a full-scale sine through the Hann window: 3 N^2 / 32
+static const double OVERVIEW_FULL_SCALE_SINE_POWER =
+    3.0 * (double)OVERVIEW_BASE_BIN_FRAMES * (double)OVERVIEW_BASE_BIN_FRAMES / 32.0;
+
+std::string overview_level_filename(size_t level) {
+    return "overview_" + std::to_string(level) + ".bin";
+}
+
+// ----------------- Bin spectrum -----------------
+
+// Hann window, bit reversal, twiddles and band edges of the level-0 FFT
+struct overview_fft_tables {
+    float window[OVERVIEW_BASE_BIN_FRAMES];
+    uint16_t bit_reversed[OVERVIEW_BASE_BIN_FRAMES];
+    float twiddle_cos[OVERVIEW_BASE_BIN_FRAMES / 2];
+    float twiddle_sin[OVERVIEW_BASE_BIN_FRAMES / 2];
+    uint16_t band_edges[OVERVIEW_BAND_COUNT + 1];
+
+    overview_fft_tables() {
+        const double pi = 3.14159265358979323846;
+        unsigned bits = 0;
+        while (((size_t)1 << bits) < OVERVIEW_BASE_BIN_FRAMES) ++bits;
+        for (size_t i = 0; i < OVERVIEW_BASE_BIN_FRAMES; ++i) {
+            window[i] = (float)(0.5 - 0.5 * std::cos(2.0 * pi * (double)i / (double)OVERVIEW_BASE_BIN_FRAMES));
+            unsigned reversed = 0;
+            for (unsigned bit = 0; bit < bits; ++bit) reversed |= (unsigned)((i >> bit) & 1u) << (bits - 1 - bit);
+            bit_reversed[i] = (uint16_t)reversed;
+        }
+        for (size_t k = 0; k < OVERVIEW_BASE_BIN_FRAMES / 2; ++k) {
+            twiddle_cos[k] = (float)std::cos(2.0 * pi * (double)k / (double)OVERVIEW_BASE_BIN_FRAMES);
+            twiddle_sin[k] = (float)-std::sin(2.0 * pi * (double)k / (double)OVERVIEW_BASE_BIN_FRAMES);
+        }
+        // geometric from FFT bin 1 to Nyquist, at least one bin per band
+        const double top_bin = (double)(OVERVIEW_BASE_BIN_FRAMES / 2);
+        band_edges[0] = 1;
+        for (size_t band = 1; band <= OVERVIEW_BAND_COUNT; ++band) {
+            long edge = std::lround(std::pow(top_bin, (double)band / (double)OVERVIEW_BAND_COUNT));
+            band_edges[band] = (uint16_t)std::max<long>(edge, band_edges[band - 1] + 1);
+        }
+        band_edges[OVERVIEW_BAND_COUNT] = (uint16_t)top_bin;
+    }
+};
+
+static const overview_fft_tables& fft_tables() {
+    static const overview_fft_tables tables;
+    return tables;
+}
+
+const uint16_t* overview_band_edge_bins() {
+    return fft_tables().band_edges;
+}
+
+// Power of bins 0 .. N/2-1 of the windowed bin (iterative radix-2, real input in the real parts)
+static void compute_bin_power_spectrum(const float* samples, float* power_out) {
+    const overview_fft_tables& tables = fft_tables();
+    float real[OVERVIEW_BASE_BIN_FRAMES];
+    float imag[OVERVIEW_BASE_BIN_FRAMES];
+    for (size_t i = 0; i < OVERVIEW_BASE_BIN_FRAMES; ++i) {
+        size_t j = tables.bit_reversed[i];
+        real[j] = samples[i] * tables.window[i];
+        imag[j] = 0.0f;
+    }
+    for (size_t span = 1; span < OVERVIEW_BASE_BIN_FRAMES; span <<= 1) {
+        size_t twiddle_stride = OVERVIEW_BASE_BIN_FRAMES / (2 * span);
+        for (size_t start = 0; start < OVERVIEW_BASE_BIN_FRAMES; start += 2 * span) {
+            for (size_t k = 0; k < span; ++k) {
+                float w_real = tables.twiddle_cos[k * twiddle_stride];
+                float w_imag = tables.twiddle_sin[k * twiddle_stride];
+                size_t a = start + k;
+                size_t b = a + span;
+                float t_real = real[b] * w_real - imag[b] * w_imag;
+                float t_imag = real[b] * w_imag + imag[b] * w_real;
+                real[b] = real[a] - t_real;
+                imag[b] = imag[a] - t_imag;
+                real[a] += t_real;
+                imag[a] += t_imag;
+            }
+        }
+    }
+    for (size_t k = 0; k < OVERVIEW_BASE_BIN_FRAMES / 2; ++k) power_out[k] = real[k] * real[k] + imag[k] * imag[k];
+}
+
+// ----------------- archive_overview_writer -----------------
+
+bool archive_overview_writer::open(const std::string& directory, uint32_t sample_rate, uint64_t end_index) {
+    close();
+    directory_ = directory;
+    sample_rate_ = sample_rate;
+    all_synced_ = true;
+    (void)fft_tables(); // build the shared tables here, not on the first bin
+
+    for (size_t level = 0; level < OVERVIEW_LEVEL_COUNT; ++level) {
+        std::string path = directory + "/" + overview_level_filename(level);
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            std::cerr << "[ARCHIVE] open " << path << " failed: " << strerror(errno) << "\n";
+            close();
+            return false;
+        }
+        level_fds_[level] = fd;
+
+        overview_file_header expected = {};
+        memcpy(expected.magic, OVERVIEW_FILE_MAGIC, sizeof(expected.magic));
+        expected.version = OVERVIEW_FILE_VERSION;
+        expected.record_bytes = sizeof(overview_bin_record);
+        expected.level = (uint32_t)level;
+        expected.band_count = OVERVIEW_BAND_COUNT;
+        expected.sample_rate = sample_rate;
+        expected.fft_frames = OVERVIEW_BASE_BIN_FRAMES;
+        expected.bin_frames = overview_bin_frames(level);
+        overview_file_header existing = {};
+        struct stat file_stat;
+        bool is_new = fstat(fd, &file_stat) != 0 || (size_t)file_stat.st_size < sizeof(existing);
+        if (is_new) {
+            if (pwrite(fd, &expected, sizeof(expected), 0) != (ssize_t)sizeof(expected)) {
+                std::cerr << "[ARCHIVE] could not write " << path << "\n";
+                close();
+                return false;
+            }
+        } else if (pread(fd, &existing, sizeof(existing), 0) != (ssize_t)sizeof(existing) ||
+                   memcmp(&existing, &expected, sizeof(existing)) != 0) {
+            std::cerr << "[ARCHIVE] " << path << " holds a different overview format, no overview for this archive\n";
+            close();
+            return false;
+        }
+
+        // continue the bin end_index falls in, on top of what an earlier session wrote
+        uint64_t bin_frames = overview_bin_frames(level);
+        start_bin(level, end_index / bin_frames);
+        if (!is_new && end_index % bin_frames != 0) {
+            level_accumulator& current = levels_[level];
+            off_t offset = (off_t)(OVERVIEW_FILE_HEADER_BYTES + current.bin * sizeof(overview_bin_record));
+            if (pread(fd, &current.base, sizeof(current.base), offset) == (ssize_t)sizeof(current.base)) {
+                current.has_base = current.base.coverage != 0;
+            }
+        }
+        pending_[level].count = 0;
+        pending_[level].records.assign(OVERVIEW_PENDING_RECORDS + 1, overview_bin_record()); // + the bin in progress
+    }
+    return true;
+}
+
+void archive_overview_writer::start_bin(size_t level, uint64_t bin) {
+    level_accumulator& accumulator = levels_[level];
+    accumulator = level_accumulator();
+    accumulator.bin = bin;
+    if (level == 0) memset(level0_samples_, 0, sizeof(level0_samples_));
+}
+
+void archive_overview_writer::add_frames(uint64_t archive_index, const uint8_t* packed24, size_t frame_count) {
+    if (!is_open()) return;
+    while (frame_count > 0) {
+        if (levels_[0].bin != archive_index / OVERVIEW_BASE_BIN_FRAMES) {
+            // close every bin that ends before this frame, bottom up
+            for (size_t level = 0; level < OVERVIEW_LEVEL_COUNT; ++level) {
+                uint64_t bin = archive_index / overview_bin_frames(level);
+                if (levels_[level].bin == bin) break;
+                finish_bin(level);
+                start_bin(level, bin);
+            }
+        }
+        level_accumulator& bin = levels_[0];
+        size_t offset_in_bin = (size_t)(archive_index % OVERVIEW_BASE_BIN_FRAMES);
+        size_t piece_frames = std::min(frame_count, OVERVIEW_BASE_BIN_FRAMES - offset_in_bin);
+        if (bin.covered_frames == 0) {
+            bin.min_sample = INT32_MAX;
+            bin.max_sample = INT32_MIN;
+        }
+        double sum_squares = 0.0;
+        for (size_t i = 0; i < piece_frames; ++i) {
+            const uint8_t* bytes = packed24 + i * 3;
+            int32_t sample = (int32_t)(((uint32_t)bytes[0] << 8) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 24)) >> 8;
+            bin.min_sample = std::min(bin.min_sample, sample);
+            bin.max_sample = std::max(bin.max_sample, sample);
+            float value = (float)sample * (1.0f / 8388608.0f);
+            sum_squares += (double)value * value;
+            level0_samples_[offset_in_bin + i] = value;
+        }
+        bin.sum_squares += sum_squares;
+        bin.covered_frames += piece_frames;
+        archive_index += piece_frames;
+        packed24 += piece_frames * 3;
+        frame_count -= piece_frames;
+    }
+}
+
+void archive_overview_writer::compute_level0_bands(level_accumulator& bin) {
+    if (bin.covered_frames == 0) return;
+    const overview_fft_tables& tables = fft_tables();
+    float power[OVERVIEW_BASE_BIN_FRAMES / 2];
+    compute_bin_power_spectrum(level0_samples_, power);
+    // the unrecorded part is zeros: scale back up to the power while recording
+    double coverage = (double)bin.covered_frames / (double)OVERVIEW_BASE_BIN_FRAMES;
+    for (size_t band = 0; band < OVERVIEW_BAND_COUNT; ++band) {
+        double band_power = 0.0;
+        for (size_t k = tables.band_edges[band]; k < tables.band_edges[band + 1]; ++k) band_power += power[k];
+        bin.band_energy[band] = band_power / (OVERVIEW_FULL_SCALE_SINE_POWER * coverage) * (double)bin.covered_frames;
+    }
+}
+
+void archive_overview_writer::finish_bin(size_t level) {
+    level_accumulator& bin = levels_[level];
+    // a bin with nothing new since open is on disk as it is
+    if (bin.bin == UINT64_MAX || bin.covered_frames == 0) return;
+    if (level == 0) compute_level0_bands(bin);
+
+    pending_records& pending = pending_[level];
+    if (pending.count > 0 && (pending.first_bin + pending.count != bin.bin || pending.count == OVERVIEW_PENDING_RECORDS)) {
+        write_pending(level, nullptr);
+    }
+    if (pending.count == 0) pending.first_bin = bin.bin;
+    pending.records[pending.count++] = make_record(level, bin);
+
+    // the parent gets only this session's audio; its own base covers the rest
+    if (level + 1 < OVERVIEW_LEVEL_COUNT && bin.covered_frames > 0) add_child(level + 1, bin);
+}
+
+void archive_overview_writer::add_child(size_t level, const level_accumulator& child) {
+    uint64_t parent_bin = child.bin / OVERVIEW_LEVEL_FANOUT;
+    if (levels_[level].bin != parent_bin) {
+        finish_bin(level);
+        start_bin(level, parent_bin);
+    }
+    merge_child(levels_[level], child);
+}
+
+void archive_overview_writer::merge_child(level_accumulator& parent, const level_accumulator& child) {
+    if (parent.covered_frames == 0) {
+        parent.min_sample = child.min_sample;
+        parent.max_sample = child.max_sample;
+    } else {
+        parent.min_sample = std::min(parent.min_sample, child.min_sample);
+        parent.max_sample = std::max(parent.max_sample, child.max_sample);
+    }
+    parent.sum_squares += child.sum_squares;
+    parent.covered_frames += child.covered_frames;
+    for (size_t band = 0; band < OVERVIEW_BAND_COUNT; ++band) parent.band_energy[band] += child.band_energy[band];
+}
+
+overview_bin_record archive_overview_writer::make_record(size_t level, const level_accumulator& bin) const {
+    const double bin_frames = (double)overview_bin_frames(level);
+    double covered_frames = (double)bin.covered_frames;
+    double sum_squares = bin.sum_squares;
+    double band_energy[OVERVIEW_BAND_COUNT];
+    std::copy(bin.band_energy, bin.band_energy + OVERVIEW_BAND_COUNT, band_energy);
+    int32_t min_sample = bin.min_sample;
+    int32_t max_sample = bin.max_sample;
+    if (bin.has_base) {
+        // the earlier session's share, recovered (to record precision) from its record
+        const overview_bin_record& base = bin.base;
+        double base_frames = (double)base.coverage / 255.0 * bin_frames;
+        double base_rms = (double)base.rms / 65535.0;
+        sum_squares += base_rms * base_rms * base_frames;
+        for (size_t band = 0; band < OVERVIEW_BAND_COUNT; ++band) {
+            if (base.band_level[band] != 0) {
+                band_energy[band] += std::pow(10.0, ((double)base.band_level[band] - 255.0) / 20.0) * base_frames;
+            }
+        }
+        int32_t base_min = (int32_t)base.min_sample * 256;
+        int32_t base_max = (int32_t)base.max_sample * 256 + 255;
+        min_sample = covered_frames > 0.0 ? std::min(min_sample, base_min) : base_min;
+        max_sample = covered_frames > 0.0 ? std::max(max_sample, base_max) : base_max;
+        covered_frames += base_frames;
+    }
+
+    overview_bin_record record = {};
+    if (covered_frames <= 0.0) return record;
+    record.min_sample = (int16_t)(min_sample >> 8);
+    record.max_sample = (int16_t)(max_sample >> 8);
+    double rms = std::sqrt(sum_squares / covered_frames);
+    record.rms = (uint16_t)std::min(65535.0, std::round(rms * 65535.0));
+    record.coverage = (uint8_t)std::max(1.0, std::min(255.0, std::round(covered_frames / bin_frames * 255.0)));
+    for (size_t band = 0; band < OVERVIEW_BAND_COUNT; ++band) {
+        double band_power = band_energy[band] / covered_frames;
+        double level_value = band_power > 0.0 ? 255.0 + 20.0 * std::log10(band_power) : 1.0;
+        record.band_level[band] = (uint8_t)std::max(1.0, std::min(255.0, std::round(level_value)));
+    }
+    return record;
+}
+
+bool archive_overview_writer::write_records(size_t level, uint64_t first_bin, const overview_bin_record* records, size_t count) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(records);
+    size_t byte_count = count * sizeof(overview_bin_record);
+    off_t file_offset = (off_t)(OVERVIEW_FILE_HEADER_BYTES + first_bin * sizeof(overview_bin_record));
+    stream_archive_statistics& statistics = stream_archive_stats();
+    while (byte_count > 0) {
+        ssize_t written = pwrite(level_fds_[level], bytes, byte_count, file_offset);
+        if (written < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+        if (written <= 0) {
+            statistics.write_errors.fetch_add(1, std::memory_order_relaxed);
+            std::cerr << "[ARCHIVE] overview write in " << directory_ << " failed: "
+                      << (written < 0 ? strerror(errno) : "no progress") << "\n";
+            return false;
+        }
+        statistics.write_syscalls.fetch_add(1, std::memory_order_relaxed);
+        statistics.bytes_written.fetch_add((uint64_t)written, std::memory_order_relaxed);
+        bytes += written;
+        byte_count -= (size_t)written;
+        file_offset += written;
+    }
+    all_synced_ = false;
+    return true;
+}
+
+// The pending run, and extra_record (the bin after it) in the same write when given
+bool archive_overview_writer::write_pending(size_t level, const overview_bin_record* extra_record) {
+    pending_records& pending = pending_[level];
+    size_t count = pending.count;
+    if (extra_record) pending.records[count++] = *extra_record;
+    pending.count = 0;
+    return count == 0 || write_records(level, pending.first_bin, pending.records.data(), count);
+}
+
+// The pending run and a bin that is not finished yet
+bool archive_overview_writer::write_unfinished(size_t level, const level_accumulator& bin) {
+    if (bin.bin == UINT64_MAX || bin.covered_frames == 0) return write_pending(level, nullptr);
+    overview_bin_record record = make_record(level, bin);
+    pending_records& pending = pending_[level];
+    if (pending.count > 0 && pending.first_bin + pending.count == bin.bin) return write_pending(level, &record);
+    bool ok = write_pending(level, nullptr);
+    return write_records(level, bin.bin, &record, 1) && ok;
+}
+
+bool archive_overview_writer::flush() {
+    if (!is_open()) return true;
+    bool ok = true;
+    // a level's bins only finish when the level below moves on, so each level's bin in
+    // progress is written with the ones below folded in (on copies; nothing is counted
+    // twice): every level reaches up to the last appended frame
+    level_accumulator child;
+    for (size_t level = 0; level < OVERVIEW_LEVEL_COUNT; ++level) {
+        level_accumulator current = levels_[level];
+        if (level == 0) {
+            if (current.covered_frames > 0) compute_level0_bands(current);
+        } else if (child.bin != UINT64_MAX && child.covered_frames > 0) {
+            uint64_t parent_bin = child.bin / OVERVIEW_LEVEL_FANOUT;
+            if (current.bin != parent_bin) {
+                // complete, but only finished once the next child arrives
+                ok = write_unfinished(level, current) && ok;
+                current = level_accumulator();
+                current.bin = parent_bin;
+            }
+            merge_child(current, child);
+        }
+        ok = write_unfinished(level, current) && ok;
+        child = current;
+    }
+    return ok;
+}
+
+void archive_overview_writer::sync_to_disk() {
+    if (!is_open() || all_synced_) return;
+    stream_archive_statistics& statistics = stream_archive_stats();
+    for (int fd : level_fds_) {
+        if (fd < 0) continue;
+        statistics.fdatasync_calls.fetch_add(1, std::memory_order_relaxed);
+        if (fdatasync(fd) != 0) perror("fdatasync");
+    }
+    all_synced_ = true;
+}
+
+void archive_overview_writer::close() {
+    if (is_open()) {
+        flush();
+        sync_to_disk();
+    }
+    for (int& fd : level_fds_) {
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+    }
+    for (size_t level = 0; level < OVERVIEW_LEVEL_COUNT; ++level) {
+        levels_[level] = level_accumulator();
+        pending_[level].count = 0;
+    }
+}
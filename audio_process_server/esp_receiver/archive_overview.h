@@ -0,0 +1,134 @@
+// archive_overview.h
+// Multi-resolution overview of an archive (stream_archive.h), for drawing hours of
+// waveform and spectrum without reading the audio.
+//
+// Level 0 has one bin per OVERVIEW_BASE_BIN_FRAMES frames of the archive timeline;
+// each level above combines OVERVIEW_LEVEL_FANOUT bins of the one below, so level k
+// bins are 1024 * 4^k frames (21 ms at level 0, 5.8 min at level 7 at 48 kHz). Bins
+// are aligned to multiples of their size on the archive index, like the chunks.
+//
+// A bin holds the min/max sample, the RMS, how much of it was recorded, and the
+// power in OVERVIEW_BAND_COUNT log-spaced bands (47 Hz .. Nyquist) from a Hann
+// windowed FFT over each level-0 bin, averaged over the bin's duration.
+//
+// Storage, next to the chunks: <root>/<device>/overview_<level>.bin, a header and
+// then the fixed-size record of bin i at OVERVIEW_FILE_HEADER_BYTES + i * record
+// size. A gap in the audio is a hole of zero records (coverage 0 = nothing recorded),
+// and a tile of OVERVIEW_TILE_BINS bins is one contiguous byte range of one file,
+// served as is.
+//
+// archive_overview_writer is fed by the archive writer with every run it appends
+// and writes completed bins, plus the bins still filling (rewritten in place), each
+// time the archive flushes. Bins that were partly written by an earlier session
+// (the device reconnected mid-bin) are merged with what is on disk. Records are
+// rewritten without a lock, so a reader racing a flush can see one torn record of
+// the newest bins; it is rewritten by the next flush.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+static constexpr size_t OVERVIEW_BASE_BIN_FRAMES = 1024;   // also the FFT size
+static constexpr size_t OVERVIEW_LEVEL_FANOUT = 4;
+static constexpr size_t OVERVIEW_LEVEL_COUNT = 8;
+static constexpr size_t OVERVIEW_BAND_COUNT = 16;
+static constexpr size_t OVERVIEW_TILE_BINS = 1024;
+static constexpr size_t OVERVIEW_FILE_HEADER_BYTES = 64;
+static constexpr char OVERVIEW_FILE_MAGIC[8] = {'E', 'S', 'P', 'O', 'V', 'W', '1', '\0'};
+static constexpr uint32_t OVERVIEW_FILE_VERSION = 1;
+
+struct overview_file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_bytes;
+    uint32_t level;
+    uint32_t band_count;
+    uint32_t sample_rate;
+    uint32_t fft_frames;
+    uint64_t bin_frames;
+    uint8_t reserved[24];
+};
+static_assert(sizeof(overview_file_header) == OVERVIEW_FILE_HEADER_BYTES, "overview header layout");
+
+// Little-endian on disk and on the wire (the tile endpoint sends records as stored)
+struct overview_bin_record {
+    int16_t min_sample;        // 24-bit samples >> 8
+    int16_t max_sample;
+    uint16_t rms;              // 65535 = full scale
+    uint8_t coverage;          // recorded share of the bin, 255 = all; 0 = nothing (a gap)
+    uint8_t reserved;
+    uint8_t band_level[OVERVIEW_BAND_COUNT]; // 255 + 2 * dB (0 dB = a full-scale sine), 0 = no data
+};
+static_assert(sizeof(overview_bin_record) == 24, "overview record layout");
+
+inline uint64_t overview_bin_frames(size_t level) {
+    uint64_t frames = OVERVIEW_BASE_BIN_FRAMES;
+    for (size_t i = 0; i < level; ++i) frames *= OVERVIEW_LEVEL_FANOUT;
+    return frames;
+}
+
+// "overview_<level>.bin"
+std::string overview_level_filename(size_t level);
+// Lower FFT bin of each band, plus the end of the last (OVERVIEW_BASE_BIN_FRAMES / 2)
+const uint16_t* overview_band_edge_bins();
+
+class archive_overview_writer {
+public:
+    archive_overview_writer() = default;
+    ~archive_overview_writer() { close(); }
+    archive_overview_writer(const archive_overview_writer&) = delete;
+    archive_overview_writer& operator=(const archive_overview_writer&) = delete;
+
+    // Open or create the level files of an archive directory (packed 24-bit mono).
+    // end_index is where the archive continues; a bin it falls inside is merged with
+    // its record on disk.
+    bool open(const std::string& directory, uint32_t sample_rate, uint64_t end_index);
+    bool is_open() const { return level_fds_[0] >= 0; }
+
+    // A contiguous run on the archive timeline; indices only move forward
+    void add_frames(uint64_t archive_index, const uint8_t* packed24, size_t frame_count);
+
+    // Write completed bins and the bins in progress
+    bool flush();
+    void sync_to_disk();
+    // Flush and close. Safe to call twice.
+    void close();
+
+private:
+    struct level_accumulator {
+        uint64_t bin = UINT64_MAX;  // bin number at this level
+        int32_t min_sample = 0;     // 24-bit
+        int32_t max_sample = 0;
+        double sum_squares = 0.0;   // of samples in [-1, 1)
+        uint64_t covered_frames = 0;
+        double band_energy[OVERVIEW_BAND_COUNT] = {}; // band power x covered frames
+        bool has_base = false;      // merge with base (written by an earlier session)
+        overview_bin_record base = {};
+    };
+
+    struct pending_records {          // completed bins not yet written, a contiguous run
+        uint64_t first_bin = 0;
+        size_t count = 0;
+        std::vector<overview_bin_record> records;
+    };
+
+    void start_bin(size_t level, uint64_t bin);
+    void finish_bin(size_t level);
+    void add_child(size_t level, const level_accumulator& child);
+    static void merge_child(level_accumulator& parent, const level_accumulator& child);
+    void compute_level0_bands(level_accumulator& bin);
+    overview_bin_record make_record(size_t level, const level_accumulator& bin) const;
+    bool write_pending(size_t level, const overview_bin_record* extra_record);
+    bool write_unfinished(size_t level, const level_accumulator& bin);
+    bool write_records(size_t level, uint64_t first_bin, const overview_bin_record* records, size_t count);
+
+    std::string directory_;
+    uint32_t sample_rate_ = 0;
+    int level_fds_[OVERVIEW_LEVEL_COUNT] = {-1, -1, -1, -1, -1, -1, -1, -1};
+    level_accumulator levels_[OVERVIEW_LEVEL_COUNT];
+    pending_records pending_[OVERVIEW_LEVEL_COUNT];
+    float level0_samples_[OVERVIEW_BASE_BIN_FRAMES] = {}; // the level-0 bin in progress, 0 where not recorded
+    bool all_synced_ = true;
+};
@@ -0,0 +1,262 @@
+// drift_resampler.cpp
+// Coefficient tables and SIMD dot-product kernels of the drift resampler (see drift_resampler.h).
+//
+// Phase p of the table is the filter for an output that sits p/RESAMPLER_PHASES of
+// a sample after history_[i + TAPS/2 - 1]; coefficient_delta holds phase p+1 minus
+// phase p, so the taps for a fractional phase mu are coefficients + mu * deltas.
+// Every phase is normalized to unity DC gain.
+#include "drift_resampler.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <mutex>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DRIFT_RESAMPLER_HAVE_X86_KERNELS 1
+#endif
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#define DRIFT_RESAMPLER_HAVE_NEON_KERNEL 1
+#endif
+
+// Kaiser beta for ~80 dB stop-band attenuation, and the -6 dB point in cycles per sample
+static const double RESAMPLER_KAISER_BETA = 8.0;
+static const double RESAMPLER_CUTOFF_CYCLES_PER_SAMPLE = 0.458; // 22 kHz at 48 kHz
+static const size_t RESAMPLER_TABLE_ALIGNMENT_BYTES = 64;
+
+using resampler_dot_kernel = float (*)(const float* coefficients, const float* deltas, float phase_fraction,
+                                       const float* samples);
+
+struct resampler_tables {
+    float* coefficients = nullptr;  // [RESAMPLER_PHASES][RESAMPLER_TAPS]
+    float* deltas = nullptr;        // [RESAMPLER_PHASES][RESAMPLER_TAPS]
+    resampler_dot_kernel dot_kernel = nullptr;
+    const char* kernel_name = "scalar";
+};
+
+static resampler_tables global_resampler_tables;
+static std::once_flag global_resampler_tables_once;
+
+// ----------------- Dot-product kernels -----------------
+
+static float resampler_dot_scalar(const float* coefficients, const float* deltas, float phase_fraction,
+                                  const float* samples) {
+    float accumulator = 0.0f;
+    for (size_t tap = 0; tap < RESAMPLER_TAPS; ++tap) {
+        accumulator += (coefficients[tap] + phase_fraction * deltas[tap]) * samples[tap];
+    }
+    return accumulator;
+}
+
+#if defined(DRIFT_RESAMPLER_HAVE_X86_KERNELS)
+
+static float resampler_dot_sse2(const float* coefficients, const float* deltas, float phase_fraction,
+                                const float* samples) {
+    const __m128 fraction = _mm_set1_ps(phase_fraction);
+    __m128 accumulator_a = _mm_setzero_ps();
+    __m128 accumulator_b = _mm_setzero_ps();
+    for (size_t tap = 0; tap < RESAMPLER_TAPS; tap += 8) {
+        __m128 taps_a = _mm_add_ps(_mm_load_ps(coefficients + tap), _mm_mul_ps(fraction, _mm_load_ps(deltas + tap)));
+        __m128 taps_b = _mm_add_ps(_mm_load_ps(coefficients + tap + 4), _mm_mul_ps(fraction, _mm_load_ps(deltas + tap + 4)));
+        accumulator_a = _mm_add_ps(accumulator_a, _mm_mul_ps(taps_a, _mm_loadu_ps(samples + tap)));
+        accumulator_b = _mm_add_ps(accumulator_b, _mm_mul_ps(taps_b, _mm_loadu_ps(samples + tap + 4)));
+    }
+    __m128 sum = _mm_add_ps(accumulator_a, accumulator_b);
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+}
+
+__attribute__((target("avx2,fma")))
+static float resampler_dot_avx2_fma(const float* coefficients, const float* deltas, float phase_fraction,
+                                    const float* samples) {
+    const __m256 fraction = _mm256_set1_ps(phase_fraction);
+    __m256 accumulator_a = _mm256_setzero_ps();
+    __m256 accumulator_b = _mm256_setzero_ps();
+    for (size_t tap = 0; tap < RESAMPLER_TAPS; tap += 16) {
+        __m256 taps_a = _mm256_fmadd_ps(fraction, _mm256_load_ps(deltas + tap), _mm256_load_ps(coefficients + tap));
+        __m256 taps_b = _mm256_fmadd_ps(fraction, _mm256_load_ps(deltas + tap + 8), _mm256_load_ps(coefficients + tap + 8));
+        accumulator_a = _mm256_fmadd_ps(taps_a, _mm256_loadu_ps(samples + tap), accumulator_a);
+        accumulator_b = _mm256_fmadd_ps(taps_b, _mm256_loadu_ps(samples + tap + 8), accumulator_b);
+    }
+    __m256 sum8 = _mm256_add_ps(accumulator_a, accumulator_b);
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(sum8), _mm256_extractf128_ps(sum8, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+}
+
+#endif // DRIFT_RESAMPLER_HAVE_X86_KERNELS
+
+#if defined(DRIFT_RESAMPLER_HAVE_NEON_KERNEL)
+
+static float resampler_dot_neon(const float* coefficients, const float* deltas, float phase_fraction,
+                                const float* samples) {
+    float32x4_t accumulator_a = vdupq_n_f32(0.0f);
+    float32x4_t accumulator_b = vdupq_n_f32(0.0f);
+    for (size_t tap = 0; tap < RESAMPLER_TAPS; tap += 8) {
+        float32x4_t taps_a = vfmaq_n_f32(vld1q_f32(coefficients + tap), vld1q_f32(deltas + tap), phase_fraction);
+        float32x4_t taps_b = vfmaq_n_f32(vld1q_f32(coefficients + tap + 4), vld1q_f32(deltas + tap + 4), phase_fraction);
+        accumulator_a = vfmaq_f32(accumulator_a, taps_a, vld1q_f32(samples + tap));
+        accumulator_b = vfmaq_f32(accumulator_b, taps_b, vld1q_f32(samples + tap + 4));
+    }
+    return vaddvq_f32(vaddq_f32(accumulator_a, accumulator_b));
+}
+
+#endif // DRIFT_RESAMPLER_HAVE_NEON_KERNEL
+
+// ----------------- Coefficient tables -----------------
+
+static double bessel_i0(double x) {
+    double sum = 1.0, term = 1.0;
+    for (int k = 1; k < 50; ++k) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+        if (term < sum * 1e-17) break;
+    }
+    return sum;
+}
+
+// Taps for an output phase_offset (0..1) of a sample after the centre-left tap
+static void compute_resampler_phase(double phase_offset, double* taps_out) {
+    const double half_span = (double)(RESAMPLER_TAPS / 2);
+    const double window_norm = bessel_i0(RESAMPLER_KAISER_BETA);
+    double tap_sum = 0.0;
+    for (size_t tap = 0; tap < RESAMPLER_TAPS; ++tap) {
+        double distance = (double)tap - (double)(RESAMPLER_TAPS / 2 - 1) - phase_offset;
+        double x = 2.0 * RESAMPLER_CUTOFF_CYCLES_PER_SAMPLE * distance;
+        double sinc = distance == 0.0 ? 1.0 : std::sin(M_PI * x) / (M_PI * x);
+        double window_position = distance / half_span;
+        double window = window_position * window_position >= 1.0
+                            ? 0.0
+                            : bessel_i0(RESAMPLER_KAISER_BETA * std::sqrt(1.0 - window_position * window_position)) / window_norm;
+        taps_out[tap] = sinc * window;
+        tap_sum += taps_out[tap];
+    }
+    for (size_t tap = 0; tap < RESAMPLER_TAPS; ++tap) taps_out[tap] /= tap_sum;
+}
+
+static void build_resampler_tables() {
+    size_t table_bytes = RESAMPLER_PHASES * RESAMPLER_TAPS * sizeof(float);
+    float* coefficients = static_cast<float*>(std::aligned_alloc(RESAMPLER_TABLE_ALIGNMENT_BYTES, table_bytes));
+    float* deltas = static_cast<float*>(std::aligned_alloc(RESAMPLER_TABLE_ALIGNMENT_BYTES, table_bytes));
+    if (!coefficients || !deltas) {
+        std::free(coefficients);
+        std::free(deltas);
+        return;
+    }
+    double phase_taps[RESAMPLER_TAPS];
+    double next_phase_taps[RESAMPLER_TAPS];
+    compute_resampler_phase(0.0, phase_taps);
+    for (size_t phase = 0; phase < RESAMPLER_PHASES; ++phase) {
+        compute_resampler_phase((double)(phase + 1) / RESAMPLER_PHASES, next_phase_taps);
+        for (size_t tap = 0; tap < RESAMPLER_TAPS; ++tap) {
+            coefficients[phase * RESAMPLER_TAPS + tap] = (float)phase_taps[tap];
+            deltas[phase * RESAMPLER_TAPS + tap] = (float)(next_phase_taps[tap] - phase_taps[tap]);
+            phase_taps[tap] = next_phase_taps[tap];
+        }
+    }
+
+    global_resampler_tables.dot_kernel = resampler_dot_scalar;
+    global_resampler_tables.kernel_name = "scalar";
+#if defined(DRIFT_RESAMPLER_HAVE_X86_KERNELS)
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        global_resampler_tables.dot_kernel = resampler_dot_avx2_fma;
+        global_resampler_tables.kernel_name = "avx2+fma";
+    } else {
+        global_resampler_tables.dot_kernel = resampler_dot_sse2;
+        global_resampler_tables.kernel_name = "sse2";
+    }
+#elif defined(DRIFT_RESAMPLER_HAVE_NEON_KERNEL)
+    global_resampler_tables.dot_kernel = resampler_dot_neon;
+    global_resampler_tables.kernel_name = "neon";
+#endif
+    global_resampler_tables.coefficients = coefficients;
+    global_resampler_tables.deltas = deltas;
+}
+
+const char* selected_resampler_kernel_name() {
+    return global_resampler_tables.kernel_name;
+}
+
+// ----------------- drift_resampler -----------------
+
+bool drift_resampler::initialize() {
+    std::call_once(global_resampler_tables_once, build_resampler_tables);
+    if (!global_resampler_tables.coefficients) return false;
+    if (is_initialized()) return true;
+    // after a block: < TAPS frames kept + one block, plus the silence finish() appends
+    history_.assign(RESAMPLER_TAPS + RESAMPLER_MAX_BLOCK_FRAMES + RESAMPLER_TAPS / 2, 0.0f);
+    output_capacity_frames_ = (size_t)std::ceil(RESAMPLER_MAX_BLOCK_FRAMES / (1.0 - RESAMPLER_MAX_STEP_DEVIATION)) + 2;
+    output_bytes_.assign(output_capacity_frames_ * 3, 0);
+    return true;
+}
+
+void drift_resampler::restart(uint64_t first_input_index, uint64_t first_output_index) {
+    // silence before the first input, so the first output can be centred on it
+    const size_t lead_in_frames = RESAMPLER_TAPS / 2 - 1;
+    std::fill(history_.begin(), history_.begin() + lead_in_frames, 0.0f);
+    history_frames_ = lead_in_frames;
+    history_start_index_ = first_input_index - lead_in_frames;
+    read_position_ = 0.0;
+    next_output_index_ = first_output_index;
+    started_ = true;
+}
+
+void drift_resampler::append_input(const uint8_t* packed24, size_t frame_count) {
+    float* destination = history_.data() + history_frames_;
+    for (size_t frame = 0; frame < frame_count; ++frame) {
+        const uint8_t* bytes = packed24 + frame * 3;
+        int32_t sample = (int32_t)(((uint32_t)bytes[0] << 8) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 24)) >> 8;
+        destination[frame] = (float)sample;
+    }
+    history_frames_ += frame_count;
+}
+
+size_t drift_resampler::produce_output(double input_step, double read_position_limit) {
+    if (input_step < 1.0 - RESAMPLER_MAX_STEP_DEVIATION) input_step = 1.0 - RESAMPLER_MAX_STEP_DEVIATION;
+    if (input_step > 1.0 + RESAMPLER_MAX_STEP_DEVIATION) input_step = 1.0 + RESAMPLER_MAX_STEP_DEVIATION;
+    const resampler_dot_kernel dot_kernel = global_resampler_tables.dot_kernel;
+    const float* coefficients = global_resampler_tables.coefficients;
+    const float* deltas = global_resampler_tables.deltas;
+
+    size_t output_frames = 0;
+    uint8_t* output = output_bytes_.data();
+    while (output_frames < output_capacity_frames_ && read_position_ < read_position_limit) {
+        size_t first_tap = (size_t)read_position_;
+        if (first_tap + RESAMPLER_TAPS > history_frames_) break;
+        double phase_position = (read_position_ - (double)first_tap) * (double)RESAMPLER_PHASES;
+        size_t phase = (size_t)phase_position;
+        float phase_fraction = (float)(phase_position - (double)phase);
+
+        float value = dot_kernel(coefficients + phase * RESAMPLER_TAPS, deltas + phase * RESAMPLER_TAPS, phase_fraction,
+                                 history_.data() + first_tap);
+        long rounded = std::lround(value);
+        if (rounded > 8388607) rounded = 8388607;
+        if (rounded < -8388608) rounded = -8388608;
+        uint32_t u24 = (uint32_t)rounded & 0xFFFFFFu;
+        output[0] = (uint8_t)(u24 & 0xFF);
+        output[1] = (uint8_t)((u24 >> 8) & 0xFF);
+        output[2] = (uint8_t)((u24 >> 16) & 0xFF);
+        output += 3;
+        ++output_frames;
+        read_position_ += input_step;
+    }
+    next_output_index_ += output_frames;
+    return output_frames;
+}
+
+void drift_resampler::discard_consumed_history() {
+    size_t consumed_frames = (size_t)read_position_;
+    if (consumed_frames > history_frames_) consumed_frames = history_frames_;
+    if (consumed_frames == 0) return;
+    memmove(history_.data(), history_.data() + consumed_frames, (history_frames_ - consumed_frames) * sizeof(float));
+    history_frames_ -= consumed_frames;
+    history_start_index_ += consumed_frames;
+    read_position_ -= (double)consumed_frames;
+}
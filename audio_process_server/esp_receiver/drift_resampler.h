@@ -0,0 +1,108 @@
+// drift_resampler.h
+// Streaming asynchronous resampler for clock-drift compensation.
+//
+// Every ESP derives its I2S clock from its own APLL, so two nodes that both claim
+// 48 kHz differ by a few ppm. The writer stage can run each stream through this
+// resampler to put it onto the host's 48 kHz timeline: the ratio is a step of
+// input samples per output sample, very close to 1.0, which the caller updates from
+// the device clock estimate (stream_timing.h) before every run.
+//
+// The filter is a polyphase Kaiser-windowed sinc of RESAMPLER_TAPS taps with
+// RESAMPLER_PHASES phases, linearly interpolated between neighbouring phases (a
+// first-order Farrow structure over the polyphase bank). Coefficients and their
+// per-phase deltas are precomputed once, so one output sample is a single
+// RESAMPLER_TAPS-long dot product, run by a SIMD kernel chosen at runtime
+// (AVX2+FMA > SSE2 > NEON > scalar).
+//
+// Input and output are packed 24-bit mono frames. All buffers are allocated by
+// initialize(), so processing never allocates.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+static constexpr size_t RESAMPLER_TAPS = 64;                // ~80 dB stop band, flat to ~20 kHz at 48 kHz
+static constexpr size_t RESAMPLER_PHASES = 256;             // phase interpolation error below -90 dB
+static constexpr size_t RESAMPLER_MAX_BLOCK_FRAMES = 1024;  // input frames per internal block
+static constexpr double RESAMPLER_MAX_STEP_DEVIATION = 0.01; // steps are clamped to 1 +- 1%
+
+class drift_resampler {
+public:
+    bool initialize();
+    bool is_initialized() const { return !history_.empty(); }
+
+    // Start a new timeline: the next input frame has index first_input_index, and the
+    // first output frame (index first_output_index) is taken exactly at that input
+    void restart(uint64_t first_input_index, uint64_t first_output_index);
+    bool started() const { return started_; }
+
+    // Resample frame_count packed 24-bit frames, which must continue at next_input_index().
+    // input_step is input samples per output sample. sink(first_output_index, bytes,
+    // frames) receives the output in contiguous runs.
+    template <typename output_sink>
+    void process(const uint8_t* packed24, size_t frame_count, double input_step, output_sink&& sink);
+
+    // End of the timeline: emit the outputs still held back by the filter delay
+    template <typename output_sink>
+    void finish(double input_step, output_sink&& sink);
+
+    // Index the next input frame must have
+    uint64_t next_input_index() const { return history_start_index_ + history_frames_; }
+    uint64_t next_output_index() const { return next_output_index_; }
+    // Input position (fractional sample index) the next output frame is taken at
+    double next_output_input_position() const {
+        return (double)history_start_index_ + read_position_ + (double)(RESAMPLER_TAPS / 2 - 1);
+    }
+
+private:
+    void append_input(const uint8_t* packed24, size_t frame_count);
+    // Compute outputs until the filter runs out of input or the read position reaches
+    // read_position_limit; returns the number of frames placed in output_bytes_
+    size_t produce_output(double input_step, double read_position_limit);
+    void discard_consumed_history();
+
+    // history_[0] holds input index history_start_index_. The next output is computed
+    // from history_[floor(read_position_)] onward, RESAMPLER_TAPS samples.
+    std::vector<float> history_;
+    size_t history_frames_ = 0;
+    uint64_t history_start_index_ = 0;
+    double read_position_ = 0.0;
+    bool started_ = false;
+
+    std::vector<uint8_t> output_bytes_;
+    size_t output_capacity_frames_ = 0;
+    uint64_t next_output_index_ = 0;
+};
+
+// Name of the dot-product kernel in use ("avx2+fma", "sse2", "neon", "scalar")
+const char* selected_resampler_kernel_name();
+
+template <typename output_sink>
+void drift_resampler::process(const uint8_t* packed24, size_t frame_count, double input_step, output_sink&& sink) {
+    while (frame_count > 0) {
+        size_t block_frames = frame_count < RESAMPLER_MAX_BLOCK_FRAMES ? frame_count : RESAMPLER_MAX_BLOCK_FRAMES;
+        append_input(packed24, block_frames);
+        packed24 += block_frames * 3;
+        frame_count -= block_frames;
+
+        uint64_t first_output_index = next_output_index_;
+        size_t output_frames = produce_output(input_step, (double)history_frames_);
+        if (output_frames > 0) sink(first_output_index, output_bytes_.data(), output_frames);
+        discard_consumed_history();
+    }
+}
+
+template <typename output_sink>
+void drift_resampler::finish(double input_step, output_sink&& sink) {
+    if (!started_) return;
+    // outputs up to the last real input; silence stands in for the samples after it
+    static const uint8_t silence[RESAMPLER_TAPS / 2 * 3] = {};
+    double read_position_limit = (double)history_frames_ - (double)(RESAMPLER_TAPS / 2 - 1);
+    append_input(silence, RESAMPLER_TAPS / 2);
+
+    uint64_t first_output_index = next_output_index_;
+    size_t output_frames = produce_output(input_step, read_position_limit);
+    if (output_frames > 0) sink(first_output_index, output_bytes_.data(), output_frames);
+    started_ = false;
+}
@@ -0,0 +1,620 @@
+// dsp_chain.cpp
+// Settings cell, coefficient preparation, per-stream processing and the SIMD block
+// kernels of the DSP chain (see dsp_chain.h).
+//
+// The biquad kernels run the transposed direct form II recurrence four samples at a
+// time: the block's outputs and the state after it are linear in the four inputs and
+// the state before it, so prepare_dsp_chain() tabulates that 6-column matrix once per
+// config (by running the scalar recurrence on unit inputs) and the kernels evaluate
+// it with broadcasts and multiply-adds. Only the two state values carry from block
+// to block, instead of every output depending on the one before it. Samples are float,
+// the filter arithmetic double.
+#include "dsp_chain.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DSP_CHAIN_HAVE_X86_KERNELS 1
+#endif
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#define DSP_CHAIN_HAVE_NEON_KERNELS 1
+#endif
+
+static constexpr float LEFT24_TO_FLOAT = 1.0f / 2147483648.0f;  // int32 full scale -> +-1.0
+static constexpr float FLOAT_TO_24BIT = 8388608.0f;
+static constexpr float GAIN_SETTLED_EPSILON = 1e-4f;            // a disabled stage this close to unity is done
+static const float DSP_GATE_ENVELOPE_RELEASE_MS = 50.0f;        // peak hold of the gate detector
+static const float DSP_GATE_HYSTERESIS = 0.5f;                  // closes 6 dB below the threshold
+static const float DSP_AGC_ENVELOPE_RELEASE_MS = 300.0f;        // peak hold of the AGC detector
+
+// ----------------- Settings cell -----------------
+
+void dsp_chain_settings_cell::store(const dsp_chain_config& config) {
+    uint64_t words[WORD_COUNT] = {};
+    memcpy(words, &config, sizeof(config));
+    std::lock_guard<std::mutex> lock(store_mutex_);
+    uint64_t sequence = sequence_.load(std::memory_order_relaxed);
+    sequence_.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t word_index = 0; word_index < WORD_COUNT; ++word_index) {
+        words_[word_index].store(words[word_index], std::memory_order_relaxed);
+    }
+    sequence_.store(sequence + 2, std::memory_order_release);
+}
+
+uint64_t dsp_chain_settings_cell::load(dsp_chain_config& out) const {
+    uint64_t words[WORD_COUNT];
+    while (true) {
+        uint64_t sequence_before = sequence_.load(std::memory_order_acquire);
+        if (sequence_before & 1u) continue; // a store is in progress
+        for (size_t word_index = 0; word_index < WORD_COUNT; ++word_index) {
+            words[word_index] = words_[word_index].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (sequence_.load(std::memory_order_relaxed) == sequence_before) {
+            memcpy(&out, words, sizeof(out));
+            return sequence_before;
+        }
+    }
+}
+
+dsp_chain_config sanitize_dsp_chain_config(const dsp_chain_config& config) {
+    auto clamp = [](float value, float low, float high) {
+        return std::isfinite(value) ? std::min(std::max(value, low), high) : low;
+    };
+    dsp_chain_config out = config;
+    out.highpass_cutoff_hz = clamp(config.highpass_cutoff_hz, 10.0f, 1000.0f);
+    out.highpass_q = clamp(config.highpass_q, 0.3f, 4.0f);
+    out.gate_threshold_dbfs = clamp(config.gate_threshold_dbfs, -120.0f, 0.0f);
+    out.gate_range_db = clamp(config.gate_range_db, 0.0f, 90.0f);
+    out.gate_attack_ms = clamp(config.gate_attack_ms, 0.1f, 1000.0f);
+    out.gate_release_ms = clamp(config.gate_release_ms, 1.0f, 5000.0f);
+    out.agc_target_dbfs = clamp(config.agc_target_dbfs, -60.0f, 0.0f);
+    out.agc_max_gain_db = clamp(config.agc_max_gain_db, 0.0f, 40.0f);
+    out.agc_attack_ms = clamp(config.agc_attack_ms, 0.1f, 5000.0f);
+    out.agc_release_ms = clamp(config.agc_release_ms, 1.0f, 30000.0f);
+    out.limiter_ceiling_dbfs = clamp(config.limiter_ceiling_dbfs, -30.0f, 0.0f);
+    out.limiter_release_ms = clamp(config.limiter_release_ms, 1.0f, 5000.0f);
+    return out;
+}
+
+// ----------------- Coefficients -----------------
+
+static float db_to_linear(float db) {
+    return std::pow(10.0f, db / 20.0f);
+}
+
+// One-pole step per control block for a time constant
+static float control_block_coefficient(float time_constant_ms, uint32_t sample_rate) {
+    double block_ms = 1000.0 * (double)DSP_CONTROL_BLOCK_FRAMES / (double)sample_rate;
+    return (float)(1.0 - std::exp(-block_ms / (double)time_constant_ms));
+}
+
+void prepare_dsp_chain(const dsp_chain_config& config_in, uint32_t sample_rate, dsp_chain_coefficients& out) {
+    const dsp_chain_config config = sanitize_dsp_chain_config(config_in);
+    out = dsp_chain_coefficients{};
+    out.highpass_enabled = config.highpass_enabled;
+    out.gate_enabled = config.gate_enabled;
+    out.agc_enabled = config.agc_enabled;
+    out.limiter_enabled = config.limiter_enabled;
+
+    // RBJ cookbook high-pass, normalized by a0
+    double cutoff_hz = std::min((double)config.highpass_cutoff_hz, 0.45 * (double)sample_rate);
+    double w0 = 2.0 * M_PI * cutoff_hz / (double)sample_rate;
+    double alpha = std::sin(w0) / (2.0 * (double)config.highpass_q);
+    double cos_w0 = std::cos(w0);
+    double a0 = 1.0 + alpha;
+    double b0 = (1.0 + cos_w0) / 2.0 / a0, b1 = -(1.0 + cos_w0) / a0, b2 = b0;
+    double a1 = -2.0 * cos_w0 / a0, a2 = (1.0 - alpha) / a0;
+    out.b0 = b0;
+    out.b1 = b1;
+    out.b2 = b2;
+    out.a1 = a1;
+    out.a2 = a2;
+    // block matrix: response of 4 steps to each unit input / unit state
+    for (int column = 0; column < 6; ++column) {
+        double x[4] = {0.0, 0.0, 0.0, 0.0};
+        double z1 = column == 4 ? 1.0 : 0.0, z2 = column == 5 ? 1.0 : 0.0;
+        if (column < 4) x[column] = 1.0;
+        for (int n = 0; n < 4; ++n) {
+            double y = b0 * x[n] + z1;
+            double next_z1 = b1 * x[n] - a1 * y + z2;
+            z2 = b2 * x[n] - a2 * y;
+            z1 = next_z1;
+            out.block_columns[column][n] = y;
+        }
+        out.block_columns[column][4] = z1;
+        out.block_columns[column][5] = z2;
+    }
+
+    out.gate_threshold = db_to_linear(config.gate_threshold_dbfs);
+    out.gate_envelope_decay = 1.0f - control_block_coefficient(DSP_GATE_ENVELOPE_RELEASE_MS, sample_rate);
+    out.gate_closed_gain = db_to_linear(-config.gate_range_db);
+    out.gate_attack_coefficient = control_block_coefficient(config.gate_attack_ms, sample_rate);
+    out.gate_release_coefficient = control_block_coefficient(config.gate_release_ms, sample_rate);
+
+    out.agc_target = db_to_linear(config.agc_target_dbfs);
+    out.agc_envelope_decay = 1.0f - control_block_coefficient(DSP_AGC_ENVELOPE_RELEASE_MS, sample_rate);
+    out.agc_max_gain = db_to_linear(config.agc_max_gain_db);
+    out.agc_attack_coefficient = control_block_coefficient(config.agc_attack_ms, sample_rate);
+    out.agc_release_coefficient = control_block_coefficient(config.agc_release_ms, sample_rate);
+
+    out.limiter_ceiling = db_to_linear(config.limiter_ceiling_dbfs);
+    out.limiter_release_coefficient = control_block_coefficient(config.limiter_release_ms, sample_rate);
+}
+
+// ----------------- Block kernels -----------------
+
+struct dsp_block_kernels {
+    void (*left24_to_float)(const uint8_t* input_left24, float* out, size_t count);
+    void (*float_to_left24)(const float* samples, int32_t* out_left24, size_t count);
+    void (*biquad)(float* samples, size_t count, const dsp_chain_coefficients& coefficients, double state[2]);
+    float (*peak_abs)(const float* samples, size_t count);
+    void (*gain_ramp)(float* samples, size_t count, float start_gain, float gain_step);
+    const char* name;
+};
+
+// Scalar reference
+
+static void left24_to_float_scalar(const uint8_t* input_left24, float* out, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        int32_t word;
+        memcpy(&word, input_left24 + i * 4, 4);
+        out[i] = (float)word * LEFT24_TO_FLOAT;
+    }
+}
+
+static void float_to_left24_scalar(const float* samples, int32_t* out_left24, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        float scaled = std::min(std::max(samples[i] * FLOAT_TO_24BIT, -8388608.0f), 8388607.0f);
+        out_left24[i] = (int32_t)((uint32_t)(int32_t)std::nearbyint(scaled) << 8);
+    }
+}
+
+static void biquad_tail(float* samples, size_t count, const dsp_chain_coefficients& c, double state[2]) {
+    double z1 = state[0], z2 = state[1];
+    for (size_t i = 0; i < count; ++i) {
+        double x = samples[i];
+        double y = c.b0 * x + z1;
+        z1 = c.b1 * x - c.a1 * y + z2;
+        z2 = c.b2 * x - c.a2 * y;
+        samples[i] = (float)y;
+    }
+    state[0] = z1;
+    state[1] = z2;
+}
+
+static void biquad_scalar(float* samples, size_t count, const dsp_chain_coefficients& coefficients, double state[2]) {
+    biquad_tail(samples, count, coefficients, state);
+}
+
+static float peak_abs_scalar(const float* samples, size_t count) {
+    float peak = 0.0f;
+    for (size_t i = 0; i < count; ++i) peak = std::max(peak, std::fabs(samples[i]));
+    return peak;
+}
+
+static void gain_ramp_scalar(float* samples, size_t count, float start_gain, float gain_step) {
+    for (size_t i = 0; i < count; ++i) samples[i] *= start_gain + gain_step * (float)(i + 1);
+}
+
+#if defined(DSP_CHAIN_HAVE_X86_KERNELS)
+
+// SSE2 (every x86-64 CPU)
+
+static void left24_to_float_sse2(const uint8_t* input_left24, float* out, size_t count) {
+    const __m128 scale = _mm_set1_ps(LEFT24_TO_FLOAT);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i words = _mm_loadu_si128((const __m128i*)(input_left24 + i * 4));
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(words), scale));
+    }
+    left24_to_float_scalar(input_left24 + i * 4, out + i, count - i);
+}
+
+static void float_to_left24_sse2(const float* samples, int32_t* out_left24, size_t count) {
+    const __m128 scale = _mm_set1_ps(FLOAT_TO_24BIT);
+    const __m128 low = _mm_set1_ps(-8388608.0f), high = _mm_set1_ps(8388607.0f);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 scaled = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(samples + i), scale), low), high);
+        _mm_storeu_si128((__m128i*)(out_left24 + i), _mm_slli_epi32(_mm_cvtps_epi32(scaled), 8));
+    }
+    float_to_left24_scalar(samples + i, out_left24 + i, count - i);
+}
+
+static void biquad_sse2(float* samples, size_t count, const dsp_chain_coefficients& c, double state[2]) {
+    // two double lanes per vector: outputs 0-1, outputs 2-3, next state
+    __m128d output01_columns[6], output23_columns[6], state_columns[6];
+    for (int column = 0; column < 6; ++column) {
+        output01_columns[column] = _mm_load_pd(c.block_columns[column]);
+        output23_columns[column] = _mm_load_pd(c.block_columns[column] + 2);
+        state_columns[column] = _mm_load_pd(c.block_columns[column] + 4);
+    }
+    __m128d z1 = _mm_set1_pd(state[0]), z2 = _mm_set1_pd(state[1]);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128d y01 = _mm_mul_pd(z1, output01_columns[4]);
+        __m128d y23 = _mm_mul_pd(z1, output23_columns[4]);
+        __m128d s = _mm_mul_pd(z1, state_columns[4]);
+        y01 = _mm_add_pd(y01, _mm_mul_pd(z2, output01_columns[5]));
+        y23 = _mm_add_pd(y23, _mm_mul_pd(z2, output23_columns[5]));
+        s = _mm_add_pd(s, _mm_mul_pd(z2, state_columns[5]));
+        for (int k = 0; k < 4; ++k) {
+            __m128d x = _mm_set1_pd((double)samples[i + k]);
+            y01 = _mm_add_pd(y01, _mm_mul_pd(x, output01_columns[k]));
+            y23 = _mm_add_pd(y23, _mm_mul_pd(x, output23_columns[k]));
+            s = _mm_add_pd(s, _mm_mul_pd(x, state_columns[k]));
+        }
+        _mm_storeu_ps(samples + i, _mm_movelh_ps(_mm_cvtpd_ps(y01), _mm_cvtpd_ps(y23)));
+        z1 = _mm_unpacklo_pd(s, s);
+        z2 = _mm_unpackhi_pd(s, s);
+    }
+    state[0] = _mm_cvtsd_f64(z1);
+    state[1] = _mm_cvtsd_f64(z2);
+    biquad_tail(samples + i, count - i, c, state);
+}
+
+static float peak_abs_sse2(const float* samples, size_t count) {
+    const __m128 magnitude_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+    __m128 peak4 = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) peak4 = _mm_max_ps(peak4, _mm_and_ps(_mm_loadu_ps(samples + i), magnitude_mask));
+    peak4 = _mm_max_ps(peak4, _mm_movehl_ps(peak4, peak4));
+    peak4 = _mm_max_ss(peak4, _mm_shuffle_ps(peak4, peak4, 1));
+    return std::max(_mm_cvtss_f32(peak4), peak_abs_scalar(samples + i, count - i));
+}
+
+static void gain_ramp_sse2(float* samples, size_t count, float start_gain, float gain_step) {
+    const __m128 step4 = _mm_set1_ps(4.0f * gain_step);
+    __m128 gain = _mm_add_ps(_mm_set1_ps(start_gain), _mm_mul_ps(_mm_set1_ps(gain_step), _mm_setr_ps(1.0f, 2.0f, 3.0f, 4.0f)));
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_ps(samples + i, _mm_mul_ps(_mm_loadu_ps(samples + i), gain));
+        gain = _mm_add_ps(gain, step4);
+    }
+    gain_ramp_scalar(samples + i, count - i, start_gain + gain_step * (float)i, gain_step);
+}
+
+// AVX2 + FMA
+
+__attribute__((target("avx2,fma")))
+static void left24_to_float_avx2(const uint8_t* input_left24, float* out, size_t count) {
+    const __m256 scale = _mm256_set1_ps(LEFT24_TO_FLOAT);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i words = _mm256_loadu_si256((const __m256i*)(input_left24 + i * 4));
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(words), scale));
+    }
+    left24_to_float_scalar(input_left24 + i * 4, out + i, count - i);
+}
+
+__attribute__((target("avx2,fma")))
+static void float_to_left24_avx2(const float* samples, int32_t* out_left24, size_t count) {
+    const __m256 scale = _mm256_set1_ps(FLOAT_TO_24BIT);
+    const __m256 low = _mm256_set1_ps(-8388608.0f), high = _mm256_set1_ps(8388607.0f);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 scaled = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(samples + i), scale), low), high);
+        _mm256_storeu_si256((__m256i*)(out_left24 + i), _mm256_slli_epi32(_mm256_cvtps_epi32(scaled), 8));
+    }
+    float_to_left24_scalar(samples + i, out_left24 + i, count - i);
+}
+
+__attribute__((target("avx2,fma")))
+static void biquad_avx2_fma(float* samples, size_t count, const dsp_chain_coefficients& c, double state[2]) {
+    __m256d output_columns[6];
+    __m128d state_columns[6];
+    for (int column = 0; column < 6; ++column) {
+        output_columns[column] = _mm256_load_pd(c.block_columns[column]);
+        state_columns[column] = _mm_load_pd(c.block_columns[column] + 4);
+    }
+    __m128d z1 = _mm_set1_pd(state[0]), z2 = _mm_set1_pd(state[1]);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        // the input terms do not depend on the state: only the last two FMAs are on the recurrence
+        __m256d x = _mm256_cvtps_pd(_mm_loadu_ps(samples + i));
+        __m256d x0 = _mm256_permute4x64_pd(x, 0x00), x1 = _mm256_permute4x64_pd(x, 0x55);
+        __m256d x2 = _mm256_permute4x64_pd(x, 0xAA), x3 = _mm256_permute4x64_pd(x, 0xFF);
+        __m256d y = _mm256_fmadd_pd(x1, output_columns[1], _mm256_mul_pd(x0, output_columns[0]));
+        __m256d y_odd = _mm256_fmadd_pd(x3, output_columns[3], _mm256_mul_pd(x2, output_columns[2]));
+        __m128d s = _mm_fmadd_pd(_mm256_castpd256_pd128(x1), state_columns[1],
+                                 _mm_mul_pd(_mm256_castpd256_pd128(x0), state_columns[0]));
+        __m128d s_odd = _mm_fmadd_pd(_mm256_castpd256_pd128(x3), state_columns[3],
+                                     _mm_mul_pd(_mm256_castpd256_pd128(x2), state_columns[2]));
+        y = _mm256_add_pd(y, y_odd);
+        s = _mm_add_pd(s, s_odd);
+        __m256d z1_wide = _mm256_broadcastsd_pd(z1), z2_wide = _mm256_broadcastsd_pd(z2);
+        y = _mm256_fmadd_pd(z2_wide, output_columns[5], _mm256_fmadd_pd(z1_wide, output_columns[4], y));
+        s = _mm_fmadd_pd(z2, state_columns[5], _mm_fmadd_pd(z1, state_columns[4], s));
+        _mm_storeu_ps(samples + i, _mm256_cvtpd_ps(y));
+        z1 = _mm_unpacklo_pd(s, s);
+        z2 = _mm_unpackhi_pd(s, s);
+    }
+    state[0] = _mm_cvtsd_f64(z1);
+    state[1] = _mm_cvtsd_f64(z2);
+    biquad_tail(samples + i, count - i, c, state);
+}
+
+__attribute__((target("avx2,fma")))
+static float peak_abs_avx2(const float* samples, size_t count) {
+    const __m256 magnitude_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+    __m256 peak8 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) peak8 = _mm256_max_ps(peak8, _mm256_and_ps(_mm256_loadu_ps(samples + i), magnitude_mask));
+    __m128 peak4 = _mm_max_ps(_mm256_castps256_ps128(peak8), _mm256_extractf128_ps(peak8, 1));
+    peak4 = _mm_max_ps(peak4, _mm_movehl_ps(peak4, peak4));
+    peak4 = _mm_max_ss(peak4, _mm_shuffle_ps(peak4, peak4, 1));
+    return std::max(_mm_cvtss_f32(peak4), peak_abs_scalar(samples + i, count - i));
+}
+
+__attribute__((target("avx2,fma")))
+static void gain_ramp_avx2(float* samples, size_t count, float start_gain, float gain_step) {
+    const __m256 step8 = _mm256_set1_ps(8.0f * gain_step);
+    __m256 gain = _mm256_fmadd_ps(_mm256_set1_ps(gain_step), _mm256_setr_ps(1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f, 8.0f),
+                                  _mm256_set1_ps(start_gain));
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        _mm256_storeu_ps(samples + i, _mm256_mul_ps(_mm256_loadu_ps(samples + i), gain));
+        gain = _mm256_add_ps(gain, step8);
+    }
+    gain_ramp_scalar(samples + i, count - i, start_gain + gain_step * (float)i, gain_step);
+}
+
+#endif // DSP_CHAIN_HAVE_X86_KERNELS
+
+#if defined(DSP_CHAIN_HAVE_NEON_KERNELS)
+
+static void left24_to_float_neon(const uint8_t* input_left24, float* out, size_t count) {
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        int32x4_t words = vreinterpretq_s32_u8(vld1q_u8(input_left24 + i * 4));
+        vst1q_f32(out + i, vmulq_n_f32(vcvtq_f32_s32(words), LEFT24_TO_FLOAT));
+    }
+    left24_to_float_scalar(input_left24 + i * 4, out + i, count - i);
+}
+
+static void float_to_left24_neon(const float* samples, int32_t* out_left24, size_t count) {
+    const float32x4_t low = vdupq_n_f32(-8388608.0f), high = vdupq_n_f32(8388607.0f);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        float32x4_t scaled = vminq_f32(vmaxq_f32(vmulq_n_f32(vld1q_f32(samples + i), FLOAT_TO_24BIT), low), high);
+        vst1q_s32(out_left24 + i, vshlq_n_s32(vcvtnq_s32_f32(scaled), 8));
+    }
+    float_to_left24_scalar(samples + i, out_left24 + i, count - i);
+}
+
+static void biquad_neon(float* samples, size_t count, const dsp_chain_coefficients& c, double state[2]) {
+    float64x2_t output01_columns[6], output23_columns[6], state_columns[6];
+    for (int column = 0; column < 6; ++column) {
+        output01_columns[column] = vld1q_f64(c.block_columns[column]);
+        output23_columns[column] = vld1q_f64(c.block_columns[column] + 2);
+        state_columns[column] = vld1q_f64(c.block_columns[column] + 4);
+    }
+    float64x2_t z = vld1q_f64(state); // lanes 0, 1 = z1, z2
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        float32x4_t x_float = vld1q_f32(samples + i);
+        float64x2_t x01 = vcvt_f64_f32(vget_low_f32(x_float)), x23 = vcvt_high_f64_f32(x_float);
+        float64x2_t y01 = vmulq_laneq_f64(output01_columns[4], z, 0);
+        float64x2_t y23 = vmulq_laneq_f64(output23_columns[4], z, 0);
+        float64x2_t s = vmulq_laneq_f64(state_columns[4], z, 0);
+        y01 = vfmaq_laneq_f64(y01, output01_columns[5], z, 1);
+        y23 = vfmaq_laneq_f64(y23, output23_columns[5], z, 1);
+        s = vfmaq_laneq_f64(s, state_columns[5], z, 1);
+        y01 = vfmaq_laneq_f64(vfmaq_laneq_f64(y01, output01_columns[0], x01, 0), output01_columns[1], x01, 1);
+        y23 = vfmaq_laneq_f64(vfmaq_laneq_f64(y23, output23_columns[0], x01, 0), output23_columns[1], x01, 1);
+        s = vfmaq_laneq_f64(vfmaq_laneq_f64(s, state_columns[0], x01, 0), state_columns[1], x01, 1);
+        y01 = vfmaq_laneq_f64(vfmaq_laneq_f64(y01, output01_columns[2], x23, 0), output01_columns[3], x23, 1);
+        y23 = vfmaq_laneq_f64(vfmaq_laneq_f64(y23, output23_columns[2], x23, 0), output23_columns[3], x23, 1);
+        z = vfmaq_laneq_f64(vfmaq_laneq_f64(s, state_columns[2], x23, 0), state_columns[3], x23, 1);
+        vst1q_f32(samples + i, vcombine_f32(vcvt_f32_f64(y01), vcvt_f32_f64(y23)));
+    }
+    vst1q_f64(state, z);
+    biquad_tail(samples + i, count - i, c, state);
+}
+
+static float peak_abs_neon(const float* samples, size_t count) {
+    float32x4_t peak4 = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) peak4 = vmaxq_f32(peak4, vabsq_f32(vld1q_f32(samples + i)));
+    return std::max(vmaxvq_f32(peak4), peak_abs_scalar(samples + i, count - i));
+}
+
+static void gain_ramp_neon(float* samples, size_t count, float start_gain, float gain_step) {
+    static const float ramp_steps[4] = {1.0f, 2.0f, 3.0f, 4.0f};
+    float32x4_t gain = vfmaq_n_f32(vdupq_n_f32(start_gain), vld1q_f32(ramp_steps), gain_step);
+    const float32x4_t step4 = vdupq_n_f32(4.0f * gain_step);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        vst1q_f32(samples + i, vmulq_f32(vld1q_f32(samples + i), gain));
+        gain = vaddq_f32(gain, step4);
+    }
+    gain_ramp_scalar(samples + i, count - i, start_gain + gain_step * (float)i, gain_step);
+}
+
+#endif // DSP_CHAIN_HAVE_NEON_KERNELS
+
+// ----------------- Self check + runtime dispatch -----------------
+
+static const dsp_block_kernels DSP_SCALAR_KERNELS = {left24_to_float_scalar, float_to_left24_scalar, biquad_scalar,
+                                                     peak_abs_scalar, gain_ramp_scalar, "scalar"};
+
+// Run one kernel set against the scalar reference on a noisy tone with an odd length
+// (tails included); float results must agree to rounding, conversions to 1 LSB
+static bool run_dsp_kernel_self_check(const dsp_block_kernels& kernels) {
+    const size_t count = 1027;
+    std::mt19937 rng(7);
+    std::vector<uint8_t> input(count * 4);
+    for (size_t i = 0; i < count; ++i) {
+        double value = 0.5 * std::sin(0.01 * (double)i) + 0.1 * ((double)(rng() % 2001) / 1000.0 - 1.0);
+        int32_t word = (int32_t)((uint32_t)(int32_t)std::lround(value * 8388607.0) << 8);
+        memcpy(&input[i * 4], &word, 4);
+    }
+    dsp_chain_config config;
+    config.highpass_enabled = true;
+    config.highpass_cutoff_hz = 120.0f;
+    dsp_chain_coefficients coefficients;
+    prepare_dsp_chain(config, 48000, coefficients);
+
+    std::vector<float> reference(count), candidate(count);
+    DSP_SCALAR_KERNELS.left24_to_float(input.data(), reference.data(), count);
+    kernels.left24_to_float(input.data(), candidate.data(), count);
+    if (reference != candidate) return false;
+
+    double reference_state[2] = {0.01, -0.02}, candidate_state[2] = {0.01, -0.02};
+    DSP_SCALAR_KERNELS.biquad(reference.data(), count, coefficients, reference_state);
+    kernels.biquad(candidate.data(), count, coefficients, candidate_state);
+    for (size_t i = 0; i < count; ++i) {
+        if (std::fabs(reference[i] - candidate[i]) > 1e-6f) return false;
+    }
+    if (std::fabs(DSP_SCALAR_KERNELS.peak_abs(reference.data(), count) - kernels.peak_abs(reference.data(), count)) != 0.0f) return false;
+
+    candidate = reference;
+    DSP_SCALAR_KERNELS.gain_ramp(reference.data(), count, 1.5f, -0.001f);
+    kernels.gain_ramp(candidate.data(), count, 1.5f, -0.001f);
+    for (size_t i = 0; i < count; ++i) {
+        if (std::fabs(reference[i] - candidate[i]) > 1e-5f) return false;
+    }
+
+    std::vector<int32_t> reference_words(count), candidate_words(count);
+    DSP_SCALAR_KERNELS.float_to_left24(reference.data(), reference_words.data(), count);
+    kernels.float_to_left24(reference.data(), candidate_words.data(), count);
+    for (size_t i = 0; i < count; ++i) {
+        if (std::abs((reference_words[i] >> 8) - (candidate_words[i] >> 8)) > 1) return false;
+    }
+    return true;
+}
+
+static dsp_block_kernels detect_dsp_block_kernels() {
+    std::vector<dsp_block_kernels> candidates;
+#if defined(DSP_CHAIN_HAVE_X86_KERNELS)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        candidates.push_back({left24_to_float_avx2, float_to_left24_avx2, biquad_avx2_fma, peak_abs_avx2, gain_ramp_avx2, "avx2+fma"});
+    }
+    candidates.push_back({left24_to_float_sse2, float_to_left24_sse2, biquad_sse2, peak_abs_sse2, gain_ramp_sse2, "sse2"});
+#endif
+#if defined(DSP_CHAIN_HAVE_NEON_KERNELS)
+    candidates.push_back({left24_to_float_neon, float_to_left24_neon, biquad_neon, peak_abs_neon, gain_ramp_neon, "neon"});
+#endif
+    for (const dsp_block_kernels& candidate : candidates) {
+        if (run_dsp_kernel_self_check(candidate)) return candidate;
+        std::cerr << "[DSP] " << candidate.name << " chain kernels failed self check, skipping\n";
+    }
+    return DSP_SCALAR_KERNELS;
+}
+
+static const dsp_block_kernels& selected_kernels() {
+    static const dsp_block_kernels selected = detect_dsp_block_kernels();
+    return selected;
+}
+
+const char* selected_dsp_chain_kernel_name() {
+    return selected_kernels().name;
+}
+
+// ----------------- Per-stream processing -----------------
+
+static bool gain_settled(float gain) {
+    return std::fabs(gain - 1.0f) < GAIN_SETTLED_EPSILON;
+}
+
+bool stream_dsp_chain::is_bypassed(const dsp_chain_coefficients& c) const {
+    return !c.highpass_enabled && highpass_mix_ == 0.0f && !c.gate_enabled && !c.agc_enabled && !c.limiter_enabled &&
+           gain_settled(gate_gain_) && gain_settled(agc_gain_) && gain_settled(limiter_gain_);
+}
+
+void stream_dsp_chain::process(const uint8_t* input_left24, int32_t* output_left24, size_t frame_count,
+                               const dsp_chain_coefficients& coefficients, float makeup_gain, float* work) {
+    const dsp_block_kernels& kernels = selected_kernels();
+    float* samples = work;
+    kernels.left24_to_float(input_left24, samples, frame_count);
+    if (coefficients.highpass_enabled || highpass_mix_ != 0.0f) {
+        process_highpass(samples, work + frame_count, frame_count, coefficients);
+    }
+    process_dynamics(samples, frame_count, coefficients, makeup_gain);
+    kernels.float_to_left24(samples, output_left24, frame_count);
+}
+
+void stream_dsp_chain::process_highpass(float* samples, float* dry, size_t frame_count, const dsp_chain_coefficients& c) {
+    const dsp_block_kernels& kernels = selected_kernels();
+    float target_mix = c.highpass_enabled ? 1.0f : 0.0f;
+    if (highpass_mix_ == target_mix) {
+        kernels.biquad(samples, frame_count, c, highpass_state_);
+        return;
+    }
+    // switched on or off: crossfade dry and filtered over this packet
+    memcpy(dry, samples, frame_count * sizeof(float));
+    kernels.biquad(samples, frame_count, c, highpass_state_);
+    float mix_step = (target_mix - highpass_mix_) / (float)frame_count;
+    for (size_t i = 0; i < frame_count; ++i) {
+        float mix = highpass_mix_ + mix_step * (float)(i + 1);
+        samples[i] = dry[i] + (samples[i] - dry[i]) * mix;
+    }
+    highpass_mix_ = target_mix;
+    if (target_mix == 0.0f) highpass_state_[0] = highpass_state_[1] = 0.0; // restart clean when re-enabled
+}
+
+void stream_dsp_chain::process_dynamics(float* samples, size_t frame_count, const dsp_chain_coefficients& c, float makeup_gain) {
+    const dsp_block_kernels& kernels = selected_kernels();
+    if (!running_) {
+        applied_gain_ = gate_gain_ * agc_gain_ * makeup_gain * limiter_gain_; // continue from where bypass left off
+        running_ = true;
+    }
+    for (size_t block_start = 0; block_start < frame_count; block_start += DSP_CONTROL_BLOCK_FRAMES) {
+        size_t block_frames = std::min(DSP_CONTROL_BLOCK_FRAMES, frame_count - block_start);
+        float* block = samples + block_start;
+        float peak = kernels.peak_abs(block, block_frames);
+
+        // gate: peak-hold detector with hysteresis, gain opens with attack and closes with release
+        gate_envelope_ = std::max(peak, gate_envelope_ * c.gate_envelope_decay);
+        if (c.gate_enabled) {
+            if (gate_envelope_ >= c.gate_threshold) gate_open_ = true;
+            else if (gate_envelope_ < c.gate_threshold * DSP_GATE_HYSTERESIS) gate_open_ = false;
+        } else {
+            gate_open_ = true;
+        }
+        float gate_target = gate_open_ ? 1.0f : c.gate_closed_gain;
+        gate_gain_ += (gate_target - gate_gain_) * (gate_target > gate_gain_ ? c.gate_attack_coefficient : c.gate_release_coefficient);
+
+        // AGC: steer the peak envelope to the target; hold while the gate is closed
+        agc_envelope_ = std::max(peak, agc_envelope_ * c.agc_envelope_decay);
+        float agc_target_gain = 1.0f;
+        if (c.agc_enabled) {
+            agc_target_gain = agc_envelope_ > 0.0f ? c.agc_target / agc_envelope_ : c.agc_max_gain;
+            agc_target_gain = std::min(std::max(agc_target_gain, 1.0f / c.agc_max_gain), c.agc_max_gain);
+        }
+        if (gate_open_ || !c.agc_enabled) {
+            agc_gain_ += (agc_target_gain - agc_gain_) * (agc_target_gain < agc_gain_ ? c.agc_attack_coefficient : c.agc_release_coefficient);
+        }
+
+        // limiter: instant attack on the block peak, release towards unity
+        float gain_before_limiter = gate_gain_ * agc_gain_ * makeup_gain;
+        float limiter_target = 1.0f;
+        if (c.limiter_enabled && peak * gain_before_limiter > c.limiter_ceiling) {
+            limiter_target = c.limiter_ceiling / (peak * gain_before_limiter);
+        }
+        bool limiting = limiter_target < limiter_gain_;
+        limiter_gain_ = limiting ? limiter_target : limiter_gain_ + (limiter_target - limiter_gain_) * c.limiter_release_coefficient;
+
+        float block_gain = gain_before_limiter * limiter_gain_;
+        float start_gain = limiting ? std::min(applied_gain_, block_gain) : applied_gain_;
+        kernels.gain_ramp(block, block_frames, start_gain, (block_gain - start_gain) / (float)block_frames);
+        applied_gain_ = block_gain;
+    }
+    // disabled stages settle exactly, so the stream can drop back to bypass
+    if (!c.gate_enabled && gain_settled(gate_gain_)) gate_gain_ = 1.0f;
+    if (!c.agc_enabled && gain_settled(agc_gain_)) agc_gain_ = 1.0f;
+    if (!c.limiter_enabled && gain_settled(limiter_gain_)) limiter_gain_ = 1.0f;
+    if (is_bypassed(c)) running_ = false;
+}
@@ -0,0 +1,146 @@
+// dsp_chain.h
+// Real-time processing of each stream's recorded channel in the DSP stage, so the
+// files need no offline clean-up pass:
+//
+//   high-pass (DC block + rumble) -> noise gate -> AGC -> makeup gain -> limiter
+//
+// Blocks are one packet (frames_in_packet) of float samples, full scale +-1.0. The
+// high-pass is a biquad (RBJ cookbook); the gate, AGC and limiter compute one gain
+// per DSP_CONTROL_BLOCK_FRAMES from the block peak and ramp linearly to it, so gain
+// changes never step. The AGC holds its gain while the gate is closed, so it does
+// not pull the noise floor up between words. The limiter has no lookahead: it
+// reaches its ceiling within one control block, and the final conversion saturates.
+//
+// Settings are global and hot-swapped from /control: dsp_chain_settings_cell is a
+// seqlock the DSP threads read without locking, and prepare_dsp_chain() turns a
+// config into coefficients once per change. A stage switched on or off fades over
+// one packet. The per-sample work (int <-> float, the biquad as a 4-sample
+// block-matrix recurrence in double, peak, gain ramp) runs in SIMD kernels chosen at startup
+// (AVX2+FMA > SSE2 > NEON > scalar). With every stage off and settled a stream is
+// bypassed entirely.
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+static constexpr size_t DSP_CONTROL_BLOCK_FRAMES = 32;  // 0.67 ms at 48 kHz
+
+struct dsp_chain_config {
+    bool highpass_enabled = false;
+    float highpass_cutoff_hz = 80.0f;     // INMP441 rumble and DC sit below this
+    float highpass_q = 0.7071f;
+
+    bool gate_enabled = false;
+    float gate_threshold_dbfs = -60.0f;   // peak envelope below this closes the gate
+    float gate_range_db = 30.0f;          // attenuation when closed
+    float gate_attack_ms = 2.0f;
+    float gate_release_ms = 150.0f;
+
+    bool agc_enabled = false;
+    float agc_target_dbfs = -18.0f;       // peak envelope the AGC steers towards
+    float agc_max_gain_db = 24.0f;
+    float agc_attack_ms = 20.0f;          // gain decrease
+    float agc_release_ms = 1000.0f;       // gain increase
+
+    bool limiter_enabled = false;
+    float limiter_ceiling_dbfs = -1.0f;
+    float limiter_release_ms = 100.0f;
+};
+
+// Clamp every field to the range the chain supports
+dsp_chain_config sanitize_dsp_chain_config(const dsp_chain_config& config);
+
+// ----------------- Settings publication -----------------
+
+// One dsp_chain_config shared between the control handlers (writers, serialized by
+// an internal mutex) and the DSP threads (lock-free readers). The words are atomics,
+// so a torn read is detected and retried rather than being a data race.
+class dsp_chain_settings_cell {
+public:
+    dsp_chain_settings_cell() { store(dsp_chain_config{}); }
+
+    void store(const dsp_chain_config& config);
+    // Changes with every store; compare against the generation of the last load()
+    uint64_t generation() const { return sequence_.load(std::memory_order_acquire); }
+    // Copy the current settings; returns their generation. Never blocks: it only
+    // retries while a store is in progress.
+    uint64_t load(dsp_chain_config& out) const;
+
+private:
+    static constexpr size_t WORD_COUNT = (sizeof(dsp_chain_config) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+    std::mutex store_mutex_;
+    std::atomic<uint64_t> sequence_{0};   // odd while a store is in progress
+    std::atomic<uint64_t> words_[WORD_COUNT] = {};
+};
+
+// ----------------- Coefficients -----------------
+
+// A config prepared for one sample rate. Plain data; prepare_dsp_chain() does not allocate.
+struct dsp_chain_coefficients {
+    bool highpass_enabled = false;
+    bool gate_enabled = false;
+    bool agc_enabled = false;
+    bool limiter_enabled = false;
+
+    // transposed direct form II biquad, and its 4-sample block form: column j (x0..x3,
+    // then z1, z2) holds the four outputs in lanes 0..3 and the new z1, z2 in lanes 4, 5.
+    // Double precision: with poles this close to 1, float state is only good to ~-80 dB.
+    double b0 = 1.0, b1 = 0.0, b2 = 0.0, a1 = 0.0, a2 = 0.0;
+    alignas(32) double block_columns[6][8] = {};
+
+    float gate_threshold = 0.0f;          // linear
+    float gate_envelope_decay = 0.0f;     // peak detector decay per control block
+    float gate_closed_gain = 1.0f;
+    float gate_attack_coefficient = 1.0f; // one-pole step per control block, 0..1
+    float gate_release_coefficient = 1.0f;
+
+    float agc_target = 1.0f;
+    float agc_envelope_decay = 0.0f;
+    float agc_max_gain = 1.0f;
+    float agc_attack_coefficient = 1.0f;
+    float agc_release_coefficient = 1.0f;
+
+    float limiter_ceiling = 1.0f;
+    float limiter_release_coefficient = 1.0f;
+};
+
+void prepare_dsp_chain(const dsp_chain_config& config, uint32_t sample_rate, dsp_chain_coefficients& out);
+
+// ----------------- Per-stream state -----------------
+
+class stream_dsp_chain {
+public:
+    // True if process() would change nothing: every stage off and every fade finished
+    bool is_bypassed(const dsp_chain_coefficients& coefficients) const;
+
+    // frame_count int32-left24 words (native order, any alignment) in; processed words
+    // out, saturated to 24 bits (out may be the input). makeup_gain is applied before
+    // the limiter. work holds frame_count * 2 floats.
+    void process(const uint8_t* input_left24, int32_t* output_left24, size_t frame_count,
+                 const dsp_chain_coefficients& coefficients, float makeup_gain, float* work);
+
+    // Current gain of the gate, AGC and limiter combined, for /status (DSP thread)
+    float dynamics_gain() const { return gate_gain_ * agc_gain_ * limiter_gain_; }
+    bool gate_open() const { return gate_open_; }
+
+private:
+    void process_highpass(float* samples, float* dry, size_t frame_count, const dsp_chain_coefficients& coefficients);
+    void process_dynamics(float* samples, size_t frame_count, const dsp_chain_coefficients& coefficients, float makeup_gain);
+
+    double highpass_state_[2] = {0.0, 0.0};
+    float highpass_mix_ = 0.0f;           // 0 = dry, 1 = filtered
+
+    float gate_envelope_ = 0.0f;
+    bool gate_open_ = true;
+    float gate_gain_ = 1.0f;
+    float agc_envelope_ = 0.0f;
+    float agc_gain_ = 1.0f;
+    float limiter_gain_ = 1.0f;
+    float applied_gain_ = 1.0f;           // gain at the end of the last block, including makeup
+    bool running_ = false;                // applied_gain_ is valid (false while bypassed)
+};
+
+// Name of the block kernel set in use ("avx2+fma", "sse2", "neon", "scalar")
+const char* selected_dsp_chain_kernel_name();
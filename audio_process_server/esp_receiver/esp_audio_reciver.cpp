@@ -1,27 +1,34 @@
-// esp_receiver_and_web_combined.cpp
-// Single-binary: TCP audio receiver (from ESP streamer) + Drogon web UI
+// esp_audio_reciver.cpp
+// The ESP audio receiver and its Drogon web UI in one binary (esp_receiver_combined).
 //
-// Fixes and improvements compared to original:
-//  - correct socket/file types and setsockopt usage
-//  - robust recv_all function
-//  - correct header parsing with correct byte indices
-//  - correct WAV chunk names ("fmt " with trailing space), correct endian writes
-//  - thread-safe file writes and WAV header patch on shutdown
-//  - integrated Drogon web UI reading/modifying the same shared globals
-//  - long descriptive variable names used everywhere for learning clarity
+// Devices stream ESP2 packets over TCP (optionally as resumable sessions) or UDP
+// (with FEC). The receive path is split into shards, one per core: each shard
+// accepts on its own listen sockets and runs an epoll receiver thread that
+// frames packets in place, a DSP thread (decode, processing chain, gain, packed
+// 24-bit) and a writer thread (jitter buffer, WAV segments, archive), connected by
+// lock-free SPSC rings. See the pipeline and shard sections below.
 //
-// NOTE: this file should be compiled/linked with Drogon and pthreads.
-// Use your existing CMake with this file as the receiver + webserver source.
+// The web UI (/status, /control, /ws, /listen, /archive, /metrics, /trace) reads
+// and adjusts the same globals and merges the shards' counters when it reads them.
 #include <arpa/inet.h>
 #include <errno.h>
+#include <dirent.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdio.h>
 #include <string.h>
+#include <linux/sockios.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <atomic>
 #include <chrono>
 #include <cstdint>
@@ -29,6 +36,8 @@
 #include <cmath>
 #include <iostream>
 #include <cstring>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <sstream>
 #include <string>
@@ -38,373 +47,3130 @@
 #include <drogon/drogon.h>
 #include <json/json.h>
 
+#include "activity_clips.h"
+#include "allocation_counter.h"
+#include "drift_resampler.h"
+#include "dsp_chain.h"
+#include "esp2_wire_header.h"
+#include "jitter_buffer.h"
+#include "level_meter.h"
+#include "live_monitor.h"
+#include "packet_pool.h"
+#include "pipeline_counters.h"
+#include "receive_ring.h"
+#include "sample_convert.h"
+#include "shm_audio_export.h"
+#include "spsc_ring.h"
+#include "stream_archive.h"
+#include "stream_timing.h"
+#include "trace_spans.h"
+#include "udp_fec.h"
+#include "wav_writer.h"
+
 using namespace drogon;
 
 // ----------------- Configuration constants -----------------
 
 static const char* SERVER_BIND_ADDRESS = "0.0.0.0";
 static const uint16_t TCP_LISTEN_PORT = 7000;   // match ESP PC_PORT
+static const uint16_t UDP_LISTEN_PORT = 7000;   // ESP UDP transport (same number, separate protocol)
 static const uint16_t WEB_HTTP_PORT = 8080;     // web UI port
 
-// Header layout constants (must match the ESP streamer)
-static const uint32_t HEADER_MAGIC = 0x45535032; // ASCII 'E' 'S' 'P' '2'
-static constexpr int HEADER_SIZE = 34;
-static const uint16_t FORMAT_INT32_LEFT24 = 1u;
-
 // Audio parameters (must align with ESP streamer)
 static const uint32_t EXPECTED_SAMPLE_RATE = 48000;
-static const uint8_t EXPECTED_CHANNEL_COUNT = 1;       // mic channel only
-static const uint8_t IN_BYTES_PER_SAMPLE = 4;         // sent as int32 left-aligned
+static const uint8_t EXPECTED_CHANNEL_COUNT = 1;       // recorded: the mic channel (channel 0 of a multi-channel node)
+static const uint8_t IN_BYTES_PER_SAMPLE = 4;         // widest payload sample (int32 left-aligned)
 static const uint8_t OUT_BYTES_PER_SAMPLE = 3;        // we write 24-bit WAV -> 3 bytes/sample
 
 // File and buffer sizing
-static const char* OUTPUT_WAV_FILENAME = "received_audio_esp32.wav";
-static const unsigned BUFFER_SECONDS = 4; // optional ring buffer window (not used in this simple version)
+// Each connected device gets its own sink: <prefix>_<device ip>.wav
+static const char* OUTPUT_WAV_FILENAME_PREFIX = "received_audio_esp32";
+static const unsigned BUFFER_SECONDS = 4; // longest sample-index gap zero-filled in place; longer ones start a new segment
 static const size_t RING_BUFFER_SIZE_SAMPLES = (size_t)EXPECTED_SAMPLE_RATE * BUFFER_SECONDS;
+// How long the writer holds audio back so late/reordered packets can still land at
+// their sample_index (the Python prototype's WRITE_MISSING_TIMEOUT)
+static const unsigned JITTER_REORDER_WINDOW_MS = 250;
+
+// /ws status push: default per-subscriber rate (a client may ask for another within
+// the min/max bounds), how often the publisher wakes, and how often a full snapshot
+// is sent instead of a delta so late joiners and missed messages converge
+static const uint32_t STATUS_PUSH_DEFAULT_INTERVAL_MS = 200;
+static const uint32_t STATUS_PUSH_MIN_INTERVAL_MS = 50;
+static const uint32_t STATUS_PUSH_MAX_INTERVAL_MS = 10000;
+static const int STATUS_PUSH_TICK_MS = 50;
+static const int STATUS_PUSH_KEYFRAME_INTERVAL_MS = 5000;
+
+// /listen live monitoring: how much converted audio each listened-to stream keeps,
+// how often the fan-out thread sends, the largest message, and how many messages a
+// listener may leave unacknowledged before it is skipped ahead instead of queued
+static const unsigned LIVE_MONITOR_RING_SECONDS = 1;
+static const int LIVE_MONITOR_TICK_MS = 10;
+static const size_t LIVE_MONITOR_MAX_BLOCK_FRAMES = 4800;    // 100 ms at 48 kHz
+static const uint32_t LIVE_MONITOR_MAX_UNACKED_BLOCKS = 12;  // ~120 ms of audio in flight
+static const uint32_t LIVE_MONITOR_DEFAULT_RATE = 16000;
+
+// Shared-memory export (shm_audio_ring.h): every stream's converted audio in
+// "/esp_audio_<device>" for local consumers, published by the DSP stage
+static const bool SHM_EXPORT_ENABLED = true;
+static const unsigned SHM_EXPORT_RING_SECONDS = 2;
+static const uint32_t SHM_EXPORT_BLOCK_CAPACITY = 1024;     // descriptors: ~21 s of 1024-frame packets
+
+static const size_t MAX_FRAMES_LIMIT = 1 << 16; // 65536 frames per packet (safety limit)
+
+// Multi-device ingest (epoll) sizing
+static const int MAX_CONCURRENT_STREAMS = 256;            // connections beyond this are refused
+static const int EPOLL_MAX_EVENTS_PER_WAIT = 64;
+static const int EPOLL_WAIT_TIMEOUT_MS = 200;             // how often the loop re-checks global_should_run
+static const size_t RECV_BYTES_BUDGET_PER_WAKEUP = 256 * 1024; // per-stream fairness cap per epoll wakeup
+static const int RECV_SOCKET_BUFFER_BYTES = 1 << 20;      // SO_RCVBUF asked for on the listen socket (kernel doubles it)
+static const size_t RECEIVE_RING_BYTES = 256 * 1024;      // per-stream receive_ring, ~1.3 s of one 48 kHz int32 stream
+static const int RECEIVE_THROTTLED_POLL_MS = 1;           // epoll timeout while a stream waits for ring space
+                                                          // or for its previous stream to let go of the label
+
+// TCP sessions (esp2_wire_header.h): a device that opens with a hello keeps its stream
+// and files across reconnects. A disconnected session stream is parked, sink open,
+// for SESSION_RESUME_GRACE_MS before it is closed like any other.
+static const uint32_t SESSION_RESUME_GRACE_MS = 30000;
+static const uint32_t SESSION_ACK_INTERVAL_MS = 100;
+static const int SESSION_ACK_MAX_QUEUED_BYTES = 4096;     // skip an ack while the send queue holds more than this
+// formats asked of a session device, best first, when it has no usable preference
+static const uint8_t SESSION_FORMAT_PREFERENCE[] = {ESP2_FORMAT_RICE24, ESP2_FORMAT_PACKED24, ESP2_FORMAT_INT32_LEFT24,
+                                                    ESP2_FORMAT_INT16, ESP2_FORMAT_IMA_ADPCM};
+
+// Optional UDP transport: one ESP2 packet per datagram, optional XOR parity (udp_fec.h).
+// A UDP stream is one source address; it closes after UDP_STREAM_IDLE_TIMEOUT_MS of silence.
+static const bool UDP_TRANSPORT_ENABLED = true;
+static const size_t UDP_MAX_DATAGRAM_BYTES = 8192;
+static const size_t UDP_RECV_BATCH_DATAGRAMS = 32;        // per recvmmsg() call
+static const size_t UDP_RECV_BATCHES_PER_WAKEUP = 8;      // fairness cap, like RECV_BYTES_BUDGET_PER_WAKEUP
+static const uint32_t UDP_STREAM_IDLE_TIMEOUT_MS = 3000;
+static const uint32_t UDP_IDLE_SWEEP_INTERVAL_MS = 250;
+
+// WAV writer policy: batch size, max age of buffered audio, and the durability period
+// (header patch + fdatasync) that bounds how much audio a crash can lose
+static const size_t WAV_WRITE_BATCH_BYTES = 256 * 1024;      // ~1.8 s of one 48 kHz 24-bit stream
+static const uint32_t WAV_FLUSH_INTERVAL_MS = 1000;
+static const uint32_t WAV_DURABILITY_SYNC_INTERVAL_MS = 5000;
+static const int WAV_TIMER_SERVICE_INTERVAL_MS = 50;         // how often the writer checks those timers
+
+// Rolling segments: each device's recording is split into files of at most this many
+// seconds (0 = no limit) or bytes (0 = no limit); closed segments are final on disk.
+// Files beyond 4 GiB are written as RF64 when WAV_ALLOW_RF64 is set.
+static const uint32_t WAV_SEGMENT_MAX_SECONDS = 3600;
+static const uint64_t WAV_SEGMENT_MAX_BYTES = 0;
+static const bool WAV_ALLOW_RF64 = true;
+
+// Drift compensation (off by default, toggled via /control or /ws): the writer resamples
+// each stream onto the host's 48 kHz timeline, so sample indices (and segment names)
+// of different devices count the same host-clock samples. The rate comes from the
+// device clock estimate; a slow phase loop pulls the output onto the estimated host
+// capture time, and an error too large to slew restarts the timeline (new segment).
+static const bool DRIFT_COMPENSATION_DEFAULT_ENABLED = false;
+static const double DRIFT_PHASE_LOOP_SECONDS = 5.0;    // time constant of the phase correction
+static const double DRIFT_MAX_SLEW_PPM = 500.0;        // largest rate change the phase loop applies
+static const double DRIFT_MAX_PHASE_ERROR_MS = 20.0;   // beyond this, jump instead of slewing
+
+// Activity-triggered recording (off by default, toggled via /control or /ws): instead of
+// everything, the writer keeps only clips around detected activity (activity_clips.h),
+// each in its own segment file and listed in <prefix>_<device>_clips.jsonl. The
+// pre-roll is what a clip keeps ahead of the first active hop, so onsets are not cut.
+static const bool ACTIVITY_RECORDING_DEFAULT_ENABLED = false;
+static const uint32_t ACTIVITY_PRE_ROLL_MS = 1000;
+static const uint32_t ACTIVITY_POST_ROLL_MS = 2000;
+static const float ACTIVITY_MIN_LEVEL_DBFS = -70.0f;
+static const float ACTIVITY_LEVEL_MARGIN_DB = 10.0f;
+static const float ACTIVITY_FLUX_BIN_MARGIN_DB = 10.0f;
+
+// Chunked archive (stream_archive.h): each stream's final timeline (after drift
+// compensation, before activity gating) is also kept in ARCHIVE_CHUNK_SECONDS chunks
+// under ARCHIVE_DIRECTORY/<device>/ with an index, so GET /archive/audio can cut any
+// range out of it. Uses the WAV batch/flush/durability settings above.
+static const bool ARCHIVE_ENABLED = true;
+static const char* ARCHIVE_DIRECTORY = "esp_archive";
+static const uint32_t ARCHIVE_CHUNK_SECONDS = 60;
+static const uint32_t ARCHIVE_MAX_RANGE_SECONDS = 3600;        // longest range one request may ask for
+static const size_t ARCHIVE_STREAM_RESPONSE_MAX_BYTES = 256 * 1024; // per stream-response callback
 
 // ----------------- Global state (shared between receiver and web UI) -----------------
 
-// These are intentionally long descriptive names for clarity while learning
-static std::atomic<bool> global_should_run{true};
-static std::atomic<double> global_makeup_gain{1.0};
-static std::mutex global_file_write_mutex;
-static int global_total_samples_written_count = 0;
-
-static std::atomic<uint64_t> global_highest_received_sample_index{0};
-static std::atomic<uint32_t> global_last_received_sequence{0};
-
-// Store listen socket descriptor so signal handler can close it
-static int global_tcp_listen_socket_fd = -1;
-
-// ----------------- Utility helpers (endian-safe IO) -----------------
-
-// Write 32-bit little-endian to file
-static void write_u32_le(FILE* file_pointer, uint32_t value) {
-    uint8_t bytes[4];
-    bytes[0] = (uint8_t)(value & 0xFF);
-    bytes[1] = (uint8_t)((value >> 8) & 0xFF);
-    bytes[2] = (uint8_t)((value >> 16) & 0xFF);
-    bytes[3] = (uint8_t)((value >> 24) & 0xFF);
-    fwrite(bytes, 1, 4, file_pointer);
-}
-
-// Write 16-bit little-endian to file
-static void write_u16_le(FILE* file_pointer, uint16_t value) {
-    uint8_t bytes[2];
-    bytes[0] = (uint8_t)(value & 0xFF);
-    bytes[1] = (uint8_t)((value >> 8) & 0xFF);
-    fwrite(bytes, 1, 2, file_pointer);
-}
-
-// Robustly receive exactly `required_bytes` bytes from `sockfd` into `buffer`.
-// Returns true on success, false if connection closed or unrecoverable error.
-// This properly handles EINTR and partial reads.
-static bool recv_all(int sockfd, uint8_t* buffer, size_t required_bytes) {
-    size_t total_received = 0;
-    while (total_received < required_bytes) {
-        ssize_t r = recv(sockfd, buffer + total_received, required_bytes - total_received, 0);
-        if (r < 0) {
-            if (errno == EINTR) continue; // interrupted, try again
-            perror("recv");
-            return false;
+// These are intentionally long descriptive names for clarity while learning
+static std::atomic<bool> global_should_run{true};
+static std::atomic<double> global_makeup_gain{1.0};
+static std::atomic<bool> global_drift_compensation_enabled{DRIFT_COMPENSATION_DEFAULT_ENABLED};
+static std::atomic<bool> global_activity_recording_enabled{ACTIVITY_RECORDING_DEFAULT_ENABLED};
+// high-pass / gate / AGC / limiter settings (dsp_chain.h); the DSP threads read them without locking
+static dsp_chain_settings_cell global_dsp_chain_settings;
+// sample totals and the "latest packet" status are kept per receiver shard (see below)
+
+// ----------------- ESP2 header decode -----------------
+
+// Decoded copy of an ESP2 packet header (wire layout in include/esp2_wire_header.h)
+struct esp2_packet_header {
+    uint32_t magic = 0;
+    uint32_t sequence_number = 0;
+    uint64_t first_sample_index = 0;
+    uint64_t timestamp_microseconds = 0;
+    uint16_t frames_in_packet = 0;
+    uint8_t channels_in_packet = 0;
+    uint8_t bytes_per_sample_in_packet = 0;
+    uint32_t sample_rate_in_packet = 0;
+    uint8_t format_id_in_packet = 0;
+    uint8_t header_version = 0;
+    uint16_t flags = 0;
+    uint32_t capture_overrun_frames = 0; // frames the device dropped just before this packet
+};
+
+// Decode from a validated view over the stream's header buffer
+static void parse_esp2_header(const esp2_wire_header& wire, esp2_packet_header& header) {
+    header.magic = wire.magic();
+    header.sequence_number = wire.sequence();
+    header.first_sample_index = wire.first_sample_index();
+    header.timestamp_microseconds = wire.timestamp_us();
+    header.frames_in_packet = wire.frames();
+    header.channels_in_packet = wire.channels();
+    header.bytes_per_sample_in_packet = wire.bytes_per_sample();
+    header.sample_rate_in_packet = wire.sample_rate();
+    header.format_id_in_packet = wire.format_id();
+    header.header_version = wire.header_version();
+    header.flags = wire.flags();
+    header.capture_overrun_frames = wire.capture_overrun_frames();
+}
+
+// ----------------- Packet pipeline (receiver -> DSP -> writer) -----------------
+//
+// Packets travel through three threads connected by lock-free SPSC rings:
+//
+//   receiver (epoll, recv only) -> dsp_input_ring -> DSP (gain + 24-bit pack)
+//   -> writer_input_ring -> writer (file I/O) -> free_slot_ring -> receiver
+//
+// Each receiver shard (below) owns one such pipeline.
+//
+// Every ring is at least PIPELINE_SLOT_COUNT deep, so a push of a slot that was
+// popped from another ring can never fail. When no free slot is available the
+// receiver drops the packet (counted) instead of stalling the TCP window.
+//
+// Each connection reads into its own receive_ring: one recv() takes whatever the
+// socket holds and every complete frame in it is framed in place. A slot's payload
+// is a view into that ring, which the DSP stage releases once it has converted it.
+// Slot output buffers live in one fixed slab (packet_pool.h) sized for
+// PACKET_POOL_SLOT_FRAMES x PACKET_POOL_MAX_CHANNELS, so the steady-state packet
+// path performs no heap allocations; /status reports the counter that proves it.
+
+struct esp_stream_connection;
+
+enum class packet_slot_kind { audio_packet, stream_closed };
+
+struct audio_packet_slot {
+    packet_slot_kind kind = packet_slot_kind::audio_packet;
+    esp_stream_connection* stream = nullptr;  // owning stream; kept alive until its stream_closed marker is written
+    esp2_packet_header header;
+    const uint8_t* payload_bytes = nullptr;   // raw ESP payload: a view into stream->receive_ring
+    size_t payload_size = 0;
+    uint64_t payload_release_position = 0;    // receive_ring position to release once converted
+    uint8_t* output_bytes = nullptr;          // packed 24-bit output of the DSP stage (slab region)
+    size_t output_size = 0;
+    uint64_t host_receive_us = 0;             // host monotonic time the payload completed
+    uint64_t capture_excess_delay_us = 0;     // capture -> receive delay above the best-case path
+    const stream_converter_info* converter = nullptr; // the stream's converter for this packet's format
+};
+
+static const size_t PIPELINE_SLOT_COUNT = 256;       // ~5.4 s of a single 1024-frame stream in flight
+static const int PIPELINE_IDLE_SLEEP_US = 500;      // consumer back-off when its input ring is empty
+
+// Per-slot capacity: 4x the ESP's FRAMES_PER_PACKET, stereo-capable. Packets larger than this
+// (but still under MAX_FRAMES_LIMIT) are rejected at header time instead of allocating.
+static const size_t PACKET_POOL_SLOT_FRAMES = 4096;
+static const size_t PACKET_POOL_MAX_CHANNELS = 2;
+static const size_t MAX_PACKET_PAYLOAD_BYTES = PACKET_POOL_SLOT_FRAMES * PACKET_POOL_MAX_CHANNELS * IN_BYTES_PER_SAMPLE;
+static_assert(PACKET_POOL_SLOT_FRAMES <= MAX_FRAMES_LIMIT, "pool slots cannot exceed the protocol frame limit");
+static_assert(RECEIVE_RING_BYTES >= 2 * (ESP2_WIRE_HEADER_MAX_BYTES + MAX_PACKET_PAYLOAD_BYTES),
+              "a receive ring must hold a largest frame with room to read the next");
+
+// ----------------- Receiver shards -----------------
+//
+// The whole pipeline above runs once per shard. A shard owns its listen sockets (TCP
+// and UDP, both SO_REUSEPORT when there is more than one shard, so the kernel spreads
+// connections and UDP sources across shards by address hash), its epoll loop, its
+// packet slots and rings, and its receiver, DSP and writer threads, all pinned to
+// one core. A connection lives on the shard that accepted it. Only the stream
+// registry (on connect and close) is shared; the web handlers merge the shards'
+// counters when they read them.
+
+static const unsigned RECEIVER_SHARD_COUNT = 1;          // 0 = one shard per online CPU
+static const bool RECEIVER_PIN_SHARDS_TO_CORES = true;   // applies only with more than one shard
+
+// A new connection that resumes (socket_fd >= 0) or ends (socket_fd == -1: the device
+// restarted) a session stream owned by another shard
+struct session_handoff {
+    std::shared_ptr<esp_stream_connection> stream;
+    int socket_fd = -1;
+    std::string peer_ip;
+    std::string peer_address;
+    uint32_t session_id = 0;
+};
+
+struct receiver_shard {
+    unsigned shard_index = 0;
+    int pinned_cpu = -1;                     // -1 = not pinned
+    bool reuse_port = false;                 // listen sockets share their port with the other shards
+
+    packet_buffer_pool packet_pool;
+    std::vector<audio_packet_slot> packet_slots;
+    spsc_ring<audio_packet_slot*> free_slot_ring{PIPELINE_SLOT_COUNT};    // writer -> receiver
+    spsc_ring<audio_packet_slot*> dsp_input_ring{PIPELINE_SLOT_COUNT};    // receiver -> DSP
+    spsc_ring<audio_packet_slot*> writer_input_ring{PIPELINE_SLOT_COUNT}; // DSP -> writer
+
+    // Set by each stage after it has pushed its last slot, so the next stage can drain and exit
+    std::atomic<bool> receiver_stage_finished{false};
+    std::atomic<bool> dsp_stage_finished{false};
+
+    // TCP listen socket, kept so the signal handler can close it
+    std::atomic<int> listen_socket_fd{-1};
+
+    // resumed sessions whose stream lives on this shard but whose new connection was
+    // accepted by another; pushed under global_stream_registry_mutex, which also guards
+    // the eventfd (-1 once the receiver thread has stopped taking them)
+    std::vector<session_handoff> incoming_session_handoffs;
+    int session_handoff_event_fd = -1;
+
+    // receiver thread only
+    std::vector<esp_stream_connection*> streams_pending_close;  // no free slot for their stream_closed marker yet
+    std::vector<esp_stream_connection*> throttled_streams;      // receive ring full, EPOLLIN off
+    std::vector<esp_stream_connection*> parked_sessions;        // disconnected, waiting to be resumed
+    std::vector<esp_stream_connection*> streams_awaiting_label; // restarted device, previous stream's files still open
+    int epoll_fd = -1;
+    std::map<uint64_t, esp_stream_connection*> udp_streams;     // by source address
+    uint64_t last_udp_idle_sweep_us = 0;
+    std::vector<uint8_t> udp_datagram_storage;                  // recvmmsg() batch: UDP_RECV_BATCH_DATAGRAMS datagrams
+    struct sockaddr_in udp_sources[UDP_RECV_BATCH_DATAGRAMS];
+    struct iovec udp_vectors[UDP_RECV_BATCH_DATAGRAMS];
+    struct mmsghdr udp_messages[UDP_RECV_BATCH_DATAGRAMS];
+
+    // DSP thread only: coded payloads are decoded here first (one slot's samples)
+    std::vector<int32_t> dsp_decode_scratch;
+    // DSP thread only: the chain settings prepared for this shard, re-prepared when
+    // global_dsp_chain_settings changes generation, and the chain's float work area
+    dsp_chain_coefficients dsp_chain_coefficients_in_use;
+    uint64_t dsp_chain_generation = UINT64_MAX;
+    std::vector<float> dsp_chain_work;
+    // writer thread only: streams with a configured recorder, so their flush/durability timers run while idle
+    std::vector<esp_stream_connection*> writer_open_streams;
+
+    // status for the web UI, one writer thread each
+    std::atomic<uint64_t> highest_received_sample_index{0};  // latest packet of any stream on the shard
+    std::atomic<uint32_t> last_received_sequence{0};
+    single_writer_counter samples_written;                   // writer thread
+};
+
+// Created in main() before any thread starts and before the signal handlers are installed
+static std::vector<std::unique_ptr<receiver_shard>> global_receiver_shards;
+
+// Allocate the shard's slab, bind each slot to its regions and hand every slot to the
+// receiver. Must run before the shard's threads start.
+static bool initialize_shard_pipeline(receiver_shard& shard) {
+    const size_t max_samples_per_slot = PACKET_POOL_SLOT_FRAMES * PACKET_POOL_MAX_CHANNELS;
+    if (!shard.packet_pool.initialize(PIPELINE_SLOT_COUNT, max_samples_per_slot * OUT_BYTES_PER_SAMPLE)) {
+        std::cerr << "[POOL] could not allocate packet slab\n";
+        return false;
+    }
+    shard.packet_slots.resize(PIPELINE_SLOT_COUNT);
+    for (size_t slot_index = 0; slot_index < shard.packet_slots.size(); ++slot_index) {
+        audio_packet_slot& slot = shard.packet_slots[slot_index];
+        slot.output_bytes = shard.packet_pool.output_region(slot_index);
+        shard.free_slot_ring.try_push(&slot);
+    }
+    shard.dsp_decode_scratch.assign(shard.packet_pool.output_capacity() / OUT_BYTES_PER_SAMPLE, 0);
+    shard.dsp_chain_work.assign(shard.dsp_decode_scratch.size() * 2, 0.0f);
+    if (UDP_TRANSPORT_ENABLED) shard.udp_datagram_storage.assign(UDP_RECV_BATCH_DATAGRAMS * UDP_MAX_DATAGRAM_BYTES, 0);
+    std::cout << "[POOL] shard " << shard.shard_index << ": " << PIPELINE_SLOT_COUNT << " packet slots, "
+              << shard.packet_pool.slab_bytes() / 1024 << " KiB slab\n";
+    return true;
+}
+
+// Pin the calling shard thread to the shard's core (no-op when unpinned)
+static void pin_current_thread_to_shard_cpu(const receiver_shard& shard) {
+    if (shard.pinned_cpu < 0) return;
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(shard.pinned_cpu, &cpu_set);
+    int error = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+    if (error != 0) std::cerr << "[SHARD] could not pin shard " << shard.shard_index << " to cpu " << shard.pinned_cpu << ": " << strerror(error) << "\n";
+}
+
+// ----------------- Per-connection stream state -----------------
+
+// One connected ESP streamer. Parser state is owned by its shard's receiver thread,
+// the sink by the shard's writer thread; the web handlers only read the atomic status
+// fields while holding global_stream_registry_mutex.
+struct esp_stream_connection {
+    int socket_fd = -1;
+    uint64_t stream_id = 0;
+    receiver_shard* shard = nullptr;   // the shard that accepted it, for its whole lifetime
+    std::string peer_address;          // "ip:port" as seen at accept()
+    std::string peer_ip;
+
+    // output (a series of WAV segments per connected device), opened lazily by the writer
+    std::string device_label;              // device part of the segment filenames
+    sample_index_jitter_buffer output_jitter_buffer;  // places audio by first_sample_index
+    segmented_wav_recorder output_recorder;
+    bool output_recorder_configured = false;
+    std::atomic<bool> output_closed{false};  // set by the writer once the files are finalized
+    // a restarted device's previous stream on another shard, whose label this stream
+    // took: its packets stay in the ring until that stream's files are finalized
+    // (receiver thread)
+    std::shared_ptr<esp_stream_connection> label_predecessor;
+
+    // drift compensation between jitter buffer and recorder (writer thread); the atomics
+    // mirror its state to the web UI
+    drift_resampler output_resampler;
+    double drift_input_step = 1.0;            // input samples per output sample last used
+    std::atomic<bool> drift_compensation_active{false};
+    std::atomic<double> drift_rate_correction_ppm{0.0}; // total resampling ratio deviation from 1
+    std::atomic<double> drift_phase_error_us{0.0};      // host timeline minus output position
+
+    // activity-triggered recording (writer thread): the clip gate sits in front of the
+    // recorder while global_activity_recording_enabled is set
+    activity_clip_gate activity_gate;
+    activity_clip_index activity_index;
+    bool activity_gate_engaged = false;
+    std::string activity_clip_filename;     // first segment file of the clip in progress
+
+    // chunked archive of the same timeline (writer thread), opened with the recorder
+    stream_archive_writer archive_writer;
+
+    stream_level_meter output_level_meter;  // updated by the DSP stage, post-gain
+
+    // processing chain state (DSP thread); the atomics mirror it to the web UI
+    stream_dsp_chain dsp_chain;
+    std::atomic<float> dsp_dynamics_gain_db{0.0f};  // gate, AGC and limiter combined
+    std::atomic<bool> dsp_gate_open{true};
+
+    // live monitoring: the DSP stage publishes into the ring only while listeners exist.
+    // The ring is allocated (once) by the first listener before the count goes non-zero.
+    live_monitor_ring monitor_ring;
+    std::atomic<int> monitor_listener_count{0};
+    // shared-memory export (DSP thread): created at the first packet, closed when the
+    // stream_closed marker passes the DSP stage
+    shm_audio_exporter shm_exporter;
+    bool shm_export_attempted = false;
+    // received bytes not yet framed or still held by the DSP stage (receiver thread,
+    // releases from the DSP thread); EPOLLIN is switched off while it is full
+    receive_ring receive_buffer;
+    bool receive_throttled = false;
+
+    // converter for the format of the latest packet: picked from the first header and
+    // looked up again only if the sender switches (a Rice packet that fell back to
+    // packed 24-bit); written by the receiver thread, read by /status
+    std::atomic<const stream_converter_info*> payload_converter{nullptr};
+
+    // TCP session (receiver thread), set up by the hello. The identity is written under
+    // global_stream_registry_mutex (other shards and /status read it there) and does
+    // not change; session_enabled is cleared under it when the stream is closed.
+    bool session_checked = false;           // first bytes looked at: hello or a legacy sender
+    bool session_enabled = false;
+    uint64_t session_device_id = 0;
+    uint32_t session_id = 0;
+    uint8_t session_format = 0;             // negotiated payload format
+    uint64_t session_received_end_index = 0; // frames before this have been received
+    uint64_t session_acked_end_index = 0;    // last acked to the device
+    uint64_t session_last_ack_us = 0;
+    uint64_t session_parked_us = 0;
+    std::atomic<bool> session_parked{false};
+    std::atomic<uint32_t> session_resumes{0};
+
+    // UDP transport (receiver thread): datagrams are appended to receive_buffer whole
+    bool udp_transport = false;
+    uint64_t udp_source_key = 0;
+    uint64_t last_datagram_us = 0;
+    fec_group_decoder fec_decoder;
+
+    // status mirrored to the web UI
+    stream_receive_counters receive_counters;   // receiver thread only
+    stream_write_counters write_counters;       // writer thread only
+    std::atomic<uint64_t> highest_received_sample_index{0};
+    std::atomic<uint32_t> last_received_sequence{0};
+
+    // timing from timestamp_us (see stream_timing.h): the estimator is fed by the
+    // receiver thread, the histograms by the receiver and writer threads
+    device_clock_estimator device_clock;
+    latency_histogram capture_to_receive_latency;
+    latency_histogram receive_to_writer_latency;
+    latency_histogram capture_to_writer_latency;
+};
+
+// All streams whose sink is still open, keyed by stream_id.
+// Insert happens on the receiver thread, erase on the writer thread once the
+// stream's stream_closed marker has drained through the pipeline.
+static std::mutex global_stream_registry_mutex;
+static std::map<uint64_t, std::shared_ptr<esp_stream_connection>> global_active_streams;
+static uint64_t global_next_stream_id = 1;
+// Session streams by device id, until they are closed (same mutex)
+static std::map<uint64_t, esp_stream_connection*> global_session_streams;
+
+// Per-device totals for /metrics, so a device's counters stay monotonic across
+// reconnects: closed streams are folded into global_closed_device_totals (keyed by
+// peer IP) when the writer releases them, live streams are added at scrape time.
+struct device_metric_totals {
+    uint64_t bytes_received = 0;
+    uint64_t packets_received = 0;
+    uint64_t packets_dropped = 0;
+    uint64_t header_errors = 0;
+    uint64_t bad_magic_disconnects = 0;
+    uint64_t fec_packets_recovered = 0;
+    uint64_t fec_packets_unrecoverable = 0;
+    uint64_t capture_overrun_frames = 0;
+    uint64_t frames_written = 0;
+    uint64_t gap_events = 0;
+    uint64_t gap_frames = 0;
+    uint64_t late_frames = 0;
+    uint64_t duplicate_frames = 0;
+    uint64_t activity_clips = 0;
+    uint64_t connections = 0;
+};
+// Guarded by global_stream_registry_mutex
+static std::map<std::string, device_metric_totals> global_closed_device_totals;
+
+static void accumulate_device_metric_totals(const esp_stream_connection& stream, device_metric_totals& totals) {
+    const jitter_buffer_counters& timeline_counters = stream.output_jitter_buffer.counters();
+    totals.bytes_received += stream.receive_counters.bytes_received.load();
+    totals.packets_received += stream.receive_counters.packets_received.load();
+    totals.packets_dropped += stream.receive_counters.packets_dropped.load();
+    totals.header_errors += stream.receive_counters.header_errors.load();
+    totals.bad_magic_disconnects += stream.receive_counters.bad_magic_disconnects.load();
+    totals.fec_packets_recovered += stream.receive_counters.fec_packets_recovered.load();
+    totals.fec_packets_unrecoverable += stream.receive_counters.fec_packets_unrecoverable.load();
+    totals.capture_overrun_frames += stream.receive_counters.capture_overrun_frames.load();
+    totals.frames_written += stream.write_counters.frames_written.load();
+    totals.gap_events += timeline_counters.gap_events.load(std::memory_order_relaxed);
+    totals.gap_frames += timeline_counters.gap_frames.load(std::memory_order_relaxed);
+    totals.late_frames += timeline_counters.late_frames.load(std::memory_order_relaxed);
+    totals.duplicate_frames += timeline_counters.duplicate_frames.load(std::memory_order_relaxed);
+    totals.activity_clips += stream.activity_gate.counters().clips_finished.load(std::memory_order_relaxed);
+    totals.connections += 1;
+}
+
+// Pick the device label used in segment filenames. The wire header carries no device ID
+// yet, so the peer IP stands in for it; a second concurrent stream from the same IP gets
+// its source port appended so two recorders never write the same segment names.
+// Caller must hold global_stream_registry_mutex.
+static std::string choose_stream_device_label(const std::string& peer_ip, uint16_t peer_port) {
+    for (const auto& entry : global_active_streams) {
+        if (entry.second->device_label == peer_ip) {
+            return peer_ip + "_" + std::to_string(peer_port);
+        }
+    }
+    return peer_ip;
+}
+
+// Apply the writer/segment policy to the stream's recorder and size its jitter buffer (writer thread)
+static void configure_stream_output_recorder(esp_stream_connection& stream) {
+    wav_writer_policy writer_policy;
+    writer_policy.batch_bytes = WAV_WRITE_BATCH_BYTES;
+    writer_policy.flush_interval_ms = WAV_FLUSH_INTERVAL_MS;
+    writer_policy.durability_interval_ms = WAV_DURABILITY_SYNC_INTERVAL_MS;
+    writer_policy.allow_rf64 = WAV_ALLOW_RF64;
+
+    wav_segment_policy segment_policy;
+    segment_policy.max_segment_frames = (uint64_t)WAV_SEGMENT_MAX_SECONDS * EXPECTED_SAMPLE_RATE;
+    segment_policy.max_segment_bytes = WAV_SEGMENT_MAX_BYTES;
+
+    std::string path_prefix = std::string(OUTPUT_WAV_FILENAME_PREFIX) + "_" + stream.device_label;
+    stream.output_recorder.configure(path_prefix, EXPECTED_SAMPLE_RATE, EXPECTED_CHANNEL_COUNT, OUT_BYTES_PER_SAMPLE,
+                                     writer_policy, segment_policy);
+
+    size_t reorder_window_frames = (size_t)EXPECTED_SAMPLE_RATE * JITTER_REORDER_WINDOW_MS / 1000;
+    if (!stream.output_jitter_buffer.initialize(EXPECTED_CHANNEL_COUNT * OUT_BYTES_PER_SAMPLE, reorder_window_frames,
+                                                PACKET_POOL_SLOT_FRAMES * PACKET_POOL_MAX_CHANNELS, RING_BUFFER_SIZE_SAMPLES)) {
+        std::cerr << "[WAV] could not allocate jitter buffer for stream " << stream.stream_id << "\n";
+    }
+    // allocated up front so enabling compensation later never allocates on the writer path
+    if (!stream.output_resampler.initialize()) {
+        std::cerr << "[WAV] could not allocate drift resampler for stream " << stream.stream_id << "\n";
+    }
+    // likewise the activity gate's pre-roll
+    activity_detector_config detector_config;
+    detector_config.min_level_dbfs = ACTIVITY_MIN_LEVEL_DBFS;
+    detector_config.level_margin_db = ACTIVITY_LEVEL_MARGIN_DB;
+    detector_config.flux_bin_margin_db = ACTIVITY_FLUX_BIN_MARGIN_DB;
+    activity_clip_policy clip_policy;
+    clip_policy.pre_roll_ms = ACTIVITY_PRE_ROLL_MS;
+    clip_policy.post_roll_ms = ACTIVITY_POST_ROLL_MS;
+    if (!stream.activity_gate.initialize(EXPECTED_SAMPLE_RATE, detector_config, clip_policy)) {
+        std::cerr << "[WAV] could not allocate activity pre-roll for stream " << stream.stream_id << "\n";
+    }
+    stream.activity_index.configure((path_prefix + "_clips.jsonl").c_str());
+    stream.activity_clip_filename.reserve(path_prefix.size() + 32);
+
+    if (ARCHIVE_ENABLED) {
+        stream_archive_policy archive_policy;
+        archive_policy.chunk_frames = (uint64_t)ARCHIVE_CHUNK_SECONDS * EXPECTED_SAMPLE_RATE;
+        archive_policy.batch_bytes = WAV_WRITE_BATCH_BYTES;
+        archive_policy.flush_interval_ms = WAV_FLUSH_INTERVAL_MS;
+        archive_policy.durability_interval_ms = WAV_DURABILITY_SYNC_INTERVAL_MS;
+        if (!stream.archive_writer.open(std::string(ARCHIVE_DIRECTORY) + "/" + stream.device_label, EXPECTED_SAMPLE_RATE,
+                                        EXPECTED_CHANNEL_COUNT, OUT_BYTES_PER_SAMPLE, archive_policy)) {
+            std::cerr << "[ARCHIVE] stream " << stream.stream_id << " is not archived\n";
+        }
+    }
+    stream.output_recorder_configured = true;
+}
+
+// Append a contiguous run to the stream's segments (writer thread)
+static void write_frames_to_recorder(esp_stream_connection& stream, uint64_t first_sample_index, const uint8_t* bytes,
+                                     size_t frame_count, batched_wav_sink::clock::time_point now) {
+    size_t byte_count = frame_count * EXPECTED_CHANNEL_COUNT * OUT_BYTES_PER_SAMPLE;
+    if (!stream.output_recorder.append_packet(first_sample_index, bytes, byte_count, frame_count, now) &&
+        !stream.output_recorder.is_open()) {
+        std::cerr << "[WAV] no open segment for stream " << stream.stream_id << ", " << frame_count << " frames not written\n";
+        return;
+    }
+    stream.shard->samples_written.add(frame_count);
+    stream.write_counters.frames_written.add(frame_count);
+}
+
+// Wall-clock capture time (us since the epoch) of the frame at this recorder index
+static int64_t wall_clock_us_of_recorded_index(const esp_stream_connection& stream, uint64_t index) {
+    double host_us;
+    if (stream.drift_compensation_active.load(std::memory_order_relaxed)) {
+        host_us = (double)index * 1e6 / EXPECTED_SAMPLE_RATE; // the resampled timeline counts host-clock samples
+    } else {
+        device_clock_snapshot clock = stream.device_clock.snapshot();
+        host_us = clock.valid ? clock.host_time_of_sample_us((double)index, EXPECTED_SAMPLE_RATE) : (double)host_monotonic_us();
+    }
+    int64_t wall_now_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                              std::chrono::system_clock::now().time_since_epoch()).count();
+    return wall_now_us - (int64_t)((double)host_monotonic_us() - host_us);
+}
+
+// A clip starts in a segment of its own and, once finished, is listed in the stream's clip index
+static void handle_activity_clip_event(esp_stream_connection& stream, const activity_clip_event& clip, bool started) {
+    if (started) {
+        stream.output_recorder.close_segment();
+        stream.activity_clip_filename.clear();
+        return;
+    }
+    stream.output_recorder.close_segment();
+    if (stream.activity_clip_filename.empty()) return; // nothing of it reached a file
+    stream.activity_index.append(stream.activity_clip_filename.c_str(), clip, EXPECTED_SAMPLE_RATE,
+                                 wall_clock_us_of_recorded_index(stream, clip.first_sample_index));
+    std::cout << "[WAV] stream " << stream.stream_id << " activity clip " << stream.activity_clip_filename << ": "
+              << clip.frame_count * 1000 / EXPECTED_SAMPLE_RATE << " ms, peak " << clip.peak_dbfs << " dBFS\n";
+}
+
+// The archive takes every frame of the timeline; the start time is only looked up when
+// the run does not continue the current index record (writer thread)
+static void write_frames_to_archive(esp_stream_connection& stream, uint64_t first_sample_index, const uint8_t* bytes,
+                                    size_t frame_count, batched_wav_sink::clock::time_point now) {
+    if (!stream.archive_writer.is_open()) return;
+    int64_t start_unix_us = stream.archive_writer.continues_record(first_sample_index)
+                                ? 0
+                                : wall_clock_us_of_recorded_index(stream, first_sample_index);
+    stream.archive_writer.append(first_sample_index, bytes, frame_count, start_unix_us, now);
+}
+
+static void finish_activity_clip(esp_stream_connection& stream) {
+    stream.activity_gate.finish([&](const activity_clip_event& clip, bool started) {
+        handle_activity_clip_event(stream, clip, started);
+    });
+}
+
+// Append a contiguous run to the stream's recording: all of it, or only the activity
+// clips while activity recording is on; the archive always gets all of it (writer thread)
+static void append_frames_to_recorder(esp_stream_connection& stream, uint64_t first_sample_index, const uint8_t* bytes,
+                                      size_t frame_count, batched_wav_sink::clock::time_point now) {
+    write_frames_to_archive(stream, first_sample_index, bytes, frame_count, now);
+    bool gate_wanted = global_activity_recording_enabled.load(std::memory_order_relaxed) && stream.activity_gate.is_initialized();
+    if (gate_wanted != stream.activity_gate_engaged) {
+        // switching mode ends the continuous segment or the clip in progress here
+        if (stream.activity_gate_engaged) finish_activity_clip(stream);
+        stream.output_recorder.close_segment();
+        stream.activity_gate_engaged = gate_wanted;
+    }
+    if (!gate_wanted) {
+        write_frames_to_recorder(stream, first_sample_index, bytes, frame_count, now);
+        return;
+    }
+    stream.activity_gate.process(
+        first_sample_index, bytes, frame_count,
+        [&](uint64_t clip_first_index, const uint8_t* clip_bytes, size_t clip_frames) {
+            write_frames_to_recorder(stream, clip_first_index, clip_bytes, clip_frames, now);
+            if (stream.activity_clip_filename.empty() && stream.output_recorder.is_open()) {
+                stream.activity_clip_filename = stream.output_recorder.current_segment_filename();
+            }
+        },
+        [&](const activity_clip_event& clip, bool started) { handle_activity_clip_event(stream, clip, started); });
+}
+
+// End the resampled timeline: write out what the resampler still holds (writer thread)
+static void finish_drift_compensation(esp_stream_connection& stream, batched_wav_sink::clock::time_point now) {
+    stream.output_resampler.finish(stream.drift_input_step, [&](uint64_t first_output_index, const uint8_t* bytes, size_t frame_count) {
+        append_frames_to_recorder(stream, first_output_index, bytes, frame_count, now);
+    });
+    stream.drift_compensation_active.store(false, std::memory_order_relaxed);
+}
+
+// Host 48 kHz timeline index at which the input sample was captured
+static double host_timeline_index_of_sample(const device_clock_snapshot& clock, double sample_index) {
+    return clock.host_time_of_sample_us(sample_index, EXPECTED_SAMPLE_RATE) * EXPECTED_SAMPLE_RATE * 1e-6;
+}
+
+// Resample a released run onto the host timeline and append it (writer thread)
+static void write_drift_compensated_frames(esp_stream_connection& stream, uint64_t first_sample_index, const uint8_t* bytes,
+                                           size_t frame_count, batched_wav_sink::clock::time_point now) {
+    drift_resampler& resampler = stream.output_resampler;
+    device_clock_snapshot clock = stream.device_clock.snapshot();
+
+    // a jump in the input (jitter buffer resync) or a phase error too large to slew
+    // away ends the current timeline
+    double phase_error_frames = 0.0;
+    if (resampler.started()) {
+        phase_error_frames = host_timeline_index_of_sample(clock, resampler.next_output_input_position()) -
+                             (double)resampler.next_output_index();
+        if (resampler.next_input_index() != first_sample_index ||
+            std::fabs(phase_error_frames) > DRIFT_MAX_PHASE_ERROR_MS * EXPECTED_SAMPLE_RATE / 1000.0) {
+            finish_drift_compensation(stream, now);
+            phase_error_frames = 0.0;
+        }
+    }
+    if (!resampler.started()) {
+        double first_output_index = host_timeline_index_of_sample(clock, (double)first_sample_index);
+        resampler.restart(first_sample_index, first_output_index > 0.0 ? (uint64_t)std::llround(first_output_index) : 0);
+        stream.drift_compensation_active.store(true, std::memory_order_relaxed);
+    }
+
+    // rate from the clock estimate, nudged so the phase error decays over DRIFT_PHASE_LOOP_SECONDS
+    double phase_correction = phase_error_frames / (DRIFT_PHASE_LOOP_SECONDS * EXPECTED_SAMPLE_RATE);
+    phase_correction = std::min(std::max(phase_correction, -DRIFT_MAX_SLEW_PPM * 1e-6), DRIFT_MAX_SLEW_PPM * 1e-6);
+    stream.drift_input_step = clock.sample_rate_host_clock(EXPECTED_SAMPLE_RATE) / EXPECTED_SAMPLE_RATE * (1.0 - phase_correction);
+    stream.drift_rate_correction_ppm.store((1.0 / stream.drift_input_step - 1.0) * 1e6, std::memory_order_relaxed);
+    stream.drift_phase_error_us.store(phase_error_frames * 1e6 / EXPECTED_SAMPLE_RATE, std::memory_order_relaxed);
+
+    resampler.process(bytes, frame_count, stream.drift_input_step, [&](uint64_t first_output_index, const uint8_t* output_bytes, size_t output_frames) {
+        append_frames_to_recorder(stream, first_output_index, output_bytes, output_frames, now);
+    });
+}
+
+// Route a contiguous run released by the jitter buffer to the stream's segments,
+// through the drift resampler when compensation is on (writer thread)
+static void write_released_frames(esp_stream_connection& stream, uint64_t first_sample_index, const uint8_t* bytes,
+                                  size_t frame_count, batched_wav_sink::clock::time_point now) {
+    if (global_drift_compensation_enabled.load(std::memory_order_relaxed) && stream.output_resampler.is_initialized()) {
+        write_drift_compensated_frames(stream, first_sample_index, bytes, frame_count, now);
+        return;
+    }
+    if (stream.output_resampler.started()) finish_drift_compensation(stream, now);
+    append_frames_to_recorder(stream, first_sample_index, bytes, frame_count, now);
+}
+
+// Release what the jitter buffer still holds and finalize the stream's last segment (writer thread)
+static void close_stream_output_recorder(esp_stream_connection& stream) {
+    auto now = batched_wav_sink::clock::now();
+    stream.output_jitter_buffer.flush([&](uint64_t first_sample_index, const uint8_t* bytes, size_t frame_count) {
+        write_released_frames(stream, first_sample_index, bytes, frame_count, now);
+    });
+    if (stream.output_resampler.started()) finish_drift_compensation(stream, now);
+    if (stream.activity_gate_engaged) finish_activity_clip(stream);
+    stream.output_recorder.close();
+    stream.activity_index.close();
+    stream.archive_writer.close();
+    std::cout << "[WAV] stream " << stream.stream_id << " closed, segments=" << stream.output_recorder.segments_closed()
+              << ", samples_written=" << stream.write_counters.frames_written.load() << std::endl;
+}
+
+// ----------------- Receiver stage: framing in the receive ring -----------------
+
+static void count_stream_header_error(esp_stream_connection& stream) {
+    stream.receive_counters.header_errors.add();
+    this_thread_pipeline_counters()[pipeline_counter::header_errors].add();
+}
+
+// Pick the stream's converter for this header's format fields. False (stream must be
+// dropped) for a format no converter handles, instead of recording it as noise.
+static bool select_stream_payload_converter(esp_stream_connection& stream, const esp2_packet_header& header) {
+    const stream_converter_info* converter = stream.payload_converter.load(std::memory_order_relaxed);
+    if (converter && converter->format_id == header.format_id_in_packet && converter->channels == header.channels_in_packet &&
+        converter->bytes_per_sample == header.bytes_per_sample_in_packet) {
+        return true;
+    }
+    converter = find_stream_converter(header.format_id_in_packet, header.channels_in_packet, header.bytes_per_sample_in_packet);
+    if (!converter) {
+        stream.receive_counters.header_errors.add();
+        this_thread_pipeline_counters()[pipeline_counter::unsupported_format_disconnects].add();
+        std::cerr << "[TCP] " << stream.peer_address << " unsupported payload: format_id=" << int(header.format_id_in_packet)
+                  << " channels=" << int(header.channels_in_packet) << " bytes_per_sample="
+                  << int(header.bytes_per_sample_in_packet) << std::endl;
+        return false;
+    }
+    if (header.sample_rate_in_packet != EXPECTED_SAMPLE_RATE) {
+        std::cerr << "[WARN] " << stream.peer_address << " sample_rate mismatch: received=" << header.sample_rate_in_packet
+                  << " expected=" << EXPECTED_SAMPLE_RATE << "\n";
+    }
+    stream.payload_converter.store(converter, std::memory_order_relaxed);
+    return true;
+}
+
+// A complete frame is in the ring: hand its payload view to the DSP stage, or drop it
+// if no slot is free (counted; its bytes are reclaimed with the next release).
+static void on_stream_frame_complete(esp_stream_connection& stream, const esp2_packet_header& header,
+                                     const uint8_t* payload, size_t payload_bytes, size_t frame_bytes, uint64_t host_receive_us) {
+    ESP_TRACE_SPAN(enqueue, stream.stream_id, header.first_sample_index);
+    // timing: every received packet counts, even one dropped for lack of a slot
+    stream.device_clock.add_observation(header.timestamp_microseconds, host_receive_us, header.first_sample_index);
+    uint64_t capture_excess_delay_us = stream.device_clock.excess_delay_us(header.timestamp_microseconds, host_receive_us);
+    stream.capture_to_receive_latency.record(capture_excess_delay_us);
+    if (header.capture_overrun_frames != 0) {
+        // the device's capture ring overflowed during a network stall; the gap is real audio loss
+        stream.receive_counters.capture_overrun_frames.add(header.capture_overrun_frames);
+        this_thread_pipeline_counters()[pipeline_counter::capture_overrun_frames].add(header.capture_overrun_frames);
+    }
+    // a session device is told it may free this packet, even if no slot takes it below
+    uint64_t end_index = header.first_sample_index + header.frames_in_packet;
+    if (end_index > stream.session_received_end_index) stream.session_received_end_index = end_index;
+
+    receiver_shard& shard = *stream.shard;
+    audio_packet_slot* slot = nullptr;
+    if (!shard.free_slot_ring.try_pop(slot)) {
+        stream.receive_buffer.consume(frame_bytes, false);
+        stream.receive_counters.packets_dropped.add();
+        this_thread_pipeline_counters()[pipeline_counter::packets_dropped].add();
+        return;
+    }
+    slot->kind = packet_slot_kind::audio_packet;
+    slot->stream = &stream;
+    slot->header = header;
+    slot->converter = stream.payload_converter.load(std::memory_order_relaxed);
+    slot->payload_bytes = payload;
+    slot->payload_size = payload_bytes;
+    slot->payload_release_position = stream.receive_buffer.consume(frame_bytes, true);
+    slot->host_receive_us = host_receive_us;
+    slot->capture_excess_delay_us = capture_excess_delay_us;
+    shard.dsp_input_ring.try_push(slot); // cannot fail, see pipeline comment
+
+    // update status atoms (per stream and the shard's "latest packet from any stream")
+    uint64_t last_sample_index = header.first_sample_index + (uint64_t)header.frames_in_packet - 1;
+    stream.receive_counters.packets_received.add();
+    this_thread_pipeline_counters()[pipeline_counter::packets_received].add();
+    stream.highest_received_sample_index.store(last_sample_index);
+    stream.last_received_sequence.store(header.sequence_number);
+    shard.highest_received_sample_index.store(last_sample_index);
+    shard.last_received_sequence.store(header.sequence_number);
+}
+
+// Frame every complete ESP2 packet that has arrived; a partial frame stays in the ring
+// for the next recv(). Returns false if the stream must be dropped.
+static bool frame_received_packets(esp_stream_connection& stream, uint64_t host_receive_us) {
+    receive_ring& ring = stream.receive_buffer;
+    ESP_TRACE_CHAIN(frame_chain);
+    while (true) {
+        const uint8_t* frame = ring.unparsed_data();
+        size_t available_bytes = ring.unparsed_bytes();
+        size_t header_bytes = 0;
+        esp2_header_status status = esp2_check_wire_header(frame, available_bytes, &header_bytes);
+        if (status == esp2_header_status::need_more_bytes) return true;
+        ESP_TRACE_CHAINED_NAMED_SPAN(frame_chain, frame_span, frame, stream.stream_id, 0);
+        if (status != esp2_header_status::complete) {
+            count_stream_header_error(stream);
+            if (status == esp2_header_status::bad_magic) {
+                stream.receive_counters.bad_magic_disconnects.add();
+                this_thread_pipeline_counters()[pipeline_counter::bad_magic_disconnects].add();
+                std::cerr << "[TCP] " << stream.peer_address << " bad header magic: 0x" << std::hex
+                          << esp2_load_le32(frame) << std::dec << std::endl;
+            } else if (status == esp2_header_status::unsupported_version) {
+                std::cerr << "[TCP] " << stream.peer_address << " unsupported header version "
+                          << int(frame[offsetof(esp2_wire_header, header_version_byte)]) << std::endl;
+            } else {
+                std::cerr << "[TCP] " << stream.peer_address << " bad header length" << std::endl;
+            }
+            return false;
+        }
+
+        // the ring is contiguous for up to its capacity, so the header is read in place
+        esp2_packet_header header;
+        const esp2_wire_header& wire_header = *esp2_wire_header_view(frame, available_bytes);
+        parse_esp2_header(wire_header, header);
+        ESP_TRACE_SET_ARG(frame_span, header.first_sample_index);
+
+        // the first packet picks the stream's converter (sample rate only warned about)
+        if (!select_stream_payload_converter(stream, header)) return false;
+
+        // payload size (fixed by the format, or announced for the variable-length ones)
+        size_t payload_bytes = wire_header.payload_bytes();
+        if (payload_bytes == 0) {
+            std::cerr << "[TCP] zero payload size, skipping\n";
+            ring.consume(header_bytes, false);
+            continue;
+        }
+        // Safety: limit excessive sizes
+        if (header.frames_in_packet == 0 || header.frames_in_packet > MAX_FRAMES_LIMIT) {
+            std::cerr << "[TCP] suspicious number of frames: " << header.frames_in_packet << " (limiting/skipping)\n";
+            count_stream_header_error(stream);
+            return false;
+        }
+
+        // Packets must fit the receive ring as received and a pool slot after conversion
+        size_t output_bytes = (size_t)header.frames_in_packet * (size_t)header.channels_in_packet * OUT_BYTES_PER_SAMPLE;
+        if (payload_bytes > MAX_PACKET_PAYLOAD_BYTES || output_bytes > stream.shard->packet_pool.output_capacity()) {
+            std::cerr << "[TCP] " << stream.peer_address << " packet of " << header.frames_in_packet << " frames x "
+                      << int(header.channels_in_packet) << " channels exceeds pool slot capacity\n";
+            count_stream_header_error(stream);
+            return false;
+        }
+
+        size_t frame_bytes = header_bytes + payload_bytes;
+        if (available_bytes < frame_bytes) return true;
+        on_stream_frame_complete(stream, header, frame + header_bytes, payload_bytes, frame_bytes, host_receive_us);
+    }
+}
+
+enum class stream_read_result {
+    keep,
+    disconnected,   // the peer closed or the connection failed: a session stream is parked
+    failed,         // protocol error: drop the stream
+    handed_over,    // the connection resumes another stream; this one is to be released
+};
+
+// TCP sessions, defined with the epoll loop below
+static stream_read_result check_session_hello(esp_stream_connection& stream);
+static void send_session_ack_if_due(esp_stream_connection& stream, uint64_t now_us);
+
+// Drain whatever the socket has ready (up to a fairness budget) into the stream's ring
+// and frame it. Never blocks.
+static stream_read_result service_readable_stream(esp_stream_connection& stream) {
+    receive_ring& ring = stream.receive_buffer;
+    size_t bytes_this_wakeup = 0;
+    while (bytes_this_wakeup < RECV_BYTES_BUDGET_PER_WAKEUP) {
+        size_t writable_bytes = ring.writable_bytes();
+        if (writable_bytes == 0) {
+            // the DSP stage still holds every byte; pause this socket until it releases some
+            stream.receive_throttled = true;
+            return stream_read_result::keep;
+        }
+        ssize_t r;
+        {
+            ESP_TRACE_NAMED_SPAN(recv_span, recv, stream.stream_id, 0);
+            r = recv(stream.socket_fd, ring.write_pointer(), writable_bytes, 0);
+            ESP_TRACE_SET_ARG(recv_span, r > 0 ? (uint64_t)r : 0);
+        }
+        if (r < 0) {
+            if (errno == EINTR) continue;                          // interrupted, try again
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return stream_read_result::keep; // drained for now
+            perror("recv");
+            return stream_read_result::disconnected;
+        }
+        if (r == 0) {
+            // peer closed connection
+            return stream_read_result::disconnected;
+        }
+        ring.commit_write((size_t)r);
+        bytes_this_wakeup += (size_t)r;
+        stream.receive_counters.bytes_received.add((uint64_t)r);
+        this_thread_pipeline_counters()[pipeline_counter::bytes_received].add((uint64_t)r);
+
+        uint64_t now_us = host_monotonic_us();
+        if (!stream.session_checked) {
+            // a session device opens with a hello and then waits for the welcome
+            stream_read_result result = check_session_hello(stream);
+            if (result != stream_read_result::keep || !stream.session_checked) return result;
+        }
+        if (stream.label_predecessor) {
+            // held unframed (and unacked) until the previous stream lets go of the label
+            auto& awaiting = stream.shard->streams_awaiting_label;
+            if (std::find(awaiting.begin(), awaiting.end(), &stream) == awaiting.end()) awaiting.push_back(&stream);
+            if ((size_t)r < writable_bytes) return stream_read_result::keep;
+            continue;
+        }
+        if (!frame_received_packets(stream, now_us)) return stream_read_result::failed;
+        if (stream.session_enabled) send_session_ack_if_due(stream, now_us);
+        // a short read means the socket is empty; skip the recv() that would return EAGAIN
+        if ((size_t)r < writable_bytes) return stream_read_result::keep;
+    }
+    return stream_read_result::keep;
+}
+
+// ----------------- DSP stage: decode + chain + gain + int32-left24 -> packed 24-bit -----------------
+
+// Kernel picked once at startup, before the shards start (SIMD when available, verified
+// against the scalar reference); every stream converter ends in it
+static packed24_convert_kernel global_packed24_convert_kernel = convert_int32_left24_to_packed24_scalar;
+
+// Pick up a /control change to the chain settings before the next packet (DSP thread)
+static void refresh_shard_dsp_chain(receiver_shard& shard) {
+    if (global_dsp_chain_settings.generation() == shard.dsp_chain_generation) return;
+    dsp_chain_config config;
+    shard.dsp_chain_generation = global_dsp_chain_settings.load(config);
+    prepare_dsp_chain(config, EXPECTED_SAMPLE_RATE, shard.dsp_chain_coefficients_in_use);
+}
+
+static void convert_slot_to_packed24(audio_packet_slot& slot) {
+    receiver_shard& shard = *slot.stream->shard;
+    const size_t frames_in_packet = (size_t)slot.header.frames_in_packet;
+    // fixed-point gain; the kernels match the old double/llround path bit for bit
+    const int32_t gain_q16 = quantize_gain_to_q16(global_makeup_gain.load());
+
+    // Output goes straight into the slot's output region (capacity checked at header time):
+    // the first channel, through the converter the receiver picked for this format
+    int32_t* scratch_left24 = shard.dsp_decode_scratch.data();
+    stream_dsp_chain& chain = slot.stream->dsp_chain;
+    bool decoded;
+    if (chain.is_bypassed(shard.dsp_chain_coefficients_in_use)) {
+        decoded = slot.converter->convert(slot.payload_bytes, slot.payload_size, frames_in_packet, gain_q16,
+                                          global_packed24_convert_kernel, scratch_left24, slot.output_bytes);
+    } else {
+        // the chain applies the makeup gain itself, ahead of its limiter
+        const uint8_t* channel0_left24 = slot.converter->decode_channel0(slot.payload_bytes, slot.payload_size,
+                                                                         frames_in_packet, scratch_left24);
+        decoded = channel0_left24 != nullptr;
+        if (decoded) {
+            chain.process(channel0_left24, scratch_left24, frames_in_packet, shard.dsp_chain_coefficients_in_use,
+                          (float)gain_q16 / (float)SAMPLE_GAIN_Q16_ONE, shard.dsp_chain_work.data());
+            global_packed24_convert_kernel(reinterpret_cast<const uint8_t*>(scratch_left24), slot.output_bytes,
+                                           frames_in_packet, SAMPLE_GAIN_Q16_ONE);
+        }
+        slot.stream->dsp_dynamics_gain_db.store(20.0f * std::log10(std::max(chain.dynamics_gain(), 1e-6f)),
+                                                std::memory_order_relaxed);
+        slot.stream->dsp_gate_open.store(chain.gate_open(), std::memory_order_relaxed);
+    }
+    if (!decoded) {
+        // keep the timeline intact: the packet's frames are written as silence
+        memset(slot.output_bytes, 0, frames_in_packet * OUT_BYTES_PER_SAMPLE);
+        this_thread_pipeline_counters()[pipeline_counter::payload_decode_errors].add();
+    }
+    slot.output_size = frames_in_packet * OUT_BYTES_PER_SAMPLE;
+}
+
+// One block per packet into the stream's shared-memory ring (DSP thread)
+static void publish_slot_to_shm_export(const audio_packet_slot& slot, size_t frame_count) {
+    esp_stream_connection& stream = *slot.stream;
+    if (!stream.shm_export_attempted) {
+        stream.shm_export_attempted = true;
+        size_t data_bytes = (size_t)EXPECTED_SAMPLE_RATE * SHM_EXPORT_RING_SECONDS * EXPECTED_CHANNEL_COUNT * OUT_BYTES_PER_SAMPLE;
+        if (!stream.shm_exporter.open(stream.device_label.c_str(), stream.stream_id, EXPECTED_SAMPLE_RATE,
+                                      EXPECTED_CHANNEL_COUNT, OUT_BYTES_PER_SAMPLE, data_bytes, SHM_EXPORT_BLOCK_CAPACITY,
+                                      (uint32_t)PACKET_POOL_SLOT_FRAMES)) {
+            std::cerr << "[SHM] stream " << stream.stream_id << " is not exported\n";
+        }
+    }
+    // capture time on the host clock: the receive time less the delay above the best-case path
+    uint64_t host_capture_us = stream.device_clock.has_estimate() ? slot.host_receive_us - slot.capture_excess_delay_us : 0;
+    stream.shm_exporter.publish(slot.output_bytes, (uint32_t)frame_count, slot.header.first_sample_index,
+                                slot.header.timestamp_microseconds, slot.host_receive_us, host_capture_us);
+}
+
+static void dsp_stage_loop(receiver_shard& shard) {
+    pin_current_thread_to_shard_cpu(shard);
+    this_thread_pipeline_counters(); // register before the packet path, it allocates once
+    ESP_TRACE_THREAD("dsp " + std::to_string(shard.shard_index));
+    mark_current_thread_as_packet_path();
+    audio_packet_slot* slot = nullptr;
+    ESP_TRACE_CHAIN(convert_chain);
+    while (true) {
+        // read the finished flag before popping so a slot pushed just before it was set is not missed
+        bool upstream_finished = shard.receiver_stage_finished.load(std::memory_order_acquire);
+        if (!shard.dsp_input_ring.try_pop(slot)) {
+            if (upstream_finished) break;
+            ESP_TRACE_BREAK_CHAIN(convert_chain);
+            std::this_thread::sleep_for(std::chrono::microseconds(PIPELINE_IDLE_SLEEP_US));
+            continue;
+        }
+        if (slot->kind == packet_slot_kind::audio_packet) {
+            ESP_TRACE_CHAINED_SPAN(convert_chain, convert, slot->stream->stream_id, slot->header.first_sample_index);
+            refresh_shard_dsp_chain(shard);
+            convert_slot_to_packed24(*slot);
+            slot->stream->receive_buffer.release_through(slot->payload_release_position);
+            this_thread_pipeline_counters()[pipeline_counter::packets_converted].add();
+            // meter what will be written (after gain and saturation), one update per packet
+            uint32_t packet_peak_abs = 0;
+            uint64_t packet_sum_squares = 0;
+            size_t output_samples = slot->output_size / OUT_BYTES_PER_SAMPLE;
+            measure_packed24_levels(slot->output_bytes, output_samples, packet_peak_abs, packet_sum_squares);
+            slot->stream->output_level_meter.update(packet_peak_abs, packet_sum_squares, output_samples, EXPECTED_SAMPLE_RATE);
+            if (slot->stream->monitor_listener_count.load(std::memory_order_acquire) > 0) {
+                slot->stream->monitor_ring.publish(slot->output_bytes, output_samples, slot->header.first_sample_index);
+            }
+            if (SHM_EXPORT_ENABLED) publish_slot_to_shm_export(*slot, output_samples);
+        } else if (slot->kind == packet_slot_kind::stream_closed) {
+            ESP_TRACE_BREAK_CHAIN(convert_chain);
+            slot->stream->shm_exporter.close(); // after its last packet; readers see "closed"
+        }
+        shard.writer_input_ring.try_push(slot); // cannot fail, see pipeline comment
+    }
+    shard.dsp_stage_finished.store(true, std::memory_order_release);
+    std::cout << "[DSP] shard " << shard.shard_index << " stage exiting\n";
+}
+
+// ----------------- Writer stage: file I/O -----------------
+
+static void write_slot_to_stream_sink(audio_packet_slot& slot, batched_wav_sink::clock::time_point now) {
+    esp_stream_connection& stream = *slot.stream;
+    if (!stream.output_recorder_configured) {
+        configure_stream_output_recorder(stream);
+        stream.shard->writer_open_streams.push_back(&stream);
+    }
+
+    uint64_t pipeline_delay_us = host_monotonic_us() - slot.host_receive_us;
+    stream.receive_to_writer_latency.record(pipeline_delay_us);
+    stream.capture_to_writer_latency.record(slot.capture_excess_delay_us + pipeline_delay_us);
+
+    // Place the packet at its sample_index; runs leaving the reorder window go to the
+    // segment recorder (gaps already zero-filled), which batches them into pwrites
+    stream.output_jitter_buffer.insert(slot.header.first_sample_index, slot.output_bytes, slot.header.frames_in_packet,
+                                       [&](uint64_t first_sample_index, const uint8_t* bytes, size_t frame_count) {
+                                           write_released_frames(stream, first_sample_index, bytes, frame_count, now);
+                                       });
+}
+
+static void writer_stage_loop(receiver_shard& shard) {
+    pin_current_thread_to_shard_cpu(shard);
+    this_thread_pipeline_counters(); // register before the packet path, it allocates once
+    ESP_TRACE_THREAD("writer " + std::to_string(shard.shard_index));
+    mark_current_thread_as_packet_path();
+    audio_packet_slot* slot = nullptr;
+    auto next_timer_service = batched_wav_sink::clock::now();
+    ESP_TRACE_CHAIN(write_chain);
+    while (true) {
+        auto now = batched_wav_sink::clock::now();
+        if (now >= next_timer_service) {
+            ESP_TRACE_BREAK_CHAIN(write_chain); // the timers spans come between
+            for (esp_stream_connection* stream : shard.writer_open_streams) {
+                ESP_TRACE_SPAN(timers, stream->stream_id, 0);
+                stream->output_recorder.service_timers(now);
+                stream->archive_writer.service_timers(now);
+            }
+            next_timer_service = now + std::chrono::milliseconds(WAV_TIMER_SERVICE_INTERVAL_MS);
+        }
+
+        bool upstream_finished = shard.dsp_stage_finished.load(std::memory_order_acquire);
+        if (!shard.writer_input_ring.try_pop(slot)) {
+            if (upstream_finished) break;
+            ESP_TRACE_BREAK_CHAIN(write_chain);
+            std::this_thread::sleep_for(std::chrono::microseconds(PIPELINE_IDLE_SLEEP_US));
+            continue;
+        }
+
+        if (slot->kind == packet_slot_kind::audio_packet) {
+            ESP_TRACE_CHAINED_SPAN(write_chain, write, slot->stream->stream_id, slot->header.first_sample_index);
+            write_slot_to_stream_sink(*slot, now);
+            this_thread_pipeline_counters()[pipeline_counter::packets_written].add();
+        } else {
+            // every packet of this stream is already written: finalize and release it
+            ESP_TRACE_BREAK_CHAIN(write_chain); // not to be charged to the next write
+            esp_stream_connection* stream = slot->stream;
+            close_stream_output_recorder(*stream);
+            stream->output_closed.store(true, std::memory_order_release);
+            auto& open_streams = shard.writer_open_streams;
+            open_streams.erase(std::remove(open_streams.begin(), open_streams.end(), stream), open_streams.end());
+            std::lock_guard<std::mutex> lock(global_stream_registry_mutex);
+            accumulate_device_metric_totals(*stream, global_closed_device_totals[stream->peer_ip]);
+            global_active_streams.erase(stream->stream_id); // releases the last reference
+        }
+        slot->stream = nullptr;
+        shard.free_slot_ring.try_push(slot); // cannot fail, see pipeline comment
+    }
+    std::cout << "[WAV] shard " << shard.shard_index << " writer stage exiting\n";
+}
+
+// ----------------- TCP receiver server (epoll ingest loop) -----------------
+
+static void set_stream_epoll_events(int epoll_fd, esp_stream_connection& stream, uint32_t events) {
+    struct epoll_event stream_event;
+    memset(&stream_event, 0, sizeof(stream_event));
+    stream_event.events = events;
+    stream_event.data.ptr = &stream;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, stream.socket_fd, &stream_event) < 0) perror("epoll_ctl");
+}
+
+static void throttle_stream(int epoll_fd, esp_stream_connection& stream) {
+    set_stream_epoll_events(epoll_fd, stream, 0); // hang-ups and errors are still reported
+    stream.shard->throttled_streams.push_back(&stream);
+}
+
+// Re-arm streams whose ring has space again and frame what they already hold
+static void resume_throttled_streams(receiver_shard& shard, int epoll_fd) {
+    auto& throttled = shard.throttled_streams;
+    throttled.erase(std::remove_if(throttled.begin(), throttled.end(),
+                                   [epoll_fd](esp_stream_connection* stream) {
+                                       if (stream->receive_buffer.writable_bytes() == 0) return false;
+                                       stream->receive_throttled = false;
+                                       set_stream_epoll_events(epoll_fd, *stream, EPOLLIN | EPOLLRDHUP);
+                                       return true;
+                                   }),
+                    throttled.end());
+}
+
+// Queue the stream_closed marker behind the stream's last packet. Returns false if no
+// slot is free yet (retry later).
+static bool try_enqueue_stream_closed_marker(esp_stream_connection& stream) {
+    audio_packet_slot* slot = nullptr;
+    if (!stream.shard->free_slot_ring.try_pop(slot)) return false;
+    slot->kind = packet_slot_kind::stream_closed;
+    slot->stream = &stream;
+    stream.shard->dsp_input_ring.try_push(slot); // cannot fail, see pipeline comment
+    return true;
+}
+
+static void retry_pending_stream_closes(receiver_shard& shard) {
+    auto& pending = shard.streams_pending_close;
+    pending.erase(std::remove_if(pending.begin(), pending.end(),
+                                 [](esp_stream_connection* stream) { return try_enqueue_stream_closed_marker(*stream); }),
+                  pending.end());
+}
+
+// Give a new stream its id and device label and publish it (caller holds
+// global_stream_registry_mutex and has checked MAX_CONCURRENT_STREAMS)
+static void register_stream_locked(const std::shared_ptr<esp_stream_connection>& stream, uint16_t client_port, const char* log_tag) {
+    stream->stream_id = global_next_stream_id++;
+    stream->device_label = choose_stream_device_label(stream->peer_ip, client_port);
+    global_active_streams[stream->stream_id] = stream;
+    this_thread_pipeline_counters()[pipeline_counter::connections_accepted].add();
+    std::cout << log_tag << " stream " << stream->stream_id << " connected from " << stream->peer_address
+              << " -> device " << stream->device_label << std::endl;
+}
+
+// Accept every pending connection on the (non-blocking) listen socket and register it with epoll
+static void accept_pending_streams(receiver_shard& shard, int listen_fd, int epoll_fd) {
+    while (true) {
+        struct sockaddr_in client_address;
+        socklen_t client_address_length = sizeof(client_address);
+        int client_fd = accept4(listen_fd, (struct sockaddr*)&client_address, &client_address_length, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_fd < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("accept");
+            return;
+        }
+
+        char client_ip_str[INET_ADDRSTRLEN] = {0};
+        inet_ntop(AF_INET, &client_address.sin_addr, client_ip_str, sizeof(client_ip_str));
+        uint16_t client_port = ntohs(client_address.sin_port);
+
+        auto stream = std::make_shared<esp_stream_connection>();
+        stream->shard = &shard;
+        stream->socket_fd = client_fd;
+        stream->peer_ip = client_ip_str;
+        stream->peer_address = stream->peer_ip + ":" + std::to_string(client_port);
+        if (!stream->receive_buffer.initialize(RECEIVE_RING_BYTES)) {
+            std::cerr << "[TCP] refusing " << stream->peer_address << ": could not map a receive ring\n";
+            this_thread_pipeline_counters()[pipeline_counter::connections_refused].add();
+            close(client_fd);
+            continue;
+        }
+
+        struct epoll_event client_event;
+        memset(&client_event, 0, sizeof(client_event));
+        client_event.events = EPOLLIN | EPOLLRDHUP;
+        client_event.data.ptr = stream.get();
+
+        std::lock_guard<std::mutex> lock(global_stream_registry_mutex);
+        if ((int)global_active_streams.size() >= MAX_CONCURRENT_STREAMS) {
+            std::cerr << "[TCP] refusing " << stream->peer_address << ": " << MAX_CONCURRENT_STREAMS << " streams already active\n";
+            this_thread_pipeline_counters()[pipeline_counter::connections_refused].add();
+            close(client_fd);
+            continue;
+        }
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &client_event) < 0) {
+            perror("epoll_ctl");
+            close(client_fd);
+            continue;
+        }
+        register_stream_locked(stream, client_port, "[TCP]");
+    }
+}
+
+// Take the stream's socket out of epoll and close it (receiver thread only)
+static void detach_stream_socket(int epoll_fd, esp_stream_connection& stream) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, stream.socket_fd, nullptr);
+    if (stream.receive_throttled) {
+        auto& throttled = stream.shard->throttled_streams;
+        throttled.erase(std::remove(throttled.begin(), throttled.end(), &stream), throttled.end());
+        stream.receive_throttled = false;
+    }
+    close(stream.socket_fd);
+    stream.socket_fd = -1;
+}
+
+// End a stream whose socket is already detached (receiver thread only): send its close
+// marker down the pipeline. The writer finalizes the sink and frees the stream once
+// the marker reaches it.
+static void close_stream(esp_stream_connection& stream) {
+    if (stream.session_enabled) {
+        std::lock_guard<std::mutex> lock(global_stream_registry_mutex);
+        auto session = global_session_streams.find(stream.session_device_id);
+        if (session != global_session_streams.end() && session->second == &stream) global_session_streams.erase(session);
+        stream.session_enabled = false;
+    }
+    if (stream.session_parked.load(std::memory_order_relaxed)) {
+        auto& parked = stream.shard->parked_sessions;
+        parked.erase(std::remove(parked.begin(), parked.end(), &stream), parked.end());
+        stream.session_parked.store(false);
+    }
+    if (stream.label_predecessor) {
+        auto& awaiting = stream.shard->streams_awaiting_label;
+        awaiting.erase(std::remove(awaiting.begin(), awaiting.end(), &stream), awaiting.end());
+        stream.label_predecessor.reset();
+    }
+    if (!try_enqueue_stream_closed_marker(stream)) stream.shard->streams_pending_close.push_back(&stream);
+}
+
+// Stop reading a stream and close it (receiver thread only)
+static void drop_stream(int epoll_fd, esp_stream_connection& stream) {
+    detach_stream_socket(epoll_fd, stream);
+    std::cout << "[TCP] stream " << stream.stream_id << " (" << stream.peer_address << ") disconnected\n";
+    close_stream(stream);
+}
+
+// ----------------- TCP sessions -----------------
+//
+// A session device (see esp2_wire_header.h) keeps its stream across connections. When
+// its connection drops, the stream is parked: socket gone, sink and pipeline state
+// kept, for SESSION_RESUME_GRACE_MS. A hello with the same device and session id, on
+// a new connection, resumes it; so does one that arrives while the old connection still
+// looks alive (the device gave up on it first). The new connection is always accepted
+// as a stream of its own first; once its hello names an existing stream, its socket is
+// queued to the shard that owns that stream, which attaches it between epoll batches,
+// so no event of the old socket is mistaken for one of the new. The throwaway stream
+// is released. A hello with a new session id from a known device means it restarted:
+// the old stream is closed and the new one starts fresh.
+
+static char global_session_handoff_epoll_tag;
+
+// Send one whole control message on the non-blocking socket
+static bool send_session_message(int socket_fd, const void* message, size_t bytes) {
+    ssize_t sent;
+    do {
+        sent = send(socket_fd, message, bytes, MSG_DONTWAIT | MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    return sent == (ssize_t)bytes;
+}
+
+static bool send_session_welcome(int socket_fd, uint8_t result, uint8_t format, uint64_t resume_sample_index, uint64_t stream_id) {
+    esp2_session_welcome welcome;
+    welcome.set(result, format, resume_sample_index, (uint32_t)stream_id, SESSION_ACK_INTERVAL_MS);
+    return send_session_message(socket_fd, &welcome, sizeof(welcome));
+}
+
+// Tell the device what it may free, at most every SESSION_ACK_INTERVAL_MS
+static void send_session_ack_if_due(esp_stream_connection& stream, uint64_t now_us) {
+    if (stream.session_received_end_index == stream.session_acked_end_index) return;
+    if (now_us - stream.session_last_ack_us < (uint64_t)SESSION_ACK_INTERVAL_MS * 1000) return;
+    // a device that stopped reading its acks is not sent more of them
+    int queued_bytes = 0;
+    if (ioctl(stream.socket_fd, SIOCOUTQ, &queued_bytes) < 0 || queued_bytes > SESSION_ACK_MAX_QUEUED_BYTES) return;
+    esp2_session_ack ack;
+    ack.set(stream.session_received_end_index);
+    if (!send_session_message(stream.socket_fd, &ack, sizeof(ack))) {
+        // a partly sent ack would garble the device's side: make it reconnect and resume
+        std::cerr << "[TCP] stream " << stream.stream_id << " could not send an ack, resetting the connection\n";
+        shutdown(stream.socket_fd, SHUT_RDWR);
+        return;
+    }
+    stream.session_acked_end_index = stream.session_received_end_index;
+    stream.session_last_ack_us = now_us;
+}
+
+// The device's preferred format if the receiver takes it, else the receiver's best of
+// the formats offered; 0 if none fits
+static uint8_t negotiate_session_format(const esp2_session_hello& hello) {
+    auto usable = [&hello](uint8_t format) {
+        bool listed = std::find(std::begin(SESSION_FORMAT_PREFERENCE), std::end(SESSION_FORMAT_PREFERENCE), format) !=
+                      std::end(SESSION_FORMAT_PREFERENCE);
+        return listed && (hello.format_mask() & esp2_session_format_bit(format)) != 0 &&
+               find_stream_converter(format, hello.channels(), esp2_format_bytes_per_sample(format)) != nullptr;
+    };
+    if (usable(hello.preferred_format())) return hello.preferred_format();
+    for (uint8_t format : SESSION_FORMAT_PREFERENCE) {
+        if (usable(format)) return format;
+    }
+    return 0;
+}
+
+// Park a session stream whose connection is gone (receiver thread only)
+static void park_session_stream(int epoll_fd, esp_stream_connection& stream) {
+    detach_stream_socket(epoll_fd, stream);
+    // a partial frame of the lost connection is sent again after the resume
+    stream.receive_buffer.consume(stream.receive_buffer.unparsed_bytes(), false);
+    stream.session_parked_us = host_monotonic_us();
+    stream.session_parked.store(true);
+    stream.shard->parked_sessions.push_back(&stream);
+    std::cout << "[TCP] stream " << stream.stream_id << " (" << stream.peer_address << ") disconnected, session kept for "
+              << SESSION_RESUME_GRACE_MS / 1000 << " s\n";
+}
+
+static void expire_parked_sessions(receiver_shard& shard, uint64_t now_us) {
+    std::vector<esp_stream_connection*> expired;
+    for (esp_stream_connection* stream : shard.parked_sessions) {
+        if (now_us - stream->session_parked_us >= (uint64_t)SESSION_RESUME_GRACE_MS * 1000) expired.push_back(stream);
+    }
+    for (esp_stream_connection* stream : expired) {
+        std::cout << "[TCP] stream " << stream->stream_id << " session not resumed, closed\n";
+        this_thread_pipeline_counters()[pipeline_counter::sessions_expired].add();
+        close_stream(*stream);
+    }
+}
+
+// Queue a connection (or, with socket_fd -1, the end) for a session stream of any
+// shard, its own included. Caller holds global_stream_registry_mutex. False if that
+// shard has stopped taking them.
+static bool queue_session_handoff_locked(session_handoff&& handoff) {
+    receiver_shard& owner = *handoff.stream->shard;
+    if (owner.session_handoff_event_fd < 0) return false;
+    owner.incoming_session_handoffs.push_back(std::move(handoff));
+    uint64_t one = 1;
+    if (write(owner.session_handoff_event_fd, &one, sizeof(one)) < 0) perror("write(eventfd)");
+    return true;
+}
+
+// Move a resumed connection onto its stream (the stream's receiver thread, between batches)
+static void resume_session_stream(esp_stream_connection& stream, session_handoff& handoff) {
+    receiver_shard& shard = *stream.shard;
+    if (stream.socket_fd >= 0) {
+        // the device has given up on the connection we still hold
+        detach_stream_socket(shard.epoll_fd, stream);
+        stream.receive_buffer.consume(stream.receive_buffer.unparsed_bytes(), false);
+    } else {
+        auto& parked = shard.parked_sessions;
+        parked.erase(std::remove(parked.begin(), parked.end(), &stream), parked.end());
+    }
+
+    bool sent = send_session_welcome(handoff.socket_fd, ESP2_SESSION_RESUMED, stream.session_format,
+                                     stream.session_received_end_index, stream.stream_id);
+    struct epoll_event stream_event;
+    memset(&stream_event, 0, sizeof(stream_event));
+    stream_event.events = EPOLLIN | EPOLLRDHUP;
+    stream_event.data.ptr = &stream;
+    if (!sent || epoll_ctl(shard.epoll_fd, EPOLL_CTL_ADD, handoff.socket_fd, &stream_event) < 0) {
+        std::cerr << "[TCP] stream " << stream.stream_id << " could not resume on " << handoff.peer_address << "\n";
+        close(handoff.socket_fd);
+        stream.session_parked_us = host_monotonic_us();
+        stream.session_parked.store(true);
+        shard.parked_sessions.push_back(&stream);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(global_stream_registry_mutex);
+        stream.socket_fd = handoff.socket_fd;
+        stream.peer_ip = handoff.peer_ip;
+        stream.peer_address = handoff.peer_address;
+    }
+    handoff.socket_fd = -1;
+    stream.session_parked.store(false);
+    stream.session_acked_end_index = stream.session_received_end_index;
+    stream.session_resumes.fetch_add(1, std::memory_order_relaxed);
+    this_thread_pipeline_counters()[pipeline_counter::sessions_resumed].add();
+    std::cout << "[TCP] stream " << stream.stream_id << " resumed from " << stream.peer_address << " at sample "
+              << stream.session_received_end_index << std::endl;
+}
+
+// Attach the connections other streams handed over (receiver thread, between batches)
+static void take_session_handoffs(receiver_shard& shard) {
+    std::vector<session_handoff> handoffs;
+    {
+        std::lock_guard<std::mutex> lock(global_stream_registry_mutex);
+        handoffs.swap(shard.incoming_session_handoffs);
+    }
+    for (session_handoff& handoff : handoffs) {
+        esp_stream_connection& stream = *handoff.stream;
+        if (handoff.socket_fd < 0) {
+            // the device restarted, its new stream is on another shard
+            if (!stream.session_enabled) continue;
+            std::cout << "[TCP] stream " << stream.stream_id << ": device restarted, closing\n";
+            if (stream.socket_fd >= 0) detach_stream_socket(shard.epoll_fd, stream);
+            close_stream(stream);
+            continue;
+        }
+        if (!stream.session_enabled || stream.session_id != handoff.session_id) {
+            // closed in the meantime: the device retries and starts a new session
+            send_session_welcome(handoff.socket_fd, ESP2_SESSION_REJECTED, 0, 0, stream.stream_id);
+            close(handoff.socket_fd);
+            continue;
+        }
+        resume_session_stream(stream, handoff);
+    }
+}
+
+// The first bytes of a TCP stream: a session hello, or the first packet of a sender
+// without sessions. Sets session_checked once it can tell.
+static stream_read_result check_session_hello(esp_stream_connection& stream) {
+    receive_ring& ring = stream.receive_buffer;
+    size_t available_bytes = ring.unparsed_bytes();
+    if (available_bytes < 4) return stream_read_result::keep;
+    if (esp2_load_le32(ring.unparsed_data()) != ESP2_SESSION_HELLO_MAGIC) {
+        stream.session_checked = true;
+        return stream_read_result::keep;
+    }
+    if (available_bytes < sizeof(esp2_session_hello)) return stream_read_result::keep;
+    stream.session_checked = true;
+    esp2_session_hello hello;
+    memcpy(&hello, ring.unparsed_data(), sizeof(hello));
+    ring.consume(sizeof(hello), false);
+    if (hello.version() != ESP2_SESSION_VERSION || available_bytes > sizeof(hello)) {
+        // newer protocol, or packets sent before the welcome
+        std::cerr << "[TCP] " << stream.peer_address << " bad session hello (version " << int(hello.version()) << ", "
+                  << available_bytes << " bytes)\n";
+        count_stream_header_error(stream);
+        return stream_read_result::failed;
+    }
+
+    receiver_shard& shard = *stream.shard;
+    std::shared_ptr<esp_stream_connection> restarted;  // the device's previous stream, on this shard
+    {
+        std::lock_guard<std::mutex> lock(global_stream_registry_mutex);
+        auto session = global_session_streams.find(hello.device_id());
+        if (session != global_session_streams.end()) {
+            std::shared_ptr<esp_stream_connection> previous = global_active_streams.at(session->second->stream_id);
+            session_handoff handoff;
+            handoff.stream = previous;
+            handoff.peer_ip = stream.peer_ip;
+            handoff.peer_address = stream.peer_address;
+            handoff.session_id = hello.session_id();
+            if (previous->session_id == hello.session_id()) {
+                // resume: the socket moves to the previous stream, this one is released
+                epoll_ctl(shard.epoll_fd, EPOLL_CTL_DEL, stream.socket_fd, nullptr);
+                handoff.socket_fd = stream.socket_fd;
+                if (!queue_session_handoff_locked(std::move(handoff))) return stream_read_result::failed;
+                stream.socket_fd = -1;
+                std::cout << "[TCP] stream " << stream.stream_id << " (" << stream.peer_address << ") resumes stream "
+                          << previous->stream_id << std::endl;
+                return stream_read_result::handed_over;
+            }
+            // the label carries over either way. On this shard the previous stream is
+            // closed below and its files are finalized before this stream writes any; on
+            // another, this stream's packets wait until that shard's writer has done so
+            stream.device_label = previous->device_label;
+            if (previous->shard == &shard) {
+                restarted = previous;
+            } else {
+                stream.label_predecessor = previous;
+                queue_session_handoff_locked(std::move(handoff));
+            }
+        }
+    }
+    if (restarted && restarted->session_enabled) {
+        std::cout << "[TCP] stream " << restarted->stream_id << ": device restarted, closing\n";
+        if (restarted->socket_fd >= 0) detach_stream_socket(shard.epoll_fd, *restarted);
+        close_stream(*restarted);
+    }
+
+    uint8_t format = negotiate_session_format(hello);
+    if (format == 0) {
+        send_session_welcome(stream.socket_fd, ESP2_SESSION_REJECTED, 0, 0, stream.stream_id);
+        std::cerr << "[TCP] " << stream.peer_address << " offers no usable format (mask 0x" << std::hex << hello.format_mask()
+                  << std::dec << ", " << int(hello.channels()) << " channels)\n";
+        this_thread_pipeline_counters()[pipeline_counter::unsupported_format_disconnects].add();
+        return stream_read_result::failed;
+    }
+    if (!send_session_welcome(stream.socket_fd, ESP2_SESSION_NEW, format, hello.acked_end_index(), stream.stream_id)) {
+        std::cerr << "[TCP] " << stream.peer_address << " could not send the session welcome\n";
+        return stream_read_result::failed;
+    }
+    {
+        std::lock_guard<std::mutex> lock(global_stream_registry_mutex);
+        stream.session_enabled = true;
+        stream.session_device_id = hello.device_id();
+        stream.session_id = hello.session_id();
+        global_session_streams[hello.device_id()] = &stream;
+    }
+    stream.session_format = format;
+    stream.session_received_end_index = hello.acked_end_index();
+    stream.session_acked_end_index = hello.acked_end_index();
+    std::cout << "[TCP] stream " << stream.stream_id << ": session " << std::hex << hello.session_id() << " of device "
+              << hello.device_id() << std::dec << ", format " << int(format) << ", from sample " << hello.acked_end_index()
+              << std::endl;
+    return stream_read_result::keep;
+}
+
+// Frame the held packets of streams whose previous stream has finalized its files
+// (receiver thread)
+static void release_streams_awaiting_label(receiver_shard& shard, int epoll_fd) {
+    std::vector<esp_stream_connection*> released;
+    auto& awaiting = shard.streams_awaiting_label;
+    awaiting.erase(std::remove_if(awaiting.begin(), awaiting.end(),
+                                  [&released](esp_stream_connection* stream) {
+                                      if (!stream->label_predecessor->output_closed.load(std::memory_order_acquire)) return false;
+                                      stream->label_predecessor.reset();
+                                      released.push_back(stream);
+                                      return true;
+                                  }),
+                   awaiting.end());
+    uint64_t now_us = host_monotonic_us();
+    for (esp_stream_connection* stream : released) {
+        if (!frame_received_packets(*stream, now_us)) {
+            drop_stream(epoll_fd, *stream);
+            continue;
+        }
+        if (stream->session_enabled) send_session_ack_if_due(*stream, now_us);
+    }
+}
+
+// Release a stream whose connection went to another (receiver thread): it never
+// carried a packet, so nothing in the pipeline refers to it
+static void release_handed_over_stream(esp_stream_connection& stream) {
+    std::lock_guard<std::mutex> lock(global_stream_registry_mutex);
+    global_active_streams.erase(stream.stream_id);
+}
+
+// ----------------- UDP transport -----------------
+//
+// Each datagram is one whole ESP2 packet. Datagrams are validated, run through the
+// source's FEC decoder, and appended whole to that source's receive ring, where the
+// same framing as TCP hands them to the pipeline. Reordering and losses that FEC
+// cannot repair are left to the writer's jitter buffer.
+
+// epoll data.ptr of the UDP socket (the listen socket uses nullptr)
+static char global_udp_socket_epoll_tag;
+
+static uint64_t source_key_of(const struct sockaddr_in& source) {
+    return ((uint64_t)ntohl(source.sin_addr.s_addr) << 16) | ntohs(source.sin_port);
+}
+
+static esp_stream_connection* find_or_create_udp_stream(receiver_shard& shard, const struct sockaddr_in& source) {
+    uint64_t source_key = source_key_of(source);
+    auto existing = shard.udp_streams.find(source_key);
+    if (existing != shard.udp_streams.end()) return existing->second;
+
+    char source_ip_str[INET_ADDRSTRLEN] = {0};
+    inet_ntop(AF_INET, &source.sin_addr, source_ip_str, sizeof(source_ip_str));
+    uint16_t source_port = ntohs(source.sin_port);
+
+    auto stream = std::make_shared<esp_stream_connection>();
+    stream->shard = &shard;
+    stream->udp_transport = true;
+    stream->udp_source_key = source_key;
+    stream->peer_ip = source_ip_str;
+    stream->peer_address = stream->peer_ip + ":" + std::to_string(source_port);
+    if (!stream->receive_buffer.initialize(RECEIVE_RING_BYTES) || !stream->fec_decoder.initialize(UDP_MAX_DATAGRAM_BYTES)) {
+        std::cerr << "[UDP] ignoring " << stream->peer_address << ": could not allocate stream buffers\n";
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(global_stream_registry_mutex);
+    if ((int)global_active_streams.size() >= MAX_CONCURRENT_STREAMS) {
+        this_thread_pipeline_counters()[pipeline_counter::connections_refused].add();
+        return nullptr;
+    }
+    register_stream_locked(stream, source_port, "[UDP]");
+    shard.udp_streams[source_key] = stream.get();
+    return stream.get();
+}
+
+static void close_udp_stream(esp_stream_connection& stream, const char* reason) {
+    stream.shard->udp_streams.erase(stream.udp_source_key);
+    std::cout << "[UDP] stream " << stream.stream_id << " (" << stream.peer_address << ") " << reason << "\n";
+    if (!try_enqueue_stream_closed_marker(stream)) stream.shard->streams_pending_close.push_back(&stream);
+}
+
+static void close_idle_udp_streams(receiver_shard& shard, uint64_t now_us) {
+    if (now_us - shard.last_udp_idle_sweep_us < (uint64_t)UDP_IDLE_SWEEP_INTERVAL_MS * 1000) return;
+    shard.last_udp_idle_sweep_us = now_us;
+    std::vector<esp_stream_connection*> idle_streams;
+    for (const auto& entry : shard.udp_streams) {
+        if (now_us - entry.second->last_datagram_us > (uint64_t)UDP_STREAM_IDLE_TIMEOUT_MS * 1000) idle_streams.push_back(entry.second);
+    }
+    for (esp_stream_connection* stream : idle_streams) close_udp_stream(*stream, "idle, closed");
+}
+
+// Copy one whole packet into the stream's ring; with no room it is dropped like a packet without a slot
+static void append_udp_packet(esp_stream_connection& stream, const uint8_t* packet, size_t packet_bytes) {
+    receive_ring& ring = stream.receive_buffer;
+    if (ring.writable_bytes() < packet_bytes) {
+        stream.receive_counters.packets_dropped.add();
+        this_thread_pipeline_counters()[pipeline_counter::packets_dropped].add();
+        return;
+    }
+    memcpy(ring.write_pointer(), packet, packet_bytes); // the mirrored mapping keeps this contiguous
+    ring.commit_write(packet_bytes);
+}
+
+static void on_udp_datagram(receiver_shard& shard, const struct sockaddr_in& source, const uint8_t* datagram,
+                            size_t datagram_bytes, bool truncated, uint64_t host_receive_us) {
+    pipeline_thread_counters& counters = this_thread_pipeline_counters();
+    counters[pipeline_counter::udp_datagrams_received].add();
+    counters[pipeline_counter::bytes_received].add(datagram_bytes);
+
+    // only well-formed packets may open a stream
+    size_t header_bytes = 0;
+    const esp2_wire_header* header = truncated ? nullptr : esp2_wire_header_view(datagram, datagram_bytes);
+    if (header) header_bytes = header->header_bytes();
+    if (!header || header_bytes + header->payload_bytes() != datagram_bytes) {
+        counters[pipeline_counter::udp_datagrams_rejected].add();
+        return;
+    }
+    esp_stream_connection* stream = find_or_create_udp_stream(shard, source);
+    if (!stream) {
+        counters[pipeline_counter::udp_datagrams_rejected].add();
+        return;
+    }
+    stream->last_datagram_us = host_receive_us;
+    stream->receive_counters.bytes_received.add(datagram_bytes);
+
+    const esp2_fec_extension* fec = esp2_fec_extension_of(*header);
+    bool is_parity = fec && (header->flags() & ESP2_FLAG_FEC_PARITY);
+    if (!is_parity) append_udp_packet(*stream, datagram, datagram_bytes);
+    if (fec) {
+        uint64_t unrecoverable_before = stream->fec_decoder.unrecoverable_packets();
+        size_t recovered_bytes = 0;
+        const uint8_t* recovered = stream->fec_decoder.add_packet(*header, *fec, datagram + header_bytes,
+                                                                  datagram_bytes - header_bytes, &recovered_bytes);
+        if (recovered) {
+            append_udp_packet(*stream, recovered, recovered_bytes);
+            stream->receive_counters.fec_packets_recovered.add();
+            counters[pipeline_counter::fec_packets_recovered].add();
+        }
+        uint64_t newly_unrecoverable = stream->fec_decoder.unrecoverable_packets() - unrecoverable_before;
+        if (newly_unrecoverable) {
+            stream->receive_counters.fec_packets_unrecoverable.add(newly_unrecoverable);
+            counters[pipeline_counter::fec_packets_unrecoverable].add(newly_unrecoverable);
+        }
+    }
+    if (!frame_received_packets(*stream, host_receive_us)) close_udp_stream(*stream, "sent an unusable packet, closed");
+}
+
+static inline uint64_t udp_batch_bytes(const struct mmsghdr* messages, int received) {
+    uint64_t bytes = 0;
+    for (int i = 0; i < received; ++i) bytes += messages[i].msg_len;
+    return bytes;
+}
+
+// Drain the UDP socket in recvmmsg() batches (up to a fairness budget). Never blocks.
+static void service_udp_socket(receiver_shard& shard, int udp_fd) {
+    struct sockaddr_in* sources = shard.udp_sources;
+    struct iovec* vectors = shard.udp_vectors;
+    struct mmsghdr* messages = shard.udp_messages;
+    auto datagram_at = [&shard](size_t i) { return shard.udp_datagram_storage.data() + i * UDP_MAX_DATAGRAM_BYTES; };
+
+    for (size_t batch = 0; batch < UDP_RECV_BATCHES_PER_WAKEUP; ++batch) {
+        for (size_t i = 0; i < UDP_RECV_BATCH_DATAGRAMS; ++i) {
+            vectors[i].iov_base = datagram_at(i);
+            vectors[i].iov_len = UDP_MAX_DATAGRAM_BYTES;
+            memset(&messages[i].msg_hdr, 0, sizeof(messages[i].msg_hdr));
+            messages[i].msg_hdr.msg_name = &sources[i];
+            messages[i].msg_hdr.msg_namelen = sizeof(sources[i]);
+            messages[i].msg_hdr.msg_iov = &vectors[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+        }
+        int received;
+        {
+            ESP_TRACE_NAMED_SPAN(recv_span, recv, 0, 0);
+            received = recvmmsg(udp_fd, messages, UDP_RECV_BATCH_DATAGRAMS, MSG_DONTWAIT, nullptr);
+            ESP_TRACE_SET_ARG(recv_span, received > 0 ? udp_batch_bytes(messages, received) : 0);
+        }
+        if (received < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("recvmmsg");
+            return;
+        }
+        uint64_t host_receive_us = host_monotonic_us();
+        for (int i = 0; i < received; ++i) {
+            bool truncated = (messages[i].msg_hdr.msg_flags & MSG_TRUNC) != 0;
+            on_udp_datagram(shard, sources[i], datagram_at(i), messages[i].msg_len, truncated, host_receive_us);
+        }
+        if ((size_t)received < UDP_RECV_BATCH_DATAGRAMS) return; // drained
+    }
+}
+
+static int open_udp_socket(const receiver_shard& shard, int epoll_fd) {
+    int udp_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (udp_fd < 0) {
+        perror("socket(udp)");
+        return -1;
+    }
+    // the kernel hashes each source address to one of the shards' sockets
+    int reuse_port_flag = 1;
+    if (shard.reuse_port && setsockopt(udp_fd, SOL_SOCKET, SO_REUSEPORT, &reuse_port_flag, sizeof(reuse_port_flag)) < 0) {
+        perror("setsockopt(SO_REUSEPORT)");
+    }
+    int receive_buffer_bytes = RECV_SOCKET_BUFFER_BYTES;
+    if (setsockopt(udp_fd, SOL_SOCKET, SO_RCVBUF, &receive_buffer_bytes, sizeof(receive_buffer_bytes)) < 0) {
+        perror("setsockopt(SO_RCVBUF)");
+    }
+    struct sockaddr_in bind_address;
+    memset(&bind_address, 0, sizeof(bind_address));
+    bind_address.sin_family = AF_INET;
+    bind_address.sin_port = htons(UDP_LISTEN_PORT);
+    bind_address.sin_addr.s_addr = INADDR_ANY;
+    struct epoll_event udp_event;
+    memset(&udp_event, 0, sizeof(udp_event));
+    udp_event.events = EPOLLIN;
+    udp_event.data.ptr = &global_udp_socket_epoll_tag;
+    if (bind(udp_fd, (struct sockaddr*)&bind_address, sizeof(bind_address)) < 0 ||
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, udp_fd, &udp_event) < 0) {
+        perror("udp bind/epoll_ctl");
+        close(udp_fd);
+        return -1;
+    }
+    if (shard.shard_index == 0) std::cout << "[UDP] listening on port " << UDP_LISTEN_PORT << std::endl;
+    return udp_fd;
+}
+
+static void tcp_audio_receiver_server_loop(receiver_shard& shard) {
+    pin_current_thread_to_shard_cpu(shard);
+    this_thread_pipeline_counters(); // register before the packet path, it allocates once
+    ESP_TRACE_THREAD("receiver " + std::to_string(shard.shard_index));
+    mark_current_thread_as_packet_path();
+
+    // Create listen socket
+    int listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        perror("socket");
+        return;
+    }
+
+    // keep the fd for shutdown signaling
+    shard.listen_socket_fd.store(listen_fd);
+
+    // allow reuse address; with shards, every shard listens on the port and the kernel
+    // spreads new connections across them
+    int reuse_flag = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse_flag, sizeof(reuse_flag));
+    if (shard.reuse_port && setsockopt(listen_fd, SOL_SOCKET, SO_REUSEPORT, &reuse_flag, sizeof(reuse_flag)) < 0) {
+        perror("setsockopt(SO_REUSEPORT)");
+    }
+
+    // accepted sockets inherit the receive buffer; set before listen() so the window scale covers it
+    int receive_buffer_bytes = RECV_SOCKET_BUFFER_BYTES;
+    if (setsockopt(listen_fd, SOL_SOCKET, SO_RCVBUF, &receive_buffer_bytes, sizeof(receive_buffer_bytes)) < 0) {
+        perror("setsockopt(SO_RCVBUF)");
+    }
+
+    struct sockaddr_in bind_address;
+    memset(&bind_address, 0, sizeof(bind_address));
+    bind_address.sin_family = AF_INET;
+    bind_address.sin_port = htons(TCP_LISTEN_PORT);
+    bind_address.sin_addr.s_addr = INADDR_ANY;
+
+    if (bind(listen_fd, (struct sockaddr*)&bind_address, sizeof(bind_address)) < 0) {
+        perror("bind");
+        close(listen_fd);
+        shard.listen_socket_fd.store(-1);
+        return;
+    }
+
+    if (listen(listen_fd, SOMAXCONN) < 0) {
+        perror("listen");
+        close(listen_fd);
+        shard.listen_socket_fd.store(-1);
+        return;
+    }
+
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        perror("epoll_create1");
+        close(listen_fd);
+        shard.listen_socket_fd.store(-1);
+        return;
+    }
+
+    // data.ptr == nullptr marks the listen socket; every other event carries its esp_stream_connection*
+    struct epoll_event listen_event;
+    memset(&listen_event, 0, sizeof(listen_event));
+    listen_event.events = EPOLLIN;
+    listen_event.data.ptr = nullptr;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &listen_event) < 0) {
+        perror("epoll_ctl");
+        close(epoll_fd);
+        close(listen_fd);
+        shard.listen_socket_fd.store(-1);
+        return;
+    }
+
+    if (shard.shard_index == 0) {
+        std::cout << "[TCP] listening on port " << TCP_LISTEN_PORT << " (up to " << MAX_CONCURRENT_STREAMS << " streams, "
+                  << global_receiver_shards.size() << " shard(s))" << std::endl;
+    }
+    int udp_fd = UDP_TRANSPORT_ENABLED ? open_udp_socket(shard, epoll_fd) : -1;
+    shard.epoll_fd = epoll_fd;
+
+    // wakes the loop when another shard queues a resumed session's connection
+    int handoff_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    struct epoll_event handoff_event;
+    memset(&handoff_event, 0, sizeof(handoff_event));
+    handoff_event.events = EPOLLIN;
+    handoff_event.data.ptr = &global_session_handoff_epoll_tag;
+    if (handoff_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, handoff_fd, &handoff_event) < 0) {
+        perror("eventfd");  // sessions still start, they just cannot be resumed
+        if (handoff_fd >= 0) close(handoff_fd);
+        handoff_fd = -1;
+    }
+    {
+        std::lock_guard<std::mutex> lock(global_stream_registry_mutex);
+        shard.session_handoff_event_fd = handoff_fd;
+    }
+
+    struct epoll_event ready_events[EPOLL_MAX_EVENTS_PER_WAIT];
+    while (global_should_run.load()) {
+        // bounded wait so a shutdown request is noticed even when every stream is idle
+        bool streams_waiting = !shard.throttled_streams.empty() || !shard.streams_awaiting_label.empty();
+        int wait_timeout_ms = streams_waiting ? RECEIVE_THROTTLED_POLL_MS : EPOLL_WAIT_TIMEOUT_MS;
+        int ready_count = epoll_wait(epoll_fd, ready_events, EPOLL_MAX_EVENTS_PER_WAIT, wait_timeout_ms);
+        if (ready_count < 0) {
+            if (errno == EINTR) {
+                // interrupted by signal, check global flag
+                continue;
+            }
+            perror("epoll_wait");
+            break;
+        }
+
+        if (!shard.streams_pending_close.empty()) retry_pending_stream_closes(shard);
+        if (!shard.throttled_streams.empty()) resume_throttled_streams(shard, epoll_fd);
+        if (!shard.udp_streams.empty()) close_idle_udp_streams(shard, host_monotonic_us());
+        if (!shard.parked_sessions.empty()) expire_parked_sessions(shard, host_monotonic_us());
+        if (!shard.streams_awaiting_label.empty()) release_streams_awaiting_label(shard, epoll_fd);
+
+        bool handoffs_signalled = false;
+        for (int event_index = 0; event_index < ready_count; ++event_index) {
+            const struct epoll_event& ready = ready_events[event_index];
+            if (ready.data.ptr == nullptr) {
+                ESP_TRACE_SPAN(accept, 0, 0);
+                accept_pending_streams(shard, listen_fd, epoll_fd);
+                continue;
+            }
+            if (ready.data.ptr == &global_udp_socket_epoll_tag) {
+                service_udp_socket(shard, udp_fd);
+                continue;
+            }
+            if (ready.data.ptr == &global_session_handoff_epoll_tag) {
+                uint64_t wakeups = 0;
+                if (read(handoff_fd, &wakeups, sizeof(wakeups)) < 0 && errno != EAGAIN) perror("read(eventfd)");
+                handoffs_signalled = true;
+                continue;
+            }
+
+            esp_stream_connection& stream = *static_cast<esp_stream_connection*>(ready.data.ptr);
+            if (stream.socket_fd < 0) continue; // closed by an earlier event of this batch
+            stream_read_result result = stream_read_result::keep;
+            if (ready.events & EPOLLIN) {
+                result = service_readable_stream(stream);
+                if (result == stream_read_result::keep && stream.receive_throttled) throttle_stream(epoll_fd, stream);
+            }
+            // hang-up/error with nothing left to read; EPOLLRDHUP alone is handled by recv() returning 0
+            if (result == stream_read_result::keep && (ready.events & (EPOLLHUP | EPOLLERR)) && !(ready.events & EPOLLIN)) {
+                result = stream_read_result::disconnected;
+            }
+            if (result == stream_read_result::handed_over) {
+                release_handed_over_stream(stream);
+            } else if (result == stream_read_result::disconnected && stream.session_enabled) {
+                park_session_stream(epoll_fd, stream);
+            } else if (result != stream_read_result::keep) {
+                drop_stream(epoll_fd, stream);
+            }
         }
-        if (r == 0) {
-            // peer closed connection
-            return false;
+        // after the batch: none of its events can belong to a socket replaced here
+        if (handoffs_signalled) take_session_handoffs(shard);
+    } // event loop
+
+    // Shutdown: no more handoffs; connections already queued are closed (their devices
+    // keep the audio and try again)
+    std::vector<session_handoff> pending_handoffs;
+    {
+        std::lock_guard<std::mutex> lock(global_stream_registry_mutex);
+        shard.session_handoff_event_fd = -1;
+        pending_handoffs.swap(shard.incoming_session_handoffs);
+    }
+    for (const session_handoff& handoff : pending_handoffs) {
+        if (handoff.socket_fd >= 0) close(handoff.socket_fd);
+    }
+    if (handoff_fd >= 0) close(handoff_fd);
+    while (!shard.parked_sessions.empty()) {
+        std::cout << "[TCP] stream " << shard.parked_sessions.front()->stream_id << " session closed at shutdown\n";
+        close_stream(*shard.parked_sessions.front());
+    }
+
+    // Shutdown: close every stream of this shard that is still connected; the writer finalizes their sinks
+    std::vector<std::shared_ptr<esp_stream_connection>> remaining_streams;
+    {
+        std::lock_guard<std::mutex> lock(global_stream_registry_mutex);
+        for (const auto& entry : global_active_streams) {
+            if (entry.second->shard == &shard) remaining_streams.push_back(entry.second);
         }
-        total_received += (size_t)r;
     }
-    return true;
+    for (const auto& stream : remaining_streams) {
+        if (stream->socket_fd >= 0) drop_stream(epoll_fd, *stream);
+    }
+    while (!shard.udp_streams.empty()) close_udp_stream(*shard.udp_streams.begin()->second, "closed at shutdown");
+    while (!shard.streams_pending_close.empty()) {
+        retry_pending_stream_closes(shard);
+        std::this_thread::sleep_for(std::chrono::microseconds(PIPELINE_IDLE_SLEEP_US));
+    }
+
+    close(epoll_fd);
+    if (udp_fd >= 0) close(udp_fd);
+    if (shard.listen_socket_fd.exchange(-1) >= 0) close(listen_fd);
+    std::cout << "[TCP] shard " << shard.shard_index << " receiver server exiting\n";
 }
 
-// Build and write a placeholder WAV header for 24-bit PCM (we will patch sizes later)
-// This follows RIFF/WAVE fmt chunk + data chunk with placeholders for sizes.
-static bool write_wav_header_placeholder(FILE* file_pointer, uint32_t sample_rate, uint16_t channels) {
-    if (!file_pointer) return false;
-
-    // RIFF chunk
-    fwrite("RIFF", 1, 4, file_pointer);
-    write_u32_le(file_pointer, 0); // placeholder for overall RIFF chunk size
-    fwrite("WAVE", 1, 4, file_pointer);
-
-    // fmt chunk (PCM)
-    fwrite("fmt ", 1, 4, file_pointer);            // note the trailing space
-    write_u32_le(file_pointer, 16);                // fmt chunk size
-    write_u16_le(file_pointer, 1);                 // audio format 1 = PCM
-    write_u16_le(file_pointer, channels);          // number of channels
-    write_u32_le(file_pointer, sample_rate);       // sample rate
-    uint32_t byte_rate = sample_rate * channels * OUT_BYTES_PER_SAMPLE;
-    write_u32_le(file_pointer, byte_rate);         // byte rate
-    uint16_t block_align = channels * OUT_BYTES_PER_SAMPLE;
-    write_u16_le(file_pointer, block_align);       // block align
-    write_u16_le(file_pointer, OUT_BYTES_PER_SAMPLE * 8); // bits per sample (24)
-
-    // data chunk header
-    fwrite("data", 1, 4, file_pointer);
-    write_u32_le(file_pointer, 0); // placeholder for data size
+// ----------------- Drogon web UI handlers (use the same globals) -----------------
 
-    return true;
+// Build a JSON status object using the shared globals
+static Json::Value build_live_monitor_status_json(); // defined with the /listen endpoint below
+
+static Json::Value latency_histogram_json(const latency_histogram& histogram) {
+    Json::Value histogram_json;
+    histogram_json["p50_us"] = static_cast<Json::UInt64>(histogram.percentile(0.50));
+    histogram_json["p99_us"] = static_cast<Json::UInt64>(histogram.percentile(0.99));
+    histogram_json["max_us"] = static_cast<Json::UInt64>(histogram.max());
+    histogram_json["count"] = static_cast<Json::UInt64>(histogram.count());
+    return histogram_json;
 }
 
-// Finalize WAV header by writing the correct sizes (called on shutdown)
-static void finalize_wav_header(FILE* file_pointer, uint32_t total_samples_written, uint16_t channels, uint32_t sample_rate) {
-    if (!file_pointer) return;
-    uint32_t data_bytes = total_samples_written * (uint32_t)channels * (uint32_t)OUT_BYTES_PER_SAMPLE;
-    // riff size = 4 ("WAVE") + (8 + fmtChunkSize) + (8 + dataBytes)
-    uint32_t riff_size = 4 + (8 + 16) + (8 + data_bytes);
-    fflush(file_pointer);
-    fseek(file_pointer, 4, SEEK_SET);
-    write_u32_le(file_pointer, riff_size);
-    // data chunk size offset is at 4 + (8+16) + 4 = 40
-    fseek(file_pointer, 40, SEEK_SET);
-    write_u32_le(file_pointer, data_bytes);
-    fflush(file_pointer);
+// Clock offset/drift, effective sample rate and latency percentiles of one stream
+static Json::Value build_stream_timing_json(const esp_stream_connection& stream) {
+    const device_clock_estimator& clock = stream.device_clock;
+    Json::Value timing_json;
+    timing_json["estimate_ready"] = clock.has_estimate();
+    timing_json["clock_offset_us"] = clock.offset_us();
+    timing_json["clock_drift_ppm"] = clock.drift_ppm();
+    timing_json["clock_resets"] = static_cast<Json::UInt64>(clock.resets());
+    timing_json["nominal_sample_rate"] = EXPECTED_SAMPLE_RATE;
+    timing_json["sample_rate_device_clock"] = clock.sample_rate_device_clock();
+    timing_json["sample_rate_host_clock"] = clock.sample_rate_host_clock();
+    double host_rate = clock.sample_rate_host_clock();
+    timing_json["sample_rate_error_ppm"] = host_rate > 0.0 ? (host_rate / EXPECTED_SAMPLE_RATE - 1.0) * 1e6 : 0.0;
+
+    Json::Value latency_json;
+    latency_json["capture_to_receive"] = latency_histogram_json(stream.capture_to_receive_latency);
+    latency_json["receive_to_writer"] = latency_histogram_json(stream.receive_to_writer_latency);
+    latency_json["capture_to_writer"] = latency_histogram_json(stream.capture_to_writer_latency);
+    timing_json["latency"] = latency_json;
+    return timing_json;
 }
 
-// Convert a signed 32-bit left-aligned-24 sample to 3 bytes little-endian packed 24-bit
-static void int32_left24_to_3bytes_le(int32_t sample_int32_left24, uint8_t out3[3]) {
-    // arithmetic right shift by 8 to align 24-bit value
-    int32_t sample_24 = sample_int32_left24 >> 8;
-    uint32_t u24 = (uint32_t)sample_24 & 0xFFFFFFu;
-    out3[0] = (uint8_t)(u24 & 0xFF);
-    out3[1] = (uint8_t)((u24 >> 8) & 0xFF);
-    out3[2] = (uint8_t)((u24 >> 16) & 0xFF);
+// Chain settings in the shape apply_requested_dsp_chain() accepts, plus the kernel set
+static Json::Value dsp_chain_config_json(const dsp_chain_config& config) {
+    Json::Value dsp_json;
+    dsp_json["highpass"]["enabled"] = config.highpass_enabled;
+    dsp_json["highpass"]["cutoff_hz"] = config.highpass_cutoff_hz;
+    dsp_json["highpass"]["q"] = config.highpass_q;
+    dsp_json["gate"]["enabled"] = config.gate_enabled;
+    dsp_json["gate"]["threshold_dbfs"] = config.gate_threshold_dbfs;
+    dsp_json["gate"]["range_db"] = config.gate_range_db;
+    dsp_json["gate"]["attack_ms"] = config.gate_attack_ms;
+    dsp_json["gate"]["release_ms"] = config.gate_release_ms;
+    dsp_json["agc"]["enabled"] = config.agc_enabled;
+    dsp_json["agc"]["target_dbfs"] = config.agc_target_dbfs;
+    dsp_json["agc"]["max_gain_db"] = config.agc_max_gain_db;
+    dsp_json["agc"]["attack_ms"] = config.agc_attack_ms;
+    dsp_json["agc"]["release_ms"] = config.agc_release_ms;
+    dsp_json["limiter"]["enabled"] = config.limiter_enabled;
+    dsp_json["limiter"]["ceiling_dbfs"] = config.limiter_ceiling_dbfs;
+    dsp_json["limiter"]["release_ms"] = config.limiter_release_ms;
+    dsp_json["kernel"] = selected_dsp_chain_kernel_name();
+    return dsp_json;
+}
+
+static Json::Value build_status_json() {
+    Json::Value status_json;
+    status_json["running"] = global_should_run.load() ? 1 : 0;
+    status_json["gain"] = global_makeup_gain.load();
+    status_json["drift_compensation"] = global_drift_compensation_enabled.load();
+    status_json["activity_recording"] = global_activity_recording_enabled.load();
+    dsp_chain_config dsp_config;
+    global_dsp_chain_settings.load(dsp_config);
+    status_json["dsp"] = dsp_chain_config_json(dsp_config);
+
+    // merged over the shards: the latest packet is the shard with the furthest sample index
+    uint64_t highest_sample_index = 0;
+    uint32_t last_sequence = 0;
+    uint64_t samples_written = 0;
+    for (const auto& shard : global_receiver_shards) {
+        uint64_t shard_highest_sample_index = shard->highest_received_sample_index.load();
+        if (shard_highest_sample_index >= highest_sample_index) {
+            highest_sample_index = shard_highest_sample_index;
+            last_sequence = shard->last_received_sequence.load();
+        }
+        samples_written += shard->samples_written.load();
+    }
+    status_json["last_sequence"] = static_cast<Json::UInt>(last_sequence);
+    status_json["highest_sample_index"] = static_cast<Json::UInt64>(highest_sample_index);
+    status_json["samples_written"] = static_cast<Json::UInt64>(samples_written);
+
+    Json::Value streams_json(Json::arrayValue);
+    {
+        std::lock_guard<std::mutex> lock(global_stream_registry_mutex);
+        for (const auto& entry : global_active_streams) {
+            const esp_stream_connection& stream = *entry.second;
+            Json::Value stream_json;
+            stream_json["stream_id"] = static_cast<Json::UInt64>(stream.stream_id);
+            stream_json["peer"] = stream.peer_address;
+            stream_json["device"] = stream.device_label;
+            stream_json["transport"] = stream.udp_transport ? "udp" : "tcp";
+            char shm_segment_name[160];
+            if (SHM_EXPORT_ENABLED && shm_audio_segment_name(stream.device_label.c_str(), shm_segment_name, sizeof(shm_segment_name))) {
+                stream_json["shm_segment"] = shm_segment_name;
+            }
+            const stream_converter_info* payload_converter = stream.payload_converter.load(std::memory_order_relaxed);
+            stream_json["payload_format"] = payload_converter ? payload_converter->name : "";
+            stream_json["shard"] = stream.shard->shard_index;
+            stream_json["dsp_gain_db"] = stream.dsp_dynamics_gain_db.load(std::memory_order_relaxed);
+            stream_json["gate_open"] = stream.dsp_gate_open.load(std::memory_order_relaxed);
+            stream_json["packets_received"] = static_cast<Json::UInt64>(stream.receive_counters.packets_received.load());
+            stream_json["packets_dropped"] = static_cast<Json::UInt64>(stream.receive_counters.packets_dropped.load());
+            stream_json["samples_written"] = static_cast<Json::UInt64>(stream.write_counters.frames_written.load());
+            stream_json["last_sequence"] = static_cast<Json::UInt>(stream.last_received_sequence.load());
+            stream_json["highest_sample_index"] = static_cast<Json::UInt64>(stream.highest_received_sample_index.load());
+            stream_json["capture_overrun_frames"] = static_cast<Json::UInt64>(stream.receive_counters.capture_overrun_frames.load());
+            if (stream.udp_transport) {
+                Json::Value fec_json;
+                fec_json["recovered"] = static_cast<Json::UInt64>(stream.receive_counters.fec_packets_recovered.load());
+                fec_json["unrecoverable"] = static_cast<Json::UInt64>(stream.receive_counters.fec_packets_unrecoverable.load());
+                stream_json["fec"] = fec_json;
+            }
+            if (stream.session_enabled) {
+                char device_id_text[17];
+                snprintf(device_id_text, sizeof(device_id_text), "%016llx", (unsigned long long)stream.session_device_id);
+                Json::Value session_json;
+                session_json["device_id"] = device_id_text;
+                session_json["resumes"] = stream.session_resumes.load(std::memory_order_relaxed);
+                session_json["parked"] = stream.session_parked.load(std::memory_order_relaxed);
+                stream_json["session"] = session_json;
+            }
+
+            // sample-index timeline health (see jitter_buffer.h)
+            const jitter_buffer_counters& timeline_counters = stream.output_jitter_buffer.counters();
+            Json::Value timeline_json;
+            timeline_json["gap_events"] = static_cast<Json::UInt64>(timeline_counters.gap_events.load());
+            timeline_json["gap_frames"] = static_cast<Json::UInt64>(timeline_counters.gap_frames.load());
+            timeline_json["duplicate_frames"] = static_cast<Json::UInt64>(timeline_counters.duplicate_frames.load());
+            timeline_json["late_frames"] = static_cast<Json::UInt64>(timeline_counters.late_frames.load());
+            timeline_json["reordered_packets"] = static_cast<Json::UInt64>(timeline_counters.reordered_packets.load());
+            timeline_json["resyncs"] = static_cast<Json::UInt64>(timeline_counters.timeline_resyncs.load());
+            stream_json["timeline"] = timeline_json;
+
+            Json::Value level_json;
+            level_json["peak_dbfs"] = stream.output_level_meter.peak_dbfs();
+            level_json["rms_dbfs"] = stream.output_level_meter.rms_dbfs();
+            stream_json["level"] = level_json;
+            stream_json["timing"] = build_stream_timing_json(stream);
+            Json::Value drift_json;
+            drift_json["active"] = stream.drift_compensation_active.load(std::memory_order_relaxed);
+            drift_json["rate_correction_ppm"] = stream.drift_rate_correction_ppm.load(std::memory_order_relaxed);
+            drift_json["phase_error_us"] = stream.drift_phase_error_us.load(std::memory_order_relaxed);
+            stream_json["drift_compensation"] = drift_json;
+            const activity_clip_counters& activity_counters = stream.activity_gate.counters();
+            Json::Value activity_json;
+            activity_json["in_clip"] = activity_counters.in_clip.load(std::memory_order_relaxed);
+            activity_json["level_dbfs"] = activity_counters.level_dbfs.load(std::memory_order_relaxed);
+            activity_json["noise_floor_dbfs"] = activity_counters.noise_floor_dbfs.load(std::memory_order_relaxed);
+            activity_json["flux_bins"] = activity_counters.flux_bins.load(std::memory_order_relaxed);
+            activity_json["clips"] = static_cast<Json::UInt64>(activity_counters.clips_finished.load(std::memory_order_relaxed));
+            activity_json["frames_seen"] = static_cast<Json::UInt64>(activity_counters.frames_seen.load(std::memory_order_relaxed));
+            activity_json["frames_in_clips"] = static_cast<Json::UInt64>(activity_counters.frames_passed.load(std::memory_order_relaxed));
+            stream_json["activity"] = activity_json;
+            streams_json.append(stream_json);
+        }
+    }
+    status_json["active_streams"] = streams_json.size();
+    status_json["streams"] = streams_json;
+
+    // per-stage queue depth / high-water marks of the receiver -> DSP -> writer pipelines:
+    // summed over the shards (high-water: the deepest shard), then per shard
+    struct ring_totals {
+        uint64_t depth = 0, high_water = 0, capacity = 0;
+        void add(const spsc_ring<audio_packet_slot*>& ring) {
+            depth += ring.depth();
+            high_water = std::max<uint64_t>(high_water, ring.high_water());
+            capacity += ring.capacity();
+        }
+        Json::Value json() const {
+            Json::Value ring_status;
+            ring_status["depth"] = static_cast<Json::UInt64>(depth);
+            ring_status["high_water"] = static_cast<Json::UInt64>(high_water);
+            ring_status["capacity"] = static_cast<Json::UInt64>(capacity);
+            return ring_status;
+        }
+    };
+    ring_totals dsp_queue_totals, writer_queue_totals;
+    uint64_t free_slots = 0, slab_bytes = 0, slab_allocations = 0;
+    Json::Value shards_json(Json::arrayValue);
+    for (const auto& shard : global_receiver_shards) {
+        ring_totals shard_dsp_queue, shard_writer_queue;
+        shard_dsp_queue.add(shard->dsp_input_ring);
+        shard_writer_queue.add(shard->writer_input_ring);
+        dsp_queue_totals.add(shard->dsp_input_ring);
+        writer_queue_totals.add(shard->writer_input_ring);
+        free_slots += shard->free_slot_ring.depth();
+        slab_bytes += shard->packet_pool.slab_bytes();
+        slab_allocations += shard->packet_pool.slab_allocations();
+
+        Json::Value shard_json;
+        shard_json["shard"] = shard->shard_index;
+        shard_json["cpu"] = shard->pinned_cpu;
+        shard_json["dsp_queue"] = shard_dsp_queue.json();
+        shard_json["writer_queue"] = shard_writer_queue.json();
+        shard_json["free_slots"] = static_cast<Json::UInt64>(shard->free_slot_ring.depth());
+        shard_json["samples_written"] = static_cast<Json::UInt64>(shard->samples_written.load());
+        shards_json.append(shard_json);
+    }
+    Json::Value pipeline_json;
+    pipeline_json["dsp_queue"] = dsp_queue_totals.json();
+    pipeline_json["writer_queue"] = writer_queue_totals.json();
+    pipeline_json["free_slots"] = static_cast<Json::UInt64>(free_slots);
+    pipeline_json["slot_count"] = static_cast<Json::UInt64>(PIPELINE_SLOT_COUNT * global_receiver_shards.size());
+    pipeline_json["dropped_packets"] = static_cast<Json::UInt64>(pipeline_counter_total(pipeline_counter::packets_dropped));
+    pipeline_json["shards"] = shards_json;
+    status_json["pipeline"] = pipeline_json;
+
+    // packet slab usage; packet_path_heap_allocations stays flat while streams are running
+    Json::Value pool_json;
+    pool_json["slab_bytes"] = static_cast<Json::UInt64>(slab_bytes);
+    pool_json["slot_output_bytes"] = static_cast<Json::UInt64>(global_receiver_shards.front()->packet_pool.output_capacity());
+    pool_json["stream_receive_ring_bytes"] = static_cast<Json::UInt64>(RECEIVE_RING_BYTES);
+    pool_json["slab_allocations"] = static_cast<Json::UInt64>(slab_allocations);
+    pool_json["packet_path_heap_allocations"] = static_cast<Json::UInt64>(packet_path_heap_allocation_count());
+    status_json["packet_pool"] = pool_json;
+    status_json["conversion_kernel"] = selected_packed24_convert_kernel_name();
+
+    const wav_writer_statistics& writer_stats = wav_writer_stats();
+    Json::Value writer_json;
+    writer_json["backend"] = wav_writer_backend_name();
+    writer_json["write_syscalls"] = static_cast<Json::UInt64>(writer_stats.write_syscalls.load());
+    writer_json["bytes_written"] = static_cast<Json::UInt64>(writer_stats.bytes_written.load());
+    writer_json["header_patches"] = static_cast<Json::UInt64>(writer_stats.header_patches.load());
+    writer_json["fdatasync_calls"] = static_cast<Json::UInt64>(writer_stats.fdatasync_calls.load());
+    writer_json["write_errors"] = static_cast<Json::UInt64>(writer_stats.write_errors.load());
+    writer_json["batch_bytes"] = static_cast<Json::UInt64>(WAV_WRITE_BATCH_BYTES);
+    writer_json["flush_interval_ms"] = WAV_FLUSH_INTERVAL_MS;
+    writer_json["durability_interval_ms"] = WAV_DURABILITY_SYNC_INTERVAL_MS;
+    writer_json["segments_closed"] = static_cast<Json::UInt64>(writer_stats.segments_closed.load());
+    writer_json["segment_max_seconds"] = WAV_SEGMENT_MAX_SECONDS;
+    writer_json["segment_max_bytes"] = static_cast<Json::UInt64>(WAV_SEGMENT_MAX_BYTES);
+    writer_json["rf64"] = WAV_ALLOW_RF64;
+    status_json["writer"] = writer_json;
+
+    const stream_archive_statistics& archive_stats = stream_archive_stats();
+    Json::Value archive_json;
+    archive_json["enabled"] = ARCHIVE_ENABLED;
+    archive_json["directory"] = ARCHIVE_DIRECTORY;
+    archive_json["chunk_seconds"] = ARCHIVE_CHUNK_SECONDS;
+    archive_json["write_syscalls"] = static_cast<Json::UInt64>(archive_stats.write_syscalls.load());
+    archive_json["bytes_written"] = static_cast<Json::UInt64>(archive_stats.bytes_written.load());
+    archive_json["records_started"] = static_cast<Json::UInt64>(archive_stats.records_started.load());
+    archive_json["chunks_opened"] = static_cast<Json::UInt64>(archive_stats.chunks_opened.load());
+    archive_json["fdatasync_calls"] = static_cast<Json::UInt64>(archive_stats.fdatasync_calls.load());
+    archive_json["write_errors"] = static_cast<Json::UInt64>(archive_stats.write_errors.load());
+    archive_json["ranges_served"] = static_cast<Json::UInt64>(archive_stats.ranges_served.load());
+    archive_json["bytes_served"] = static_cast<Json::UInt64>(archive_stats.bytes_served.load());
+    status_json["archive"] = archive_json;
+    status_json["live_monitor"] = build_live_monitor_status_json();
+    return status_json;
 }
 
-// Helper to read an int32 from 4 bytes little-endian
-static inline int32_t le_bytes_to_int32(const uint8_t* p) {
-    uint32_t w = (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
-    return (int32_t)w;
+// Clamp and apply a gain request from /control or /ws; returns the gain now in effect
+static double apply_requested_gain(double requested_gain) {
+    // clamp to reasonable range
+    if (requested_gain < 0.01) requested_gain = 0.01;
+    if (requested_gain > 16.0) requested_gain = 16.0;
+    global_makeup_gain.store(requested_gain);
+    return requested_gain;
 }
 
-// ----------------- Header validation helper -----------------
-static void validate_header_basics(uint32_t sample_rate, uint8_t channels, uint8_t bytes_per_sample, uint16_t format_id) {
-    if (sample_rate != EXPECTED_SAMPLE_RATE) {
-        std::cerr << "[WARN] sample_rate mismatch: received=" << sample_rate << " expected=" << EXPECTED_SAMPLE_RATE << "\n";
+// Merge a "dsp" request from /control or /ws onto the current chain settings, e.g.
+//   {"highpass":{"enabled":true,"cutoff_hz":100},"gate":{"threshold_dbfs":-55}}
+// Members left out are kept. Returns the settings now in effect (clamped).
+static Json::Value apply_requested_dsp_chain(const Json::Value& request) {
+    static std::mutex apply_mutex; // concurrent requests merge one after the other
+    std::lock_guard<std::mutex> lock(apply_mutex);
+    dsp_chain_config config;
+    global_dsp_chain_settings.load(config);
+    auto read_flag = [](const Json::Value& stage, const char* key, bool& field) {
+        if (stage.isMember(key) && stage[key].isBool()) field = stage[key].asBool();
+    };
+    auto read_number = [](const Json::Value& stage, const char* key, float& field) {
+        if (stage.isMember(key) && stage[key].isNumeric()) field = (float)stage[key].asDouble();
+    };
+    const Json::Value& highpass = request["highpass"];
+    if (highpass.isObject()) {
+        read_flag(highpass, "enabled", config.highpass_enabled);
+        read_number(highpass, "cutoff_hz", config.highpass_cutoff_hz);
+        read_number(highpass, "q", config.highpass_q);
     }
-    if (channels != EXPECTED_CHANNEL_COUNT) {
-        std::cerr << "[WARN] channel count mismatch: received=" << int(channels) << " expected=" << int(EXPECTED_CHANNEL_COUNT) << "\n";
+    const Json::Value& gate = request["gate"];
+    if (gate.isObject()) {
+        read_flag(gate, "enabled", config.gate_enabled);
+        read_number(gate, "threshold_dbfs", config.gate_threshold_dbfs);
+        read_number(gate, "range_db", config.gate_range_db);
+        read_number(gate, "attack_ms", config.gate_attack_ms);
+        read_number(gate, "release_ms", config.gate_release_ms);
     }
-    if (bytes_per_sample != IN_BYTES_PER_SAMPLE) {
-        std::cerr << "[WARN] bytes_per_sample mismatch: received=" << int(bytes_per_sample) << " expected=" << int(IN_BYTES_PER_SAMPLE) << "\n";
+    const Json::Value& agc = request["agc"];
+    if (agc.isObject()) {
+        read_flag(agc, "enabled", config.agc_enabled);
+        read_number(agc, "target_dbfs", config.agc_target_dbfs);
+        read_number(agc, "max_gain_db", config.agc_max_gain_db);
+        read_number(agc, "attack_ms", config.agc_attack_ms);
+        read_number(agc, "release_ms", config.agc_release_ms);
     }
-    if (format_id != FORMAT_INT32_LEFT24) {
-        std::cerr << "[WARN] format_id mismatch: received=" << format_id << " expected=" << FORMAT_INT32_LEFT24 << "\n";
+    const Json::Value& limiter = request["limiter"];
+    if (limiter.isObject()) {
+        read_flag(limiter, "enabled", config.limiter_enabled);
+        read_number(limiter, "ceiling_dbfs", config.limiter_ceiling_dbfs);
+        read_number(limiter, "release_ms", config.limiter_release_ms);
     }
+    config = sanitize_dsp_chain_config(config);
+    global_dsp_chain_settings.store(config);
+    return dsp_chain_config_json(config);
 }
 
-// ----------------- TCP receiver server -----------------
+// ----------------- WebSocket status push (/ws) -----------------
+//
+// One publisher thread builds the status JSON at most once per tick and sends each
+// subscriber only the members that changed since what that subscriber last got.
+// Every message carries absolute values, so dropped or skipped pushes cost nothing
+// but freshness. The audio threads only ever publish atomics that build_status_json()
+// reads; they never touch a socket.
+
+struct status_subscriber {
+    Json::Value last_sent_status{Json::objectValue};
+    uint32_t push_interval_ms = STATUS_PUSH_DEFAULT_INTERVAL_MS;
+    std::chrono::steady_clock::time_point next_push_time;
+    std::chrono::steady_clock::time_point next_keyframe_time; // first push is always a full snapshot
+};
+
+static std::mutex global_status_subscribers_mutex;
+static std::map<WebSocketConnectionPtr, status_subscriber> global_status_subscribers;
+
+static std::string json_to_compact_string(const Json::Value& value) {
+    Json::StreamWriterBuilder writer_builder;
+    writer_builder["indentation"] = "";
+    return Json::writeString(writer_builder, value);
+}
 
-static void tcp_audio_receiver_server_loop() {
-    // Create listen socket
-    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (listen_fd < 0) {
-        perror("socket");
-        return;
+// Members of current that differ from previous. Objects are diffed recursively;
+// arrays (e.g. streams) and scalars are replaced whole.
+static Json::Value build_json_delta(const Json::Value& previous, const Json::Value& current) {
+    Json::Value delta(Json::objectValue);
+    for (const std::string& member_name : current.getMemberNames()) {
+        const Json::Value& current_member = current[member_name];
+        if (!previous.isMember(member_name)) {
+            delta[member_name] = current_member;
+            continue;
+        }
+        const Json::Value& previous_member = previous[member_name];
+        if (current_member.isObject() && previous_member.isObject()) {
+            Json::Value nested_delta = build_json_delta(previous_member, current_member);
+            if (nested_delta.size() > 0) delta[member_name] = nested_delta;
+        } else if (current_member != previous_member) {
+            delta[member_name] = current_member;
+        }
     }
+    return delta;
+}
 
-    // keep global fd for shutdown signaling
-    global_tcp_listen_socket_fd = listen_fd;
-
-    // allow reuse address
-    int reuse_flag = 1;
-    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse_flag, sizeof(reuse_flag));
+static void send_json_to_subscriber(const WebSocketConnectionPtr& connection, const Json::Value& message) {
+    // queued on the connection's event loop; never blocks this thread on the client
+    if (connection->connected()) connection->send(json_to_compact_string(message));
+}
 
-    struct sockaddr_in bind_address;
-    memset(&bind_address, 0, sizeof(bind_address));
-    bind_address.sin_family = AF_INET;
-    bind_address.sin_port = htons(TCP_LISTEN_PORT);
-    bind_address.sin_addr.s_addr = INADDR_ANY;
+class status_websocket_controller : public drogon::WebSocketController<status_websocket_controller> {
+public:
+    void handleNewConnection(const HttpRequestPtr& /*request*/, const WebSocketConnectionPtr& connection) override {
+        std::lock_guard<std::mutex> lock(global_status_subscribers_mutex);
+        status_subscriber& subscriber = global_status_subscribers[connection];
+        subscriber.next_push_time = std::chrono::steady_clock::now();
+        subscriber.next_keyframe_time = subscriber.next_push_time;
+    }
 
-    if (bind(listen_fd, (struct sockaddr*)&bind_address, sizeof(bind_address)) < 0) {
-        perror("bind");
-        close(listen_fd);
-        global_tcp_listen_socket_fd = -1;
-        return;
+    void handleConnectionClosed(const WebSocketConnectionPtr& connection) override {
+        std::lock_guard<std::mutex> lock(global_status_subscribers_mutex);
+        global_status_subscribers.erase(connection);
     }
 
-    if (listen(listen_fd, 1) < 0) {
-        perror("listen");
-        close(listen_fd);
-        global_tcp_listen_socket_fd = -1;
-        return;
+    // Commands: {"cmd":"set","gain":g,"drift_compensation":b,"activity_recording":b,"dsp":{...}}
+    // and {"cmd":"interval","ms":n}
+    void handleNewMessage(const WebSocketConnectionPtr& connection, std::string&& message,
+                          const WebSocketMessageType& message_type) override {
+        if (message_type != WebSocketMessageType::Text) return;
+        Json::Value reply;
+        Json::Value command;
+        std::string parse_errors;
+        std::istringstream message_stream(message);
+        if (!Json::parseFromStream(Json::CharReaderBuilder(), message_stream, &command, &parse_errors) || !command.isObject()) {
+            reply["type"] = "error";
+            reply["message"] = "Invalid JSON";
+            send_json_to_subscriber(connection, reply);
+            return;
+        }
+
+        std::string command_name = command.get("cmd", "").asString();
+        bool sets_gain = command.isMember("gain") && command["gain"].isNumeric();
+        bool sets_drift_compensation = command.isMember("drift_compensation") && command["drift_compensation"].isBool();
+        bool sets_activity_recording = command.isMember("activity_recording") && command["activity_recording"].isBool();
+        bool sets_dsp_chain = command.isMember("dsp") && command["dsp"].isObject();
+        if (command_name == "set" && (sets_gain || sets_drift_compensation || sets_activity_recording || sets_dsp_chain)) {
+            reply["type"] = "ack";
+            reply["cmd"] = "set";
+            if (sets_gain) reply["gain"] = apply_requested_gain(command["gain"].asDouble());
+            if (sets_drift_compensation) {
+                global_drift_compensation_enabled.store(command["drift_compensation"].asBool());
+                reply["drift_compensation"] = global_drift_compensation_enabled.load();
+            }
+            if (sets_activity_recording) {
+                global_activity_recording_enabled.store(command["activity_recording"].asBool());
+                reply["activity_recording"] = global_activity_recording_enabled.load();
+            }
+            if (sets_dsp_chain) reply["dsp"] = apply_requested_dsp_chain(command["dsp"]);
+        } else if (command_name == "interval" && command.isMember("ms") && command["ms"].isNumeric()) {
+            uint32_t interval_ms = std::min(std::max((uint32_t)std::max(command["ms"].asInt(), 0), STATUS_PUSH_MIN_INTERVAL_MS),
+                                            STATUS_PUSH_MAX_INTERVAL_MS);
+            {
+                std::lock_guard<std::mutex> lock(global_status_subscribers_mutex);
+                auto subscriber = global_status_subscribers.find(connection);
+                if (subscriber != global_status_subscribers.end()) subscriber->second.push_interval_ms = interval_ms;
+            }
+            reply["type"] = "ack";
+            reply["cmd"] = "interval";
+            reply["ms"] = interval_ms;
+        } else {
+            reply["type"] = "error";
+            reply["message"] = "Unknown command '" + command_name + "'";
+        }
+        send_json_to_subscriber(connection, reply);
     }
 
-    std::cout << "[TCP] listening on port " << TCP_LISTEN_PORT << std::endl;
+    WS_PATH_LIST_BEGIN
+    WS_PATH_ADD("/ws");
+    WS_PATH_LIST_END
+};
 
+static void status_push_loop() {
     while (global_should_run.load()) {
-        struct sockaddr_in client_address;
-        socklen_t client_address_length = sizeof(client_address);
+        std::this_thread::sleep_for(std::chrono::milliseconds(STATUS_PUSH_TICK_MS));
+        auto now = std::chrono::steady_clock::now();
 
-        std::cout << "[TCP] waiting for a client to connect...\n";
-        int client_fd = accept(listen_fd, (struct sockaddr*)&client_address, &client_address_length);
-        if (client_fd < 0) {
-            if (errno == EINTR) {
-                // interrupted by signal, check global flag
-                continue;
+        std::lock_guard<std::mutex> lock(global_status_subscribers_mutex);
+        bool any_subscriber_due = false;
+        for (const auto& entry : global_status_subscribers) {
+            if (now >= entry.second.next_push_time) any_subscriber_due = true;
+        }
+        if (!any_subscriber_due) continue;
+
+        // one snapshot per tick, shared by every subscriber that is due
+        Json::Value current_status = build_status_json();
+        for (auto& entry : global_status_subscribers) {
+            status_subscriber& subscriber = entry.second;
+            if (now < subscriber.next_push_time) continue;
+            subscriber.next_push_time = now + std::chrono::milliseconds(subscriber.push_interval_ms);
+
+            Json::Value message;
+            if (now >= subscriber.next_keyframe_time) {
+                message = current_status;
+                message["type"] = "full";
+                subscriber.next_keyframe_time = now + std::chrono::milliseconds(STATUS_PUSH_KEYFRAME_INTERVAL_MS);
+            } else {
+                message = build_json_delta(subscriber.last_sent_status, current_status);
+                if (message.size() == 0) continue; // nothing changed: coalesce to no message at all
+                message["type"] = "delta";
             }
-            perror("accept");
-            break;
+            subscriber.last_sent_status = current_status;
+            send_json_to_subscriber(entry.first, message);
         }
+    }
+}
 
-        char client_ip_str[INET_ADDRSTRLEN] = {0};
-        inet_ntop(AF_INET, &client_address.sin_addr, client_ip_str, sizeof(client_ip_str));
-        std::cout << "[TCP] client connected from " << client_ip_str << ":" << ntohs(client_address.sin_port) << std::endl;
+// ----------------- Live monitoring (/listen) -----------------
+//
+// ws://host/listen?stream=<stream_id>&rate=<48000|24000|16000|12000|8000>&format=<s16|s24>
+//
+// Listeners of the same stream, rate and format form a group. Every tick the fan-out
+// thread reads the group's new audio from the stream's monitor ring once, encodes it
+// once and sends the same message to every listener in the group. Each client acks
+// with {"received": <messages so far>}. A listener with too many unacked messages is
+// not sent the block; it resumes at the live edge once it catches up. Ingest never
+// waits on any of this: the DSP stage only writes the overwriting ring.
+
+struct live_listener {
+    uint64_t messages_sent = 0;
+    uint64_t messages_acknowledged = 0;
+    uint64_t messages_skipped = 0;
+};
+
+struct live_monitor_group {
+    std::shared_ptr<esp_stream_connection> stream;
+    uint32_t output_rate = 0;
+    live_monitor_sample_format format = live_monitor_sample_format::pcm_s16le;
+    live_monitor_encoder encoder;
+    uint64_t ring_cursor = 0;
+    uint32_t next_block_sequence = 0;
+    std::map<WebSocketConnectionPtr, live_listener> listeners;
+};
+
+static std::mutex global_live_monitor_mutex;
+static std::vector<std::unique_ptr<live_monitor_group>> global_live_monitor_groups;
+static std::atomic<uint64_t> global_live_monitor_messages_sent{0};
+static std::atomic<uint64_t> global_live_monitor_messages_skipped{0};
+static std::atomic<uint64_t> global_live_monitor_frames_skipped{0};
+
+// Caller holds global_live_monitor_mutex
+static live_monitor_group* find_live_monitor_group_of(const WebSocketConnectionPtr& connection) {
+    for (auto& group : global_live_monitor_groups) {
+        if (group->listeners.count(connection)) return group.get();
+    }
+    return nullptr;
+}
+
+static void reject_live_listener(const WebSocketConnectionPtr& connection, const std::string& reason) {
+    Json::Value reply;
+    reply["type"] = "error";
+    reply["message"] = reason;
+    send_json_to_subscriber(connection, reply);
+    connection->shutdown();
+}
 
-        // Open output WAV file (overwrite existing file on each connect)
-        FILE* output_wav_file = nullptr;
+class live_monitor_websocket_controller : public drogon::WebSocketController<live_monitor_websocket_controller> {
+public:
+    void handleNewConnection(const HttpRequestPtr& request, const WebSocketConnectionPtr& connection) override {
+        // which stream: explicit id, or the only/first active one
+        std::shared_ptr<esp_stream_connection> stream;
         {
-            std::lock_guard<std::mutex> lock(global_file_write_mutex);
-            output_wav_file = fopen(OUTPUT_WAV_FILENAME, "wb+");
-            if (!output_wav_file) {
-                perror("fopen");
-                close(client_fd);
-                continue;
-            }
-            if (!write_wav_header_placeholder(output_wav_file, EXPECTED_SAMPLE_RATE, EXPECTED_CHANNEL_COUNT)) {
-                std::cerr << "[WAV] header write failed\n";
-                fclose(output_wav_file);
-                close(client_fd);
-                continue;
+            std::string stream_parameter = request->getParameter("stream");
+            std::lock_guard<std::mutex> lock(global_stream_registry_mutex);
+            if (stream_parameter.empty()) {
+                if (!global_active_streams.empty()) stream = global_active_streams.begin()->second;
+            } else {
+                auto entry = global_active_streams.find(std::strtoull(stream_parameter.c_str(), nullptr, 10));
+                if (entry != global_active_streams.end()) stream = entry->second;
             }
-            // seek to end for append
-            fseek(output_wav_file, 0, SEEK_END);
+        }
+        if (!stream) {
+            reject_live_listener(connection, "No such stream");
+            return;
         }
 
-        bool connection_ok = true;
-
-        // header buffer
-        uint8_t header_buffer[HEADER_SIZE];
+        std::string rate_parameter = request->getParameter("rate");
+        uint32_t output_rate = rate_parameter.empty() ? LIVE_MONITOR_DEFAULT_RATE : (uint32_t)std::strtoul(rate_parameter.c_str(), nullptr, 10);
+        std::string format_parameter = request->getParameter("format");
+        live_monitor_sample_format format = format_parameter == "s24" ? live_monitor_sample_format::pcm_s24le
+                                                                      : live_monitor_sample_format::pcm_s16le;
+        if (!format_parameter.empty() && format_parameter != "s16" && format_parameter != "s24") {
+            reject_live_listener(connection, "format must be s16 or s24");
+            return;
+        }
 
-        while (global_should_run.load() && connection_ok) {
-            // Read header
-            if (!recv_all(client_fd, header_buffer, HEADER_SIZE)) {
-                std::cout << "[TCP] header receive failed or connection closed\n";
-                break;
+        std::lock_guard<std::mutex> lock(global_live_monitor_mutex);
+        live_monitor_group* group = nullptr;
+        for (auto& candidate : global_live_monitor_groups) {
+            if (candidate->stream == stream && candidate->output_rate == output_rate && candidate->format == format) {
+                group = candidate.get();
             }
-
-            // Parse header (little-endian)
-            uint32_t magic = (uint32_t)header_buffer[0] | ((uint32_t)header_buffer[1] << 8) |
-                             ((uint32_t)header_buffer[2] << 16) | ((uint32_t)header_buffer[3] << 24);
-            if (magic != HEADER_MAGIC) {
-                std::cerr << "[TCP] bad header magic: 0x" << std::hex << magic << std::dec << std::endl;
-                connection_ok = false;
-                break;
+        }
+        if (!group) {
+            auto new_group = std::make_unique<live_monitor_group>();
+            if (!new_group->encoder.configure(EXPECTED_SAMPLE_RATE, output_rate, format)) {
+                reject_live_listener(connection, "rate must divide " + std::to_string(EXPECTED_SAMPLE_RATE));
+                return;
             }
+            if (!stream->monitor_ring.initialize((size_t)EXPECTED_SAMPLE_RATE * LIVE_MONITOR_RING_SECONDS,
+                                                 PACKET_POOL_SLOT_FRAMES * PACKET_POOL_MAX_CHANNELS)) {
+                reject_live_listener(connection, "Out of memory");
+                return;
+            }
+            new_group->stream = stream;
+            new_group->output_rate = output_rate;
+            new_group->format = format;
+            new_group->ring_cursor = stream->monitor_ring.write_position(); // start at the live edge
+            group = new_group.get();
+            global_live_monitor_groups.push_back(std::move(new_group));
+        }
+        group->listeners[connection] = live_listener();
+        stream->monitor_listener_count.fetch_add(1, std::memory_order_release);
+        std::cout << "[LIVE] listener on stream " << stream->stream_id << " at " << output_rate << " Hz "
+                  << (format == live_monitor_sample_format::pcm_s24le ? "s24" : "s16") << std::endl;
+    }
 
-            uint32_t sequence_number = (uint32_t)header_buffer[4] | ((uint32_t)header_buffer[5] << 8) |
-                                       ((uint32_t)header_buffer[6] << 16) | ((uint32_t)header_buffer[7] << 24);
-
-            uint64_t first_sample_index = 0;
-            for (int i = 0; i < 8; ++i) first_sample_index |= ((uint64_t)header_buffer[8 + i]) << (8 * i);
+    void handleConnectionClosed(const WebSocketConnectionPtr& connection) override {
+        std::lock_guard<std::mutex> lock(global_live_monitor_mutex);
+        live_monitor_group* group = find_live_monitor_group_of(connection);
+        if (!group) return;
+        group->listeners.erase(connection);
+        group->stream->monitor_listener_count.fetch_sub(1, std::memory_order_release);
+        if (group->listeners.empty()) {
+            auto& groups = global_live_monitor_groups;
+            groups.erase(std::remove_if(groups.begin(), groups.end(),
+                                        [group](const std::unique_ptr<live_monitor_group>& g) { return g.get() == group; }),
+                         groups.end());
+        }
+    }
 
-            uint64_t timestamp_microseconds = 0;
-            for (int i = 0; i < 8; ++i) timestamp_microseconds |= ((uint64_t)header_buffer[16 + i]) << (8 * i);
+    // {"received": n} flow-control acks; anything else is ignored
+    void handleNewMessage(const WebSocketConnectionPtr& connection, std::string&& message,
+                          const WebSocketMessageType& message_type) override {
+        if (message_type != WebSocketMessageType::Text) return;
+        Json::Value ack;
+        std::string parse_errors;
+        std::istringstream message_stream(message);
+        if (!Json::parseFromStream(Json::CharReaderBuilder(), message_stream, &ack, &parse_errors) || !ack.isObject() ||
+            !ack.isMember("received") || !ack["received"].isNumeric()) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(global_live_monitor_mutex);
+        live_monitor_group* group = find_live_monitor_group_of(connection);
+        if (!group) return;
+        live_listener& listener = group->listeners[connection];
+        uint64_t received = ack["received"].asUInt64();
+        if (received <= listener.messages_sent) listener.messages_acknowledged = received;
+    }
 
-            uint16_t frames_in_packet = (uint16_t)header_buffer[24] | ((uint16_t)header_buffer[25] << 8);
-            uint8_t channels_in_packet = header_buffer[26];
-            uint8_t bytes_per_sample_in_packet = header_buffer[27];
-            uint32_t sample_rate_in_packet = (uint32_t)header_buffer[28] | ((uint32_t)header_buffer[29] << 8) |
-                                             ((uint32_t)header_buffer[30] << 16) | ((uint32_t)header_buffer[31] << 24);
-            uint16_t format_id_in_packet = (uint16_t)header_buffer[32] | ((uint16_t)header_buffer[33] << 8);
+    WS_PATH_LIST_BEGIN
+    WS_PATH_ADD("/listen");
+    WS_PATH_LIST_END
+};
 
-            // Basic validation (warnings only)
-            validate_header_basics(sample_rate_in_packet, channels_in_packet, bytes_per_sample_in_packet, format_id_in_packet);
+static void live_monitor_loop() {
+    // scratch reused every tick (one block of packed 24-bit audio, one encoded message)
+    std::vector<uint8_t> block_packed24(LIVE_MONITOR_MAX_BLOCK_FRAMES * OUT_BYTES_PER_SAMPLE);
+    std::string message;
+    message.reserve(LIVE_MONITOR_FRAME_HEADER_BYTES + LIVE_MONITOR_MAX_BLOCK_FRAMES * 3);
 
-            // compute payload size
-            size_t payload_bytes = (size_t)frames_in_packet * (size_t)channels_in_packet * (size_t)bytes_per_sample_in_packet;
-            if (payload_bytes == 0) {
-                std::cerr << "[TCP] zero payload size, skipping\n";
-                continue;
-            }
-            // Safety: limit excessive sizes
-            const size_t MAX_FRAMES_LIMIT = 1 << 16; // 65536 frames per packet
-            if (frames_in_packet == 0 || frames_in_packet > MAX_FRAMES_LIMIT) {
-                std::cerr << "[TCP] suspicious number of frames: " << frames_in_packet << " (limiting/skipping)\n";
-                connection_ok = false;
-                break;
-            }
+    while (global_should_run.load()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(LIVE_MONITOR_TICK_MS));
+        std::lock_guard<std::mutex> lock(global_live_monitor_mutex);
+        for (auto group_iterator = global_live_monitor_groups.begin(); group_iterator != global_live_monitor_groups.end();) {
+            live_monitor_group& group = **group_iterator;
 
-            // Read payload
-            std::vector<uint8_t> payload_buffer(payload_bytes);
-            if (!recv_all(client_fd, payload_buffer.data(), payload_bytes)) {
-                std::cerr << "[TCP] payload receive failed\n";
-                connection_ok = false;
-                break;
+            // stream gone (it left the registry once its last segment was finalized)
+            bool stream_active = false;
+            {
+                std::lock_guard<std::mutex> registry_lock(global_stream_registry_mutex);
+                stream_active = global_active_streams.count(group.stream->stream_id) > 0;
             }
-
-            // Convert each frame's int32 (left-aligned 24) to packed 24-bit and apply gain
-            std::vector<uint8_t> output_bytes;
-            output_bytes.reserve((size_t)frames_in_packet * OUT_BYTES_PER_SAMPLE * (size_t)channels_in_packet);
-
-            double gain_now = global_makeup_gain.load();
-            for (size_t frame_index = 0; frame_index < (size_t)frames_in_packet; ++frame_index) {
-                // For mono/one-channel case each frame is 4 bytes (int32)
-                size_t base = frame_index * (size_t)bytes_per_sample_in_packet * (size_t)channels_in_packet;
-                // for each channel in packet - but we expect single channel
-                // read int32 little-endian
-                int32_t sample_int32 = le_bytes_to_int32(&payload_buffer[base]);
-                // apply gain in double then clamp
-                double scaled = (double)sample_int32 * gain_now;
-                if (scaled > (double)INT32_MAX) scaled = (double)INT32_MAX;
-                if (scaled < (double)INT32_MIN) scaled = (double)INT32_MIN;
-                int32_t scaled_i32 = (int32_t)std::llround(scaled);
-                // convert left-aligned 32->packed 24
-                uint8_t three_bytes[3];
-                int32_left24_to_3bytes_le(scaled_i32, three_bytes);
-                output_bytes.push_back(three_bytes[0]);
-                output_bytes.push_back(three_bytes[1]);
-                output_bytes.push_back(three_bytes[2]);
+            if (!stream_active) {
+                Json::Value ended;
+                ended["type"] = "ended";
+                for (auto& entry : group.listeners) {
+                    send_json_to_subscriber(entry.first, ended);
+                    entry.first->shutdown();
+                }
+                group_iterator = global_live_monitor_groups.erase(group_iterator);
+                continue;
             }
 
-            // Write to WAV file (protected by mutex)
-            {
-                std::lock_guard<std::mutex> lock(global_file_write_mutex);
-                if (!output_wav_file) {
-                    std::cerr << "[WAV] output_wav_file null\n";
-                } else {
-                    size_t wrote_count = fwrite(output_bytes.data(), 1, output_bytes.size(), output_wav_file);
-                    if (wrote_count != output_bytes.size()) {
-                        std::cerr << "[WAV] short write: " << wrote_count << " of " << output_bytes.size() << "\n";
+            uint64_t frames_skipped = 0;
+            uint64_t first_sample_index = 0;
+            size_t frame_count = group.stream->monitor_ring.read(group.ring_cursor, block_packed24.data(),
+                                                                 LIVE_MONITOR_MAX_BLOCK_FRAMES, frames_skipped, first_sample_index);
+            if (frames_skipped > 0) global_live_monitor_frames_skipped.fetch_add(frames_skipped);
+            if (frame_count > 0) {
+                // encode once for the whole group
+                message.assign(LIVE_MONITOR_FRAME_HEADER_BYTES, '\0');
+                group.encoder.encode(block_packed24.data(), frame_count, message);
+                write_live_monitor_frame_header(message, group.next_block_sequence++, first_sample_index, group.output_rate, group.format);
+
+                for (auto& entry : group.listeners) {
+                    live_listener& listener = entry.second;
+                    if (listener.messages_sent - listener.messages_acknowledged >= LIVE_MONITOR_MAX_UNACKED_BLOCKS) {
+                        // slow listener: drop this block for it rather than queue behind it
+                        ++listener.messages_skipped;
+                        global_live_monitor_messages_skipped.fetch_add(1);
+                        continue;
                     }
-                    fflush(output_wav_file);
-                    global_total_samples_written_count += (int)frames_in_packet;
+                    if (!entry.first->connected()) continue;
+                    entry.first->send(message.data(), message.size(), WebSocketMessageType::Binary);
+                    ++listener.messages_sent;
+                    global_live_monitor_messages_sent.fetch_add(1);
                 }
             }
+            ++group_iterator;
+        }
+    }
+}
+
+static Json::Value build_live_monitor_status_json() {
+    Json::Value live_json;
+    size_t listener_count = 0;
+    size_t group_count = 0;
+    {
+        std::lock_guard<std::mutex> lock(global_live_monitor_mutex);
+        group_count = global_live_monitor_groups.size();
+        for (const auto& group : global_live_monitor_groups) listener_count += group->listeners.size();
+    }
+    live_json["groups"] = static_cast<Json::UInt64>(group_count);
+    live_json["listeners"] = static_cast<Json::UInt64>(listener_count);
+    live_json["messages_sent"] = static_cast<Json::UInt64>(global_live_monitor_messages_sent.load());
+    live_json["messages_skipped"] = static_cast<Json::UInt64>(global_live_monitor_messages_skipped.load());
+    live_json["ring_frames_skipped"] = static_cast<Json::UInt64>(global_live_monitor_frames_skipped.load());
+    return live_json;
+}
+
+// ----------------- Archive retrieval (/archive) -----------------
+//
+// GET /archive lists the archived devices. GET /archive/audio cuts a range out of one
+// device's archive (stream_archive.h) as a WAV file:
+//
+//   /archive/audio?device=10.0.0.7&from_ms=<unix ms>&to_ms=<unix ms>
+//   /archive/audio?device=10.0.0.7&start_index=<archive index>&frames=<count>
+//
+// The range is found by binary search in the mapped index and read from the mapped
+// chunk files it covers, so a request costs what the clip is long, not what the
+// archive holds. Single-range Range requests are answered with 206; a range that lies
+// within one chunk file is sent from that file (sendfile), anything else (the WAV
+// header, gaps, chunk boundaries) is streamed from the mapped chunks.
+
+// Device directories are named after device labels (IP, maybe "_port")
+static bool is_valid_archive_device_name(const std::string& name) {
+    if (name.empty() || name.size() > 128 || name[0] == '.') return false;
+    for (char c : name) {
+        if (!isalnum((unsigned char)c) && c != '.' && c != '_' && c != '-') return false;
+    }
+    return true;
+}
+
+static bool parse_unsigned_parameter(const std::string& text, uint64_t& value) {
+    if (text.empty() || !isdigit((unsigned char)text[0])) return false;
+    char* end = nullptr;
+    errno = 0;
+    unsigned long long parsed = strtoull(text.c_str(), &end, 10);
+    if (errno != 0 || *end != '\0') return false;
+    value = parsed;
+    return true;
+}
+
+enum class http_byte_range { whole, partial, unsatisfiable };
+
+// One "bytes=first-last", "bytes=first-" or "bytes=-suffix" range. Anything else
+// (several ranges, other units, garbage) gets the whole body, which HTTP allows.
+static http_byte_range parse_http_byte_range(const std::string& header, uint64_t total_bytes, uint64_t& first, uint64_t& last) {
+    first = 0;
+    last = total_bytes - 1;
+    static const std::string BYTES_UNIT = "bytes=";
+    if (header.compare(0, BYTES_UNIT.size(), BYTES_UNIT) != 0 || header.find(',') != std::string::npos) {
+        return http_byte_range::whole;
+    }
+    size_t dash = header.find('-', BYTES_UNIT.size());
+    if (dash == std::string::npos) return http_byte_range::whole;
+    std::string first_text = header.substr(BYTES_UNIT.size(), dash - BYTES_UNIT.size());
+    std::string last_text = header.substr(dash + 1);
+    uint64_t value = 0;
+    if (first_text.empty()) {
+        if (!parse_unsigned_parameter(last_text, value)) return http_byte_range::whole;
+        if (value == 0) return http_byte_range::unsatisfiable;
+        first = total_bytes > value ? total_bytes - value : 0;
+        return http_byte_range::partial;
+    }
+    if (!parse_unsigned_parameter(first_text, value)) return http_byte_range::whole;
+    if (value >= total_bytes) return http_byte_range::unsatisfiable;
+    first = value;
+    if (!last_text.empty()) {
+        if (!parse_unsigned_parameter(last_text, value) || value < first) return http_byte_range::whole;
+        last = std::min(value, total_bytes - 1);
+    }
+    return http_byte_range::partial;
+}
+
+// First and last records of an archive that read back intact; false if it has none
+static bool archive_recorded_span(const archive_index_view& index, archive_index_record& first_record,
+                                  archive_index_record& last_record) {
+    size_t first_number = 0;
+    while (first_number < index.record_count() && !index.record(first_number, first_record)) ++first_number;
+    size_t last_number = index.record_count();
+    while (last_number > first_number && !index.record(last_number - 1, last_record)) --last_number;
+    return first_number < last_number;
+}
+
+static void add_archive_span_json(Json::Value& device_json, const archive_index_record& first_record,
+                                  const archive_index_record& last_record, uint32_t sample_rate) {
+    device_json["first_sample_index"] = static_cast<Json::UInt64>(first_record.first_sample_index);
+    device_json["end_sample_index"] = static_cast<Json::UInt64>(last_record.first_sample_index + last_record.frame_count);
+    device_json["start_unix_ms"] = static_cast<Json::Int64>(first_record.start_unix_us / 1000);
+    device_json["end_unix_ms"] = static_cast<Json::Int64>(
+        (last_record.start_unix_us + (int64_t)(last_record.frame_count * 1000000 / sample_rate)) / 1000);
+}
 
-            // update status atoms
-            global_highest_received_sample_index.store(first_sample_index + (uint64_t)frames_in_packet - 1);
-            global_last_received_sequence.store(sequence_number);
-        } // end per-packet loop
+static Json::Value build_archive_listing_json() {
+    Json::Value listing_json;
+    listing_json["directory"] = ARCHIVE_DIRECTORY;
+    listing_json["enabled"] = ARCHIVE_ENABLED;
+    Json::Value devices_json(Json::arrayValue);
+    std::vector<std::string> device_names;
+    if (DIR* archive_dir = opendir(ARCHIVE_DIRECTORY)) {
+        while (struct dirent* entry = readdir(archive_dir)) {
+            if (is_valid_archive_device_name(entry->d_name)) device_names.push_back(entry->d_name);
+        }
+        closedir(archive_dir);
+    }
+    std::sort(device_names.begin(), device_names.end());
+    for (const std::string& device_name : device_names) {
+        archive_index_view index;
+        if (!index.open(std::string(ARCHIVE_DIRECTORY) + "/" + device_name)) continue;
+        archive_index_record first_record, last_record;
+        if (!archive_recorded_span(index, first_record, last_record)) continue;
+        uint32_t sample_rate = index.header().sample_rate;
+        Json::Value device_json;
+        device_json["device"] = device_name;
+        device_json["sample_rate"] = sample_rate;
+        device_json["chunk_seconds"] = static_cast<Json::UInt64>(index.header().chunk_frames / sample_rate);
+        device_json["records"] = static_cast<Json::UInt64>(index.record_count());
+        add_archive_span_json(device_json, first_record, last_record, sample_rate);
+        devices_json.append(device_json);
+    }
+    listing_json["devices"] = devices_json;
+    return listing_json;
+}
 
-        // Close client
-        close(client_fd);
-        std::cout << "[TCP] client disconnected\n";
+static HttpResponsePtr archive_error_response(HttpStatusCode status, const std::string& message) {
+    auto response = HttpResponse::newHttpResponse();
+    response->setStatusCode(status);
+    response->setBody(message);
+    return response;
+}
 
-        // Close and leave header placeholder for finalization on exit
-        if (output_wav_file) {
-            std::lock_guard<std::mutex> lock(global_file_write_mutex);
-            fclose(output_wav_file);
-            output_wav_file = nullptr;
+static HttpResponsePtr handle_archive_audio_request(const HttpRequestPtr& request) {
+    std::string device_name = request->getParameter("device");
+    if (!is_valid_archive_device_name(device_name)) return archive_error_response(k400BadRequest, "Missing or invalid 'device'");
+    std::string directory = std::string(ARCHIVE_DIRECTORY) + "/" + device_name;
+    archive_index_view index;
+    if (!index.open(directory)) return archive_error_response(k404NotFound, "No archive for device " + device_name);
+    uint32_t sample_rate = index.header().sample_rate;
+    uint64_t max_range_frames = (uint64_t)ARCHIVE_MAX_RANGE_SECONDS * sample_rate;
+
+    // the range: sample indices, or wall-clock times looked up in the index
+    uint64_t first_index = 0, frame_count = 0;
+    uint64_t from_ms = 0, to_ms = 0;
+    if (parse_unsigned_parameter(request->getParameter("start_index"), first_index) &&
+        parse_unsigned_parameter(request->getParameter("frames"), frame_count)) {
+        // as given
+    } else if (parse_unsigned_parameter(request->getParameter("from_ms"), from_ms) &&
+               parse_unsigned_parameter(request->getParameter("to_ms"), to_ms) && to_ms > from_ms) {
+        uint64_t end_index = 0;
+        if (!index.index_at_time((int64_t)from_ms * 1000, first_index)) {
+            return archive_error_response(k404NotFound, "Nothing archived after from_ms");
         }
-    } // accept loop
+        if (!index.index_at_time((int64_t)to_ms * 1000, end_index)) index.end_index(end_index);
+        frame_count = end_index > first_index ? end_index - first_index : 0;
+    } else {
+        return archive_error_response(k400BadRequest, "Give 'start_index' and 'frames', or 'from_ms' and 'to_ms' (Unix ms)");
+    }
+    if (frame_count == 0) return archive_error_response(k404NotFound, "Nothing archived in that range");
+    if (frame_count > max_range_frames) {
+        return archive_error_response(k400BadRequest, "Range longer than " + std::to_string(ARCHIVE_MAX_RANGE_SECONDS) + " s");
+    }
+
+    auto reader = std::make_shared<archive_range_reader>();
+    if (!reader->open(directory, index, first_index, frame_count) || reader->recorded_frames() == 0) {
+        return archive_error_response(k404NotFound, "Nothing archived in that range");
+    }
 
-    if (listen_fd >= 0) close(listen_fd);
-    global_tcp_listen_socket_fd = -1;
-    std::cout << "[TCP] receiver server exiting\n";
+    uint64_t total_bytes = reader->total_bytes();
+    uint64_t first_byte = 0, last_byte = total_bytes - 1;
+    http_byte_range range = parse_http_byte_range(request->getHeader("Range"), total_bytes, first_byte, last_byte);
+    if (range == http_byte_range::unsatisfiable) {
+        auto response = archive_error_response(k416RequestedRangeNotSatisfiable, "Range not satisfiable");
+        response->addHeader("Content-Range", "bytes */" + std::to_string(total_bytes));
+        return response;
+    }
+    uint64_t byte_count = last_byte - first_byte + 1;
+
+    HttpResponsePtr response;
+    std::string chunk_path;
+    uint64_t chunk_offset = 0;
+    if (range == http_byte_range::partial && reader->single_file_span(first_byte, byte_count, chunk_path, chunk_offset)) {
+        response = HttpResponse::newFileResponse(chunk_path, (size_t)chunk_offset, (size_t)byte_count, false);
+    } else {
+        uint64_t position = first_byte;
+        uint64_t end_position = last_byte + 1;
+        response = HttpResponse::newStreamResponse([reader, position, end_position](char* buffer, std::size_t capacity) mutable -> std::size_t {
+            if (!buffer || position >= end_position) return 0; // a null buffer means the client went away
+            size_t wanted = (size_t)std::min<uint64_t>(std::min(capacity, ARCHIVE_STREAM_RESPONSE_MAX_BYTES), end_position - position);
+            size_t copied = reader->read(position, reinterpret_cast<uint8_t*>(buffer), wanted);
+            position += copied;
+            return copied;
+        });
+    }
+    response->setContentTypeString("audio/wav");
+    response->addHeader("Accept-Ranges", "bytes");
+    response->addHeader("X-Archive-First-Sample-Index", std::to_string(reader->first_sample_index()));
+    response->addHeader("X-Archive-Frames", std::to_string(reader->frame_count()));
+    response->addHeader("X-Archive-Start-Unix-Us", std::to_string(reader->start_unix_us()));
+    if (range == http_byte_range::partial) {
+        response->setStatusCode(k206PartialContent);
+        response->addHeader("Content-Range", "bytes " + std::to_string(first_byte) + "-" + std::to_string(last_byte) + "/" +
+                                                 std::to_string(total_bytes));
+    }
+    stream_archive_stats().ranges_served.fetch_add(1, std::memory_order_relaxed);
+    stream_archive_stats().bytes_served.fetch_add(byte_count, std::memory_order_relaxed);
+    return response;
 }
 
-// ----------------- Drogon web UI handlers (use the same globals) -----------------
+// ----------------- Archive overview (/archive/overview) -----------------
+//
+// The overview pyramid (archive_overview.h) of a device, for drawing waveform and
+// spectrum at any zoom without touching the audio:
+//
+//   /archive/overview?device=10.0.0.7                       levels, layout, span (JSON)
+//   /archive/overview/tile?device=10.0.0.7&level=6&tile=0   OVERVIEW_TILE_BINS records
+//
+// A tile is bins [tile * OVERVIEW_TILE_BINS, (tile + 1) * OVERVIEW_TILE_BINS) of one
+// level, sent straight from its file (sendfile); the last tile of a level is shorter.
+// Tiles that end before the archive does no longer change and may be cached.
 
-// Build a JSON status object using the shared globals
-static Json::Value build_status_json() {
-    Json::Value status_json;
-    status_json["running"] = global_should_run.load() ? 1 : 0;
-    status_json["gain"] = global_makeup_gain.load();
-    status_json["last_sequence"] = static_cast<Json::UInt>(global_last_received_sequence.load());
-    status_json["highest_sample_index"] = static_cast<Json::UInt64>(global_highest_received_sample_index.load());
-    status_json["samples_written"] = global_total_samples_written_count;
-    return status_json;
+static std::string archive_overview_level_path(const std::string& device_name, size_t level) {
+    return std::string(ARCHIVE_DIRECTORY) + "/" + device_name + "/" + overview_level_filename(level);
+}
+
+// Whole records in a level file; false if there is no such file
+static bool archive_overview_level_bins(const std::string& device_name, size_t level, uint64_t& bins) {
+    struct stat level_stat;
+    if (stat(archive_overview_level_path(device_name, level).c_str(), &level_stat) != 0 ||
+        (size_t)level_stat.st_size < OVERVIEW_FILE_HEADER_BYTES) {
+        return false;
+    }
+    bins = ((uint64_t)level_stat.st_size - OVERVIEW_FILE_HEADER_BYTES) / sizeof(overview_bin_record);
+    return true;
+}
+
+static HttpResponsePtr handle_archive_overview_request(const HttpRequestPtr& request) {
+    std::string device_name = request->getParameter("device");
+    if (!is_valid_archive_device_name(device_name)) return archive_error_response(k400BadRequest, "Missing or invalid 'device'");
+    archive_index_view index;
+    archive_index_record first_record, last_record;
+    uint64_t level0_bins = 0;
+    if (!index.open(std::string(ARCHIVE_DIRECTORY) + "/" + device_name) || !archive_recorded_span(index, first_record, last_record) ||
+        !archive_overview_level_bins(device_name, 0, level0_bins)) {
+        return archive_error_response(k404NotFound, "No archive overview for device " + device_name);
+    }
+    uint32_t sample_rate = index.header().sample_rate;
+
+    Json::Value overview_json;
+    overview_json["device"] = device_name;
+    overview_json["sample_rate"] = sample_rate;
+    add_archive_span_json(overview_json, first_record, last_record, sample_rate);
+    overview_json["tile_bins"] = static_cast<Json::UInt64>(OVERVIEW_TILE_BINS);
+    overview_json["level_fanout"] = static_cast<Json::UInt64>(OVERVIEW_LEVEL_FANOUT);
+    overview_json["record_bytes"] = static_cast<Json::UInt64>(sizeof(overview_bin_record));
+    overview_json["record_layout"] = "min_sample i16, max_sample i16 (24-bit >> 8), rms u16 (65535 = full scale), "
+                                     "coverage u8 (255 = all recorded, 0 = gap), reserved u8, band_level u8[" +
+                                     std::to_string(OVERVIEW_BAND_COUNT) + "] (255 + 2 * dB, 0 = no data); little-endian";
+    Json::Value band_edges_json(Json::arrayValue);
+    const uint16_t* band_edges = overview_band_edge_bins();
+    for (size_t band = 0; band <= OVERVIEW_BAND_COUNT; ++band) {
+        band_edges_json.append((double)band_edges[band] * sample_rate / (double)OVERVIEW_BASE_BIN_FRAMES);
+    }
+    overview_json["band_edges_hz"] = band_edges_json;
+    Json::Value levels_json(Json::arrayValue);
+    for (size_t level = 0; level < OVERVIEW_LEVEL_COUNT; ++level) {
+        uint64_t bins = 0;
+        if (!archive_overview_level_bins(device_name, level, bins)) break;
+        Json::Value level_json;
+        level_json["level"] = static_cast<Json::UInt64>(level);
+        level_json["bin_frames"] = static_cast<Json::UInt64>(overview_bin_frames(level));
+        level_json["bin_seconds"] = (double)overview_bin_frames(level) / sample_rate;
+        level_json["bins"] = static_cast<Json::UInt64>(bins);
+        levels_json.append(level_json);
+    }
+    overview_json["levels"] = levels_json;
+    return HttpResponse::newHttpJsonResponse(overview_json);
+}
+
+static HttpResponsePtr handle_archive_overview_tile_request(const HttpRequestPtr& request) {
+    std::string device_name = request->getParameter("device");
+    uint64_t level = 0, tile = 0;
+    if (!is_valid_archive_device_name(device_name) || !parse_unsigned_parameter(request->getParameter("level"), level) ||
+        level >= OVERVIEW_LEVEL_COUNT || !parse_unsigned_parameter(request->getParameter("tile"), tile) ||
+        tile > UINT64_MAX / OVERVIEW_TILE_BINS / sizeof(overview_bin_record)) {
+        return archive_error_response(k400BadRequest, "Give 'device', 'level' (0.." + std::to_string(OVERVIEW_LEVEL_COUNT - 1) +
+                                                          ") and 'tile'");
+    }
+    uint64_t bins = 0;
+    if (!archive_overview_level_bins(device_name, (size_t)level, bins)) {
+        return archive_error_response(k404NotFound, "No archive overview for device " + device_name);
+    }
+    uint64_t first_bin = tile * OVERVIEW_TILE_BINS;
+    if (first_bin >= bins) return archive_error_response(k404NotFound, "Tile past the end of the archive");
+    uint64_t bin_count = std::min<uint64_t>(OVERVIEW_TILE_BINS, bins - first_bin);
+
+    auto response = HttpResponse::newFileResponse(archive_overview_level_path(device_name, (size_t)level),
+                                                  (size_t)(OVERVIEW_FILE_HEADER_BYTES + first_bin * sizeof(overview_bin_record)),
+                                                  (size_t)(bin_count * sizeof(overview_bin_record)), false);
+    response->setContentTypeString("application/octet-stream");
+    response->addHeader("X-Overview-Level", std::to_string(level));
+    response->addHeader("X-Overview-First-Bin", std::to_string(first_bin));
+    response->addHeader("X-Overview-Bins", std::to_string(bin_count));
+    response->addHeader("X-Overview-Bin-Frames", std::to_string(overview_bin_frames((size_t)level)));
+    // a full tile before the archive's last bin is final
+    uint64_t archive_end_bin = 0;
+    archive_index_view index;
+    uint64_t end_index = 0;
+    if (index.open(std::string(ARCHIVE_DIRECTORY) + "/" + device_name) && index.end_index(end_index)) {
+        archive_end_bin = end_index / overview_bin_frames((size_t)level);
+    }
+    bool final_tile = bin_count == OVERVIEW_TILE_BINS && first_bin + bin_count <= archive_end_bin;
+    response->addHeader("Cache-Control", final_tile ? "public, max-age=86400" : "no-cache");
+    return response;
+}
+
+// ----------------- Metrics (/metrics, Prometheus text format) -----------------
+//
+// Counters are read from the single-writer per-thread/per-stream blocks and summed
+// here, on the scrape, so scraping never touches the packet path's cache lines.
+
+// histogram bucket bounds exported to Prometheus, in microseconds
+static const uint64_t METRICS_LATENCY_BUCKET_BOUNDS_US[] = {100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+                                                            100000, 250000, 500000, 1000000, 2500000, 5000000};
+
+// "{labels}" or "{labels,extra}" ("" when both are empty)
+static std::string metric_labels(const std::string& labels, const std::string& extra = "") {
+    if (labels.empty() && extra.empty()) return "";
+    if (labels.empty()) return "{" + extra + "}";
+    if (extra.empty()) return "{" + labels + "}";
+    return "{" + labels + "," + extra + "}";
+}
+
+static void append_metric_help(std::ostringstream& out, const char* name, const char* type, const char* help) {
+    out << "# HELP " << name << " " << help << "\n# TYPE " << name << " " << type << "\n";
+}
+
+static void append_latency_histogram_metrics(std::ostringstream& out, const std::string& name, const std::string& labels,
+                                             const latency_histogram& histogram) {
+    for (uint64_t bound_us : METRICS_LATENCY_BUCKET_BOUNDS_US) {
+        out << name << "_bucket" << metric_labels(labels, "le=\"" + std::to_string(bound_us) + "\"") << " "
+            << histogram.count_at_or_below(bound_us) << "\n";
+    }
+    out << name << "_bucket" << metric_labels(labels, "le=\"+Inf\"") << " " << histogram.count() << "\n";
+    out << name << "_sum" << metric_labels(labels) << " " << histogram.sum() << "\n";
+    out << name << "_count" << metric_labels(labels) << " " << histogram.count() << "\n";
+}
+
+static void append_device_metrics(std::ostringstream& out, const std::map<std::string, device_metric_totals>& totals_by_device,
+                                  const std::map<std::string, uint64_t>& live_streams_by_device) {
+    struct device_metric {
+        const char* name;
+        const char* help;
+        uint64_t device_metric_totals::*field;
+    };
+    static const device_metric device_metrics[] = {
+        {"esp_device_bytes_received_total", "Bytes read from the device's TCP streams and UDP datagrams.", &device_metric_totals::bytes_received},
+        {"esp_device_packets_received_total", "ESP2 packets received and queued.", &device_metric_totals::packets_received},
+        {"esp_device_packets_dropped_total", "ESP2 packets discarded for lack of a free slot.", &device_metric_totals::packets_dropped},
+        {"esp_device_header_errors_total", "Rejected ESP2 headers.", &device_metric_totals::header_errors},
+        {"esp_device_bad_magic_disconnects_total", "Streams dropped for a bad header magic.", &device_metric_totals::bad_magic_disconnects},
+        {"esp_device_fec_packets_recovered_total", "UDP packets rebuilt from FEC parity.", &device_metric_totals::fec_packets_recovered},
+        {"esp_device_fec_packets_unrecoverable_total", "UDP packets lost beyond what FEC parity could rebuild.", &device_metric_totals::fec_packets_unrecoverable},
+        {"esp_device_capture_overrun_frames_total", "Frames the device dropped at capture because its send ring was full.", &device_metric_totals::capture_overrun_frames},
+        {"esp_device_frames_written_total", "Frames handed to the WAV recorder.", &device_metric_totals::frames_written},
+        {"esp_device_gap_events_total", "Sample-index gaps seen by the jitter buffer.", &device_metric_totals::gap_events},
+        {"esp_device_gap_frames_total", "Frames zero-filled in gaps.", &device_metric_totals::gap_frames},
+        {"esp_device_late_frames_total", "Frames that arrived after their slot was written.", &device_metric_totals::late_frames},
+        {"esp_device_duplicate_frames_total", "Frames received more than once.", &device_metric_totals::duplicate_frames},
+        {"esp_device_activity_clips_total", "Activity-triggered clips written.", &device_metric_totals::activity_clips},
+        {"esp_device_connections_total", "TCP or UDP streams from the device (including the open ones).", &device_metric_totals::connections},
+    };
+    for (const device_metric& metric : device_metrics) {
+        append_metric_help(out, metric.name, "counter", metric.help);
+        for (const auto& entry : totals_by_device) {
+            out << metric.name << "{device=\"" << entry.first << "\"} " << entry.second.*metric.field << "\n";
+        }
+    }
+    append_metric_help(out, "esp_device_open_streams", "gauge", "Currently open TCP or UDP streams from the device.");
+    for (const auto& entry : totals_by_device) {
+        auto live = live_streams_by_device.find(entry.first);
+        out << "esp_device_open_streams{device=\"" << entry.first << "\"} " << (live == live_streams_by_device.end() ? 0 : live->second) << "\n";
+    }
+}
+
+static std::string build_metrics_text() {
+    std::ostringstream out;
+
+    // process-wide pipeline counters (summed over the per-thread blocks)
+    for (size_t counter_index = 0; counter_index < (size_t)pipeline_counter::count; ++counter_index) {
+        pipeline_counter counter = (pipeline_counter)counter_index;
+        std::string name = std::string("esp_receiver_") + pipeline_counter_name(counter) + "_total";
+        append_metric_help(out, name.c_str(), "counter", pipeline_counter_help(counter));
+        out << name << " " << pipeline_counter_total(counter) << "\n";
+    }
+    append_metric_help(out, "esp_receiver_packet_path_heap_allocations", "gauge", "Heap allocations made by the packet path threads.");
+    out << "esp_receiver_packet_path_heap_allocations " << packet_path_heap_allocation_count() << "\n";
+
+    // queue depths of each shard's receiver -> DSP -> writer pipeline
+    append_metric_help(out, "esp_pipeline_queue_depth", "gauge", "Packet slots waiting in a pipeline queue.");
+    for (const auto& shard : global_receiver_shards) {
+        std::string shard_label = "shard=\"" + std::to_string(shard->shard_index) + "\"";
+        out << "esp_pipeline_queue_depth{" << shard_label << ",queue=\"dsp\"} " << shard->dsp_input_ring.depth() << "\n";
+        out << "esp_pipeline_queue_depth{" << shard_label << ",queue=\"writer\"} " << shard->writer_input_ring.depth() << "\n";
+    }
+    append_metric_help(out, "esp_pipeline_queue_high_water", "gauge", "Deepest a pipeline queue has been.");
+    for (const auto& shard : global_receiver_shards) {
+        std::string shard_label = "shard=\"" + std::to_string(shard->shard_index) + "\"";
+        out << "esp_pipeline_queue_high_water{" << shard_label << ",queue=\"dsp\"} " << shard->dsp_input_ring.high_water() << "\n";
+        out << "esp_pipeline_queue_high_water{" << shard_label << ",queue=\"writer\"} " << shard->writer_input_ring.high_water() << "\n";
+    }
+    append_metric_help(out, "esp_pipeline_free_slots", "gauge", "Packet slots available to the receiver.");
+    for (const auto& shard : global_receiver_shards) {
+        out << "esp_pipeline_free_slots{shard=\"" << shard->shard_index << "\"} " << shard->free_slot_ring.depth() << "\n";
+    }
+    append_metric_help(out, "esp_shard_samples_written_total", "counter", "Frames handed to the WAV recorders by each shard's writer.");
+    for (const auto& shard : global_receiver_shards) {
+        out << "esp_shard_samples_written_total{shard=\"" << shard->shard_index << "\"} " << shard->samples_written.load() << "\n";
+    }
+    append_metric_help(out, "esp_pipeline_slots", "gauge", "Packet slots in all shards' pipelines.");
+    out << "esp_pipeline_slots " << PIPELINE_SLOT_COUNT * global_receiver_shards.size() << "\n";
+
+    // WAV writer I/O
+    const wav_writer_statistics& writer_stats = wav_writer_stats();
+    append_metric_help(out, "esp_wav_write_syscalls_total", "counter", "Write syscalls issued for WAV segments.");
+    out << "esp_wav_write_syscalls_total " << writer_stats.write_syscalls.load() << "\n";
+    append_metric_help(out, "esp_wav_bytes_written_total", "counter", "Bytes written to WAV segments.");
+    out << "esp_wav_bytes_written_total " << writer_stats.bytes_written.load() << "\n";
+    append_metric_help(out, "esp_wav_write_errors_total", "counter", "Failed WAV writes.");
+    out << "esp_wav_write_errors_total " << writer_stats.write_errors.load() << "\n";
+    append_metric_help(out, "esp_wav_fdatasync_calls_total", "counter", "fdatasync calls on WAV segments.");
+    out << "esp_wav_fdatasync_calls_total " << writer_stats.fdatasync_calls.load() << "\n";
+    append_metric_help(out, "esp_wav_segments_closed_total", "counter", "WAV segments finalized.");
+    out << "esp_wav_segments_closed_total " << writer_stats.segments_closed.load() << "\n";
+    append_metric_help(out, "esp_wav_write_latency_us", "histogram", "Duration of each WAV write syscall.");
+    append_latency_histogram_metrics(out, "esp_wav_write_latency_us", "", writer_stats.write_latency_us);
+    append_metric_help(out, "esp_wav_fdatasync_latency_us", "histogram", "Duration of each fdatasync on a WAV segment.");
+    append_latency_histogram_metrics(out, "esp_wav_fdatasync_latency_us", "", writer_stats.fdatasync_latency_us);
+
+    // archive I/O and retrieval
+    const stream_archive_statistics& archive_stats = stream_archive_stats();
+    append_metric_help(out, "esp_archive_bytes_written_total", "counter", "Bytes written to archive chunks.");
+    out << "esp_archive_bytes_written_total " << archive_stats.bytes_written.load() << "\n";
+    append_metric_help(out, "esp_archive_write_errors_total", "counter", "Failed archive writes.");
+    out << "esp_archive_write_errors_total " << archive_stats.write_errors.load() << "\n";
+    append_metric_help(out, "esp_archive_ranges_served_total", "counter", "Archive ranges served by /archive/audio.");
+    out << "esp_archive_ranges_served_total " << archive_stats.ranges_served.load() << "\n";
+    append_metric_help(out, "esp_archive_bytes_served_total", "counter", "Archive audio bytes served by /archive/audio.");
+    out << "esp_archive_bytes_served_total " << archive_stats.bytes_served.load() << "\n";
+
+    std::lock_guard<std::mutex> lock(global_stream_registry_mutex);
+
+    // per device: closed streams plus the open ones
+    std::map<std::string, device_metric_totals> totals_by_device = global_closed_device_totals;
+    std::map<std::string, uint64_t> live_streams_by_device;
+    for (const auto& entry : global_active_streams) {
+        accumulate_device_metric_totals(*entry.second, totals_by_device[entry.second->peer_ip]);
+        live_streams_by_device[entry.second->peer_ip] += 1;
+    }
+    append_device_metrics(out, totals_by_device, live_streams_by_device);
+
+    // per open stream: clock and latency (see stream_timing.h)
+    append_metric_help(out, "esp_stream_clock_offset_us", "gauge", "Host minus device clock at the best-case path delay.");
+    append_metric_help(out, "esp_stream_clock_drift_ppm", "gauge", "Device clock drift against the host monotonic clock.");
+    append_metric_help(out, "esp_stream_sample_rate_hz", "gauge", "Measured sample rate against the device or host clock.");
+    append_metric_help(out, "esp_stream_latency_us", "histogram",
+                       "Per-packet latency by stage (capture_to_receive is above the best-case path).");
+    append_metric_help(out, "esp_stream_latency_p50_us", "gauge", "Median per-packet latency by stage.");
+    append_metric_help(out, "esp_stream_latency_p99_us", "gauge", "99th percentile per-packet latency by stage.");
+    append_metric_help(out, "esp_stream_latency_max_us", "gauge", "Largest per-packet latency by stage.");
+    for (const auto& entry : global_active_streams) {
+        const esp_stream_connection& stream = *entry.second;
+        std::string labels = "stream=\"" + std::to_string(stream.stream_id) + "\",device=\"" + stream.device_label + "\"";
+        const device_clock_estimator& clock = stream.device_clock;
+        out << "esp_stream_clock_offset_us{" << labels << "} " << clock.offset_us() << "\n";
+        out << "esp_stream_clock_drift_ppm{" << labels << "} " << clock.drift_ppm() << "\n";
+        out << "esp_stream_sample_rate_hz{" << labels << ",clock=\"device\"} " << clock.sample_rate_device_clock() << "\n";
+        out << "esp_stream_sample_rate_hz{" << labels << ",clock=\"host\"} " << clock.sample_rate_host_clock() << "\n";
+        append_latency_histogram_metrics(out, "esp_stream_latency_us", labels + ",stage=\"capture_to_receive\"", stream.capture_to_receive_latency);
+        append_latency_histogram_metrics(out, "esp_stream_latency_us", labels + ",stage=\"receive_to_writer\"", stream.receive_to_writer_latency);
+        append_latency_histogram_metrics(out, "esp_stream_latency_us", labels + ",stage=\"capture_to_writer\"", stream.capture_to_writer_latency);
+        const std::pair<const char*, const latency_histogram*> stages[] = {{"capture_to_receive", &stream.capture_to_receive_latency},
+                                                                            {"receive_to_writer", &stream.receive_to_writer_latency},
+                                                                            {"capture_to_writer", &stream.capture_to_writer_latency}};
+        for (const auto& stage : stages) {
+            std::string stage_labels = "{" + labels + ",stage=\"" + stage.first + "\"}";
+            out << "esp_stream_latency_p50_us" << stage_labels << " " << stage.second->percentile(0.50) << "\n";
+            out << "esp_stream_latency_p99_us" << stage_labels << " " << stage.second->percentile(0.99) << "\n";
+            out << "esp_stream_latency_max_us" << stage_labels << " " << stage.second->max() << "\n";
+        }
+    }
+    return out.str();
 }
 
 // ----------------- Signal handling for graceful shutdown -----------------
@@ -413,11 +3179,13 @@ static void signal_handler_trigger_shutdown(int /*signum*/) {
     std::cerr << "\nSignal received, initiating graceful shutdown...\n";
     global_should_run.store(false);
 
-    // Close listen socket to break accept()
-    if (global_tcp_listen_socket_fd >= 0) {
-        shutdown(global_tcp_listen_socket_fd, SHUT_RDWR);
-        close(global_tcp_listen_socket_fd);
-        global_tcp_listen_socket_fd = -1;
+    // Close the listen sockets so no new streams are accepted; each epoll loop notices the flag on its next timeout
+    for (const auto& shard : global_receiver_shards) {
+        int listen_fd = shard->listen_socket_fd.exchange(-1);
+        if (listen_fd >= 0) {
+            shutdown(listen_fd, SHUT_RDWR);
+            close(listen_fd);
+        }
     }
 
     // Stop drogon event loop (if running)
@@ -432,12 +3200,39 @@ static void signal_handler_trigger_shutdown(int /*signum*/) {
 
 int main(int argc, char** argv) {
     (void)argc; (void)argv;
+
+    // Receiver shards: one pipeline each, pinned round-robin to the online CPUs
+    long online_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (online_cpus < 1) online_cpus = 1;
+    unsigned shard_count = RECEIVER_SHARD_COUNT != 0 ? RECEIVER_SHARD_COUNT : (unsigned)online_cpus;
+    for (unsigned shard_index = 0; shard_index < shard_count; ++shard_index) {
+        auto shard = std::make_unique<receiver_shard>();
+        shard->shard_index = shard_index;
+        shard->reuse_port = shard_count > 1;
+        if (shard_count > 1 && RECEIVER_PIN_SHARDS_TO_CORES) shard->pinned_cpu = (int)(shard_index % (unsigned)online_cpus);
+        if (!initialize_shard_pipeline(*shard)) return 1;
+        global_receiver_shards.push_back(std::move(shard));
+    }
+    global_packed24_convert_kernel = select_packed24_convert_kernel();
+    std::cout << "[DSP] using " << selected_packed24_convert_kernel_name() << " conversion kernel\n";
+    std::cout << "[DSP] processing chain kernels: " << selected_dsp_chain_kernel_name() << "\n";
+
     // Install signal handler for Ctrl-C
     signal(SIGINT, signal_handler_trigger_shutdown);
     signal(SIGTERM, signal_handler_trigger_shutdown);
 
-    // Start the TCP audio receiver in a detached thread
-    std::thread tcp_thread(tcp_audio_receiver_server_loop);
+    // Start each shard's receiver -> DSP -> writer pipeline threads
+    std::vector<std::thread> shard_threads;
+    for (const auto& shard_ptr : global_receiver_shards) {
+        receiver_shard& shard = *shard_ptr;
+        shard_threads.emplace_back(writer_stage_loop, std::ref(shard));
+        shard_threads.emplace_back(dsp_stage_loop, std::ref(shard));
+        shard_threads.emplace_back([&shard](){
+            tcp_audio_receiver_server_loop(shard);
+            // lets the DSP and writer stages drain everything queued and exit
+            shard.receiver_stage_finished.store(true, std::memory_order_release);
+        });
+    }
 
     // Configure Drogon (web server)
     drogon::app().addListener(SERVER_BIND_ADDRESS, WEB_HTTP_PORT);
@@ -469,7 +3264,37 @@ int main(int argc, char** argv) {
         callback(resp);
     }, {Get});
 
-    // POST /control -> accept JSON {"gain": <number>} and update global_makeup_gain
+    // GET /metrics -> Prometheus text exposition (pipeline, writer, per-device and per-stream)
+    drogon::app().registerHandler("/metrics", [](const HttpRequestPtr & /*req*/, std::function<void (const HttpResponsePtr &)> &&callback){
+        auto resp = HttpResponse::newHttpResponse();
+        resp->setContentTypeString("text/plain; version=0.0.4");
+        resp->setBody(build_metrics_text());
+        callback(resp);
+    }, {Get});
+
+    // GET /trace[?ms=N] -> Chrome trace JSON of the pipeline spans (the last N ms, default
+    // all that the rings hold); open in ui.perfetto.dev or chrome://tracing
+    drogon::app().registerHandler("/trace", [](const HttpRequestPtr &req, std::function<void (const HttpResponsePtr &)> &&callback){
+        if (!TRACING_COMPILED_IN) {
+            callback(archive_error_response(k404NotFound, "Tracing is not compiled in; build with -DESP_RECEIVER_TRACING=ON"));
+            return;
+        }
+        uint64_t window_ms = 0;
+        std::string window_parameter = req->getParameter("ms");
+        if (!window_parameter.empty() && !parse_unsigned_parameter(window_parameter, window_ms)) {
+            callback(archive_error_response(k400BadRequest, "ms must be a number of milliseconds"));
+            return;
+        }
+        auto resp = HttpResponse::newHttpResponse();
+        resp->setContentTypeString("application/json");
+        resp->setBody(trace_chrome_json(window_ms * 1000));
+        callback(resp);
+    }, {Get});
+
+    // POST /control -> accept JSON {"gain": <number>, "drift_compensation": <bool>,
+    // "activity_recording": <bool>, "dsp": {<stage settings, see apply_requested_dsp_chain>}}
+    // (any of them). Every field present is checked first, so a request that fails with
+    // 400 changes nothing.
     drogon::app().registerHandler("/control", [](const HttpRequestPtr &req, std::function<void (const HttpResponsePtr &)> &&callback){
         try {
             auto json_ptr = req->getJsonObject();
@@ -481,18 +3306,30 @@ int main(int argc, char** argv) {
                 return;
             }
             Json::Value &j = *json_ptr;
-            if (!j.isMember("gain")) {
+            if (!j.isMember("gain") && !j.isMember("drift_compensation") && !j.isMember("activity_recording") && !j.isMember("dsp")) {
+                auto bad = HttpResponse::newHttpResponse();
+                bad->setStatusCode(k400BadRequest);
+                bad->setBody("Missing 'gain', 'drift_compensation', 'activity_recording' or 'dsp' field");
+                callback(bad);
+                return;
+            }
+            const char* mistyped_field = nullptr;
+            if (j.isMember("gain") && !j["gain"].isNumeric()) mistyped_field = "'gain' must be a number";
+            else if (j.isMember("drift_compensation") && !j["drift_compensation"].isBool()) mistyped_field = "'drift_compensation' must be a boolean";
+            else if (j.isMember("activity_recording") && !j["activity_recording"].isBool()) mistyped_field = "'activity_recording' must be a boolean";
+            else if (j.isMember("dsp") && !j["dsp"].isObject()) mistyped_field = "'dsp' must be an object";
+            if (mistyped_field) {
                 auto bad = HttpResponse::newHttpResponse();
                 bad->setStatusCode(k400BadRequest);
-                bad->setBody("Missing 'gain' field");
+                bad->setBody(mistyped_field);
                 callback(bad);
                 return;
             }
-            double requested_gain = j["gain"].asDouble();
-            // clamp to reasonable range
-            if (requested_gain < 0.01) requested_gain = 0.01;
-            if (requested_gain > 16.0) requested_gain = 16.0;
-            global_makeup_gain.store(requested_gain);
+
+            if (j.isMember("gain")) apply_requested_gain(j["gain"].asDouble());
+            if (j.isMember("drift_compensation")) global_drift_compensation_enabled.store(j["drift_compensation"].asBool());
+            if (j.isMember("activity_recording")) global_activity_recording_enabled.store(j["activity_recording"].asBool());
+            if (j.isMember("dsp")) apply_requested_dsp_chain(j["dsp"]);
 
             Json::Value st = build_status_json();
             auto resp = HttpResponse::newHttpJsonResponse(st);
@@ -507,13 +3344,30 @@ int main(int argc, char** argv) {
         }
     }, {Post});
 
-    // Optional background poller that could mirror file/receiver status to the UI (here simply updates local copies)
-    std::thread status_poller_thread([](){
-        while (global_should_run.load()) {
-            // Could do additional monitoring here (e.g., examine file sizes, latency)
-            std::this_thread::sleep_for(std::chrono::milliseconds(200));
-        }
-    });
+    // GET /archive -> JSON list of archived devices and the span each covers
+    drogon::app().registerHandler("/archive", [](const HttpRequestPtr & /*req*/, std::function<void (const HttpResponsePtr &)> &&callback){
+        callback(HttpResponse::newHttpJsonResponse(build_archive_listing_json()));
+    }, {Get});
+
+    // GET /archive/audio?device=..&from_ms=..&to_ms=.. (or &start_index=..&frames=..) -> WAV, Range supported
+    drogon::app().registerHandler("/archive/audio", [](const HttpRequestPtr &req, std::function<void (const HttpResponsePtr &)> &&callback){
+        callback(handle_archive_audio_request(req));
+    }, {Get});
+
+    // GET /archive/overview?device=.. -> overview levels and record layout (JSON)
+    drogon::app().registerHandler("/archive/overview", [](const HttpRequestPtr &req, std::function<void (const HttpResponsePtr &)> &&callback){
+        callback(handle_archive_overview_request(req));
+    }, {Get});
+
+    // GET /archive/overview/tile?device=..&level=..&tile=.. -> raw overview records
+    drogon::app().registerHandler("/archive/overview/tile", [](const HttpRequestPtr &req, std::function<void (const HttpResponsePtr &)> &&callback){
+        callback(handle_archive_overview_tile_request(req));
+    }, {Get});
+
+    // Push status deltas to /ws subscribers (status_websocket_controller registers itself with Drogon)
+    std::thread status_poller_thread(status_push_loop);
+    // Fan live audio out to /listen listeners
+    std::thread live_monitor_thread(live_monitor_loop);
 
     // Run Drogon (this will block until app().quit() is called)
     drogon::app().run();
@@ -521,23 +3375,16 @@ int main(int argc, char** argv) {
     // Drogon exited - stop poller and join threads
     global_should_run.store(false);
     if (status_poller_thread.joinable()) status_poller_thread.join();
+    if (live_monitor_thread.joinable()) live_monitor_thread.join();
 
-    // Wait for receiver thread to finish (it will exit when global_should_run==false)
-    if (tcp_thread.joinable()) tcp_thread.join();
-
-    // Finalize WAV header if file exists
-    {
-        std::lock_guard<std::mutex> lock(global_file_write_mutex);
-        FILE* f = fopen(OUTPUT_WAV_FILENAME, "rb+");
-        if (f) {
-            finalize_wav_header(f, (uint32_t)global_total_samples_written_count, EXPECTED_CHANNEL_COUNT, EXPECTED_SAMPLE_RATE);
-            fclose(f);
-            std::cout << "[WAV] finalized header, samples_written=" << global_total_samples_written_count << std::endl;
-        } else {
-            std::cerr << "[WAV] could not open " << OUTPUT_WAV_FILENAME << " to finalize header\n";
-        }
+    // Wait for the receiver threads to finish (they exit when global_should_run==false),
+    // and for the DSP and writer stages to drain behind them
+    for (std::thread& shard_thread : shard_threads) {
+        if (shard_thread.joinable()) shard_thread.join();
     }
 
+    // Per-stream WAV headers are finalized by the writer thread as each stream closes
+
     std::cout << "Shutdown complete.\n";
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,141 @@
+// jitter_buffer.cpp
+// Sample-index ring with coverage bitmap (see jitter_buffer.h).
+#include "jitter_buffer.h"
+
+#include <string.h>
+
+#include <cstdlib>
+
+// ring and bitmap start on cache lines; the bitmap covers 64 frames per word
+static const size_t JITTER_RING_ALIGNMENT_BYTES = 64;
+static const size_t JITTER_COVERAGE_BITS_PER_WORD = 64;
+
+static size_t round_up_to_power_of_two(size_t value) {
+    size_t rounded = 1;
+    while (rounded < value) rounded <<= 1;
+    return rounded;
+}
+
+static size_t round_up_to_multiple(size_t value, size_t multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+sample_index_jitter_buffer::~sample_index_jitter_buffer() {
+    std::free(ring_bytes_);
+    std::free(coverage_words_);
+}
+
+bool sample_index_jitter_buffer::initialize(size_t bytes_per_frame, size_t reorder_window_frames,
+                                            size_t max_packet_frames, uint64_t max_gap_fill_frames) {
+    if (ring_bytes_ || bytes_per_frame == 0) return false;
+    // a whole bitmap word per 64 frames keeps the word-wise coverage ops simple
+    capacity_frames_ = round_up_to_power_of_two(reorder_window_frames + max_packet_frames);
+    if (capacity_frames_ < JITTER_COVERAGE_BITS_PER_WORD) capacity_frames_ = JITTER_COVERAGE_BITS_PER_WORD;
+    index_mask_ = capacity_frames_ - 1;
+    bytes_per_frame_ = bytes_per_frame;
+    reorder_window_frames_ = reorder_window_frames;
+    max_gap_fill_frames_ = max_gap_fill_frames;
+
+    size_t ring_bytes = round_up_to_multiple(capacity_frames_ * bytes_per_frame_, JITTER_RING_ALIGNMENT_BYTES);
+    size_t coverage_bytes = round_up_to_multiple(capacity_frames_ / 8, JITTER_RING_ALIGNMENT_BYTES);
+    ring_bytes_ = static_cast<uint8_t*>(std::aligned_alloc(JITTER_RING_ALIGNMENT_BYTES, ring_bytes));
+    coverage_words_ = static_cast<uint64_t*>(std::aligned_alloc(JITTER_RING_ALIGNMENT_BYTES, coverage_bytes));
+    if (!ring_bytes_ || !coverage_words_) {
+        std::free(ring_bytes_);
+        std::free(coverage_words_);
+        ring_bytes_ = nullptr;
+        coverage_words_ = nullptr;
+        return false;
+    }
+    // silence everywhere: unfilled frames are released as zeros without extra work
+    memset(ring_bytes_, 0, ring_bytes);
+    memset(coverage_words_, 0, coverage_bytes);
+    return true;
+}
+
+void sample_index_jitter_buffer::restart_timeline(uint64_t first_sample_index) {
+    // the ring is all zero/uncovered here: either fresh or fully flushed
+    timeline_started_ = true;
+    release_index_ = first_sample_index;
+    newest_end_index_ = first_sample_index;
+}
+
+bool sample_index_jitter_buffer::needs_timeline_resync(uint64_t first_sample_index, size_t frame_count) const {
+    uint64_t packet_end_index = first_sample_index + frame_count;
+    // far behind what was already released: not a late packet but a new timeline
+    if (packet_end_index + reorder_window_frames_ < release_index_) return true;
+    // too far ahead to zero-fill
+    return first_sample_index > newest_end_index_ && first_sample_index - newest_end_index_ > max_gap_fill_frames_;
+}
+
+void sample_index_jitter_buffer::store_packet(uint64_t first_sample_index, const uint8_t* bytes, size_t frame_count) {
+    // the part that lands before release_index_ is already on its way to disk
+    if (first_sample_index < release_index_) {
+        uint64_t late_frames = release_index_ - first_sample_index;
+        if (late_frames >= frame_count) {
+            counters_.late_frames.fetch_add(frame_count, std::memory_order_relaxed);
+            return;
+        }
+        counters_.late_frames.fetch_add(late_frames, std::memory_order_relaxed);
+        bytes += (size_t)late_frames * bytes_per_frame_;
+        frame_count -= (size_t)late_frames;
+        first_sample_index = release_index_;
+    }
+
+    uint64_t packet_end_index = first_sample_index + frame_count;
+    size_t stored_frame_count = frame_count;
+    if (first_sample_index > newest_end_index_) {
+        counters_.gap_events.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    size_t frames_already_covered = 0;
+    while (frame_count > 0) {
+        size_t ring_position = (size_t)(first_sample_index & index_mask_);
+        size_t frames_to_end = capacity_frames_ - ring_position;
+        size_t run_frames = frame_count < frames_to_end ? frame_count : frames_to_end;
+        memcpy(ring_bytes_ + ring_position * bytes_per_frame_, bytes, run_frames * bytes_per_frame_);
+        frames_already_covered += exchange_coverage(ring_position, run_frames, true);
+        bytes += run_frames * bytes_per_frame_;
+        first_sample_index += run_frames;
+        frame_count -= run_frames;
+    }
+
+    if (frames_already_covered > 0) {
+        counters_.duplicate_frames.fetch_add(frames_already_covered, std::memory_order_relaxed);
+    }
+    if (packet_end_index <= newest_end_index_) {
+        // landed behind the newest frame; unless it was a pure duplicate it filled a hole
+        if (frames_already_covered < stored_frame_count) {
+            counters_.reordered_packets.fetch_add(1, std::memory_order_relaxed);
+        }
+    } else {
+        newest_end_index_ = packet_end_index;
+    }
+}
+
+void sample_index_jitter_buffer::clear_released_run(size_t ring_position, size_t frame_count) {
+    size_t frames_that_arrived = exchange_coverage(ring_position, frame_count, false);
+    if (frames_that_arrived < frame_count) {
+        counters_.gap_frames.fetch_add(frame_count - frames_that_arrived, std::memory_order_relaxed);
+    }
+    memset(ring_bytes_ + ring_position * bytes_per_frame_, 0, frame_count * bytes_per_frame_);
+}
+
+size_t sample_index_jitter_buffer::exchange_coverage(size_t ring_position, size_t frame_count, bool set_bits) {
+    size_t previously_set = 0;
+    while (frame_count > 0) {
+        size_t word_index = ring_position / JITTER_COVERAGE_BITS_PER_WORD;
+        size_t bit_offset = ring_position % JITTER_COVERAGE_BITS_PER_WORD;
+        size_t bits_in_word = JITTER_COVERAGE_BITS_PER_WORD - bit_offset;
+        if (bits_in_word > frame_count) bits_in_word = frame_count;
+        uint64_t mask = bits_in_word == JITTER_COVERAGE_BITS_PER_WORD ? ~0ull : (((1ull << bits_in_word) - 1) << bit_offset);
+
+        uint64_t& word = coverage_words_[word_index];
+        previously_set += (size_t)__builtin_popcountll(word & mask);
+        word = set_bits ? (word | mask) : (word & ~mask);
+
+        ring_position += bits_in_word;
+        frame_count -= bits_in_word;
+    }
+    return previously_set;
+}
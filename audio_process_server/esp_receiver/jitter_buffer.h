@@ -0,0 +1,121 @@
+// jitter_buffer.h
+// Per-stream ring of converted audio keyed by absolute sample index (the ESP2
+// first_sample_index), used by the writer stage so that the file position of a
+// sample always follows from its sample_index.
+//
+// A packet is copied to ring position (sample_index & mask). Next to the audio ring
+// a coverage bitmap records which frames have arrived. Frames are released in index
+// order once they fall reorder_window_frames behind the newest frame seen (or when
+// the ring needs room, or on flush). Released audio is zeroed in the ring, so a gap
+// is already silence when it is released: gap filling is one memset per released
+// run, and gap/duplicate accounting is word-wise popcount on the bitmap rather than
+// a branch per sample.
+//
+// Packets that arrive after their frames were released are counted late and
+// dropped. A jump that cannot be bridged (backwards beyond the reorder window, or
+// forwards by more than max_gap_fill_frames, e.g. a device reboot) flushes the
+// ring and restarts the timeline at the new index; the sink sees the
+// discontinuity in the indices it is given.
+//
+// Owned by one thread (the writer stage); only the counters are read elsewhere.
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+struct jitter_buffer_counters {
+    std::atomic<uint64_t> gap_events{0};          // packets that started past the newest frame seen
+    std::atomic<uint64_t> gap_frames{0};          // frames released as zero fill
+    std::atomic<uint64_t> duplicate_frames{0};    // frames received twice while still buffered
+    std::atomic<uint64_t> late_frames{0};         // frames that arrived after being released
+    std::atomic<uint64_t> reordered_packets{0};   // packets that filled a hole behind the newest frame
+    std::atomic<uint64_t> timeline_resyncs{0};    // unbridgeable jumps that restarted the timeline
+};
+
+class sample_index_jitter_buffer {
+public:
+    sample_index_jitter_buffer() = default;
+    ~sample_index_jitter_buffer();
+
+    sample_index_jitter_buffer(const sample_index_jitter_buffer&) = delete;
+    sample_index_jitter_buffer& operator=(const sample_index_jitter_buffer&) = delete;
+
+    // Allocate the ring (capacity rounded up to a power of two, at least
+    // reorder_window_frames + max_packet_frames). Returns false on allocation failure.
+    bool initialize(size_t bytes_per_frame, size_t reorder_window_frames, size_t max_packet_frames,
+                    uint64_t max_gap_fill_frames);
+
+    // Store one packet, then release whatever has left the reorder window.
+    // sink(uint64_t first_sample_index, const uint8_t* bytes, size_t frame_count) is
+    // called with contiguous runs in index order.
+    template <typename chunk_sink>
+    void insert(uint64_t first_sample_index, const uint8_t* bytes, size_t frame_count, chunk_sink&& sink) {
+        if (frame_count == 0 || !ring_bytes_) return;
+        if (!timeline_started_) {
+            restart_timeline(first_sample_index);
+        } else if (needs_timeline_resync(first_sample_index, frame_count)) {
+            flush(sink);
+            counters_.timeline_resyncs.fetch_add(1, std::memory_order_relaxed);
+            restart_timeline(first_sample_index);
+        }
+        // make room: anything a full ring behind this packet's end goes out now
+        uint64_t packet_end_index = first_sample_index + frame_count;
+        if (packet_end_index > release_index_ + capacity_frames_) {
+            release_until(packet_end_index - capacity_frames_, sink);
+        }
+        store_packet(first_sample_index, bytes, frame_count);
+        if (newest_end_index_ > release_index_ + reorder_window_frames_) {
+            release_until(newest_end_index_ - reorder_window_frames_, sink);
+        }
+    }
+
+    // Release everything up to the newest frame seen (stream end / segment close)
+    template <typename chunk_sink>
+    void flush(chunk_sink&& sink) {
+        if (timeline_started_) release_until(newest_end_index_, sink);
+    }
+
+    const jitter_buffer_counters& counters() const { return counters_; }
+    uint64_t buffered_frames() const { return newest_end_index_ - release_index_; }
+    size_t capacity_frames() const { return capacity_frames_; }
+
+private:
+    template <typename chunk_sink>
+    void release_until(uint64_t end_index, chunk_sink&& sink) {
+        while (release_index_ < end_index) {
+            // at most two runs: up to the physical end of the ring, then from its start
+            size_t ring_position = (size_t)(release_index_ & index_mask_);
+            uint64_t frames_wanted = end_index - release_index_;
+            size_t frames_to_end = capacity_frames_ - ring_position;
+            size_t run_frames = frames_wanted < frames_to_end ? (size_t)frames_wanted : frames_to_end;
+            sink(release_index_, ring_bytes_ + ring_position * bytes_per_frame_, run_frames);
+            clear_released_run(ring_position, run_frames);
+            release_index_ += run_frames;
+        }
+        if (newest_end_index_ < release_index_) newest_end_index_ = release_index_;
+    }
+
+    void restart_timeline(uint64_t first_sample_index);
+    bool needs_timeline_resync(uint64_t first_sample_index, size_t frame_count) const;
+    void store_packet(uint64_t first_sample_index, const uint8_t* bytes, size_t frame_count);
+    void clear_released_run(size_t ring_position, size_t frame_count);
+
+    // Set or clear the coverage bits of [ring_position, ring_position + frame_count)
+    // (no wrap); returns how many of them were set before
+    size_t exchange_coverage(size_t ring_position, size_t frame_count, bool set_bits);
+
+    uint8_t* ring_bytes_ = nullptr;
+    uint64_t* coverage_words_ = nullptr;
+    size_t bytes_per_frame_ = 0;
+    size_t capacity_frames_ = 0;
+    uint64_t index_mask_ = 0;
+    size_t reorder_window_frames_ = 0;
+    uint64_t max_gap_fill_frames_ = 0;
+
+    bool timeline_started_ = false;
+    uint64_t release_index_ = 0;      // every index below this has been handed to the sink
+    uint64_t newest_end_index_ = 0;   // one past the highest index received
+
+    jitter_buffer_counters counters_;
+};
@@ -0,0 +1,53 @@
+// level_meter.h
+// Per-stream peak/RMS level meter fed by the DSP stage, one update per packet.
+//
+// Peak holds the loudest sample and falls back at LEVEL_METER_PEAK_FALLOFF_DB_PER_SECOND;
+// RMS is an exponential moving average of the mean square over
+// LEVEL_METER_RMS_WINDOW_SECONDS. Both are published as dBFS (relative to 24-bit
+// full scale) through relaxed atomics, so the web side reads them without ever
+// touching the audio path.
+#pragma once
+
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+static constexpr double LEVEL_METER_FULL_SCALE = 8388608.0; // 2^23, packed 24-bit full scale
+static constexpr double LEVEL_METER_RMS_WINDOW_SECONDS = 0.3;
+static constexpr double LEVEL_METER_PEAK_FALLOFF_DB_PER_SECOND = 20.0;
+static constexpr float LEVEL_METER_FLOOR_DBFS = -120.0f;
+
+class stream_level_meter {
+public:
+    // DSP thread only: fold one packet's peak |sample| and sum of squares into the meter
+    void update(uint32_t packet_peak_abs, uint64_t packet_sum_squares, size_t sample_count, uint32_t sample_rate) {
+        if (sample_count == 0 || sample_rate == 0) return;
+        double packet_seconds = (double)sample_count / sample_rate;
+
+        double peak_falloff = std::pow(10.0, -LEVEL_METER_PEAK_FALLOFF_DB_PER_SECOND * packet_seconds / 20.0);
+        held_peak_ = std::fmax((double)packet_peak_abs, held_peak_ * peak_falloff);
+
+        double smoothing = 1.0 - std::exp(-packet_seconds / LEVEL_METER_RMS_WINDOW_SECONDS);
+        double packet_mean_square = (double)packet_sum_squares / sample_count;
+        mean_square_ += smoothing * (packet_mean_square - mean_square_);
+
+        published_peak_dbfs_.store(to_dbfs(held_peak_), std::memory_order_relaxed);
+        published_rms_dbfs_.store(to_dbfs(std::sqrt(mean_square_)), std::memory_order_relaxed);
+    }
+
+    float peak_dbfs() const { return published_peak_dbfs_.load(std::memory_order_relaxed); }
+    float rms_dbfs() const { return published_rms_dbfs_.load(std::memory_order_relaxed); }
+
+private:
+    static float to_dbfs(double amplitude) {
+        if (amplitude <= 0.0) return LEVEL_METER_FLOOR_DBFS;
+        double dbfs = 20.0 * std::log10(amplitude / LEVEL_METER_FULL_SCALE);
+        return dbfs < LEVEL_METER_FLOOR_DBFS ? LEVEL_METER_FLOOR_DBFS : (float)dbfs;
+    }
+
+    double held_peak_ = 0.0;
+    double mean_square_ = 0.0;
+    std::atomic<float> published_peak_dbfs_{LEVEL_METER_FLOOR_DBFS};
+    std::atomic<float> published_rms_dbfs_{LEVEL_METER_FLOOR_DBFS};
+};
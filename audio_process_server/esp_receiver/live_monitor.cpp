@@ -0,0 +1,196 @@
+// live_monitor.cpp
+// Overwriting monitor ring and per-group encoder (see live_monitor.h).
+#include "live_monitor.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+static const size_t LIVE_MONITOR_BYTES_PER_FRAME = 3; // packed 24-bit mono
+static const size_t LIVE_MONITOR_RING_ALIGNMENT_BYTES = 64;
+// decimation filter length per unit of decimation factor (3:1 -> 97 taps)
+static const uint32_t LIVE_MONITOR_FILTER_TAPS_PER_FACTOR = 32;
+// pass band edge as a fraction of the output Nyquist frequency
+static const double LIVE_MONITOR_FILTER_CUTOFF_FRACTION = 0.9;
+
+static int32_t packed24_to_int32(const uint8_t* bytes) {
+    return (int32_t)(((uint32_t)bytes[0] << 8) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 24)) >> 8;
+}
+
+// ----------------- live_monitor_ring -----------------
+
+live_monitor_ring::~live_monitor_ring() {
+    std::free(ring_bytes_);
+}
+
+bool live_monitor_ring::initialize(size_t capacity_frames, size_t max_publish_frames) {
+    if (ring_bytes_) return true;
+    size_t rounded_frames = 1;
+    while (rounded_frames < capacity_frames || rounded_frames < 2 * max_publish_frames) rounded_frames <<= 1;
+    size_t ring_bytes = (rounded_frames * LIVE_MONITOR_BYTES_PER_FRAME + LIVE_MONITOR_RING_ALIGNMENT_BYTES - 1) /
+                        LIVE_MONITOR_RING_ALIGNMENT_BYTES * LIVE_MONITOR_RING_ALIGNMENT_BYTES;
+    uint8_t* ring = static_cast<uint8_t*>(std::aligned_alloc(LIVE_MONITOR_RING_ALIGNMENT_BYTES, ring_bytes));
+    if (!ring) return false;
+    memset(ring, 0, ring_bytes);
+    capacity_frames_ = rounded_frames;
+    max_publish_frames_ = max_publish_frames;
+    index_mask_ = rounded_frames - 1;
+    ring_bytes_ = ring;
+    return true;
+}
+
+void live_monitor_ring::publish(const uint8_t* packed24, size_t frame_count, uint64_t first_sample_index) {
+    if (!ring_bytes_ || frame_count == 0) return;
+    if (frame_count > max_publish_frames_) {
+        // keep only the newest part; the reader's safety margin assumes this bound
+        packed24 += (frame_count - max_publish_frames_) * LIVE_MONITOR_BYTES_PER_FRAME;
+        first_sample_index += frame_count - max_publish_frames_;
+        frame_count = max_publish_frames_;
+    }
+    uint64_t position = write_position_.load(std::memory_order_relaxed);
+    size_t frames_left = frame_count;
+    while (frames_left > 0) {
+        size_t ring_position = (size_t)(position & index_mask_);
+        size_t run_frames = std::min(frames_left, capacity_frames_ - ring_position);
+        memcpy(ring_bytes_ + ring_position * LIVE_MONITOR_BYTES_PER_FRAME, packed24, run_frames * LIVE_MONITOR_BYTES_PER_FRAME);
+        packed24 += run_frames * LIVE_MONITOR_BYTES_PER_FRAME;
+        position += run_frames;
+        frames_left -= run_frames;
+    }
+    write_end_sample_index_.store(first_sample_index + frame_count, std::memory_order_relaxed);
+    write_position_.store(position, std::memory_order_release);
+}
+
+size_t live_monitor_ring::read(uint64_t& cursor, uint8_t* out_packed24, size_t max_frames, uint64_t& frames_skipped,
+                               uint64_t& first_sample_index_out) const {
+    if (!ring_bytes_) return 0;
+    uint64_t write_position = write_position_.load(std::memory_order_acquire);
+    uint64_t write_end_sample_index = write_end_sample_index_.load(std::memory_order_relaxed);
+    if (cursor > write_position || write_position - cursor > readable_span()) {
+        // lapped (or never started): resume at the live edge
+        if (cursor < write_position) frames_skipped += write_position - cursor;
+        cursor = write_position;
+        return 0;
+    }
+
+    size_t frame_count = (size_t)std::min<uint64_t>(write_position - cursor, max_frames);
+    uint64_t position = cursor;
+    uint8_t* destination = out_packed24;
+    size_t frames_left = frame_count;
+    while (frames_left > 0) {
+        size_t ring_position = (size_t)(position & index_mask_);
+        size_t run_frames = std::min(frames_left, capacity_frames_ - ring_position);
+        memcpy(destination, ring_bytes_ + ring_position * LIVE_MONITOR_BYTES_PER_FRAME, run_frames * LIVE_MONITOR_BYTES_PER_FRAME);
+        destination += run_frames * LIVE_MONITOR_BYTES_PER_FRAME;
+        position += run_frames;
+        frames_left -= run_frames;
+    }
+
+    // seqlock-style validation: if the producer advanced far enough during the copy to
+    // reach the start of what we copied, the copy may be torn; drop it and skip ahead
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t write_position_after = write_position_.load(std::memory_order_relaxed);
+    if (write_position_after - cursor > readable_span()) {
+        frames_skipped += write_position_after - cursor;
+        cursor = write_position_after;
+        return 0;
+    }
+
+    first_sample_index_out = write_end_sample_index - (write_position - cursor);
+    cursor += frame_count;
+    return frame_count;
+}
+
+// ----------------- live_monitor_encoder -----------------
+
+bool live_monitor_encoder::configure(uint32_t input_rate, uint32_t output_rate, live_monitor_sample_format format) {
+    if (output_rate == 0 || output_rate > input_rate || input_rate % output_rate != 0) return false;
+    if (format != live_monitor_sample_format::pcm_s16le && format != live_monitor_sample_format::pcm_s24le) return false;
+    output_rate_ = output_rate;
+    decimation_factor_ = input_rate / output_rate;
+    format_ = format;
+    decimation_phase_ = 0;
+    delay_line_position_ = 0;
+    filter_taps_.clear();
+    delay_line_.clear();
+    if (decimation_factor_ == 1) return true;
+
+    // Blackman-windowed sinc low-pass, unity DC gain
+    size_t tap_count = LIVE_MONITOR_FILTER_TAPS_PER_FACTOR * decimation_factor_ + 1;
+    double cutoff = LIVE_MONITOR_FILTER_CUTOFF_FRACTION * 0.5 / decimation_factor_; // cycles per input sample
+    double center = (double)(tap_count - 1) / 2.0;
+    double tap_sum = 0.0;
+    filter_taps_.resize(tap_count);
+    for (size_t tap = 0; tap < tap_count; ++tap) {
+        double t = (double)tap - center;
+        double sinc = t == 0.0 ? 2.0 * cutoff : std::sin(2.0 * M_PI * cutoff * t) / (M_PI * t);
+        double window = 0.42 - 0.5 * std::cos(2.0 * M_PI * tap / (tap_count - 1)) + 0.08 * std::cos(4.0 * M_PI * tap / (tap_count - 1));
+        filter_taps_[tap] = (float)(sinc * window);
+        tap_sum += filter_taps_[tap];
+    }
+    for (float& tap : filter_taps_) tap = (float)(tap / tap_sum);
+    delay_line_.assign(tap_count, 0.0f);
+    return true;
+}
+
+void live_monitor_encoder::append_sample(int32_t sample_24, std::string& out) const {
+    if (format_ == live_monitor_sample_format::pcm_s16le) {
+        int32_t sample_16 = sample_24 >> 8;
+        out.push_back((char)(sample_16 & 0xFF));
+        out.push_back((char)((sample_16 >> 8) & 0xFF));
+    } else {
+        out.push_back((char)(sample_24 & 0xFF));
+        out.push_back((char)((sample_24 >> 8) & 0xFF));
+        out.push_back((char)((sample_24 >> 16) & 0xFF));
+    }
+}
+
+void live_monitor_encoder::encode(const uint8_t* packed24, size_t frame_count, std::string& out) {
+    if (decimation_factor_ == 1) {
+        if (format_ == live_monitor_sample_format::pcm_s24le) {
+            out.append(reinterpret_cast<const char*>(packed24), frame_count * LIVE_MONITOR_BYTES_PER_FRAME);
+            return;
+        }
+        // s16: the top two bytes of each packed 24-bit sample
+        for (size_t frame = 0; frame < frame_count; ++frame) {
+            out.push_back((char)packed24[frame * 3 + 1]);
+            out.push_back((char)packed24[frame * 3 + 2]);
+        }
+        return;
+    }
+
+    const size_t tap_count = filter_taps_.size();
+    for (size_t frame = 0; frame < frame_count; ++frame) {
+        delay_line_[delay_line_position_] = (float)packed24_to_int32(packed24 + frame * 3);
+        delay_line_position_ = delay_line_position_ + 1 == tap_count ? 0 : delay_line_position_ + 1;
+        if (++decimation_phase_ < decimation_factor_) continue;
+        decimation_phase_ = 0;
+
+        // oldest sample sits at delay_line_position_; the filter is symmetric so order is irrelevant
+        float accumulator = 0.0f;
+        size_t first_run = tap_count - delay_line_position_;
+        for (size_t tap = 0; tap < first_run; ++tap) accumulator += filter_taps_[tap] * delay_line_[delay_line_position_ + tap];
+        for (size_t tap = first_run; tap < tap_count; ++tap) accumulator += filter_taps_[tap] * delay_line_[tap - first_run];
+
+        long rounded = std::lround(accumulator);
+        if (rounded > 8388607) rounded = 8388607;
+        if (rounded < -8388608) rounded = -8388608;
+        append_sample((int32_t)rounded, out);
+    }
+}
+
+void write_live_monitor_frame_header(std::string& out, uint32_t block_sequence, uint64_t first_sample_index,
+                                     uint32_t sample_rate, live_monitor_sample_format format) {
+    uint8_t* header = reinterpret_cast<uint8_t*>(&out[0]);
+    auto put_le = [](uint8_t* destination, uint64_t value, int byte_count) {
+        for (int i = 0; i < byte_count; ++i) destination[i] = (uint8_t)((value >> (8 * i)) & 0xFF);
+    };
+    put_le(header + 0, LIVE_MONITOR_FRAME_MAGIC, 4);
+    put_le(header + 4, block_sequence, 4);
+    put_le(header + 8, first_sample_index, 8);
+    put_le(header + 16, sample_rate, 4);
+    put_le(header + 20, (uint16_t)format, 2);
+    put_le(header + 22, 1, 2); // mono
+}
@@ -0,0 +1,99 @@
+// live_monitor.h
+// Building blocks of the /listen live-monitoring endpoint.
+//
+// live_monitor_ring: per-stream ring of converted (packed 24-bit mono) audio that the
+// DSP stage publishes into only while someone is listening. It is a single-producer
+// ring that never waits for its reader: the reader keeps its own cursor and, if the
+// producer laps it, skips ahead to the live edge. A slow listener therefore can
+// never hold a packet slot or push back on ingest. There is one copy per stream
+// regardless of listener count.
+//
+// live_monitor_encoder: turns packed 24-bit audio into the wire format a group of
+// listeners asked for (s16 or s24, 48 kHz or an integer decimation of it behind a
+// windowed-sinc low-pass). It runs once per (stream, rate, format) group, not once
+// per listener.
+//
+// Wire frame (binary WebSocket message), little-endian:
+//   0  u32 magic "MON1"      4 u32 block_sequence   8 u64 first_sample_index (48 kHz timeline)
+//   16 u32 sample_rate      20 u16 format (1 = s16, 2 = s24)   22 u16 channels
+//   24 samples
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+static constexpr uint32_t LIVE_MONITOR_FRAME_MAGIC = 0x314E4F4D; // "MON1"
+static constexpr size_t LIVE_MONITOR_FRAME_HEADER_BYTES = 24;
+
+enum class live_monitor_sample_format : uint16_t { pcm_s16le = 1, pcm_s24le = 2 };
+
+class live_monitor_ring {
+public:
+    live_monitor_ring() = default;
+    ~live_monitor_ring();
+
+    live_monitor_ring(const live_monitor_ring&) = delete;
+    live_monitor_ring& operator=(const live_monitor_ring&) = delete;
+
+    // Allocate capacity_frames (rounded up to a power of two). max_publish_frames is the
+    // largest single publish, used to decide when a reader's data may be overwritten.
+    // Idempotent; returns false only on allocation failure.
+    bool initialize(size_t capacity_frames, size_t max_publish_frames);
+    bool is_initialized() const { return ring_bytes_ != nullptr; }
+
+    // Producer (DSP thread): append frame_count packed 24-bit frames
+    void publish(const uint8_t* packed24, size_t frame_count, uint64_t first_sample_index);
+
+    // Reader: copy up to max_frames frames from cursor. A cursor that was (or may have
+    // been) overwritten jumps to the live edge first; frames jumped over are added
+    // to frames_skipped. Returns frames copied and the sample index of the first one
+    // (derived from the newest publish, exact unless the stream had gaps).
+    size_t read(uint64_t& cursor, uint8_t* out_packed24, size_t max_frames, uint64_t& frames_skipped,
+                uint64_t& first_sample_index_out) const;
+
+    // Position one past the newest published frame (a new reader starts here)
+    uint64_t write_position() const { return write_position_.load(std::memory_order_acquire); }
+
+private:
+    // frames behind the write position that are safe from a publish in progress
+    uint64_t readable_span() const { return capacity_frames_ - max_publish_frames_; }
+
+    uint8_t* ring_bytes_ = nullptr;
+    size_t capacity_frames_ = 0;
+    size_t max_publish_frames_ = 0;
+    uint64_t index_mask_ = 0;
+    std::atomic<uint64_t> write_position_{0};
+    std::atomic<uint64_t> write_end_sample_index_{0};  // sample index one past the newest frame
+};
+
+class live_monitor_encoder {
+public:
+    // output_rate must divide input_rate. Returns false for unsupported combinations.
+    bool configure(uint32_t input_rate, uint32_t output_rate, live_monitor_sample_format format);
+
+    // Append the encoded form of frame_count packed 24-bit frames to out
+    void encode(const uint8_t* packed24, size_t frame_count, std::string& out);
+
+    uint32_t output_rate() const { return output_rate_; }
+    live_monitor_sample_format format() const { return format_; }
+
+private:
+    void append_sample(int32_t sample_24, std::string& out) const;
+
+    uint32_t output_rate_ = 0;
+    uint32_t decimation_factor_ = 1;
+    live_monitor_sample_format format_ = live_monitor_sample_format::pcm_s16le;
+
+    // decimating FIR: taps, circular delay line, and the input phase within one output period
+    std::vector<float> filter_taps_;
+    std::vector<float> delay_line_;
+    size_t delay_line_position_ = 0;
+    uint32_t decimation_phase_ = 0;
+};
+
+// Write the 24-byte frame header at the start of out (which must already hold it)
+void write_live_monitor_frame_header(std::string& out, uint32_t block_sequence, uint64_t first_sample_index,
+                                     uint32_t sample_rate, live_monitor_sample_format format);
@@ -0,0 +1,56 @@
+// packet_pool.h
+// Fixed slab backing the packet slots of the receiver -> DSP -> writer pipeline.
+//
+// One aligned allocation at startup holds, for every slot, an output region (what
+// the writer appends). The raw payload a slot carries is a view into its stream's
+// receive_ring. Slots are recycled through the pipeline rings, so after
+// initialize() the packet path never touches the heap.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+class packet_buffer_pool {
+public:
+    // regions start on cache-line boundaries so SIMD loads/stores stay aligned
+    static constexpr size_t REGION_ALIGNMENT_BYTES = 64;
+
+    packet_buffer_pool() = default;
+    ~packet_buffer_pool() { std::free(slab_); }
+
+    packet_buffer_pool(const packet_buffer_pool&) = delete;
+    packet_buffer_pool& operator=(const packet_buffer_pool&) = delete;
+
+    // Allocate the slab. Returns false if the allocation failed or was already done.
+    bool initialize(size_t slot_count, size_t output_capacity_bytes) {
+        if (slab_) return false;
+        output_capacity_ = output_capacity_bytes;
+        slot_stride_ = round_up_to_alignment(output_capacity_bytes);
+        slot_count_ = slot_count;
+        slab_bytes_ = slot_stride_ * slot_count;
+        slab_ = static_cast<uint8_t*>(std::aligned_alloc(REGION_ALIGNMENT_BYTES, slab_bytes_));
+        if (!slab_) return false;
+        ++slab_allocations_;
+        return true;
+    }
+
+    uint8_t* output_region(size_t slot_index) const { return slab_ + slot_index * slot_stride_; }
+
+    size_t output_capacity() const { return output_capacity_; }
+    size_t slot_count() const { return slot_count_; }
+    size_t slab_bytes() const { return slab_bytes_; }
+    uint64_t slab_allocations() const { return slab_allocations_; }
+
+private:
+    static size_t round_up_to_alignment(size_t bytes) {
+        return (bytes + REGION_ALIGNMENT_BYTES - 1) / REGION_ALIGNMENT_BYTES * REGION_ALIGNMENT_BYTES;
+    }
+
+    uint8_t* slab_ = nullptr;
+    size_t output_capacity_ = 0;
+    size_t slot_stride_ = 0;
+    size_t slot_count_ = 0;
+    size_t slab_bytes_ = 0;
+    uint64_t slab_allocations_ = 0;
+};
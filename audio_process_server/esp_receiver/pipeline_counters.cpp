@@ -0,0 +1,78 @@
+// pipeline_counters.cpp
+// Per-thread counter registry (see pipeline_counters.h).
+#include "pipeline_counters.h"
+
+#include <mutex>
+#include <vector>
+
+static std::mutex global_pipeline_counter_registry_mutex;
+static std::vector<pipeline_thread_counters*> global_pipeline_counter_blocks;
+
+pipeline_thread_counters& this_thread_pipeline_counters() {
+    thread_local pipeline_thread_counters* thread_counters = nullptr;
+    if (!thread_counters) {
+        thread_counters = new pipeline_thread_counters();
+        std::lock_guard<std::mutex> lock(global_pipeline_counter_registry_mutex);
+        global_pipeline_counter_blocks.push_back(thread_counters);
+    }
+    return *thread_counters;
+}
+
+uint64_t pipeline_counter_total(pipeline_counter counter) {
+    std::lock_guard<std::mutex> lock(global_pipeline_counter_registry_mutex);
+    uint64_t total = 0;
+    for (const pipeline_thread_counters* block : global_pipeline_counter_blocks) {
+        total += block->values[(size_t)counter].load();
+    }
+    return total;
+}
+
+const char* pipeline_counter_name(pipeline_counter counter) {
+    switch (counter) {
+    case pipeline_counter::connections_accepted: return "connections_accepted";
+    case pipeline_counter::connections_refused: return "connections_refused";
+    case pipeline_counter::sessions_resumed: return "sessions_resumed";
+    case pipeline_counter::sessions_expired: return "sessions_expired";
+    case pipeline_counter::bytes_received: return "bytes_received";
+    case pipeline_counter::packets_received: return "packets_received";
+    case pipeline_counter::packets_dropped: return "packets_dropped";
+    case pipeline_counter::header_errors: return "header_errors";
+    case pipeline_counter::bad_magic_disconnects: return "bad_magic_disconnects";
+    case pipeline_counter::packets_converted: return "packets_converted";
+    case pipeline_counter::packets_written: return "packets_written";
+    case pipeline_counter::udp_datagrams_received: return "udp_datagrams_received";
+    case pipeline_counter::udp_datagrams_rejected: return "udp_datagrams_rejected";
+    case pipeline_counter::fec_packets_recovered: return "fec_packets_recovered";
+    case pipeline_counter::fec_packets_unrecoverable: return "fec_packets_unrecoverable";
+    case pipeline_counter::payload_decode_errors: return "payload_decode_errors";
+    case pipeline_counter::unsupported_format_disconnects: return "unsupported_format_disconnects";
+    case pipeline_counter::capture_overrun_frames: return "capture_overrun_frames";
+    case pipeline_counter::count: break;
+    }
+    return "unknown";
+}
+
+const char* pipeline_counter_help(pipeline_counter counter) {
+    switch (counter) {
+    case pipeline_counter::connections_accepted: return "TCP connections and UDP sources accepted as streams.";
+    case pipeline_counter::connections_refused: return "Connections refused at the stream limit.";
+    case pipeline_counter::sessions_resumed: return "TCP sessions continued on a new connection.";
+    case pipeline_counter::sessions_expired: return "Disconnected TCP sessions closed after the grace period.";
+    case pipeline_counter::bytes_received: return "Bytes read from all TCP streams and UDP datagrams.";
+    case pipeline_counter::packets_received: return "ESP2 packets received and queued.";
+    case pipeline_counter::packets_dropped: return "ESP2 packets discarded for lack of a free slot.";
+    case pipeline_counter::header_errors: return "Rejected ESP2 headers.";
+    case pipeline_counter::bad_magic_disconnects: return "Streams dropped for a bad header magic.";
+    case pipeline_counter::packets_converted: return "Packets converted by the DSP stage.";
+    case pipeline_counter::packets_written: return "Packets handed to the jitter buffer by the writer stage.";
+    case pipeline_counter::udp_datagrams_received: return "UDP datagrams received.";
+    case pipeline_counter::udp_datagrams_rejected: return "UDP datagrams malformed, truncated or without a stream slot.";
+    case pipeline_counter::fec_packets_recovered: return "UDP packets rebuilt from FEC parity.";
+    case pipeline_counter::fec_packets_unrecoverable: return "UDP packets lost beyond what FEC parity could rebuild.";
+    case pipeline_counter::payload_decode_errors: return "Coded payloads that failed to decode (written as silence).";
+    case pipeline_counter::unsupported_format_disconnects: return "Streams dropped for a format no converter handles.";
+    case pipeline_counter::capture_overrun_frames: return "Frames devices reported dropping at capture because their send ring was full.";
+    case pipeline_counter::count: break;
+    }
+    return "Pipeline counter.";
+}
@@ -0,0 +1,83 @@
+// pipeline_counters.h
+// Contention-free counters for the packet path, summed only when /metrics is scraped.
+//
+// Every counter has exactly one writing thread, so an increment is a relaxed load
+// plus a relaxed store: no locked read-modify-write on the hot loop. Each thread's
+// counters (and each stream's receiver-owned and writer-owned counters) fill their
+// own cache lines, so instrumentation never bounces a line between the receiver,
+// DSP and writer threads. Readers on other threads load relaxed values and may be a
+// few increments behind.
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+static constexpr size_t PIPELINE_COUNTER_CACHE_LINE_BYTES = 64;
+
+class single_writer_counter {
+public:
+    void add(uint64_t amount = 1) {
+        value_.store(value_.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+    uint64_t load() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> value_{0};
+};
+
+// Process-wide counters, kept per thread
+enum class pipeline_counter : size_t {
+    connections_accepted,
+    connections_refused,
+    sessions_resumed,        // TCP sessions continued on a new connection
+    sessions_expired,        // disconnected sessions closed after the grace period
+    bytes_received,
+    packets_received,
+    packets_dropped,         // no free packet slot
+    header_errors,           // bad magic, oversized or malformed headers
+    bad_magic_disconnects,
+    packets_converted,       // DSP stage
+    packets_written,         // writer stage (handed to the jitter buffer)
+    udp_datagrams_received,
+    udp_datagrams_rejected,  // malformed, truncated, or no stream slot for a new source
+    fec_packets_recovered,   // lost UDP packets rebuilt from parity
+    fec_packets_unrecoverable, // lost from groups missing two or more packets
+    payload_decode_errors,   // coded payloads that failed to decode (written as silence)
+    unsupported_format_disconnects, // streams dropped for a format no converter handles
+    capture_overrun_frames,  // frames devices reported dropping at capture (ESP2_FLAG_CAPTURE_OVERRUN)
+    count
+};
+
+struct alignas(PIPELINE_COUNTER_CACHE_LINE_BYTES) pipeline_thread_counters {
+    single_writer_counter values[(size_t)pipeline_counter::count];
+
+    single_writer_counter& operator[](pipeline_counter counter) { return values[(size_t)counter]; }
+};
+
+// The calling thread's counters. The block is allocated and registered on first use,
+// so call this once at thread start, before the thread joins the packet path.
+// Blocks outlive their threads and keep their totals.
+pipeline_thread_counters& this_thread_pipeline_counters();
+
+// Sum over all threads (scrape side)
+uint64_t pipeline_counter_total(pipeline_counter counter);
+const char* pipeline_counter_name(pipeline_counter counter);
+const char* pipeline_counter_help(pipeline_counter counter);  // one sentence, for the /metrics HELP line
+
+// Per-stream counters written only by the receiver thread
+struct alignas(PIPELINE_COUNTER_CACHE_LINE_BYTES) stream_receive_counters {
+    single_writer_counter bytes_received;
+    single_writer_counter packets_received;
+    single_writer_counter packets_dropped;
+    single_writer_counter header_errors;
+    single_writer_counter bad_magic_disconnects;
+    single_writer_counter fec_packets_recovered;
+    single_writer_counter fec_packets_unrecoverable;
+    single_writer_counter capture_overrun_frames;
+};
+
+// Per-stream counters written only by the writer thread
+struct alignas(PIPELINE_COUNTER_CACHE_LINE_BYTES) stream_write_counters {
+    single_writer_counter frames_written;
+};
@@ -0,0 +1,53 @@
+// receive_ring.cpp
+// Double mapping of the receive ring (see receive_ring.h).
+#include "receive_ring.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstdio>
+
+receive_ring::~receive_ring() {
+    if (base_) munmap(base_, capacity_ * 2);
+}
+
+bool receive_ring::initialize(size_t capacity_bytes) {
+    if (base_) return false;
+    long page_bytes = sysconf(_SC_PAGESIZE);
+    if (capacity_bytes == 0 || (capacity_bytes & (capacity_bytes - 1)) != 0 ||
+        page_bytes <= 0 || capacity_bytes % (size_t)page_bytes != 0) {
+        return false;
+    }
+
+    int memory_fd = memfd_create("esp_receive_ring", MFD_CLOEXEC);
+    if (memory_fd < 0) {
+        perror("memfd_create");
+        return false;
+    }
+    if (ftruncate(memory_fd, (off_t)capacity_bytes) != 0) {
+        perror("ftruncate");
+        close(memory_fd);
+        return false;
+    }
+
+    // reserve twice the size, then map the same pages into both halves
+    void* reserved = mmap(nullptr, capacity_bytes * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (reserved == MAP_FAILED) {
+        perror("mmap");
+        close(memory_fd);
+        return false;
+    }
+    uint8_t* base = static_cast<uint8_t*>(reserved);
+    bool mapped = mmap(base, capacity_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, memory_fd, 0) != MAP_FAILED &&
+                  mmap(base + capacity_bytes, capacity_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, memory_fd, 0) != MAP_FAILED;
+    close(memory_fd); // the mappings keep the memory alive
+    if (!mapped) {
+        perror("mmap");
+        munmap(base, capacity_bytes * 2);
+        return false;
+    }
+
+    base_ = base;
+    capacity_ = capacity_bytes;
+    return true;
+}
@@ -0,0 +1,80 @@
+// receive_ring.h
+// Per-connection receive buffer for the epoll receiver: one recv() fills as much of it
+// as the socket has, the parser walks every complete frame in place, and payloads go
+// down the pipeline as views into it, so received bytes are never copied.
+//
+// The ring's memory is mapped twice back to back, so the bytes at any position up to
+// capacity() long are contiguous in memory: a frame that wraps the end of the ring is
+// still one pointer, for the header parser and the conversion kernels alike.
+//
+// Positions are absolute byte counts. The receiver thread owns the write and parse
+// positions; a view handed out with retain = true keeps its bytes until the consumer
+// (the DSP thread) calls release_through() with the view's end position. Views are
+// released in the order they were handed out. Bytes consumed with retain = false
+// (dropped frames) are reclaimed once every earlier retained view is released.
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+class receive_ring {
+public:
+    static constexpr size_t CACHE_LINE_BYTES = 64;
+
+    receive_ring() = default;
+    ~receive_ring();
+
+    receive_ring(const receive_ring&) = delete;
+    receive_ring& operator=(const receive_ring&) = delete;
+
+    // Map the ring (capacity: a power of two and a multiple of the page size).
+    // Returns false if the mapping failed or was already done.
+    bool initialize(size_t capacity_bytes);
+    bool is_initialized() const { return base_ != nullptr; }
+    size_t capacity() const { return capacity_; }
+
+    // ---- receiver thread ----
+
+    // Free space after the write position; 0 while the consumer still holds the ring
+    size_t writable_bytes() const { return capacity_ - (size_t)(write_position_ - reclaimable_position()); }
+    uint8_t* write_pointer() const { return base_ + (write_position_ & (capacity_ - 1)); }
+    void commit_write(size_t bytes) { write_position_ += bytes; }
+
+    const uint8_t* unparsed_data() const { return base_ + (parse_position_ & (capacity_ - 1)); }
+    size_t unparsed_bytes() const { return (size_t)(write_position_ - parse_position_); }
+
+    // Move the parse position past `bytes`. Returns the end position to hand to
+    // release_through() when the bytes were retained.
+    uint64_t consume(size_t bytes, bool retain) {
+        parse_position_ += bytes;
+        if (retain) ++retained_views_;
+        return parse_position_;
+    }
+
+    // ---- consumer thread ----
+
+    void release_through(uint64_t end_position) {
+        released_.position.store(end_position, std::memory_order_relaxed);
+        released_.views.store(released_.views.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+private:
+    uint64_t reclaimable_position() const {
+        // every retained view is back: everything parsed so far is free
+        if (released_.views.load(std::memory_order_acquire) == retained_views_) return parse_position_;
+        return released_.position.load(std::memory_order_relaxed);
+    }
+
+    uint8_t* base_ = nullptr;
+    size_t capacity_ = 0;
+    uint64_t write_position_ = 0;
+    uint64_t parse_position_ = 0;
+    uint64_t retained_views_ = 0;
+
+    // written by the consumer; kept off the receiver's line
+    struct alignas(CACHE_LINE_BYTES) released_state {
+        std::atomic<uint64_t> position{0};
+        std::atomic<uint64_t> views{0};
+    } released_;
+};
@@ -0,0 +1,450 @@
+// sample_convert.cpp
+// Scalar, SSE4.1, AVX2 and NEON implementations of the int32-left24 -> packed-24 kernel,
+// the decoders that turn coded payloads into its input, and the per-stream converters
+// built from both.
+//
+// All kernels compute, per sample s and gain k (Q16.16, 0 <= k <= 16.0):
+//   t = s * k + 2^15 - (s < 0)       // exact in int64; the -1 turns round-half-up into half-away-from-zero
+//   r = saturate_int32(t >> 16)
+//   out = r >> 8, stored as 3 little-endian bytes
+// which equals the old llround(double(s) * gain) path for the same (quantized) gain.
+//
+// The x86 kernels are compiled with target attributes and picked at runtime, so the
+// binary still runs on CPUs without AVX2/SSE4.1.
+#include "sample_convert.h"
+
+#include "esp2_payload_codec.h"
+
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SAMPLE_CONVERT_HAVE_X86_KERNELS 1
+#endif
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#define SAMPLE_CONVERT_HAVE_NEON_KERNEL 1
+#endif
+
+int32_t quantize_gain_to_q16(double gain) {
+    if (!(gain > 0.0)) return 0; // also catches NaN
+    double scaled = gain * (double)SAMPLE_GAIN_Q16_ONE;
+    if (scaled > (double)SAMPLE_GAIN_Q16_MAX) return SAMPLE_GAIN_Q16_MAX;
+    return (int32_t)std::llround(scaled);
+}
+
+// ----------------- Reference + scalar kernels -----------------
+
+void convert_int32_left24_to_packed24_reference(const uint8_t* input_int32_le, uint8_t* output_packed24,
+                                                size_t sample_count, int32_t gain_q16) {
+    const double gain_now = (double)gain_q16 / (double)SAMPLE_GAIN_Q16_ONE;
+    for (size_t sample_index = 0; sample_index < sample_count; ++sample_index) {
+        int32_t sample_int32 = le_bytes_to_int32(input_int32_le + sample_index * 4);
+        // apply gain in double then clamp
+        double scaled = (double)sample_int32 * gain_now;
+        if (scaled > (double)INT32_MAX) scaled = (double)INT32_MAX;
+        if (scaled < (double)INT32_MIN) scaled = (double)INT32_MIN;
+        int32_t scaled_i32 = (int32_t)std::llround(scaled);
+        // convert left-aligned 32->packed 24
+        int32_left24_to_3bytes_le(scaled_i32, output_packed24 + sample_index * 3);
+    }
+}
+
+void convert_int32_left24_to_packed24_scalar(const uint8_t* input_int32_le, uint8_t* output_packed24,
+                                             size_t sample_count, int32_t gain_q16) {
+    const int64_t rounding_bias = (int64_t)1 << (SAMPLE_GAIN_FRACTION_BITS - 1);
+    for (size_t sample_index = 0; sample_index < sample_count; ++sample_index) {
+        int32_t sample_int32;
+        memcpy(&sample_int32, input_int32_le + sample_index * 4, 4); // little-endian hosts only (x86/arm64)
+        int64_t biased = (int64_t)sample_int32 * gain_q16 + rounding_bias - (sample_int32 < 0 ? 1 : 0);
+        int64_t rounded = biased >> SAMPLE_GAIN_FRACTION_BITS;
+        if (rounded > INT32_MAX) rounded = INT32_MAX;
+        if (rounded < INT32_MIN) rounded = INT32_MIN;
+        int32_left24_to_3bytes_le((int32_t)rounded, output_packed24 + sample_index * 3);
+    }
+}
+
+#if defined(SAMPLE_CONVERT_HAVE_X86_KERNELS)
+
+// ----------------- SSE4.1 kernel (4 samples / iteration) -----------------
+
+// Gain, round and saturate four int32 samples; returns the saturated int32 results.
+__attribute__((target("sse4.1")))
+static inline __m128i scale_round_saturate_sse41(__m128i samples, __m128i gain) {
+    const __m128i rounding_bias = _mm_set1_epi64x((int64_t)1 << (SAMPLE_GAIN_FRACTION_BITS - 1));
+    const __m128i sample_sign = _mm_srai_epi32(samples, 31); // -1 for negative samples
+
+    // _mm_mul_epi32 multiplies dwords 0 and 2: do even lanes, then odd lanes shifted down
+    __m128i biased_even = _mm_add_epi64(_mm_mul_epi32(samples, gain), rounding_bias);
+    biased_even = _mm_add_epi64(biased_even, _mm_shuffle_epi32(sample_sign, _MM_SHUFFLE(2, 2, 0, 0)));
+    __m128i biased_odd = _mm_add_epi64(_mm_mul_epi32(_mm_srli_epi64(samples, 32), gain), rounding_bias);
+    biased_odd = _mm_add_epi64(biased_odd, _mm_shuffle_epi32(sample_sign, _MM_SHUFFLE(3, 3, 1, 1)));
+
+    // low 32 bits of (t >> 16) for each sample, back in dword order 0,1,2,3
+    __m128i result = _mm_blend_epi16(_mm_srli_epi64(biased_even, SAMPLE_GAIN_FRACTION_BITS),
+                                     _mm_slli_epi64(_mm_srli_epi64(biased_odd, SAMPLE_GAIN_FRACTION_BITS), 32), 0xCC);
+
+    // t >> 47 is 0 or -1 exactly when t >> 16 fits in int32
+    __m128i range_check = _mm_blend_epi16(_mm_srli_epi64(_mm_srai_epi32(biased_even, 47 - 32), 32),
+                                          _mm_srai_epi32(biased_odd, 47 - 32), 0xCC);
+    __m128i positive_overflow = _mm_cmpgt_epi32(range_check, _mm_setzero_si128());
+    __m128i negative_overflow = _mm_cmplt_epi32(range_check, _mm_set1_epi32(-1));
+    result = _mm_blendv_epi8(result, _mm_set1_epi32(INT32_MAX), positive_overflow);
+    result = _mm_blendv_epi8(result, _mm_set1_epi32(INT32_MIN), negative_overflow);
+    return result;
+}
+
+__attribute__((target("sse4.1")))
+static void convert_int32_left24_to_packed24_sse41(const uint8_t* input_int32_le, uint8_t* output_packed24,
+                                                   size_t sample_count, int32_t gain_q16) {
+    const __m128i gain = _mm_set1_epi32(gain_q16);
+    // bytes 0..2 of each (>> 8) dword, compacted into the low 12 bytes
+    const __m128i pack_4x3 = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+
+    size_t sample_index = 0;
+    for (; sample_index + 4 <= sample_count; sample_index += 4) {
+        __m128i samples = _mm_loadu_si128((const __m128i*)(input_int32_le + sample_index * 4));
+        __m128i aligned24 = _mm_srai_epi32(scale_round_saturate_sse41(samples, gain), 8);
+        __m128i packed = _mm_shuffle_epi8(aligned24, pack_4x3);
+        uint8_t* output = output_packed24 + sample_index * 3;
+        _mm_storel_epi64((__m128i*)output, packed);
+        uint32_t last_four_bytes = (uint32_t)_mm_extract_epi32(packed, 2);
+        memcpy(output + 8, &last_four_bytes, 4);
+    }
+    convert_int32_left24_to_packed24_scalar(input_int32_le + sample_index * 4, output_packed24 + sample_index * 3,
+                                            sample_count - sample_index, gain_q16);
+}
+
+// ----------------- AVX2 kernel (8 samples / iteration) -----------------
+
+__attribute__((target("avx2")))
+static inline __m256i scale_round_saturate_avx2(__m256i samples, __m256i gain) {
+    const __m256i rounding_bias = _mm256_set1_epi64x((int64_t)1 << (SAMPLE_GAIN_FRACTION_BITS - 1));
+    const __m256i sample_sign = _mm256_srai_epi32(samples, 31);
+
+    __m256i biased_even = _mm256_add_epi64(_mm256_mul_epi32(samples, gain), rounding_bias);
+    biased_even = _mm256_add_epi64(biased_even, _mm256_shuffle_epi32(sample_sign, _MM_SHUFFLE(2, 2, 0, 0)));
+    __m256i biased_odd = _mm256_add_epi64(_mm256_mul_epi32(_mm256_srli_epi64(samples, 32), gain), rounding_bias);
+    biased_odd = _mm256_add_epi64(biased_odd, _mm256_shuffle_epi32(sample_sign, _MM_SHUFFLE(3, 3, 1, 1)));
+
+    __m256i result = _mm256_blend_epi32(_mm256_srli_epi64(biased_even, SAMPLE_GAIN_FRACTION_BITS),
+                                        _mm256_slli_epi64(_mm256_srli_epi64(biased_odd, SAMPLE_GAIN_FRACTION_BITS), 32), 0xAA);
+
+    __m256i range_check = _mm256_blend_epi32(_mm256_srli_epi64(_mm256_srai_epi32(biased_even, 47 - 32), 32),
+                                             _mm256_srai_epi32(biased_odd, 47 - 32), 0xAA);
+    __m256i positive_overflow = _mm256_cmpgt_epi32(range_check, _mm256_setzero_si256());
+    __m256i negative_overflow = _mm256_cmpgt_epi32(_mm256_set1_epi32(-1), range_check);
+    result = _mm256_blendv_epi8(result, _mm256_set1_epi32(INT32_MAX), positive_overflow);
+    result = _mm256_blendv_epi8(result, _mm256_set1_epi32(INT32_MIN), negative_overflow);
+    return result;
+}
+
+__attribute__((target("avx2")))
+static void convert_int32_left24_to_packed24_avx2(const uint8_t* input_int32_le, uint8_t* output_packed24,
+                                                  size_t sample_count, int32_t gain_q16) {
+    const __m256i gain = _mm256_set1_epi32(gain_q16);
+    const __m256i pack_4x3 = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                              0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    // join the two 12-byte lane results into 24 contiguous bytes
+    const __m256i join_lanes = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7);
+
+    size_t sample_index = 0;
+    for (; sample_index + 8 <= sample_count; sample_index += 8) {
+        __m256i samples = _mm256_loadu_si256((const __m256i*)(input_int32_le + sample_index * 4));
+        __m256i aligned24 = _mm256_srai_epi32(scale_round_saturate_avx2(samples, gain), 8);
+        __m256i packed = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(aligned24, pack_4x3), join_lanes);
+        uint8_t* output = output_packed24 + sample_index * 3;
+        _mm_storeu_si128((__m128i*)output, _mm256_castsi256_si128(packed));
+        _mm_storel_epi64((__m128i*)(output + 16), _mm256_extracti128_si256(packed, 1));
+    }
+    convert_int32_left24_to_packed24_sse41(input_int32_le + sample_index * 4, output_packed24 + sample_index * 3,
+                                           sample_count - sample_index, gain_q16);
+}
+
+#endif // SAMPLE_CONVERT_HAVE_X86_KERNELS
+
+#if defined(SAMPLE_CONVERT_HAVE_NEON_KERNEL)
+
+// ----------------- NEON kernel (4 samples / iteration, aarch64) -----------------
+
+// vqrshrn_n_s64 is saturate((t + 2^15) >> 16); subtracting 1 from negative products
+// first gives the same half-away-from-zero rounding as the other kernels.
+static inline int32x2_t scale_round_saturate_neon(int64x2_t products) {
+    products = vaddq_s64(products, vshrq_n_s64(products, 63));
+    return vqrshrn_n_s64(products, SAMPLE_GAIN_FRACTION_BITS);
+}
+
+static void convert_int32_left24_to_packed24_neon(const uint8_t* input_int32_le, uint8_t* output_packed24,
+                                                  size_t sample_count, int32_t gain_q16) {
+    static const uint8_t pack_4x3_indices[16] = {0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 255, 255, 255, 255};
+    const uint8x16_t pack_4x3 = vld1q_u8(pack_4x3_indices);
+
+    size_t sample_index = 0;
+    for (; sample_index + 4 <= sample_count; sample_index += 4) {
+        int32x4_t samples = vreinterpretq_s32_u8(vld1q_u8(input_int32_le + sample_index * 4));
+        int32x2_t rounded_low = scale_round_saturate_neon(vmull_n_s32(vget_low_s32(samples), gain_q16));
+        int32x2_t rounded_high = scale_round_saturate_neon(vmull_high_n_s32(samples, gain_q16));
+        int32x4_t aligned24 = vshrq_n_s32(vcombine_s32(rounded_low, rounded_high), 8);
+        uint8x16_t packed = vqtbl1q_u8(vreinterpretq_u8_s32(aligned24), pack_4x3);
+        uint8_t* output = output_packed24 + sample_index * 3;
+        vst1_u8(output, vget_low_u8(packed));
+        uint32_t last_four_bytes = vgetq_lane_u32(vreinterpretq_u32_u8(packed), 2);
+        memcpy(output + 8, &last_four_bytes, 4);
+    }
+    convert_int32_left24_to_packed24_scalar(input_int32_le + sample_index * 4, output_packed24 + sample_index * 3,
+                                            sample_count - sample_index, gain_q16);
+}
+
+#endif // SAMPLE_CONVERT_HAVE_NEON_KERNEL
+
+// ----------------- Self check + runtime dispatch -----------------
+
+void fill_packed24_check_samples(int32_t* samples, size_t sample_count) {
+    // edge values first (rounding ties, saturation boundaries), then xorshift noise
+    const int32_t edge_samples[] = {0, 1, -1, 255, 256, -256, -257, 0x7FFF, -0x8000, 0x7FFFFF00, (int32_t)0x80000100,
+                                    INT32_MAX, INT32_MIN, INT32_MAX - 1, INT32_MIN + 1, 0x08000000, -0x08000000};
+    const size_t edge_count = sizeof(edge_samples) / sizeof(edge_samples[0]);
+    uint32_t noise_state = 0x9E3779B9u;
+    for (size_t sample_index = 0; sample_index < sample_count; ++sample_index) {
+        if (sample_index < edge_count) {
+            samples[sample_index] = edge_samples[sample_index];
+            continue;
+        }
+        noise_state ^= noise_state << 13;
+        noise_state ^= noise_state >> 17;
+        noise_state ^= noise_state << 5;
+        // mostly small values so products land on rounding ties, some full-scale
+        samples[sample_index] = (sample_index % 3 == 0) ? (int32_t)noise_state : (int32_t)noise_state >> (noise_state & 15);
+    }
+}
+
+size_t packed24_check_gains_q16(const int32_t** gains_out) {
+    static const int32_t gains_q16[] = {0, quantize_gain_to_q16(0.01), SAMPLE_GAIN_Q16_ONE / 2, SAMPLE_GAIN_Q16_ONE - 1,
+                                        SAMPLE_GAIN_Q16_ONE, SAMPLE_GAIN_Q16_ONE + 1, quantize_gain_to_q16(1.5),
+                                        quantize_gain_to_q16(3.14159), SAMPLE_GAIN_Q16_MAX};
+    *gains_out = gains_q16;
+    return sizeof(gains_q16) / sizeof(gains_q16[0]);
+}
+
+bool run_packed24_kernel_self_check(packed24_convert_kernel kernel) {
+    const size_t sample_count = PACKED24_CHECK_SAMPLE_COUNT;
+    std::vector<int32_t> input(sample_count);
+    std::vector<uint8_t> expected(sample_count * 3);
+    std::vector<uint8_t> actual(sample_count * 3);
+    fill_packed24_check_samples(input.data(), sample_count);
+    const uint8_t* input_bytes = reinterpret_cast<const uint8_t*>(input.data()); // native order, read as LE
+
+    const int32_t* gains_q16 = nullptr;
+    size_t gain_count = packed24_check_gains_q16(&gains_q16);
+    for (size_t gain_index = 0; gain_index < gain_count; ++gain_index) {
+        convert_int32_left24_to_packed24_reference(input_bytes, expected.data(), sample_count, gains_q16[gain_index]);
+        kernel(input_bytes, actual.data(), sample_count, gains_q16[gain_index]);
+        if (memcmp(expected.data(), actual.data(), expected.size()) != 0) return false;
+    }
+    return true;
+}
+
+size_t available_packed24_convert_kernels(packed24_convert_kernel_info* out, size_t max_count) {
+    size_t kernel_count = 0;
+    auto add = [&](packed24_convert_kernel kernel, const char* name) {
+        if (kernel_count < max_count) out[kernel_count++] = {kernel, name};
+    };
+#if defined(SAMPLE_CONVERT_HAVE_X86_KERNELS)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) add(convert_int32_left24_to_packed24_avx2, "avx2");
+    if (__builtin_cpu_supports("sse4.1")) add(convert_int32_left24_to_packed24_sse41, "sse4.1");
+#endif
+#if defined(SAMPLE_CONVERT_HAVE_NEON_KERNEL)
+    add(convert_int32_left24_to_packed24_neon, "neon");
+#endif
+    add(convert_int32_left24_to_packed24_scalar, "scalar");
+    return kernel_count;
+}
+
+static packed24_convert_kernel_info detect_packed24_convert_kernel() {
+    packed24_convert_kernel_info candidates[4];
+    size_t candidate_count = available_packed24_convert_kernels(candidates, 4);
+    for (size_t candidate_index = 0; candidate_index + 1 < candidate_count; ++candidate_index) {
+        if (run_packed24_kernel_self_check(candidates[candidate_index].kernel)) return candidates[candidate_index];
+        std::cerr << "[DSP] " << candidates[candidate_index].name << " conversion kernel failed self check, skipping\n";
+    }
+    return {convert_int32_left24_to_packed24_scalar, "scalar"};
+}
+
+static const packed24_convert_kernel_info& selected_kernel() {
+    static const packed24_convert_kernel_info selected = detect_packed24_convert_kernel();
+    return selected;
+}
+
+packed24_convert_kernel select_packed24_convert_kernel() {
+    return selected_kernel().kernel;
+}
+
+const char* selected_packed24_convert_kernel_name() {
+    return selected_kernel().name;
+}
+
+// ----------------- Level metering -----------------
+
+void measure_packed24_levels(const uint8_t* packed24, size_t sample_count, uint32_t& peak_abs_out,
+                             uint64_t& sum_squares_out) {
+    uint32_t peak_abs = 0;
+    uint64_t sum_squares = 0; // |s| < 2^23, so a packet of up to 2^17 samples cannot overflow
+    for (size_t sample_index = 0; sample_index < sample_count; ++sample_index) {
+        const uint8_t* bytes = packed24 + sample_index * 3;
+        // sign-extend 24 -> 32 bits by shifting into the top and back
+        int32_t sample = (int32_t)(((uint32_t)bytes[0] << 8) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 24)) >> 8;
+        int32_t sign_mask = sample >> 31;
+        uint32_t magnitude = (uint32_t)((sample ^ sign_mask) - sign_mask);
+        peak_abs = magnitude > peak_abs ? magnitude : peak_abs;
+        sum_squares += (uint64_t)((int64_t)sample * sample);
+    }
+    peak_abs_out = peak_abs;
+    sum_squares_out = sum_squares;
+}
+
+// ----------------- Coded payload decode -----------------
+
+#if defined(SAMPLE_CONVERT_HAVE_X86_KERNELS)
+// 4 samples / iteration: each 3-byte sample into the top of a dword, low byte zero
+__attribute__((target("ssse3")))
+static void unpack_packed24_ssse3(const uint8_t* payload, size_t sample_count, int32_t* out_left24) {
+    const __m128i spread_4x3 = _mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+    size_t sample_index = 0;
+    for (; sample_index + 6 <= sample_count; sample_index += 4) { // each 16-byte load reads 4 bytes ahead
+        __m128i packed = _mm_loadu_si128((const __m128i*)(payload + sample_index * 3));
+        _mm_storeu_si128((__m128i*)(out_left24 + sample_index), _mm_shuffle_epi8(packed, spread_4x3));
+    }
+    esp2_packed24_decode(payload + sample_index * 3, sample_count - sample_index, out_left24 + sample_index);
+}
+
+static bool cpu_has_ssse3() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("ssse3");
+}
+#endif
+
+static void unpack_packed24(const uint8_t* payload, size_t sample_count, int32_t* out_left24) {
+#if defined(SAMPLE_CONVERT_HAVE_X86_KERNELS)
+    static const bool have_ssse3 = cpu_has_ssse3();
+    if (have_ssse3) {
+        unpack_packed24_ssse3(payload, sample_count, out_left24);
+        return;
+    }
+#endif
+    esp2_packed24_decode(payload, sample_count, out_left24);
+}
+
+bool decode_payload_to_int32_left24(uint8_t format_id, const uint8_t* payload, size_t payload_bytes, size_t frames,
+                                    size_t channels, int32_t* out_left24) {
+    switch (format_id) {
+    case ESP2_FORMAT_PACKED24:
+        if (payload_bytes < frames * channels * 3) return false;
+        unpack_packed24(payload, frames * channels, out_left24);
+        return true;
+    case ESP2_FORMAT_RICE24:
+        return esp2_rice24_decode(payload, payload_bytes, frames, channels, out_left24);
+    case ESP2_FORMAT_IMA_ADPCM:
+        return esp2_ima_adpcm_decode(payload, payload_bytes, frames, channels, out_left24);
+    case ESP2_FORMAT_INT16:
+        if (payload_bytes < frames * channels * 2) return false;
+        esp2_int16_decode(payload, frames * channels, out_left24);
+        return true;
+    default:
+        return false;
+    }
+}
+
+// ----------------- Per-stream converters -----------------
+
+// First channel of an interleaved PCM payload as int32-left24 words
+template <uint8_t BYTES_PER_SAMPLE, uint8_t CHANNELS>
+static void gather_pcm_channel0_left24(const uint8_t* payload, size_t frames, int32_t* out_left24) {
+    constexpr size_t FRAME_STRIDE_BYTES = (size_t)BYTES_PER_SAMPLE * CHANNELS;
+    for (size_t frame_index = 0; frame_index < frames; ++frame_index) {
+        const uint8_t* bytes = payload + frame_index * FRAME_STRIDE_BYTES;
+        if constexpr (BYTES_PER_SAMPLE == 4) {
+            out_left24[frame_index] = (int32_t)esp2_load_le32(bytes);
+        } else if constexpr (BYTES_PER_SAMPLE == 3) {
+            out_left24[frame_index] = (int32_t)(((uint32_t)bytes[0] << 8) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 24));
+        } else {
+            out_left24[frame_index] = (int32_t)((uint32_t)esp2_load_le16(bytes) << 16);
+        }
+    }
+}
+
+template <uint8_t FORMAT_ID, uint8_t CHANNELS>
+static const uint8_t* decode_stream_channel0(const uint8_t* payload, size_t payload_bytes, size_t frames,
+                                             int32_t* scratch_left24) {
+    constexpr uint8_t BYTES_PER_SAMPLE = esp2_format_bytes_per_sample(FORMAT_ID);
+    constexpr bool IS_PCM = FORMAT_ID == ESP2_FORMAT_INT32_LEFT24 || FORMAT_ID == ESP2_FORMAT_INT16 ||
+                            FORMAT_ID == ESP2_FORMAT_PACKED24;
+    static_assert(BYTES_PER_SAMPLE != 0 && CHANNELS >= 1, "stream converter for an unknown format");
+
+    if constexpr (FORMAT_ID == ESP2_FORMAT_INT32_LEFT24 && CHANNELS == 1) {
+        // already the kernels' input: one contiguous run of samples
+        if (payload_bytes < frames * 4) return nullptr;
+        return payload;
+    } else if constexpr (IS_PCM && !(FORMAT_ID == ESP2_FORMAT_PACKED24 && CHANNELS == 1)) {
+        if (payload_bytes < frames * CHANNELS * BYTES_PER_SAMPLE) return nullptr;
+        gather_pcm_channel0_left24<BYTES_PER_SAMPLE, CHANNELS>(payload, frames, scratch_left24);
+        return reinterpret_cast<const uint8_t*>(scratch_left24);
+    } else {
+        // mono packed 24-bit (SSSE3 unpack) and the coded formats decode every channel
+        if (!decode_payload_to_int32_left24(FORMAT_ID, payload, payload_bytes, frames, CHANNELS, scratch_left24)) return nullptr;
+        if constexpr (CHANNELS > 1) {
+            for (size_t frame_index = 1; frame_index < frames; ++frame_index) {
+                scratch_left24[frame_index] = scratch_left24[frame_index * CHANNELS];
+            }
+        }
+        return reinterpret_cast<const uint8_t*>(scratch_left24);
+    }
+}
+
+template <uint8_t FORMAT_ID, uint8_t CHANNELS>
+static bool convert_stream_payload(const uint8_t* payload, size_t payload_bytes, size_t frames, int32_t gain_q16,
+                                   packed24_convert_kernel kernel, int32_t* scratch_left24, uint8_t* output_packed24) {
+    const uint8_t* channel0_int32 = decode_stream_channel0<FORMAT_ID, CHANNELS>(payload, payload_bytes, frames, scratch_left24);
+    if (!channel0_int32) return false;
+    // native-order words, which the kernels read as LE
+    kernel(channel0_int32, output_packed24, frames, gain_q16);
+    return true;
+}
+
+template <uint8_t FORMAT_ID, uint8_t CHANNELS>
+static constexpr stream_converter_info stream_converter(const char* name) {
+    return {FORMAT_ID, CHANNELS, esp2_format_bytes_per_sample(FORMAT_ID), convert_stream_payload<FORMAT_ID, CHANNELS>,
+            decode_stream_channel0<FORMAT_ID, CHANNELS>, name};
+}
+
+static const stream_converter_info STREAM_CONVERTERS[] = {
+    stream_converter<ESP2_FORMAT_INT32_LEFT24, 1>("int32_left24/1ch"),
+    stream_converter<ESP2_FORMAT_INT32_LEFT24, 2>("int32_left24/2ch"),
+    stream_converter<ESP2_FORMAT_PACKED24, 1>("packed24/1ch"),
+    stream_converter<ESP2_FORMAT_PACKED24, 2>("packed24/2ch"),
+    stream_converter<ESP2_FORMAT_RICE24, 1>("rice24/1ch"),
+    stream_converter<ESP2_FORMAT_RICE24, 2>("rice24/2ch"),
+    stream_converter<ESP2_FORMAT_IMA_ADPCM, 1>("ima_adpcm/1ch"),
+    stream_converter<ESP2_FORMAT_IMA_ADPCM, 2>("ima_adpcm/2ch"),
+    stream_converter<ESP2_FORMAT_INT16, 1>("int16/1ch"),
+    stream_converter<ESP2_FORMAT_INT16, 2>("int16/2ch"),
+};
+
+const stream_converter_info* available_stream_converters(size_t& count) {
+    count = sizeof(STREAM_CONVERTERS) / sizeof(STREAM_CONVERTERS[0]);
+    return STREAM_CONVERTERS;
+}
+
+const stream_converter_info* find_stream_converter(uint8_t format_id, uint8_t channels, uint8_t bytes_per_sample) {
+    for (const stream_converter_info& converter : STREAM_CONVERTERS) {
+        if (converter.format_id == format_id && converter.channels == channels &&
+            converter.bytes_per_sample == bytes_per_sample) {
+            return &converter;
+        }
+    }
+    return nullptr;
+}
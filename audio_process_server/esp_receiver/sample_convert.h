@@ -0,0 +1,118 @@
+// sample_convert.h
+// int32 left-aligned 24-bit (ESP format 1) -> packed 24-bit little-endian conversion
+// with makeup gain, as used by the DSP stage. Coded payloads (formats 2..5) are first
+// decoded to format 1 words by decode_payload_to_int32_left24(); find_stream_converter()
+// picks the specialized path for one stream's (format_id, channels, bytes_per_sample).
+//
+// Gain is applied in fixed point (Q16.16). For a gain that is a multiple of 1/65536
+// the double-precision reference path below computes the exact product, so every
+// kernel (scalar fixed-point, SSE4.1, AVX2, NEON) is bit-identical to it:
+//   out = (saturate_int32(round_half_away_from_zero(sample * gain))) >> 8
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+static constexpr int SAMPLE_GAIN_FRACTION_BITS = 16;
+static constexpr int32_t SAMPLE_GAIN_Q16_ONE = 1 << SAMPLE_GAIN_FRACTION_BITS;
+// 16x keeps |sample * gain_q16| below 2^51, exact in a double and in int64
+static constexpr int32_t SAMPLE_GAIN_Q16_MAX = 16 * SAMPLE_GAIN_Q16_ONE;
+
+// Convert a signed 32-bit left-aligned-24 sample to 3 bytes little-endian packed 24-bit
+static inline void int32_left24_to_3bytes_le(int32_t sample_int32_left24, uint8_t out3[3]) {
+    // arithmetic right shift by 8 to align 24-bit value
+    int32_t sample_24 = sample_int32_left24 >> 8;
+    uint32_t u24 = (uint32_t)sample_24 & 0xFFFFFFu;
+    out3[0] = (uint8_t)(u24 & 0xFF);
+    out3[1] = (uint8_t)((u24 >> 8) & 0xFF);
+    out3[2] = (uint8_t)((u24 >> 16) & 0xFF);
+}
+
+// Helper to read an int32 from 4 bytes little-endian
+static inline int32_t le_bytes_to_int32(const uint8_t* p) {
+    uint32_t w = (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+    return (int32_t)w;
+}
+
+// Round a linear gain to the Q16.16 value every kernel uses (clamped to [0, 16])
+int32_t quantize_gain_to_q16(double gain);
+
+// Kernel signature: sample_count int32 LE samples in, sample_count * 3 bytes out
+using packed24_convert_kernel = void (*)(const uint8_t* input_int32_le, uint8_t* output_packed24,
+                                         size_t sample_count, int32_t gain_q16);
+
+// The original receiver loop: double multiply, clamp, llround, shift, pack. Reference only.
+void convert_int32_left24_to_packed24_reference(const uint8_t* input_int32_le, uint8_t* output_packed24,
+                                                size_t sample_count, int32_t gain_q16);
+
+// Portable fixed-point fallback
+void convert_int32_left24_to_packed24_scalar(const uint8_t* input_int32_le, uint8_t* output_packed24,
+                                             size_t sample_count, int32_t gain_q16);
+
+struct packed24_convert_kernel_info {
+    packed24_convert_kernel kernel;
+    const char* name;
+};
+
+// Every kernel this build and CPU can run, best first, scalar last (not self-checked; for benchmarks)
+size_t available_packed24_convert_kernels(packed24_convert_kernel_info* out, size_t max_count);
+
+// Best kernel for this CPU (AVX2 > SSE4.1 > NEON > scalar), chosen once. The selection
+// is guarded by run_packed24_kernel_self_check() and falls back to scalar (with an
+// error logged) on a mismatch; tests/sample_convert_tests.cpp is what fails the build.
+packed24_convert_kernel select_packed24_convert_kernel();
+const char* selected_packed24_convert_kernel_name();
+
+// The check input: edge values (rounding ties, saturation boundaries), then xorshift
+// noise. An odd count, so every kernel also runs its scalar tail.
+static constexpr size_t PACKED24_CHECK_SAMPLE_COUNT = 1031;
+void fill_packed24_check_samples(int32_t* samples, size_t sample_count);
+// The check gains (Q16.16), from 0 through unity +-1 LSB to SAMPLE_GAIN_Q16_MAX
+size_t packed24_check_gains_q16(const int32_t** gains_out);
+
+// Compare one kernel against the reference over the check input and gains
+bool run_packed24_kernel_self_check(packed24_convert_kernel kernel);
+
+// Peak |sample| and sum of squares of a packed 24-bit LE block (level metering).
+// Branch-free per sample so the compiler can vectorize it.
+void measure_packed24_levels(const uint8_t* packed24, size_t sample_count, uint32_t& peak_abs_out,
+                             uint64_t& sum_squares_out);
+
+// Decode a coded payload (ESP2_FORMAT_PACKED24 / RICE24 / IMA_ADPCM / INT16, see
+// include/esp2_payload_codec.h) into frames * channels int32-left24 words. False for
+// other formats and for a malformed or short payload. Packed 24-bit is unpacked
+// with SSSE3 shuffles when the CPU has them; Rice and ADPCM are serial by design.
+bool decode_payload_to_int32_left24(uint8_t format_id, const uint8_t* payload, size_t payload_bytes, size_t frames,
+                                    size_t channels, int32_t* out_left24);
+
+// ----------------- Per-stream converters -----------------
+//
+// The whole packet path of one stream: payload in, the first channel (the mic slot,
+// which is what the receiver records) out as packed 24-bit with gain applied. One
+// instantiation per supported (format_id, channels, bytes_per_sample), so the frame
+// stride and sample width are constants and the inner loops have no format branches.
+// Returns false for a short or malformed coded payload; the output is then untouched.
+// decode_channel0 stops before the pack, for the DSP chain: it returns the first
+// channel as native-order int32-left24 words (the payload itself when that already
+// is one, else scratch_left24), or nullptr where convert returns false.
+using stream_payload_channel0_decoder = const uint8_t* (*)(const uint8_t* payload, size_t payload_bytes, size_t frames,
+                                                           int32_t* scratch_left24);
+using stream_payload_converter = bool (*)(const uint8_t* payload, size_t payload_bytes, size_t frames,
+                                          int32_t gain_q16, packed24_convert_kernel kernel,
+                                          int32_t* scratch_left24, uint8_t* output_packed24);
+
+struct stream_converter_info {
+    uint8_t format_id;
+    uint8_t channels;
+    uint8_t bytes_per_sample;
+    stream_payload_converter convert;  // scratch_left24 holds frames * channels words
+    stream_payload_channel0_decoder decode_channel0;
+    const char* name;                  // e.g. "int32_left24/2ch", for /status
+};
+
+// Every per-stream converter (for the conversion test and benchmarks)
+const stream_converter_info* available_stream_converters(size_t& count);
+
+// The converter for a header's format fields, or nullptr if the receiver cannot convert
+// it (unknown format_id, a width that does not match it, more than 2 channels)
+const stream_converter_info* find_stream_converter(uint8_t format_id, uint8_t channels, uint8_t bytes_per_sample);
@@ -0,0 +1,163 @@
+// shm_audio_export.cpp
+// Producer of the shared-memory live audio ring (see shm_audio_ring.h).
+#include "shm_audio_export.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <iostream>
+
+static size_t round_up_to_page(size_t bytes) {
+    long page_bytes = sysconf(_SC_PAGESIZE);
+    size_t page = page_bytes > 0 ? (size_t)page_bytes : 4096;
+    return (bytes + page - 1) / page * page;
+}
+
+bool shm_audio_exporter::open(const char* device_label, uint64_t stream_id, uint32_t sample_rate, uint16_t channels,
+                              uint16_t bytes_per_sample, size_t data_bytes, uint32_t block_capacity,
+                              uint32_t max_block_frames) {
+    close();
+    size_t frame_bytes = (size_t)channels * bytes_per_sample;
+    if (block_capacity == 0 || (block_capacity & (block_capacity - 1)) != 0 || frame_bytes == 0 ||
+        (size_t)max_block_frames * frame_bytes > data_bytes) {
+        return false;
+    }
+    if (!shm_audio_segment_name(device_label, name_, sizeof(name_))) {
+        std::cerr << "[SHM] device label " << device_label << " is too long for a segment name\n";
+        name_[0] = '\0';
+        return false;
+    }
+
+    // a leftover of the same name (crashed receiver) is replaced, not reused: whoever
+    // still maps it keeps the old object, which simply stops advancing
+    shm_unlink(name_);
+    int fd = shm_open(name_, O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        std::cerr << "[SHM] shm_open " << name_ << " failed: " << strerror(errno) << "\n";
+        name_[0] = '\0';
+        return false;
+    }
+    size_t data_offset = round_up_to_page(SHM_AUDIO_HEADER_BYTES + shm_audio_descriptors_bytes(block_capacity));
+    size_t mapping_bytes = data_offset + round_up_to_page(data_bytes);
+    // MAP_POPULATE: fault the pages in now rather than on the DSP thread's first laps
+    void* mapping = MAP_FAILED;
+    if (ftruncate(fd, (off_t)mapping_bytes) == 0) {
+        mapping = mmap(nullptr, mapping_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    }
+    if (mapping == MAP_FAILED) {
+        std::cerr << "[SHM] could not size or map " << name_ << ": " << strerror(errno) << "\n";
+        ::close(fd);
+        shm_unlink(name_);
+        name_[0] = '\0';
+        return false;
+    }
+
+    fd_ = fd;
+    mapping_ = static_cast<uint8_t*>(mapping);
+    mapping_bytes_ = mapping_bytes;
+    header_ = reinterpret_cast<shm_audio_ring_header*>(mapping_);
+    descriptors_ = reinterpret_cast<shm_audio_block_descriptor*>(mapping_ + SHM_AUDIO_HEADER_BYTES);
+    data_ = mapping_ + data_offset;
+    data_bytes_ = data_bytes;
+    block_mask_ = block_capacity - 1;
+    max_block_frames_ = max_block_frames;
+    frame_bytes_ = frame_bytes;
+    next_block_ = 0;
+    oldest_block_ = 0;
+    ring_position_ = 0;
+    published_frames_ = 0;
+
+    // the object is zero-filled: every descriptor starts at sequence 0 (no block)
+    header_->version = SHM_AUDIO_VERSION;
+    header_->header_bytes = (uint32_t)SHM_AUDIO_HEADER_BYTES;
+    header_->sample_rate = sample_rate;
+    header_->channels = channels;
+    header_->bytes_per_sample = bytes_per_sample;
+    header_->block_capacity = block_capacity;
+    header_->max_block_frames = max_block_frames;
+    header_->data_offset = data_offset;
+    header_->data_bytes = data_bytes;
+    header_->stream_id = stream_id;
+    header_->producer_pid = (int64_t)getpid();
+    snprintf(header_->device_label, sizeof(header_->device_label), "%s", device_label);
+    header_->state.store((uint32_t)shm_audio_state::live, std::memory_order_relaxed);
+    // the magic last: a reader that sees it sees a complete header
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(header_->magic, SHM_AUDIO_MAGIC, sizeof(SHM_AUDIO_MAGIC));
+    std::cout << "[SHM] exporting stream " << stream_id << " as " << name_ << " (" << data_bytes / 1024 << " KiB, "
+              << block_capacity << " blocks)\n";
+    return true;
+}
+
+void shm_audio_exporter::retire_oldest_block() {
+    // odd and unlike any valid sequence; readers of the block see it change
+    descriptors_[oldest_block_ & block_mask_].sequence.store(2 * oldest_block_ + 3, std::memory_order_relaxed);
+    ++oldest_block_;
+}
+
+void shm_audio_exporter::publish(const uint8_t* samples, uint32_t frame_count, uint64_t first_sample_index,
+                                 uint64_t device_timestamp_us, uint64_t host_receive_us, uint64_t host_capture_us) {
+    if (!mapping_ || frame_count == 0 || frame_count > max_block_frames_) return;
+    size_t byte_count = (size_t)frame_count * frame_bytes_;
+
+    // a block never straddles the end of the data area: skip the tail instead
+    uint64_t position = ring_position_;
+    if (position % data_bytes_ + byte_count > data_bytes_) position += data_bytes_ - position % data_bytes_;
+    uint64_t end_position = position + byte_count;
+
+    // retire the slot's previous block and every block whose data this overwrites
+    uint64_t block = next_block_;
+    while (oldest_block_ < block &&
+           (block - oldest_block_ > block_mask_ ||
+            descriptors_[oldest_block_ & block_mask_].ring_position.load(std::memory_order_relaxed) + data_bytes_ < end_position)) {
+        retire_oldest_block();
+    }
+    shm_audio_block_descriptor& descriptor = descriptors_[block & block_mask_];
+    descriptor.sequence.store(2 * block + 1, std::memory_order_relaxed);
+    header_->oldest_block.store(oldest_block_, std::memory_order_relaxed);
+    // the odd sequences are visible before any of the writes below
+    std::atomic_thread_fence(std::memory_order_release);
+
+    uint64_t data_offset = position % data_bytes_;
+    memcpy(data_ + data_offset, samples, byte_count);
+    descriptor.data_offset.store(data_offset, std::memory_order_relaxed);
+    descriptor.ring_position.store(position, std::memory_order_relaxed);
+    descriptor.first_sample_index.store(first_sample_index, std::memory_order_relaxed);
+    descriptor.frame_count.store(frame_count, std::memory_order_relaxed);
+    descriptor.flags.store(host_capture_us != 0 ? SHM_AUDIO_BLOCK_HAS_CAPTURE_TIME : 0, std::memory_order_relaxed);
+    descriptor.device_timestamp_us.store(device_timestamp_us, std::memory_order_relaxed);
+    descriptor.host_receive_us.store(host_receive_us, std::memory_order_relaxed);
+    descriptor.host_capture_us.store(host_capture_us, std::memory_order_relaxed);
+    descriptor.sequence.store(2 * block + 2, std::memory_order_release);
+
+    ring_position_ = end_position;
+    next_block_ = block + 1;
+    published_frames_ += frame_count;
+    header_->published_frames.store(published_frames_, std::memory_order_relaxed);
+    header_->published_blocks.store(next_block_, std::memory_order_release);
+}
+
+void shm_audio_exporter::close() {
+    if (!mapping_) return;
+    header_->state.store((uint32_t)shm_audio_state::closed, std::memory_order_release);
+    munmap(mapping_, mapping_bytes_);
+    mapping_ = nullptr;
+    header_ = nullptr;
+    descriptors_ = nullptr;
+    data_ = nullptr;
+
+    // unlink the name only if it still refers to our object (not a newer stream's)
+    struct stat ours;
+    struct stat named;
+    int named_fd = shm_open(name_, O_RDONLY | O_CLOEXEC, 0);
+    if (named_fd >= 0) {
+        if (fstat(fd_, &ours) == 0 && fstat(named_fd, &named) == 0 && ours.st_ino == named.st_ino) shm_unlink(name_);
+        ::close(named_fd);
+    }
+    ::close(fd_);
+    fd_ = -1;
+}
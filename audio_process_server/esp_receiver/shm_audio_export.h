@@ -0,0 +1,58 @@
+// shm_audio_export.h
+// Producer side of the shared-memory live audio ring (layout and protocol in
+// shm_audio_ring.h). One exporter per stream, owned by the stream's DSP thread:
+// publish() is a descriptor update and one memcpy, with no syscalls and no
+// allocation, and never waits for or looks at consumers.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "shm_audio_ring.h"
+
+class shm_audio_exporter {
+public:
+    shm_audio_exporter() = default;
+    ~shm_audio_exporter() { close(); }
+    shm_audio_exporter(const shm_audio_exporter&) = delete;
+    shm_audio_exporter& operator=(const shm_audio_exporter&) = delete;
+
+    // Create the segment for device_label, replacing a stale one of the same name (a
+    // previous connection or process; its consumers keep their mapping). data_bytes
+    // is the audio kept, block_capacity (a power of two) the descriptors.
+    bool open(const char* device_label, uint64_t stream_id, uint32_t sample_rate, uint16_t channels,
+              uint16_t bytes_per_sample, size_t data_bytes, uint32_t block_capacity, uint32_t max_block_frames);
+    bool is_open() const { return mapping_ != nullptr; }
+
+    // Publish one packet's converted audio. Blocks longer than max_block_frames are
+    // dropped. host_capture_us is 0 when there is no clock estimate yet.
+    void publish(const uint8_t* samples, uint32_t frame_count, uint64_t first_sample_index,
+                 uint64_t device_timestamp_us, uint64_t host_receive_us, uint64_t host_capture_us);
+
+    // Mark the ring closed and unlink its name. Safe to call twice.
+    void close();
+
+    const char* name() const { return name_; }
+    uint64_t published_blocks() const { return next_block_; }
+
+private:
+    void retire_oldest_block();
+
+    char name_[128] = {};
+    int fd_ = -1;                    // kept to recognise our object at unlink time
+    uint8_t* mapping_ = nullptr;
+    size_t mapping_bytes_ = 0;
+    shm_audio_ring_header* header_ = nullptr;
+    shm_audio_block_descriptor* descriptors_ = nullptr;
+    uint8_t* data_ = nullptr;
+    size_t data_bytes_ = 0;
+    uint32_t block_mask_ = 0;
+    uint32_t max_block_frames_ = 0;
+    size_t frame_bytes_ = 0;
+
+    // producer-private copies of what readers see
+    uint64_t next_block_ = 0;
+    uint64_t oldest_block_ = 0;      // oldest block not yet retired
+    uint64_t ring_position_ = 0;     // running position of the next block's data
+    uint64_t published_frames_ = 0;
+};
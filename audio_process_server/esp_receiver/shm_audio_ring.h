@@ -0,0 +1,320 @@
+// shm_audio_ring.h
+// Shared-memory export of a stream's live audio, and the header-only client for it.
+// This file is all a local consumer needs (C++11, POSIX; link -lrt on old glibc).
+//
+// The receiver's DSP stage publishes every converted packet (packed 24-bit
+// little-endian mono, after gain and the processing chain: what the recorder gets)
+// into one POSIX shared-memory object per stream, "/esp_audio_<device>" (see
+// shm_audio_segment_name()). Consumers map it read-only and read the audio in
+// place: nothing is copied on their behalf, any number of them can attach, and the
+// producer never looks at or waits for them, so a slow or crashed consumer cannot
+// affect ingest.
+//
+// Layout: a header page, then block_capacity descriptors (a power of two), then the
+// data area. Block n (n = 0, 1, ... in publish order) uses descriptor
+// n % block_capacity and a contiguous range of the data area; blocks are laid out one
+// after the other and wrap to the start of the area when the next does not fit at
+// its end. The producer is shm_audio_exporter (shm_audio_export.h).
+//
+// Each descriptor is a seqlock. Its sequence is 2n + 2 while block n is valid and odd
+// while the slot is being rewritten or its data has been (or is about to be)
+// overwritten. The producer, before reusing a slot or any data still referenced by an
+// older block, makes that block's sequence odd, then fences, then writes; it stores
+// the new block's even sequence last, with release order. A reader loads the
+// sequence (acquire), uses the block, fences (acquire) and loads it again: the block
+// was intact iff both loads were 2n + 2. So a consumer either processes the samples
+// in place and checks afterwards (shm_audio_reader::consume()), discarding its result
+// if the producer overtook it, or copies first (copy_block()).
+//
+// Timestamps per block: the device's timestamp_us of the first sample (esp_timer),
+// the host CLOCK_MONOTONIC time the packet was received, and the estimated host
+// CLOCK_MONOTONIC time its first sample was captured (the device clock mapped
+// through the receiver's offset/drift fit, so it includes the minimum network
+// latency; see stream_timing.h), plus the stream's sample index, which is what to
+// align streams on.
+//
+// When the stream closes the producer sets state to closed and unlinks the name; the
+// memory stays valid until the last consumer unmaps it. A reconnecting device gets a
+// fresh object under the same name, so a consumer that sees "closed" reopens the name.
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+static constexpr char SHM_AUDIO_MAGIC[8] = {'E', 'S', 'P', 'S', 'H', 'M', 'A', '1'};
+static constexpr uint32_t SHM_AUDIO_VERSION = 1;
+static constexpr const char* SHM_AUDIO_NAME_PREFIX = "/esp_audio_";
+static constexpr size_t SHM_AUDIO_HEADER_BYTES = 4096;
+static constexpr size_t SHM_AUDIO_DEVICE_LABEL_BYTES = 64;
+
+enum class shm_audio_state : uint32_t { live = 1, closed = 2 };
+
+// Block flags
+static constexpr uint32_t SHM_AUDIO_BLOCK_HAS_CAPTURE_TIME = 1;   // host_capture_us is an estimate (else 0)
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+              "shared-memory atomics must be lock-free to be address-free");
+
+struct shm_audio_ring_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_bytes;           // offset of the descriptors
+    uint32_t sample_rate;
+    uint16_t channels;
+    uint16_t bytes_per_sample;       // 3: packed 24-bit little-endian
+    uint32_t block_capacity;         // descriptors, a power of two
+    uint32_t max_block_frames;
+    uint64_t data_offset;            // from the start of the mapping
+    uint64_t data_bytes;
+    uint64_t stream_id;              // the receiver's stream id (changes on reconnect)
+    int64_t producer_pid;
+    char device_label[SHM_AUDIO_DEVICE_LABEL_BYTES];
+
+    // written by the producer, read by everyone (own cache line)
+    alignas(64) std::atomic<uint64_t> published_blocks; // blocks 0 .. published_blocks - 1 have been published
+    std::atomic<uint64_t> oldest_block;                 // blocks before this one are overwritten
+    std::atomic<uint64_t> published_frames;
+    std::atomic<uint32_t> state;                        // shm_audio_state
+    std::atomic<uint32_t> reserved;
+};
+static_assert(sizeof(shm_audio_ring_header) <= SHM_AUDIO_HEADER_BYTES, "header page");
+
+struct shm_audio_block_descriptor {
+    std::atomic<uint64_t> sequence;             // 2n + 2 while block n is valid, odd otherwise
+    std::atomic<uint64_t> data_offset;          // from the start of the data area
+    std::atomic<uint64_t> first_sample_index;
+    std::atomic<uint32_t> frame_count;
+    std::atomic<uint32_t> flags;
+    std::atomic<uint64_t> device_timestamp_us;  // esp_timer time of the first sample
+    std::atomic<uint64_t> host_receive_us;      // CLOCK_MONOTONIC
+    std::atomic<uint64_t> host_capture_us;      // CLOCK_MONOTONIC, estimated; 0 without the flag
+    std::atomic<uint64_t> ring_position;        // producer's running data position (data_offset = it % data_bytes)
+};
+static_assert(sizeof(shm_audio_block_descriptor) == 64, "descriptor layout");
+
+inline size_t shm_audio_descriptors_bytes(uint32_t block_capacity) {
+    return (size_t)block_capacity * sizeof(shm_audio_block_descriptor);
+}
+
+// "/esp_audio_<device>", with characters shm names and shells dislike replaced by '_'.
+// Returns false if it does not fit.
+inline bool shm_audio_segment_name(const char* device_label, char* out, size_t out_bytes) {
+    int length = snprintf(out, out_bytes, "%s%s", SHM_AUDIO_NAME_PREFIX, device_label);
+    if (length < 0 || (size_t)length >= out_bytes) return false;
+    for (char* c = out + 1; *c; ++c) {
+        bool keep = (*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') || (*c >= '0' && *c <= '9') || *c == '.' ||
+                    *c == '-' || *c == '_';
+        if (!keep) *c = '_';
+    }
+    return true;
+}
+
+// Host CLOCK_MONOTONIC in microseconds, the clock of host_receive_us / host_capture_us
+inline uint64_t shm_audio_monotonic_us() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000ull + (uint64_t)now.tv_nsec / 1000;
+}
+
+// One block as seen by a reader. samples points into the shared mapping.
+struct shm_audio_block {
+    uint64_t block_number = 0;
+    uint64_t sequence = 0;
+    const uint8_t* samples = nullptr;   // frame_count * channels * bytes_per_sample bytes
+    uint64_t first_sample_index = 0;
+    uint32_t frame_count = 0;
+    uint32_t flags = 0;
+    uint64_t device_timestamp_us = 0;
+    uint64_t host_receive_us = 0;
+    uint64_t host_capture_us = 0;
+};
+
+enum class shm_audio_read_status {
+    ok,
+    not_yet_published,   // block_number >= published_blocks()
+    overwritten,         // the producer has reused it (reader too slow): skip ahead
+};
+
+// Sign-extend one packed 24-bit little-endian sample
+inline int32_t shm_audio_sample_s24(const uint8_t* packed24) {
+    int32_t value = (int32_t)((uint32_t)packed24[0] | ((uint32_t)packed24[1] << 8) | ((uint32_t)packed24[2] << 16));
+    return (value << 8) >> 8;
+}
+
+// ----------------- Reader (consumers) -----------------
+
+class shm_audio_reader {
+public:
+    shm_audio_reader() = default;
+    ~shm_audio_reader() { close(); }
+    shm_audio_reader(const shm_audio_reader&) = delete;
+    shm_audio_reader& operator=(const shm_audio_reader&) = delete;
+
+    // Map a segment read-only, e.g. open("/esp_audio_10.0.0.7"). False if it does not
+    // exist or is not a compatible ring.
+    bool open(const char* segment_name) {
+        close();
+        int fd = shm_open(segment_name, O_RDONLY, 0);
+        if (fd < 0) return false;
+        struct stat status;
+        if (fstat(fd, &status) != 0 || (size_t)status.st_size < SHM_AUDIO_HEADER_BYTES) {
+            ::close(fd);
+            return false;
+        }
+        void* mapping = mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED) return false;
+        mapping_ = static_cast<const uint8_t*>(mapping);
+        mapping_bytes_ = (size_t)status.st_size;
+
+        const shm_audio_ring_header& ring = header();
+        bool valid = memcmp(ring.magic, SHM_AUDIO_MAGIC, sizeof(SHM_AUDIO_MAGIC)) == 0 &&
+                     ring.version == SHM_AUDIO_VERSION && ring.block_capacity != 0 &&
+                     (ring.block_capacity & (ring.block_capacity - 1)) == 0 &&
+                     ring.header_bytes + shm_audio_descriptors_bytes(ring.block_capacity) <= ring.data_offset &&
+                     ring.data_offset + ring.data_bytes <= mapping_bytes_;
+        if (!valid) {
+            close();
+            return false;
+        }
+        std::atomic_thread_fence(std::memory_order_acquire); // pairs with the fence before the magic
+        descriptors_ = reinterpret_cast<const shm_audio_block_descriptor*>(mapping_ + ring.header_bytes);
+        data_ = mapping_ + ring.data_offset;
+        frame_bytes_ = (size_t)ring.channels * ring.bytes_per_sample;
+        return true;
+    }
+
+    void close() {
+        if (mapping_) munmap(const_cast<uint8_t*>(mapping_), mapping_bytes_);
+        mapping_ = nullptr;
+        mapping_bytes_ = 0;
+    }
+
+    bool is_open() const { return mapping_ != nullptr; }
+    const shm_audio_ring_header& header() const { return *reinterpret_cast<const shm_audio_ring_header*>(mapping_); }
+    size_t frame_bytes() const { return frame_bytes_; }
+    bool producer_closed() const {
+        return header().state.load(std::memory_order_acquire) == (uint32_t)shm_audio_state::closed;
+    }
+
+    // Blocks published so far: the live edge, where a new consumer starts
+    uint64_t published_blocks() const { return header().published_blocks.load(std::memory_order_acquire); }
+
+    // Oldest block that may still be intact (it can be overwritten at any moment)
+    uint64_t oldest_block() const { return header().oldest_block.load(std::memory_order_acquire); }
+
+    // Zero-copy read: consume(const shm_audio_block&) works on the samples in place;
+    // its result (whatever it computed) must be thrown away unless this returns ok
+    template <typename block_consumer>
+    shm_audio_read_status consume(uint64_t block_number, block_consumer&& consumer) const {
+        shm_audio_block block;
+        shm_audio_read_status status = begin_read(block_number, block);
+        if (status != shm_audio_read_status::ok) return status;
+        consumer(static_cast<const shm_audio_block&>(block));
+        return still_valid(block) ? shm_audio_read_status::ok : shm_audio_read_status::overwritten;
+    }
+
+    // Copying read: the samples are copied to out (at least max_block_frames frames)
+    // and block.samples points there
+    shm_audio_read_status copy_block(uint64_t block_number, uint8_t* out, shm_audio_block& block) const {
+        shm_audio_read_status status = begin_read(block_number, block);
+        if (status != shm_audio_read_status::ok) return status;
+        memcpy(out, block.samples, (size_t)block.frame_count * frame_bytes_);
+        if (!still_valid(block)) return shm_audio_read_status::overwritten;
+        block.samples = out;
+        return shm_audio_read_status::ok;
+    }
+
+    // The two halves of consume(), for consumers that hold on to a block for a while:
+    // begin_read() fills in the descriptor, still_valid() says whether everything read
+    // since (descriptor and samples) was intact
+    shm_audio_read_status begin_read(uint64_t block_number, shm_audio_block& block) const {
+        if (block_number >= published_blocks()) return shm_audio_read_status::not_yet_published;
+        const shm_audio_ring_header& ring = header();
+        const shm_audio_block_descriptor& descriptor = descriptors_[block_number & (ring.block_capacity - 1)];
+        uint64_t expected_sequence = 2 * block_number + 2;
+        if (descriptor.sequence.load(std::memory_order_acquire) != expected_sequence) {
+            return shm_audio_read_status::overwritten;
+        }
+        block.block_number = block_number;
+        block.sequence = expected_sequence;
+        block.first_sample_index = descriptor.first_sample_index.load(std::memory_order_relaxed);
+        block.frame_count = descriptor.frame_count.load(std::memory_order_relaxed);
+        block.flags = descriptor.flags.load(std::memory_order_relaxed);
+        block.device_timestamp_us = descriptor.device_timestamp_us.load(std::memory_order_relaxed);
+        block.host_receive_us = descriptor.host_receive_us.load(std::memory_order_relaxed);
+        block.host_capture_us = descriptor.host_capture_us.load(std::memory_order_relaxed);
+        uint64_t data_offset = descriptor.data_offset.load(std::memory_order_relaxed);
+        // a torn descriptor could point anywhere; never hand out a pointer outside the area
+        if (block.frame_count > ring.max_block_frames || data_offset > ring.data_bytes ||
+            (uint64_t)block.frame_count * frame_bytes_ > ring.data_bytes - data_offset || !still_valid(block)) {
+            return shm_audio_read_status::overwritten;
+        }
+        block.samples = data_ + data_offset;
+        return shm_audio_read_status::ok;
+    }
+
+    bool still_valid(const shm_audio_block& block) const {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        const shm_audio_block_descriptor& descriptor = descriptors_[block.block_number & (header().block_capacity - 1)];
+        return descriptor.sequence.load(std::memory_order_relaxed) == block.sequence;
+    }
+
+private:
+    const uint8_t* mapping_ = nullptr;
+    size_t mapping_bytes_ = 0;
+    const shm_audio_block_descriptor* descriptors_ = nullptr;
+    const uint8_t* data_ = nullptr;
+    size_t frame_bytes_ = 0;
+};
+
+// A reader with a cursor: next() returns blocks in order and, when the producer has
+// overtaken the cursor, jumps to the oldest block still intact (blocks_skipped counts
+// what was lost). Starts at the live edge.
+class shm_audio_tap {
+public:
+    bool open(const char* segment_name) {
+        if (!reader_.open(segment_name)) return false;
+        next_block_ = reader_.published_blocks();
+        blocks_skipped_ = 0;
+        return true;
+    }
+    const shm_audio_reader& reader() const { return reader_; }
+
+    // ok: consumer ran on block next_block and its result stands; not_yet_published:
+    // nothing new (poll again, or check reader().producer_closed())
+    template <typename block_consumer>
+    shm_audio_read_status next(block_consumer&& consumer) {
+        while (true) {
+            shm_audio_read_status status = reader_.consume(next_block_, consumer);
+            if (status != shm_audio_read_status::overwritten) {
+                if (status == shm_audio_read_status::ok) ++next_block_;
+                return status;
+            }
+            // lapped: restart a little ahead of the oldest intact block, so the jump sticks
+            uint64_t oldest = reader_.oldest_block();
+            uint64_t published = reader_.published_blocks();
+            uint64_t restart = oldest + (published - oldest) / 8;
+            if (restart <= next_block_) restart = next_block_ + 1;
+            blocks_skipped_ += restart - next_block_;
+            next_block_ = restart;
+        }
+    }
+
+    uint64_t next_block() const { return next_block_; }
+    uint64_t blocks_skipped() const { return blocks_skipped_; }
+
+private:
+    shm_audio_reader reader_;
+    uint64_t next_block_ = 0;
+    uint64_t blocks_skipped_ = 0;
+};
@@ -0,0 +1,88 @@
+// spsc_ring.h
+// Bounded lock-free single-producer/single-consumer ring used to hand packet
+// slots between the receiver, DSP and writer threads.
+//
+// Exactly one thread may call try_push() and exactly one (other) thread may call
+// try_pop(). depth()/high_water() may be read from any thread (monitoring only).
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Keep producer and consumer indices on separate cache lines so the two threads
+// do not false-share while streaming.
+static constexpr size_t SPSC_CACHE_LINE_BYTES = 64;
+
+template <typename T>
+class spsc_ring {
+public:
+    // capacity is rounded up to a power of two so wrap-around is a mask
+    explicit spsc_ring(size_t requested_capacity) {
+        size_t rounded_capacity = 1;
+        while (rounded_capacity < requested_capacity) rounded_capacity <<= 1;
+        slots_.resize(rounded_capacity);
+        index_mask_ = rounded_capacity - 1;
+    }
+
+    spsc_ring(const spsc_ring&) = delete;
+    spsc_ring& operator=(const spsc_ring&) = delete;
+
+    // Producer side. Returns false (and leaves the ring untouched) when full.
+    bool try_push(const T& value) {
+        const size_t write_position = write_position_.load(std::memory_order_relaxed);
+        if (write_position - cached_read_position_ > index_mask_) {
+            cached_read_position_ = read_position_.load(std::memory_order_acquire);
+            if (write_position - cached_read_position_ > index_mask_) return false;
+        }
+        slots_[write_position & index_mask_] = value;
+        write_position_.store(write_position + 1, std::memory_order_release);
+
+        // high-water mark is only ever raised by the producer. The cached read position
+        // may be stale, which only overstates the depth, so it is refreshed before a raise.
+        size_t depth_after_push = write_position + 1 - cached_read_position_;
+        if (depth_after_push > high_water_.load(std::memory_order_relaxed)) {
+            cached_read_position_ = read_position_.load(std::memory_order_acquire);
+            depth_after_push = write_position + 1 - cached_read_position_;
+            if (depth_after_push > high_water_.load(std::memory_order_relaxed)) {
+                high_water_.store(depth_after_push, std::memory_order_relaxed);
+            }
+        }
+        return true;
+    }
+
+    // Consumer side. Returns false when empty.
+    bool try_pop(T& value_out) {
+        const size_t read_position = read_position_.load(std::memory_order_relaxed);
+        if (read_position == cached_write_position_) {
+            cached_write_position_ = write_position_.load(std::memory_order_acquire);
+            if (read_position == cached_write_position_) return false;
+        }
+        value_out = slots_[read_position & index_mask_];
+        read_position_.store(read_position + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Monitoring helpers (approximate when read from a third thread)
+    size_t depth() const {
+        const size_t write_position = write_position_.load(std::memory_order_acquire);
+        const size_t read_position = read_position_.load(std::memory_order_acquire);
+        return write_position >= read_position ? write_position - read_position : 0;
+    }
+    size_t high_water() const { return high_water_.load(std::memory_order_relaxed); }
+    size_t capacity() const { return index_mask_ + 1; }
+
+private:
+    std::vector<T> slots_;
+    size_t index_mask_ = 0;
+
+    // producer-owned
+    alignas(SPSC_CACHE_LINE_BYTES) std::atomic<size_t> write_position_{0};
+    size_t cached_read_position_ = 0;
+    std::atomic<size_t> high_water_{0};
+
+    // consumer-owned
+    alignas(SPSC_CACHE_LINE_BYTES) std::atomic<size_t> read_position_{0};
+    size_t cached_write_position_ = 0;
+};
@@ -0,0 +1,597 @@
+// stream_archive.cpp
+// Chunked, indexed per-device archive: writer and mapped range readers (see stream_archive.h).
+#include "stream_archive.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+
+#include "trace_spans.h"
+
+// page-aligned batches keep the kernel copy on whole pages (as in wav_writer.cpp)
+static const size_t ARCHIVE_BATCH_BUFFER_ALIGNMENT = 4096;
+// largest part of a chunk file a range reader maps at once
+static const size_t ARCHIVE_READ_WINDOW_BYTES = 8 * 1024 * 1024;
+// how often a reader re-reads a record whose check fails before giving up on it
+static const int ARCHIVE_RECORD_READ_ATTEMPTS = 3;
+// 32-bit RIFF size fields; a longer range is served as RF64
+static const uint64_t ARCHIVE_WAV_RIFF_MAX_DATA_BYTES = 0xFFFFFFFFull - WAV_HEADER_BYTES;
+
+static stream_archive_statistics global_stream_archive_statistics;
+
+stream_archive_statistics& stream_archive_stats() {
+    return global_stream_archive_statistics;
+}
+
+uint32_t archive_index_record_check(const archive_index_record& record) {
+    // FNV-1a over every field before the check word
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&record);
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < offsetof(archive_index_record, check); ++i) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+std::string archive_chunk_filename(uint64_t chunk_first_index) {
+    char name[40];
+    snprintf(name, sizeof(name), "%012llu.pcm", (unsigned long long)chunk_first_index);
+    return name;
+}
+
+static std::string archive_index_path(const std::string& directory) {
+    return directory + "/" + ARCHIVE_INDEX_FILENAME;
+}
+
+// mkdir -p
+static bool make_directories(const std::string& path) {
+    for (size_t slash = path.find('/', 1); ; slash = path.find('/', slash + 1)) {
+        std::string prefix = path.substr(0, slash);
+        if (!prefix.empty() && mkdir(prefix.c_str(), 0755) != 0 && errno != EEXIST) {
+            std::cerr << "[ARCHIVE] mkdir " << prefix << " failed: " << strerror(errno) << "\n";
+            return false;
+        }
+        if (slash == std::string::npos) return true;
+    }
+}
+
+static bool read_all_at(int file_descriptor, void* destination, size_t byte_count, off_t file_offset) {
+    uint8_t* bytes = static_cast<uint8_t*>(destination);
+    while (byte_count > 0) {
+        ssize_t got = pread(file_descriptor, bytes, byte_count, file_offset);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+        bytes += got;
+        byte_count -= (size_t)got;
+        file_offset += got;
+    }
+    return true;
+}
+
+static int64_t frames_to_us(uint64_t frames, uint32_t sample_rate) {
+    return (int64_t)std::llround((double)frames * 1e6 / sample_rate);
+}
+
+// ----------------- stream_archive_writer -----------------
+
+bool stream_archive_writer::open(const std::string& directory, uint32_t sample_rate, uint16_t channels,
+                                 uint16_t bytes_per_sample, const stream_archive_policy& policy) {
+    close();
+    directory_ = directory;
+    sample_rate_ = sample_rate;
+    frame_bytes_ = (size_t)channels * bytes_per_sample;
+    policy_ = policy;
+    if (policy_.chunk_frames == 0) policy_.chunk_frames = sample_rate;
+    if (!make_directories(directory)) return false;
+
+    std::string index_path = archive_index_path(directory);
+    int index_fd = ::open(index_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (index_fd < 0) {
+        std::cerr << "[ARCHIVE] open " << index_path << " failed: " << strerror(errno) << "\n";
+        return false;
+    }
+    // one writer per device archive, also across processes
+    if (flock(index_fd, LOCK_EX | LOCK_NB) != 0) {
+        std::cerr << "[ARCHIVE] " << index_path << " is in use by another writer\n";
+        ::close(index_fd);
+        return false;
+    }
+
+    struct stat index_stat;
+    archive_index_file_header header = {};
+    archived_end_index_ = 0;
+    index_shift_ = 0;
+    if (fstat(index_fd, &index_stat) != 0 || (size_t)index_stat.st_size < sizeof(header)) {
+        // new archive
+        memcpy(header.magic, ARCHIVE_INDEX_MAGIC, sizeof(header.magic));
+        header.version = ARCHIVE_INDEX_VERSION;
+        header.record_bytes = sizeof(archive_index_record);
+        header.sample_rate = sample_rate;
+        header.channels = channels;
+        header.bytes_per_sample = bytes_per_sample;
+        header.chunk_frames = policy_.chunk_frames;
+        if (!write_all_at(index_fd, reinterpret_cast<const uint8_t*>(&header), sizeof(header), 0)) {
+            ::close(index_fd);
+            return false;
+        }
+        index_bytes_ = (off_t)sizeof(header);
+    } else {
+        if (!read_all_at(index_fd, &header, sizeof(header), 0) || memcmp(header.magic, ARCHIVE_INDEX_MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != ARCHIVE_INDEX_VERSION || header.record_bytes != sizeof(archive_index_record) ||
+            header.sample_rate != sample_rate || header.channels != channels || header.bytes_per_sample != bytes_per_sample ||
+            header.chunk_frames == 0) {
+            std::cerr << "[ARCHIVE] " << index_path << " holds a different format, not appending to it\n";
+            ::close(index_fd);
+            return false;
+        }
+        // the chunk grid is fixed for the life of an archive
+        policy_.chunk_frames = header.chunk_frames;
+        // continue after the last record that reads back intact; anything behind it
+        // (cut by a crash) is overwritten
+        size_t record_count = ((size_t)index_stat.st_size - sizeof(header)) / sizeof(archive_index_record);
+        for (; record_count > 0; --record_count) {
+            archive_index_record last;
+            off_t last_offset = (off_t)(sizeof(header) + (record_count - 1) * sizeof(archive_index_record));
+            if (read_all_at(index_fd, &last, sizeof(last), last_offset) && last.check == archive_index_record_check(last)) {
+                archived_end_index_ = last.first_sample_index + last.frame_count;
+                break;
+            }
+        }
+        index_bytes_ = (off_t)(sizeof(header) + record_count * sizeof(archive_index_record));
+        if (ftruncate(index_fd, index_bytes_) != 0) perror("ftruncate");
+    }
+
+    // keep batches a whole number of pages (and at least one), and use whole frames of it
+    size_t allocation_bytes = (policy_.batch_bytes + ARCHIVE_BATCH_BUFFER_ALIGNMENT - 1) / ARCHIVE_BATCH_BUFFER_ALIGNMENT *
+                              ARCHIVE_BATCH_BUFFER_ALIGNMENT;
+    if (allocation_bytes < ARCHIVE_BATCH_BUFFER_ALIGNMENT) allocation_bytes = ARCHIVE_BATCH_BUFFER_ALIGNMENT;
+    batch_buffer_ = static_cast<uint8_t*>(std::aligned_alloc(ARCHIVE_BATCH_BUFFER_ALIGNMENT, allocation_bytes));
+    if (!batch_buffer_) {
+        std::cerr << "[ARCHIVE] could not allocate " << allocation_bytes << " byte batch buffer\n";
+        ::close(index_fd);
+        return false;
+    }
+    batch_capacity_ = allocation_bytes / frame_bytes_ * frame_bytes_;
+    batch_fill_ = 0;
+
+    if (channels == 1 && bytes_per_sample == 3 && !overview_.open(directory, sample_rate, archived_end_index_)) {
+        std::cerr << "[ARCHIVE] " << directory << " is archived without an overview\n";
+    }
+
+    index_fd_ = index_fd;
+    record_open_ = false;
+    unsynced_ = false;
+    last_durability_sync_time_ = clock::now();
+    std::cout << "[ARCHIVE] opened " << directory << " (" << policy_.chunk_frames / sample_rate << " s chunks, continuing at "
+              << archived_end_index_ << ")\n";
+    return true;
+}
+
+bool stream_archive_writer::append(uint64_t first_sample_index, const uint8_t* bytes, size_t frame_count,
+                                   int64_t start_unix_us, clock::time_point now) {
+    if (!is_open() || frame_count == 0) return false;
+
+    uint64_t archive_index = first_sample_index + index_shift_;
+    if (continues_record(first_sample_index)) {
+        start_unix_us = record_.start_unix_us +
+                        frames_to_us(archive_index - record_.first_sample_index, sample_rate_);
+    } else {
+        end_record();
+        if (archive_index < archived_end_index_) {
+            // the stream went back over archived audio: keep the archive timeline going forward
+            index_shift_ = archived_end_index_ - first_sample_index;
+            archive_index = archived_end_index_;
+            std::cout << "[ARCHIVE] " << directory_ << ": stream index " << first_sample_index
+                      << " is archived already, continuing at " << archive_index << "\n";
+        }
+    }
+
+    bool ok = true;
+    uint64_t run_first_index = archive_index;
+    while (frame_count > 0) {
+        uint64_t chunk_first_index = archive_index - archive_index % policy_.chunk_frames;
+        if (record_open_ && record_.chunk_first_index != chunk_first_index) end_record();
+        if (!record_open_ &&
+            !start_record(archive_index, archive_index - index_shift_,
+                          start_unix_us + frames_to_us(archive_index - run_first_index, sample_rate_))) {
+            global_stream_archive_statistics.write_errors.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        size_t piece_frames = (size_t)std::min<uint64_t>(frame_count, chunk_first_index + policy_.chunk_frames - archive_index);
+        size_t piece_bytes = piece_frames * frame_bytes_;
+        overview_.add_frames(archive_index, bytes, piece_frames);
+        while (piece_bytes > 0) {
+            if (batch_fill_ == 0) oldest_buffered_time_ = now;
+            size_t copy_bytes = std::min(piece_bytes, batch_capacity_ - batch_fill_);
+            memcpy(batch_buffer_ + batch_fill_, bytes, copy_bytes);
+            batch_fill_ += copy_bytes;
+            bytes += copy_bytes;
+            piece_bytes -= copy_bytes;
+            if (batch_fill_ == batch_capacity_) ok = flush() && ok;
+        }
+        archive_index += piece_frames;
+        archived_end_index_ = archive_index;
+        frame_count -= piece_frames;
+    }
+    return ok;
+}
+
+bool stream_archive_writer::start_record(uint64_t archive_index, uint64_t source_index, int64_t start_unix_us) {
+    uint64_t chunk_first_index = archive_index - archive_index % policy_.chunk_frames;
+    if ((chunk_fd_ < 0 || chunk_first_index_ != chunk_first_index) && !open_chunk(chunk_first_index)) return false;
+    record_ = archive_index_record();
+    record_.first_sample_index = archive_index;
+    record_.chunk_first_index = chunk_first_index;
+    record_.chunk_byte_offset = (archive_index - chunk_first_index) * frame_bytes_;
+    record_.start_unix_us = start_unix_us;
+    record_.source_first_sample_index = source_index;
+    record_open_ = true;
+    record_stored_ = false; // gets its slot with the first audio on disk
+    global_stream_archive_statistics.records_started.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool stream_archive_writer::open_chunk(uint64_t chunk_first_index) {
+    if (chunk_fd_ >= 0) {
+        // sync_to_disk() only covers the current chunk: this one is synced before it goes
+        if (unsynced_) sync_to_disk();
+        ::close(chunk_fd_);
+        chunk_fd_ = -1;
+    }
+    std::string path = directory_ + "/" + archive_chunk_filename(chunk_first_index);
+    chunk_fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (chunk_fd_ < 0) {
+        std::cerr << "[ARCHIVE] open " << path << " failed: " << strerror(errno) << "\n";
+        return false;
+    }
+    chunk_first_index_ = chunk_first_index;
+    global_stream_archive_statistics.chunks_opened.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool stream_archive_writer::flush() {
+    if (!record_open_ || batch_fill_ == 0) return true;
+    ESP_TRACE_SPAN(flush, 0, batch_fill_);
+    off_t file_offset = (off_t)(record_.chunk_byte_offset + record_.frame_count * frame_bytes_);
+    bool ok = write_all_at(chunk_fd_, batch_buffer_, batch_fill_, file_offset);
+    // on failure the batch is dropped rather than retried forever, like the WAV writer:
+    // the record still covers it and it reads back as silence
+    record_.frame_count += batch_fill_ / frame_bytes_;
+    batch_fill_ = 0;
+
+    record_.check = archive_index_record_check(record_);
+    if (!record_stored_) {
+        record_offset_ = index_bytes_;
+        index_bytes_ += (off_t)sizeof(archive_index_record);
+        record_stored_ = true;
+    }
+    ok = write_all_at(index_fd_, reinterpret_cast<const uint8_t*>(&record_), sizeof(record_), record_offset_) && ok;
+    ok = overview_.flush() && ok;
+    unsynced_ = true;
+    return ok;
+}
+
+void stream_archive_writer::end_record() {
+    flush();
+    record_open_ = false;
+}
+
+void stream_archive_writer::service_timers(clock::time_point now) {
+    if (!is_open()) return;
+    if (batch_fill_ > 0 && now - oldest_buffered_time_ >= std::chrono::milliseconds(policy_.flush_interval_ms)) {
+        flush();
+    }
+    if (policy_.durability_interval_ms > 0 &&
+        now - last_durability_sync_time_ >= std::chrono::milliseconds(policy_.durability_interval_ms)) {
+        flush();
+        if (unsynced_) sync_to_disk();
+        last_durability_sync_time_ = now;
+    }
+}
+
+void stream_archive_writer::close() {
+    if (is_open()) {
+        end_record();
+        overview_.close();
+        if (unsynced_) sync_to_disk();
+        if (chunk_fd_ >= 0) ::close(chunk_fd_);
+        chunk_fd_ = -1;
+        ::close(index_fd_); // releases the lock
+        index_fd_ = -1;
+    }
+    std::free(batch_buffer_);
+    batch_buffer_ = nullptr;
+    batch_fill_ = 0;
+}
+
+bool stream_archive_writer::write_all_at(int file_descriptor, const uint8_t* bytes, size_t byte_count, off_t file_offset) {
+    while (byte_count > 0) {
+        ssize_t written = pwrite(file_descriptor, bytes, byte_count, file_offset);
+        if (written < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+        if (written <= 0) {
+            global_stream_archive_statistics.write_errors.fetch_add(1, std::memory_order_relaxed);
+            std::cerr << "[ARCHIVE] write in " << directory_ << " failed: " << (written < 0 ? strerror(errno) : "no progress") << "\n";
+            return false;
+        }
+        global_stream_archive_statistics.write_syscalls.fetch_add(1, std::memory_order_relaxed);
+        global_stream_archive_statistics.bytes_written.fetch_add((uint64_t)written, std::memory_order_relaxed);
+        bytes += written;
+        byte_count -= (size_t)written;
+        file_offset += written;
+    }
+    return true;
+}
+
+// Audio first, so a record that reached the disk never points at audio that did not
+void stream_archive_writer::sync_to_disk() {
+    ESP_TRACE_SPAN(sync, 0, 0);
+    if (chunk_fd_ >= 0) {
+        global_stream_archive_statistics.fdatasync_calls.fetch_add(1, std::memory_order_relaxed);
+        if (fdatasync(chunk_fd_) != 0) perror("fdatasync");
+    }
+    global_stream_archive_statistics.fdatasync_calls.fetch_add(1, std::memory_order_relaxed);
+    if (fdatasync(index_fd_) != 0) perror("fdatasync");
+    overview_.sync_to_disk();
+    unsynced_ = false;
+}
+
+// ----------------- archive_index_view -----------------
+
+archive_index_view::~archive_index_view() {
+    if (mapping_) munmap(mapping_, mapping_bytes_);
+}
+
+bool archive_index_view::open(const std::string& directory) {
+    int index_fd = ::open(archive_index_path(directory).c_str(), O_RDONLY | O_CLOEXEC);
+    if (index_fd < 0) return false;
+    struct stat index_stat;
+    if (fstat(index_fd, &index_stat) != 0 || (size_t)index_stat.st_size < sizeof(archive_index_file_header)) {
+        ::close(index_fd);
+        return false;
+    }
+    mapping_bytes_ = (size_t)index_stat.st_size;
+    mapping_ = mmap(nullptr, mapping_bytes_, PROT_READ, MAP_SHARED, index_fd, 0);
+    ::close(index_fd);
+    if (mapping_ == MAP_FAILED) {
+        mapping_ = nullptr;
+        return false;
+    }
+    memcpy(&header_, mapping_, sizeof(header_));
+    if (memcmp(header_.magic, ARCHIVE_INDEX_MAGIC, sizeof(header_.magic)) != 0 || header_.version != ARCHIVE_INDEX_VERSION ||
+        header_.record_bytes != sizeof(archive_index_record) || header_.sample_rate == 0 || header_.chunk_frames == 0) {
+        return false;
+    }
+    record_count_ = (mapping_bytes_ - sizeof(header_)) / sizeof(archive_index_record);
+    return true;
+}
+
+const archive_index_record* archive_index_view::records() const {
+    return reinterpret_cast<const archive_index_record*>(static_cast<const uint8_t*>(mapping_) + sizeof(header_));
+}
+
+bool archive_index_view::record(size_t record_number, archive_index_record& out) const {
+    if (record_number >= record_count_) return false;
+    for (int attempt = 0; attempt < ARCHIVE_RECORD_READ_ATTEMPTS; ++attempt) {
+        memcpy(&out, records() + record_number, sizeof(out));
+        if (out.check == archive_index_record_check(out)) return true;
+        std::this_thread::yield(); // the writer may be rewriting it
+    }
+    return false;
+}
+
+// A record's start fields never change once written (only frame_count and check are
+// rewritten), so the searches read them straight from the mapping; only the candidate
+// record is copied and checked.
+size_t archive_index_view::first_record_ending_after_index(uint64_t sample_index) const {
+    const archive_index_record* begin = records();
+    const archive_index_record* after = std::upper_bound(
+        begin, begin + record_count_, sample_index,
+        [](uint64_t index, const archive_index_record& candidate) { return index < candidate.first_sample_index; });
+    size_t record_number = (size_t)(after - begin);
+    archive_index_record previous;
+    if (record_number > 0 && record(record_number - 1, previous) &&
+        previous.first_sample_index + previous.frame_count > sample_index) {
+        return record_number - 1;
+    }
+    return record_number;
+}
+
+size_t archive_index_view::first_record_ending_after_time(int64_t unix_us) const {
+    const archive_index_record* begin = records();
+    const archive_index_record* after = std::upper_bound(
+        begin, begin + record_count_, unix_us,
+        [](int64_t time_us, const archive_index_record& candidate) { return time_us < candidate.start_unix_us; });
+    size_t record_number = (size_t)(after - begin);
+    archive_index_record previous;
+    if (record_number > 0 && record(record_number - 1, previous) &&
+        previous.start_unix_us + frames_to_us(previous.frame_count, header_.sample_rate) > unix_us) {
+        return record_number - 1;
+    }
+    return record_number;
+}
+
+bool archive_index_view::index_at_time(int64_t unix_us, uint64_t& sample_index) const {
+    archive_index_record found;
+    for (size_t record_number = first_record_ending_after_time(unix_us); record_number < record_count_; ++record_number) {
+        if (!record(record_number, found) || found.frame_count == 0) continue;
+        if (unix_us <= found.start_unix_us) {
+            sample_index = found.first_sample_index;
+        } else {
+            uint64_t offset = (uint64_t)std::llround((double)(unix_us - found.start_unix_us) * header_.sample_rate * 1e-6);
+            sample_index = found.first_sample_index + std::min(offset, found.frame_count);
+        }
+        return true;
+    }
+    return false;
+}
+
+bool archive_index_view::end_index(uint64_t& sample_index) const {
+    archive_index_record last;
+    for (size_t record_number = record_count_; record_number > 0; --record_number) {
+        if (record(record_number - 1, last)) {
+            sample_index = last.first_sample_index + last.frame_count;
+            return true;
+        }
+    }
+    return false;
+}
+
+// ----------------- archive_range_reader -----------------
+
+bool archive_range_reader::open(const std::string& directory, const archive_index_view& index,
+                                uint64_t first_sample_index, uint64_t frame_count) {
+    const archive_index_file_header& header = index.header();
+    directory_ = directory;
+    first_sample_index_ = first_sample_index;
+    frame_count_ = frame_count;
+    sample_rate_ = header.sample_rate;
+    frame_bytes_ = (size_t)header.channels * header.bytes_per_sample;
+    start_unix_us_ = 0;
+    pieces_.clear();
+    if (frame_bytes_ == 0) return false;
+
+    uint64_t data_bytes = frame_count * frame_bytes_;
+    header_bytes_ = build_wav_header(header_, header.sample_rate, header.channels, header.bytes_per_sample, data_bytes,
+                                     data_bytes > ARCHIVE_WAV_RIFF_MAX_DATA_BYTES);
+
+    uint64_t range_end = first_sample_index + frame_count;
+    archive_index_record found;
+    for (size_t record_number = index.first_record_ending_after_index(first_sample_index);
+         record_number < index.record_count(); ++record_number) {
+        if (!index.record(record_number, found) || found.frame_count == 0) continue;
+        if (found.first_sample_index >= range_end) break;
+        uint64_t piece_first = std::max(first_sample_index, found.first_sample_index);
+        uint64_t piece_end = std::min(range_end, found.first_sample_index + found.frame_count);
+        if (piece_end <= piece_first) continue;
+        if (pieces_.empty()) {
+            start_unix_us_ = found.start_unix_us + (first_sample_index >= found.first_sample_index
+                                                        ? frames_to_us(first_sample_index - found.first_sample_index, sample_rate_)
+                                                        : -frames_to_us(found.first_sample_index - first_sample_index, sample_rate_));
+        }
+        source_piece piece;
+        piece.first_frame = piece_first - first_sample_index;
+        piece.frame_count = piece_end - piece_first;
+        piece.chunk_first_index = found.chunk_first_index;
+        piece.chunk_byte_offset = found.chunk_byte_offset + (piece_first - found.first_sample_index) * frame_bytes_;
+        pieces_.push_back(piece);
+    }
+    return true;
+}
+
+uint64_t archive_range_reader::recorded_frames() const {
+    uint64_t frames = 0;
+    for (const source_piece& piece : pieces_) frames += piece.frame_count;
+    return frames;
+}
+
+size_t archive_range_reader::piece_at_or_after(uint64_t frame) const {
+    auto found = std::upper_bound(pieces_.begin(), pieces_.end(), frame, [](uint64_t value, const source_piece& piece) {
+        return value < piece.first_frame + piece.frame_count;
+    });
+    return (size_t)(found - pieces_.begin());
+}
+
+size_t archive_range_reader::read(uint64_t offset, uint8_t* out, size_t byte_count) {
+    uint64_t total = total_bytes();
+    if (offset >= total) return 0;
+    byte_count = (size_t)std::min<uint64_t>(byte_count, total - offset);
+
+    size_t done = 0;
+    if (offset < header_bytes_) {
+        done = std::min(byte_count, header_bytes_ - (size_t)offset);
+        memcpy(out, header_ + offset, done);
+    }
+    while (done < byte_count) {
+        uint64_t data_byte = offset + done - header_bytes_;
+        size_t wanted = byte_count - done;
+        size_t piece_number = piece_at_or_after(data_byte / frame_bytes_);
+        uint64_t piece_start_byte = piece_number < pieces_.size() ? pieces_[piece_number].first_frame * frame_bytes_ : total;
+        if (data_byte < piece_start_byte) {
+            // not recorded: silence up to the next piece
+            size_t zero_bytes = (size_t)std::min<uint64_t>(wanted, piece_start_byte - data_byte);
+            memset(out + done, 0, zero_bytes);
+            done += zero_bytes;
+            continue;
+        }
+        const source_piece& piece = pieces_[piece_number];
+        uint64_t byte_in_piece = data_byte - piece_start_byte;
+        size_t take = (size_t)std::min<uint64_t>(wanted, piece.frame_count * frame_bytes_ - byte_in_piece);
+        done += copy_from_chunk(piece, byte_in_piece, out + done, take);
+    }
+    return done;
+}
+
+size_t archive_range_reader::copy_from_chunk(const source_piece& piece, uint64_t byte_in_piece, uint8_t* out, size_t byte_count) {
+    uint64_t file_offset = piece.chunk_byte_offset + byte_in_piece;
+    size_t done = 0;
+    while (done < byte_count) {
+        bool in_window = window_ && window_chunk_ == piece.chunk_first_index && file_offset >= window_file_offset_ &&
+                         file_offset < window_file_offset_ + window_bytes_;
+        if (!in_window) {
+            unmap_window();
+            std::string path = directory_ + "/" + archive_chunk_filename(piece.chunk_first_index);
+            int chunk_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            struct stat chunk_stat;
+            if (chunk_fd < 0 || fstat(chunk_fd, &chunk_stat) != 0 || file_offset >= (uint64_t)chunk_stat.st_size) {
+                // missing or short chunk (audio lost before it reached the disk): silence
+                if (chunk_fd >= 0) ::close(chunk_fd);
+                memset(out + done, 0, byte_count - done);
+                return byte_count;
+            }
+            // never map past the end of the file: touching that would raise SIGBUS
+            uint64_t page_bytes = (uint64_t)sysconf(_SC_PAGESIZE);
+            window_file_offset_ = file_offset / page_bytes * page_bytes;
+            window_bytes_ = (size_t)std::min<uint64_t>(ARCHIVE_READ_WINDOW_BYTES, (uint64_t)chunk_stat.st_size - window_file_offset_);
+            void* mapped = mmap(nullptr, window_bytes_, PROT_READ, MAP_SHARED, chunk_fd, (off_t)window_file_offset_);
+            ::close(chunk_fd);
+            if (mapped == MAP_FAILED) {
+                memset(out + done, 0, byte_count - done);
+                return byte_count;
+            }
+            madvise(mapped, window_bytes_, MADV_SEQUENTIAL);
+            window_ = mapped;
+            window_chunk_ = piece.chunk_first_index;
+        }
+        size_t window_offset = (size_t)(file_offset - window_file_offset_);
+        size_t copy_bytes = std::min(byte_count - done, window_bytes_ - window_offset);
+        memcpy(out + done, static_cast<const uint8_t*>(window_) + window_offset, copy_bytes);
+        done += copy_bytes;
+        file_offset += copy_bytes;
+    }
+    return done;
+}
+
+bool archive_range_reader::single_file_span(uint64_t offset, uint64_t byte_count, std::string& path, uint64_t& file_offset) const {
+    if (byte_count == 0 || offset < header_bytes_ || offset + byte_count > total_bytes()) return false;
+    uint64_t data_byte = offset - header_bytes_;
+    size_t piece_number = piece_at_or_after(data_byte / frame_bytes_);
+    if (piece_number >= pieces_.size()) return false;
+    const source_piece& piece = pieces_[piece_number];
+    uint64_t piece_start_byte = piece.first_frame * frame_bytes_;
+    if (data_byte < piece_start_byte || data_byte + byte_count > piece_start_byte + piece.frame_count * frame_bytes_) return false;
+
+    path = directory_ + "/" + archive_chunk_filename(piece.chunk_first_index);
+    file_offset = piece.chunk_byte_offset + (data_byte - piece_start_byte);
+    struct stat chunk_stat;
+    return stat(path.c_str(), &chunk_stat) == 0 && file_offset + byte_count <= (uint64_t)chunk_stat.st_size;
+}
+
+void archive_range_reader::unmap_window() {
+    if (window_) munmap(window_, window_bytes_);
+    window_ = nullptr;
+    window_chunk_ = UINT64_MAX;
+    window_bytes_ = 0;
+}
@@ -0,0 +1,264 @@
+// stream_archive.h
+// Chunked per-device archive with an index, for random-access retrieval: "device X
+// from 14:02 to 14:05" costs an index search plus reading those three minutes, not a
+// scan of the recording.
+//
+// Layout, one directory per device under the archive root:
+//
+//   <root>/<device>/index.bin                   header + fixed-size records
+//   <root>/<device>/<chunk_first_index>.pcm     raw audio (packed frames, no header)
+//
+// The archive timeline is cut into chunks of chunk_frames, aligned to multiples of
+// chunk_frames and named after their first sample index (zero-padded like the WAV
+// segments). A frame lives at byte (index - chunk_first_index) * frame_bytes of its
+// chunk, so chunks are written with positional writes and a gap in the audio is a
+// hole in the file (reads back as silence, takes no space).
+//
+// Next to them, the overview pyramid of the same timeline (archive_overview.h).
+//
+// Each index record covers one contiguous run within one chunk: its sample range,
+// the chunk and byte offset it starts at, and the wall-clock capture time of its
+// first frame. Records are appended in timeline order, so both the sample index and
+// (apart from clock steps) the time can be binary-searched. The record in progress is
+// rewritten in place after every batch write, so the index always covers the audio
+// on disk; a record check word lets a reader tell a torn or half-written record.
+//
+// The timeline is the stream's sample index. A stream that starts below what the
+// device has archived already (a device that restarted its counter, compensation
+// switched off) is shifted to continue after it; records keep the stream's own index
+// as well.
+//
+// stream_archive_writer is owned by one thread (the writer stage). The readers
+// (archive_index_view, archive_range_reader) work on the files only, from any
+// thread or process; they map just the records and audio a request needs.
+#pragma once
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "archive_overview.h"
+#include "wav_writer.h"
+
+static constexpr char ARCHIVE_INDEX_MAGIC[8] = {'E', 'S', 'P', 'A', 'R', 'C', 'H', '1'};
+static constexpr uint32_t ARCHIVE_INDEX_VERSION = 1;
+static constexpr const char* ARCHIVE_INDEX_FILENAME = "index.bin";
+
+// index.bin starts with this (native byte order, like the records)
+struct archive_index_file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_bytes;        // sizeof(archive_index_record) of the writer
+    uint32_t sample_rate;
+    uint16_t channels;
+    uint16_t bytes_per_sample;
+    uint64_t chunk_frames;
+};
+static_assert(sizeof(archive_index_file_header) == 32, "index header layout");
+
+struct archive_index_record {
+    uint64_t first_sample_index;          // archive timeline
+    uint64_t frame_count;                 // on disk
+    uint64_t chunk_first_index;           // chunk file holding the run
+    uint64_t chunk_byte_offset;           // where first_sample_index is in that file
+    int64_t start_unix_us;                // wall-clock capture time of first_sample_index
+    uint64_t source_first_sample_index;   // the stream's own index of first_sample_index
+    uint32_t reserved;
+    uint32_t check;                       // archive_index_record_check() of everything above
+};
+static_assert(sizeof(archive_index_record) == 56, "index record layout");
+
+uint32_t archive_index_record_check(const archive_index_record& record);
+// "<chunk_first_index, zero-padded>.pcm"
+std::string archive_chunk_filename(uint64_t chunk_first_index);
+
+struct stream_archive_policy {
+    uint64_t chunk_frames = 60 * 48000;
+    size_t batch_bytes = 256 * 1024;         // flush once this much audio is buffered
+    uint32_t flush_interval_ms = 1000;       // ...or once the oldest buffered byte is this old
+    uint32_t durability_interval_ms = 5000;  // fdatasync period for chunk and index; 0 = only at close
+};
+
+// Process-wide archive counters (all writers)
+struct stream_archive_statistics {
+    std::atomic<uint64_t> write_syscalls{0};
+    std::atomic<uint64_t> bytes_written{0};
+    std::atomic<uint64_t> records_started{0};
+    std::atomic<uint64_t> chunks_opened{0};
+    std::atomic<uint64_t> fdatasync_calls{0};
+    std::atomic<uint64_t> write_errors{0};
+    std::atomic<uint64_t> ranges_served{0};
+    std::atomic<uint64_t> bytes_served{0};
+};
+stream_archive_statistics& stream_archive_stats();
+
+// ----------------- Writer -----------------
+
+class stream_archive_writer {
+public:
+    using clock = std::chrono::steady_clock;
+
+    stream_archive_writer() = default;
+    ~stream_archive_writer() { close(); }
+
+    stream_archive_writer(const stream_archive_writer&) = delete;
+    stream_archive_writer& operator=(const stream_archive_writer&) = delete;
+
+    // Open (creating the directories and index as needed) and continue after what the
+    // device has archived already. Fails if the index is locked by another writer or
+    // holds a different format.
+    bool open(const std::string& directory, uint32_t sample_rate, uint16_t channels, uint16_t bytes_per_sample,
+              const stream_archive_policy& policy);
+    bool is_open() const { return index_fd_ >= 0; }
+
+    // True if a run at this stream index continues the current record: append() then
+    // does not need the run's start time
+    bool continues_record(uint64_t first_sample_index) const {
+        return record_open_ && first_sample_index + index_shift_ == archived_end_index_;
+    }
+
+    // Append a contiguous run of packed frames. start_unix_us is the wall-clock capture
+    // time of its first frame; it is only used when the run starts a record.
+    bool append(uint64_t first_sample_index, const uint8_t* bytes, size_t frame_count, int64_t start_unix_us,
+                clock::time_point now);
+
+    // Time-driven part of the policy; call periodically even when no audio arrives
+    void service_timers(clock::time_point now);
+
+    // Flush, update the index, fdatasync and close. Safe to call twice.
+    void close();
+
+    const std::string& directory() const { return directory_; }
+    uint64_t index_shift() const { return index_shift_; }
+
+private:
+    bool start_record(uint64_t archive_index, uint64_t source_index, int64_t start_unix_us);
+    bool open_chunk(uint64_t chunk_first_index);
+    bool flush();                      // batch -> chunk file, then the record
+    void end_record();
+    bool write_all_at(int file_descriptor, const uint8_t* bytes, size_t byte_count, off_t file_offset);
+    void sync_to_disk();
+
+    std::string directory_;
+    uint32_t sample_rate_ = 0;
+    size_t frame_bytes_ = 0;
+    stream_archive_policy policy_;
+
+    int index_fd_ = -1;
+    off_t index_bytes_ = 0;            // header + whole records
+    int chunk_fd_ = -1;
+    uint64_t chunk_first_index_ = 0;
+
+    uint64_t archived_end_index_ = 0;  // archive index after everything archived or buffered
+    uint64_t index_shift_ = 0;         // archive index = stream index + index_shift_
+
+    bool record_open_ = false;
+    bool record_stored_ = false;       // record_ has a slot in the index
+    archive_index_record record_ = {};
+    off_t record_offset_ = 0;
+
+    uint8_t* batch_buffer_ = nullptr;  // audio after the record's frames on disk
+    size_t batch_capacity_ = 0;
+    size_t batch_fill_ = 0;
+    clock::time_point oldest_buffered_time_;
+    clock::time_point last_durability_sync_time_;
+    bool unsynced_ = false;
+
+    archive_overview_writer overview_; // packed 24-bit mono archives only
+};
+
+// ----------------- Readers -----------------
+
+// The index of one device, mapped read-only as it was at open()
+class archive_index_view {
+public:
+    archive_index_view() = default;
+    ~archive_index_view();
+    archive_index_view(const archive_index_view&) = delete;
+    archive_index_view& operator=(const archive_index_view&) = delete;
+
+    bool open(const std::string& directory);
+    const archive_index_file_header& header() const { return header_; }
+    size_t record_count() const { return record_count_; }
+
+    // Copy record i; false if it fails its check (being rewritten, or cut by a crash)
+    bool record(size_t record_number, archive_index_record& out) const;
+    // First record that ends after the sample index, or after the wall-clock time
+    size_t first_record_ending_after_index(uint64_t sample_index) const;
+    size_t first_record_ending_after_time(int64_t unix_us) const;
+    // Archive index of the frame captured at unix_us, or of the first frame after it
+    // when that time is not recorded; false if nothing was recorded after it
+    bool index_at_time(int64_t unix_us, uint64_t& sample_index) const;
+    // Index after the last recorded frame; false for an empty archive
+    bool end_index(uint64_t& sample_index) const;
+
+private:
+    const archive_index_record* records() const;
+
+    void* mapping_ = nullptr;
+    size_t mapping_bytes_ = 0;
+    archive_index_file_header header_ = {};
+    size_t record_count_ = 0;
+};
+
+// A sample range of an archive presented as one WAV file (header + audio, gaps as
+// silence) that can be read at any offset. Chunks are mapped one at a time, just the
+// part a read touches.
+class archive_range_reader {
+public:
+    archive_range_reader() = default;
+    ~archive_range_reader() { unmap_window(); }
+    archive_range_reader(const archive_range_reader&) = delete;
+    archive_range_reader& operator=(const archive_range_reader&) = delete;
+
+    // Plan [first_sample_index, first_sample_index + frame_count) from the index
+    bool open(const std::string& directory, const archive_index_view& index, uint64_t first_sample_index,
+              uint64_t frame_count);
+
+    uint64_t first_sample_index() const { return first_sample_index_; }
+    uint64_t frame_count() const { return frame_count_; }
+    uint32_t sample_rate() const { return sample_rate_; }
+    uint64_t recorded_frames() const;            // frames backed by a record (the rest is silence)
+    int64_t start_unix_us() const { return start_unix_us_; } // of the first frame, extrapolated; 0 if unknown
+    uint64_t total_bytes() const { return header_bytes_ + frame_count_ * frame_bytes_; }
+
+    // Copy [offset, offset + byte_count) of the WAV; returns the bytes copied
+    size_t read(uint64_t offset, uint8_t* out, size_t byte_count);
+
+    // If [offset, offset + byte_count) lies within one chunk file's recorded audio, the
+    // file and the offset in it, so the caller can send it straight from the file
+    bool single_file_span(uint64_t offset, uint64_t byte_count, std::string& path, uint64_t& file_offset) const;
+
+private:
+    struct source_piece {
+        uint64_t first_frame;          // offset in the range
+        uint64_t frame_count;
+        uint64_t chunk_first_index;
+        uint64_t chunk_byte_offset;
+    };
+
+    size_t piece_at_or_after(uint64_t frame) const;
+    size_t copy_from_chunk(const source_piece& piece, uint64_t byte_in_piece, uint8_t* out, size_t byte_count);
+    void unmap_window();
+
+    std::string directory_;
+    uint64_t first_sample_index_ = 0;
+    uint64_t frame_count_ = 0;
+    uint32_t sample_rate_ = 0;
+    size_t frame_bytes_ = 0;
+    int64_t start_unix_us_ = 0;
+    uint8_t header_[WAV_MAX_HEADER_BYTES] = {};
+    size_t header_bytes_ = 0;
+    std::vector<source_piece> pieces_;
+
+    // the mapped part of one chunk file
+    uint64_t window_chunk_ = UINT64_MAX;
+    uint64_t window_file_offset_ = 0;  // page-aligned
+    size_t window_bytes_ = 0;
+    void* window_ = nullptr;
+};
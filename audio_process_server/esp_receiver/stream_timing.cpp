@@ -0,0 +1,193 @@
+// stream_timing.cpp
+// Latency histograms and device clock offset/drift estimation (see stream_timing.h).
+#include "stream_timing.h"
+
+#include <chrono>
+
+// a device timestamp that moves backwards, or jumps this far, means the ESP rebooted
+static const uint64_t TIMING_MAX_DEVICE_JUMP_US = 60ull * 1000000;
+
+uint64_t host_monotonic_us() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// ----------------- latency_histogram -----------------
+
+size_t latency_histogram::bucket_of(uint64_t value_us) {
+    // values below 2^SUB_BUCKET_BITS get exact buckets; above, 8 buckets per octave
+    if (value_us < (1u << SUB_BUCKET_BITS)) return (size_t)value_us;
+    int power = 63 - __builtin_clzll(value_us);
+    if (power > MAX_POWER_OF_TWO) return BUCKET_COUNT - 1;
+    size_t sub_bucket = (size_t)((value_us >> (power - SUB_BUCKET_BITS)) & ((1u << SUB_BUCKET_BITS) - 1));
+    return ((size_t)(power - SUB_BUCKET_BITS + 1) << SUB_BUCKET_BITS) + sub_bucket;
+}
+
+uint64_t latency_histogram::bucket_upper_bound(size_t bucket) {
+    if (bucket < (1u << SUB_BUCKET_BITS)) return bucket;
+    int power = (int)(bucket >> SUB_BUCKET_BITS) + SUB_BUCKET_BITS - 1;
+    uint64_t sub_bucket = bucket & ((1u << SUB_BUCKET_BITS) - 1);
+    uint64_t bucket_width = 1ull << (power - SUB_BUCKET_BITS);
+    return (1ull << power) + (sub_bucket + 1) * bucket_width - 1;
+}
+
+void latency_histogram::record(uint64_t value_us) {
+    buckets_[bucket_of(value_us)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_us_.fetch_add(value_us, std::memory_order_relaxed);
+    uint64_t previous_max = max_us_.load(std::memory_order_relaxed);
+    while (value_us > previous_max && !max_us_.compare_exchange_weak(previous_max, value_us, std::memory_order_relaxed)) {
+    }
+}
+
+uint64_t latency_histogram::percentile(double quantile) const {
+    uint64_t counts[BUCKET_COUNT];
+    uint64_t total = 0;
+    for (size_t bucket = 0; bucket < BUCKET_COUNT; ++bucket) {
+        counts[bucket] = buckets_[bucket].load(std::memory_order_relaxed);
+        total += counts[bucket];
+    }
+    if (total == 0) return 0;
+    uint64_t rank = (uint64_t)(quantile * (double)(total - 1)) + 1;
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket < BUCKET_COUNT; ++bucket) {
+        seen += counts[bucket];
+        if (seen >= rank) {
+            uint64_t bound = bucket_upper_bound(bucket);
+            uint64_t observed_max = max();
+            return bound < observed_max ? bound : observed_max;
+        }
+    }
+    return max();
+}
+
+uint64_t latency_histogram::count_at_or_below(uint64_t bound_us) const {
+    uint64_t total = 0;
+    for (size_t bucket = 0; bucket < BUCKET_COUNT && bucket_upper_bound(bucket) <= bound_us; ++bucket) {
+        total += buckets_[bucket].load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+// ----------------- device_clock_estimator -----------------
+
+void device_clock_estimator::reset(uint64_t device_timestamp_us, uint64_t host_receive_us, uint64_t first_sample_index) {
+    windows_filled_ = 0;
+    next_window_slot_ = 0;
+    started_ = true;
+    fit_origin_device_us_ = device_timestamp_us;
+    current_window_.start_device_us = device_timestamp_us;
+    current_window_.start_sample_index = first_sample_index;
+    current_window_.min_device_us = device_timestamp_us;
+    current_window_.min_host_minus_device_us = (int64_t)(host_receive_us - device_timestamp_us);
+    fit_intercept_us_ = (double)current_window_.min_host_minus_device_us;
+    fit_slope_ = 0.0;
+    has_estimate_.store(false, std::memory_order_relaxed);
+    publish_snapshot(device_timestamp_us, first_sample_index, fit_intercept_us_, 0.0, 0.0);
+}
+
+void device_clock_estimator::add_observation(uint64_t device_timestamp_us, uint64_t host_receive_us,
+                                             uint64_t first_sample_index) {
+    bool device_restarted = started_ && (device_timestamp_us < last_device_us_ ||
+                                         device_timestamp_us - last_device_us_ > TIMING_MAX_DEVICE_JUMP_US ||
+                                         first_sample_index < last_sample_index_);
+    if (!started_ || device_restarted) {
+        if (device_restarted) resets_.fetch_add(1, std::memory_order_relaxed);
+        reset(device_timestamp_us, host_receive_us, first_sample_index);
+    }
+    last_device_us_ = device_timestamp_us;
+    last_sample_index_ = first_sample_index;
+
+    if (device_timestamp_us - current_window_.start_device_us >= TIMING_WINDOW_US) {
+        close_window_and_refit(device_timestamp_us, first_sample_index);
+        current_window_.start_device_us = device_timestamp_us;
+        current_window_.start_sample_index = first_sample_index;
+        current_window_.min_device_us = device_timestamp_us;
+        current_window_.min_host_minus_device_us = (int64_t)(host_receive_us - device_timestamp_us);
+        return;
+    }
+    int64_t host_minus_device = (int64_t)(host_receive_us - device_timestamp_us);
+    if (host_minus_device < current_window_.min_host_minus_device_us) {
+        current_window_.min_host_minus_device_us = host_minus_device;
+        current_window_.min_device_us = device_timestamp_us;
+        if (windows_filled_ == 0) {
+            // no fit yet: the best point so far is the estimate
+            fit_intercept_us_ = (double)host_minus_device;
+            publish_snapshot(device_timestamp_us, first_sample_index, fit_intercept_us_, 0.0, 0.0);
+        }
+    }
+}
+
+void device_clock_estimator::close_window_and_refit(uint64_t newest_device_us, uint64_t newest_sample_index) {
+    windows_[next_window_slot_] = current_window_;
+    next_window_slot_ = (next_window_slot_ + 1) % TIMING_WINDOW_COUNT;
+    if (windows_filled_ < TIMING_WINDOW_COUNT) ++windows_filled_;
+
+    // least squares of window minimum vs device time (seconds from the fit origin)
+    double sum_x = 0.0, sum_y = 0.0, sum_xx = 0.0, sum_xy = 0.0;
+    // until the ring wraps the oldest window is slot 0, afterwards the one about to be overwritten
+    const envelope_window* oldest = &windows_[windows_filled_ < TIMING_WINDOW_COUNT ? 0 : next_window_slot_];
+    for (size_t i = 0; i < windows_filled_; ++i) {
+        const envelope_window& window = windows_[i];
+        double x = (double)(int64_t)(window.min_device_us - fit_origin_device_us_) * 1e-6;
+        double y = (double)window.min_host_minus_device_us;
+        sum_x += x;
+        sum_y += y;
+        sum_xx += x * x;
+        sum_xy += x * y;
+    }
+    double n = (double)windows_filled_;
+    double denominator = n * sum_xx - sum_x * sum_x;
+    double slope_us_per_s = windows_filled_ >= 2 && denominator > 0.0 ? (n * sum_xy - sum_x * sum_y) / denominator : 0.0;
+    double intercept_us = (sum_y - slope_us_per_s * sum_x) / n;
+    fit_slope_ = slope_us_per_s * 1e-6;
+    fit_intercept_us_ = intercept_us;
+
+    // effective rate: sample index advance over device time, and over host time via the drift
+    double rate_device = 0.0;
+    uint64_t elapsed_device_us = newest_device_us - oldest->start_device_us;
+    if (elapsed_device_us > 0) {
+        rate_device = (double)(newest_sample_index - oldest->start_sample_index) * 1e6 / (double)elapsed_device_us;
+    }
+    double offset_now = intercept_us + slope_us_per_s * (double)(newest_device_us - fit_origin_device_us_) * 1e-6;
+    published_offset_us_.store(offset_now, std::memory_order_relaxed);
+    published_drift_ppm_.store(slope_us_per_s, std::memory_order_relaxed); // us per s == ppm
+    published_rate_device_.store(rate_device, std::memory_order_relaxed);
+    published_rate_host_.store(rate_device / (1.0 + fit_slope_), std::memory_order_relaxed);
+    has_estimate_.store(windows_filled_ >= 2, std::memory_order_relaxed);
+    publish_snapshot(newest_device_us, newest_sample_index, offset_now, slope_us_per_s, rate_device);
+}
+
+void device_clock_estimator::publish_snapshot(uint64_t reference_device_us, uint64_t reference_sample_index,
+                                              double offset_us, double drift_ppm, double sample_rate_device_clock) {
+    std::lock_guard<std::mutex> lock(snapshot_mutex_);
+    snapshot_.valid = true;
+    snapshot_.reference_device_us = reference_device_us;
+    snapshot_.reference_sample_index = reference_sample_index;
+    snapshot_.offset_at_reference_us = offset_us;
+    snapshot_.drift_ppm = drift_ppm;
+    snapshot_.sample_rate_device_clock = sample_rate_device_clock;
+}
+
+device_clock_snapshot device_clock_estimator::snapshot() const {
+    std::lock_guard<std::mutex> lock(snapshot_mutex_);
+    return snapshot_;
+}
+
+double device_clock_snapshot::host_time_of_sample_us(double sample_index, double nominal_sample_rate) const {
+    double device_rate = sample_rate_device_clock > 0.0 ? sample_rate_device_clock : nominal_sample_rate;
+    double device_us_from_reference = (sample_index - (double)reference_sample_index) * 1e6 / device_rate;
+    return (double)reference_device_us + device_us_from_reference + offset_at_reference_us +
+           drift_ppm * 1e-6 * device_us_from_reference;
+}
+
+double device_clock_snapshot::sample_rate_host_clock(double nominal_sample_rate) const {
+    if (sample_rate_device_clock <= 0.0) return nominal_sample_rate;
+    return sample_rate_device_clock / (1.0 + drift_ppm * 1e-6);
+}
+
+uint64_t device_clock_estimator::excess_delay_us(uint64_t device_timestamp_us, uint64_t host_receive_us) const {
+    double predicted_offset = fit_intercept_us_ + fit_slope_ * (double)(int64_t)(device_timestamp_us - fit_origin_device_us_);
+    double excess = (double)(int64_t)(host_receive_us - device_timestamp_us) - predicted_offset;
+    return excess > 0.0 ? (uint64_t)excess : 0;
+}
@@ -0,0 +1,129 @@
+// stream_timing.h
+// Per-device timing from the ESP2 timestamp_us field (esp_timer_get_time() of the
+// packet's first sample) against the host's monotonic clock.
+//
+// device_clock_estimator keeps, per TIMING_WINDOW_US of device time, the smallest
+// observed host-minus-device difference. That lower envelope is the packets that
+// met no queueing. A least-squares line through the last TIMING_WINDOW_COUNT window
+// minima gives the clock offset (intercept) and drift (slope, in ppm). The offset
+// includes the minimum one-way path latency, which one-way timestamps cannot
+// separate out, so "capture -> receive" latency is reported as the delay above that
+// best case: Wi-Fi queueing and retransmission show up there first.
+//
+// The effective sample rate is measured twice: against the device clock (sample
+// index advance per esp_timer second, i.e. the I2S clock vs the ESP timer) and
+// against the host clock (the same, corrected by the estimated drift).
+//
+// latency_histogram is a fixed log-linear histogram (8 sub-buckets per power of two)
+// of relaxed atomics. Writers never block, and readers compute p50/p99 from a
+// snapshot of the counts.
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+static constexpr uint64_t TIMING_WINDOW_US = 1000000;      // one lower-envelope point per device second
+static constexpr size_t TIMING_WINDOW_COUNT = 120;          // fit over the last two minutes
+
+class latency_histogram {
+public:
+    static constexpr int SUB_BUCKET_BITS = 3;
+    static constexpr int MAX_POWER_OF_TWO = 27;   // top bucket ends at ~134 s
+    static constexpr size_t BUCKET_COUNT = (size_t)(MAX_POWER_OF_TWO + 1) << SUB_BUCKET_BITS;
+
+    void record(uint64_t value_us);
+
+    // Upper bound of the bucket holding the q-quantile (0..1); 0 when empty
+    uint64_t percentile(double quantile) const;
+    uint64_t max() const { return max_us_.load(std::memory_order_relaxed); }
+    uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+    uint64_t sum() const { return sum_us_.load(std::memory_order_relaxed); }
+
+    // Cumulative count of values <= bound_us (bucket resolution), for Prometheus buckets
+    uint64_t count_at_or_below(uint64_t bound_us) const;
+
+private:
+    static size_t bucket_of(uint64_t value_us);
+    static uint64_t bucket_upper_bound(size_t bucket);
+
+    std::atomic<uint64_t> buckets_[BUCKET_COUNT] = {};
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> sum_us_{0};
+    std::atomic<uint64_t> max_us_{0};
+};
+
+// Consistent copy of the current fit, for mapping sample indices onto host time
+struct device_clock_snapshot {
+    bool valid = false;                // false until the first packet
+    uint64_t reference_device_us = 0;  // a recent packet's timestamp_us...
+    uint64_t reference_sample_index = 0; // ...and its first_sample_index
+    double offset_at_reference_us = 0.0; // host minus device at the reference
+    double drift_ppm = 0.0;
+    double sample_rate_device_clock = 0.0; // 0 until the first window closes
+
+    // Host monotonic time (us) at which sample_index was captured
+    double host_time_of_sample_us(double sample_index, double nominal_sample_rate) const;
+    // Sample rate measured against the host clock (nominal until estimated)
+    double sample_rate_host_clock(double nominal_sample_rate) const;
+};
+
+class device_clock_estimator {
+public:
+    // Receiver thread: one call per packet (device capture time, host receive time)
+    void add_observation(uint64_t device_timestamp_us, uint64_t host_receive_us, uint64_t first_sample_index);
+
+    // Delay of this packet above the best-case path, from the current fit (>= 0)
+    uint64_t excess_delay_us(uint64_t device_timestamp_us, uint64_t host_receive_us) const;
+
+    // Published estimates (any thread)
+    bool has_estimate() const { return has_estimate_.load(std::memory_order_relaxed); }
+    double offset_us() const { return published_offset_us_.load(std::memory_order_relaxed); }
+    double drift_ppm() const { return published_drift_ppm_.load(std::memory_order_relaxed); }
+    double sample_rate_device_clock() const { return published_rate_device_.load(std::memory_order_relaxed); }
+    double sample_rate_host_clock() const { return published_rate_host_.load(std::memory_order_relaxed); }
+    uint64_t resets() const { return resets_.load(std::memory_order_relaxed); }
+    device_clock_snapshot snapshot() const;
+
+private:
+    struct envelope_window {
+        uint64_t start_device_us = 0;     // device time of the window's first packet
+        uint64_t start_sample_index = 0;  // ...and its sample index
+        uint64_t min_device_us = 0;       // device time of the lowest host-device point
+        int64_t min_host_minus_device_us = 0;
+    };
+
+    void reset(uint64_t device_timestamp_us, uint64_t host_receive_us, uint64_t first_sample_index);
+    void close_window_and_refit(uint64_t newest_device_us, uint64_t newest_sample_index);
+    void publish_snapshot(uint64_t reference_device_us, uint64_t reference_sample_index, double offset_us,
+                          double drift_ppm, double sample_rate_device_clock);
+
+    // receiver thread only
+    envelope_window windows_[TIMING_WINDOW_COUNT];
+    size_t windows_filled_ = 0;
+    size_t next_window_slot_ = 0;
+    envelope_window current_window_;
+    bool started_ = false;
+    uint64_t last_device_us_ = 0;
+    uint64_t last_sample_index_ = 0;
+    uint64_t fit_origin_device_us_ = 0;
+
+    // fit result, read by excess_delay_us() on the receiver thread
+    double fit_intercept_us_ = 0.0;
+    double fit_slope_ = 0.0;   // host-minus-device change per device microsecond
+
+    std::atomic<bool> has_estimate_{false};
+    std::atomic<double> published_offset_us_{0.0};
+    std::atomic<double> published_drift_ppm_{0.0};
+    std::atomic<double> published_rate_device_{0.0};
+    std::atomic<double> published_rate_host_{0.0};
+    std::atomic<uint64_t> resets_{0};
+
+    // written on refit (about once per second), read by the writer's drift compensation
+    mutable std::mutex snapshot_mutex_;
+    device_clock_snapshot snapshot_;
+};
+
+// Host monotonic clock in microseconds (steady_clock)
+uint64_t host_monotonic_us();
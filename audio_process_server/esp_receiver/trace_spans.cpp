@@ -0,0 +1,153 @@
+// trace_spans.cpp
+// Per-thread span registry and the Chrome trace export (see trace_spans.h).
+#include "trace_spans.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <mutex>
+#include <vector>
+
+thread_local trace_thread_ring* global_this_thread_trace_ring = nullptr;
+
+static std::mutex global_trace_registry_mutex;
+static std::vector<trace_thread_ring*> global_trace_rings;
+
+// Tick/time pair taken at startup: the dump measures the tick rate against it
+struct trace_clock_origin {
+    uint64_t ticks;
+    std::chrono::steady_clock::time_point time;
+};
+static const trace_clock_origin global_trace_clock_origin = {trace_ticks(), std::chrono::steady_clock::now()};
+
+void trace_register_current_thread(const std::string& thread_name) {
+    if (global_this_thread_trace_ring) return;
+    global_this_thread_trace_ring = new trace_thread_ring(thread_name);
+    std::lock_guard<std::mutex> lock(global_trace_registry_mutex);
+    global_trace_rings.push_back(global_this_thread_trace_ring);
+}
+
+const char* trace_span_kind_name(trace_span_kind kind) {
+    switch (kind) {
+    case trace_span_kind::accept: return "accept";
+    case trace_span_kind::recv: return "recv";
+    case trace_span_kind::frame: return "frame";
+    case trace_span_kind::enqueue: return "enqueue";
+    case trace_span_kind::convert: return "convert";
+    case trace_span_kind::write: return "write";
+    case trace_span_kind::timers: return "timers";
+    case trace_span_kind::flush: return "flush";
+    case trace_span_kind::sync: return "sync";
+    case trace_span_kind::count: break;
+    }
+    return "unknown";
+}
+
+// What a kind's arg holds in the export, or nullptr if it has none
+static const char* trace_span_arg_name(trace_span_kind kind) {
+    switch (kind) {
+    case trace_span_kind::recv:
+    case trace_span_kind::flush: return "bytes";
+    case trace_span_kind::frame:
+    case trace_span_kind::enqueue:
+    case trace_span_kind::convert:
+    case trace_span_kind::write: return "sample";
+    default: return nullptr;
+    }
+}
+
+// The packet flow a span takes part in: "s" starts it on the receiver, "t" steps
+// through DSP, "f" ends it on the writer; nullptr for spans outside it
+static const char* trace_span_flow_phase(trace_span_kind kind) {
+    switch (kind) {
+    case trace_span_kind::enqueue: return "s";
+    case trace_span_kind::convert: return "t";
+    case trace_span_kind::write: return "f";
+    default: return nullptr;
+    }
+}
+
+static void append_format(std::string& out, const char* format, ...) __attribute__((format(printf, 2, 3)));
+static void append_format(std::string& out, const char* format, ...) {
+    char buffer[256];
+    va_list arguments;
+    va_start(arguments, format);
+    int length = vsnprintf(buffer, sizeof(buffer), format, arguments);
+    va_end(arguments);
+    if (length > 0) out.append(buffer, std::min((size_t)length, sizeof(buffer) - 1));
+}
+
+static void append_json_string(std::string& out, const std::string& text) {
+    out += '"';
+    for (char c : text) {
+        if (c == '"' || c == '\\') out += '\\';
+        if ((unsigned char)c >= 0x20) out += c;
+    }
+    out += '"';
+}
+
+std::string trace_chrome_json(uint64_t window_us) {
+    std::vector<trace_thread_ring*> rings;
+    {
+        std::lock_guard<std::mutex> lock(global_trace_registry_mutex);
+        rings = global_trace_rings;
+    }
+
+    // the counter's rate over the whole run so far (constant-rate TSC / generic timer)
+    uint64_t now_ticks = trace_ticks();
+    auto now = std::chrono::steady_clock::now();
+    double elapsed_us = std::chrono::duration<double, std::micro>(now - global_trace_clock_origin.time).count();
+    double ticks_per_us = elapsed_us > 0.0 ? (double)(now_ticks - global_trace_clock_origin.ticks) / elapsed_us : 1000.0;
+    if (ticks_per_us <= 0.0) ticks_per_us = 1000.0;
+    uint64_t window_ticks = (uint64_t)((double)window_us * ticks_per_us);
+    uint64_t oldest_end_ticks = window_us > 0 && now_ticks - global_trace_clock_origin.ticks > window_ticks
+                                    ? now_ticks - window_ticks
+                                    : 0;
+    auto to_us = [&](uint64_t ticks) {
+        return ticks >= global_trace_clock_origin.ticks ? (double)(ticks - global_trace_clock_origin.ticks) / ticks_per_us : 0.0;
+    };
+
+    int pid = (int)getpid();
+    std::string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first_event = true;
+    auto begin_event = [&]() {
+        if (!first_event) out += ",\n";
+        first_event = false;
+    };
+    std::vector<trace_event> events;
+    for (size_t ring_index = 0; ring_index < rings.size(); ++ring_index) {
+        size_t tid = ring_index + 1;
+        begin_event();
+        append_format(out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%zu,\"args\":{\"name\":", pid, tid);
+        append_json_string(out, rings[ring_index]->thread_name());
+        out += "}}";
+
+        events.clear();
+        rings[ring_index]->copy_events(events);
+        for (const trace_event& event : events) {
+            if (event.end_ticks < oldest_end_ticks || event.kind >= trace_span_kind::count) continue;
+            double begin_us = to_us(event.begin_ticks);
+            double duration_us = event.end_ticks > event.begin_ticks ? (double)(event.end_ticks - event.begin_ticks) / ticks_per_us : 0.0;
+            begin_event();
+            append_format(out, "{\"name\":\"%s\",\"cat\":\"pipeline\",\"ph\":\"X\",\"pid\":%d,\"tid\":%zu,\"ts\":%.3f,\"dur\":%.3f,\"args\":{",
+                          trace_span_kind_name(event.kind), pid, tid, begin_us, duration_us);
+            const char* arg_name = trace_span_arg_name(event.kind);
+            bool has_stream = event.stream_id != 0;
+            if (has_stream) append_format(out, "\"stream\":%llu", (unsigned long long)event.stream_id);
+            if (arg_name) append_format(out, "%s\"%s\":%llu", has_stream ? "," : "", arg_name, (unsigned long long)event.arg);
+            out += "}}";
+
+            // one packet's id on every stage: its stream and first sample index
+            const char* flow_phase = trace_span_flow_phase(event.kind);
+            if (flow_phase && has_stream) {
+                begin_event();
+                append_format(out, "{\"name\":\"packet\",\"cat\":\"packet\",\"ph\":\"%s\",%s\"id\":\"0x%llx\",\"pid\":%d,\"tid\":%zu,\"ts\":%.3f}",
+                              flow_phase, flow_phase[0] == 'f' ? "\"bp\":\"e\"," : "",
+                              (unsigned long long)(event.stream_id << 44 ^ event.arg), pid, tid, begin_us);
+            }
+        }
+    }
+    out += "]}\n";
+    return out;
+}
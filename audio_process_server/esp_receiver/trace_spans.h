@@ -0,0 +1,223 @@
+// trace_spans.h
+// Hot-path tracing: timed spans of the receiver's pipeline stages, kept per thread and
+// exported on demand as Chrome trace JSON (chrome://tracing, ui.perfetto.dev) by
+// GET /trace.
+//
+// Spans are recorded only in builds with ESP_RECEIVER_TRACING defined
+// (-DESP_RECEIVER_TRACING=ON); otherwise ESP_TRACE_* expand to nothing and their
+// arguments are not evaluated. With it, a span is two reads of the cycle counter
+// (rdtsc on x86-64, cntvct_el0 on arm64, steady_clock elsewhere) and a handful of
+// relaxed stores into the thread's ring: no lock, no syscall, no allocation. Spans
+// of one busy loop (packets framed out of one recv, converted or written back to
+// back) share their edges through a trace_span_chain: each begins on the tick its
+// predecessor ended on, so it costs one counter read. The loop breaks the chain
+// before it sleeps, so no span swallows idle time; a chained span does absorb the
+// few instructions of loop overhead between two packets.
+// `esp_receiver_benchmarks --filter trace` reports both kinds of span against the
+// counter read and the recorder's own cost. On a VM where rdtsc costs ~22 ns a
+// chained span measures ~25 ns and an unchained one ~47 ns; the recorder is ~5 ns.
+// Ticks are converted to time only when the trace is dumped.
+//
+// Each thread's ring keeps its newest TRACE_RING_EVENTS spans, overwriting the
+// oldest. The thread claims an event before writing it, so a dump racing the thread
+// can tell which of the events it copied may have been overwritten and drops them.
+//
+// Spans of one packet carry its stream id and first_sample_index; the export links a
+// packet's enqueue, convert and write across threads with flow arrows.
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+static constexpr size_t TRACE_RING_EVENTS = 1u << 15;   // per thread, 1 MiB
+static constexpr uint64_t TRACE_RING_MASK = TRACE_RING_EVENTS - 1;
+
+enum class trace_span_kind : uint8_t {
+    accept,        // receiver: accepting new connections
+    recv,          // receiver: one recv()/recvmmsg() call, arg = bytes
+    frame,         // receiver: header check and framing of one packet in the ring, arg = sample index
+    enqueue,       // receiver: clock observation and slot handoff to DSP, arg = sample index
+    convert,       // DSP: decode, chain, metering and export of one packet, arg = sample index
+    write,         // writer: jitter buffer and sinks for one packet, arg = sample index
+    timers,        // writer: timed flushes and syncs of one stream
+    flush,         // a WAV or archive batch written out, arg = bytes
+    sync,          // fdatasync of a WAV or archive
+    count
+};
+
+const char* trace_span_kind_name(trace_span_kind kind);
+
+// Raw timestamp in counter ticks
+inline uint64_t trace_ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t ticks;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#else
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Copied out of a ring by the dump
+struct trace_event {
+    uint64_t begin_ticks;
+    uint64_t end_ticks;
+    uint64_t stream_id;
+    uint64_t arg;
+    trace_span_kind kind;
+};
+
+// One thread's spans. Written only by its thread; read by the dump.
+class trace_thread_ring {
+public:
+    explicit trace_thread_ring(const std::string& thread_name) : thread_name_(thread_name) {}
+    trace_thread_ring(const trace_thread_ring&) = delete;
+    trace_thread_ring& operator=(const trace_thread_ring&) = delete;
+
+    void record(trace_span_kind kind, uint64_t begin_ticks, uint64_t end_ticks, uint64_t stream_id, uint64_t arg) {
+        uint64_t index = next_event_;
+        // the claim is visible before any of the writes below
+        claimed_events_.store(index + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        stored_event& event = events_[index & TRACE_RING_MASK];
+        event.begin_ticks.store(begin_ticks, std::memory_order_relaxed);
+        event.end_ticks.store(end_ticks, std::memory_order_relaxed);
+        event.kind_and_stream.store((uint64_t)kind << 56 | (stream_id & 0x00FFFFFFFFFFFFFFull), std::memory_order_relaxed);
+        event.arg.store(arg, std::memory_order_relaxed);
+        written_events_.store(index + 1, std::memory_order_release);
+        next_event_ = index + 1;
+    }
+
+    // Append the intact events still in the ring, oldest first
+    template <typename EventContainer>
+    void copy_events(EventContainer& out) const {
+        uint64_t written = written_events_.load(std::memory_order_acquire);
+        uint64_t first = written > TRACE_RING_EVENTS ? written - TRACE_RING_EVENTS : 0;
+        size_t copy_start = out.size();
+        out.resize(copy_start + (size_t)(written - first));
+        for (uint64_t index = first; index < written; ++index) {
+            const stored_event& event = events_[index & TRACE_RING_MASK];
+            uint64_t kind_and_stream = event.kind_and_stream.load(std::memory_order_relaxed);
+            trace_event& copy = out[copy_start + (size_t)(index - first)];
+            copy.begin_ticks = event.begin_ticks.load(std::memory_order_relaxed);
+            copy.end_ticks = event.end_ticks.load(std::memory_order_relaxed);
+            copy.stream_id = kind_and_stream & 0x00FFFFFFFFFFFFFFull;
+            copy.arg = event.arg.load(std::memory_order_relaxed);
+            copy.kind = (trace_span_kind)(kind_and_stream >> 56);
+        }
+        // events claimed meanwhile may have overwritten the oldest copies
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t claimed = claimed_events_.load(std::memory_order_relaxed);
+        uint64_t first_intact = claimed > TRACE_RING_EVENTS ? claimed - TRACE_RING_EVENTS : 0;
+        if (first_intact > first) {
+            size_t torn = (size_t)std::min<uint64_t>(first_intact - first, written - first);
+            out.erase(out.begin() + (ptrdiff_t)copy_start, out.begin() + (ptrdiff_t)(copy_start + torn));
+        }
+    }
+
+    const std::string& thread_name() const { return thread_name_; }
+
+private:
+    struct stored_event {
+        std::atomic<uint64_t> begin_ticks{0};
+        std::atomic<uint64_t> end_ticks{0};
+        std::atomic<uint64_t> kind_and_stream{0};   // kind << 56 | stream id
+        std::atomic<uint64_t> arg{0};
+    };
+
+    const std::string thread_name_;
+    uint64_t next_event_ = 0;                               // thread-private
+    alignas(64) std::atomic<uint64_t> claimed_events_{0};
+    std::atomic<uint64_t> written_events_{0};
+    alignas(64) stored_event events_[TRACE_RING_EVENTS];
+};
+
+// The calling thread's ring, or nullptr if it did not register
+extern thread_local trace_thread_ring* global_this_thread_trace_ring;
+
+// Allocate and register the calling thread's ring. Call once at thread start, before
+// the thread joins the packet path; rings outlive their threads.
+void trace_register_current_thread(const std::string& thread_name);
+
+// Consecutive spans of one loop: the end tick of the last one, where the next begins
+struct trace_span_chain {
+    uint64_t last_end_ticks = 0;   // 0: no predecessor, the next span reads the counter
+
+    // Before the loop waits: the next span must not begin back here
+    void break_chain() { last_end_ticks = 0; }
+};
+
+// Records [construction, destruction) into the thread's ring
+class trace_scoped_span {
+public:
+    trace_scoped_span(trace_span_kind kind, uint64_t stream_id, uint64_t arg)
+        : ring_(global_this_thread_trace_ring), kind_(kind), stream_id_(stream_id), arg_(arg), begin_ticks_(trace_ticks()) {}
+    // Begins where the chain's previous span ended, if it has one
+    trace_scoped_span(trace_span_kind kind, uint64_t stream_id, uint64_t arg, trace_span_chain& chain)
+        : ring_(global_this_thread_trace_ring), chain_(&chain), kind_(kind), stream_id_(stream_id), arg_(arg),
+          begin_ticks_(chain.last_end_ticks != 0 ? chain.last_end_ticks : trace_ticks()) {}
+    ~trace_scoped_span() {
+        if (!ring_) return;
+        uint64_t end_ticks = trace_ticks();
+        ring_->record(kind_, begin_ticks_, end_ticks, stream_id_, arg_);
+        if (chain_) chain_->last_end_ticks = end_ticks;
+    }
+    trace_scoped_span(const trace_scoped_span&) = delete;
+    trace_scoped_span& operator=(const trace_scoped_span&) = delete;
+
+    void set_arg(uint64_t arg) { arg_ = arg; }
+
+private:
+    trace_thread_ring* ring_;
+    trace_span_chain* chain_ = nullptr;
+    trace_span_kind kind_;
+    uint64_t stream_id_;
+    uint64_t arg_;
+    uint64_t begin_ticks_;
+};
+
+// Chrome trace JSON of every registered thread's spans that ended in the last
+// window_us microseconds (0 = everything still in the rings)
+std::string trace_chrome_json(uint64_t window_us);
+
+#if defined(ESP_RECEIVER_TRACING)
+static constexpr bool TRACING_COMPILED_IN = true;
+#define ESP_TRACE_CONCAT_INNER(a, b) a##b
+#define ESP_TRACE_CONCAT(a, b) ESP_TRACE_CONCAT_INNER(a, b)
+// A span for the rest of the enclosing scope
+#define ESP_TRACE_SPAN(kind, stream_id, arg) \
+    trace_scoped_span ESP_TRACE_CONCAT(trace_span_line_, __LINE__)(trace_span_kind::kind, (stream_id), (arg))
+// The same, named so its argument can be filled in once known
+#define ESP_TRACE_NAMED_SPAN(name, kind, stream_id, arg) trace_scoped_span name(trace_span_kind::kind, (stream_id), (arg))
+#define ESP_TRACE_SET_ARG(name, arg) name.set_arg(arg)
+// A chain for the spans of one loop, declared before it
+#define ESP_TRACE_CHAIN(chain) trace_span_chain chain
+// A span in a chain, for the rest of the enclosing scope
+#define ESP_TRACE_CHAINED_SPAN(chain, kind, stream_id, arg) \
+    trace_scoped_span ESP_TRACE_CONCAT(trace_span_line_, __LINE__)(trace_span_kind::kind, (stream_id), (arg), chain)
+#define ESP_TRACE_CHAINED_NAMED_SPAN(chain, name, kind, stream_id, arg) \
+    trace_scoped_span name(trace_span_kind::kind, (stream_id), (arg), chain)
+#define ESP_TRACE_BREAK_CHAIN(chain) chain.break_chain()
+#define ESP_TRACE_THREAD(thread_name) trace_register_current_thread(thread_name)
+#else
+static constexpr bool TRACING_COMPILED_IN = false;
+#define ESP_TRACE_SPAN(kind, stream_id, arg) ((void)0)
+#define ESP_TRACE_NAMED_SPAN(name, kind, stream_id, arg) ((void)0)
+#define ESP_TRACE_SET_ARG(name, arg) ((void)0)
+#define ESP_TRACE_CHAIN(chain) ((void)0)
+#define ESP_TRACE_CHAINED_SPAN(chain, kind, stream_id, arg) ((void)0)
+#define ESP_TRACE_CHAINED_NAMED_SPAN(chain, name, kind, stream_id, arg) ((void)0)
+#define ESP_TRACE_BREAK_CHAIN(chain) ((void)0)
+#define ESP_TRACE_THREAD(thread_name) ((void)0)
+#endif
@@ -0,0 +1,135 @@
+// udp_fec.cpp
+// XOR parity recovery for UDP streams (see udp_fec.h).
+#include "udp_fec.h"
+
+#include <cstring>
+
+// Sequence numbers wrap; a is older than b if it is less than half the space behind
+static bool sequence_is_older(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
+static int count_set_bits(uint32_t mask) {
+    return __builtin_popcount(mask);
+}
+
+bool fec_group_decoder::initialize(size_t max_payload_bytes) {
+    if (block_capacity_ != 0) return false;
+    block_capacity_ = ESP2_FEC_BLOCK_PREFIX_BYTES + max_payload_bytes;
+    accumulator_storage_.assign(block_capacity_ * TRACKED_GROUPS, 0);
+    recovered_packet_.resize(ESP2_WIRE_HEADER_BYTES + ESP2_PAYLOAD_LENGTH_EXTENSION_BYTES + max_payload_bytes);
+    for (size_t group_index = 0; group_index < TRACKED_GROUPS; ++group_index) {
+        groups_[group_index].accumulator = accumulator_storage_.data() + group_index * block_capacity_;
+    }
+    return true;
+}
+
+void fec_group_decoder::retire_group(group_state& group) {
+    if (group.in_use && !group.finished) {
+        unrecoverable_packets_ += (uint64_t)(group.packets_in_group - count_set_bits(group.data_received_mask));
+    }
+    memset(group.accumulator, 0, group.block_bytes); // the rest is still zero
+    group.in_use = false;
+    group.finished = false;
+    group.data_received_mask = 0;
+    group.parity_received = false;
+    group.block_bytes = 0;
+}
+
+fec_group_decoder::group_state* fec_group_decoder::find_or_claim_group(uint32_t first_sequence, uint8_t packets_in_group) {
+    group_state* free_group = nullptr;
+    group_state* oldest_group = nullptr;
+    for (group_state& group : groups_) {
+        if (!group.in_use) {
+            if (!free_group) free_group = &group;
+            continue;
+        }
+        if (group.first_sequence == first_sequence) return group.packets_in_group == packets_in_group ? &group : nullptr;
+        if (!oldest_group || sequence_is_older(group.first_sequence, oldest_group->first_sequence)) oldest_group = &group;
+    }
+    group_state* group = free_group;
+    if (!group) {
+        // a straggler from before every tracked group is too late to help
+        if (sequence_is_older(first_sequence, oldest_group->first_sequence)) return nullptr;
+        retire_group(*oldest_group);
+        group = oldest_group;
+    }
+    group->in_use = true;
+    group->first_sequence = first_sequence;
+    group->packets_in_group = packets_in_group;
+    return group;
+}
+
+const uint8_t* fec_group_decoder::rebuild_missing_packet(group_state& group, size_t* recovered_bytes) {
+    group.finished = true;
+    uint32_t group_mask = (uint32_t)(((uint64_t)1 << group.packets_in_group) - 1u);
+    uint32_t missing_mask = ~group.data_received_mask & group_mask;
+    uint32_t missing_index = (uint32_t)__builtin_ctz(missing_mask);
+
+    // the block prefix describes the lost packet itself: the group may mix formats
+    const uint8_t* block = group.accumulator;
+    uint64_t first_sample_index = esp2_load_le64(block);
+    uint64_t timestamp_us = esp2_load_le64(block + 8);
+    uint16_t frames = esp2_load_le16(block + 16);
+    uint8_t format_id = block[18];
+    uint8_t bytes_per_sample = block[19];
+    uint16_t flags = esp2_load_le16(block + 20);
+    size_t payload_bytes = esp2_load_le32(block + 22);
+
+    esp2_wire_header* rebuilt = reinterpret_cast<esp2_wire_header*>(recovered_packet_.data());
+    rebuilt->set(group.first_sequence + missing_index, first_sample_index, timestamp_us, frames, group.channels,
+                 bytes_per_sample, group.sample_rate, format_id);
+    size_t header_bytes = ESP2_WIRE_HEADER_BYTES;
+    bool length_consistent = payload_bytes == rebuilt->payload_bytes();
+    if (flags & ESP2_FLAG_PAYLOAD_LENGTH) {
+        header_bytes = esp2_append_payload_length(recovered_packet_.data(), (uint32_t)payload_bytes);
+        length_consistent = true;
+    }
+    if (frames == 0 || (flags & ~ESP2_FLAG_PAYLOAD_LENGTH) != 0 || !length_consistent ||
+        ESP2_FEC_BLOCK_PREFIX_BYTES + payload_bytes > group.block_bytes) {
+        ++unrecoverable_packets_; // parity inconsistent with the data it covers
+        return nullptr;
+    }
+    memcpy(recovered_packet_.data() + header_bytes, block + ESP2_FEC_BLOCK_PREFIX_BYTES, payload_bytes);
+    ++recovered_packets_;
+    *recovered_bytes = header_bytes + payload_bytes;
+    return recovered_packet_.data();
+}
+
+const uint8_t* fec_group_decoder::add_packet(const esp2_wire_header& header, const esp2_fec_extension& fec,
+                                             const uint8_t* payload, size_t payload_bytes, size_t* recovered_bytes) {
+    *recovered_bytes = 0;
+    uint8_t packets_in_group = fec.packets_in_group();
+    bool is_parity = (header.flags() & ESP2_FLAG_FEC_PARITY) != 0;
+    if (block_capacity_ == 0 || packets_in_group < 2 || packets_in_group > ESP2_FEC_MAX_GROUP_PACKETS) return nullptr;
+    if (!is_parity && fec.index_in_group() >= packets_in_group) return nullptr;
+    size_t block_bytes = is_parity ? payload_bytes : ESP2_FEC_BLOCK_PREFIX_BYTES + payload_bytes;
+    if (block_bytes > block_capacity_) return nullptr;
+
+    group_state* group = find_or_claim_group(fec.group_first_sequence(), packets_in_group);
+    if (!group || group->finished) return nullptr;
+
+    if (is_parity) {
+        if (group->parity_received) return nullptr;
+        group->parity_received = true;
+        esp2_xor_bytes(group->accumulator, payload, payload_bytes);
+    } else {
+        uint32_t bit = 1u << fec.index_in_group();
+        if (group->data_received_mask & bit) return nullptr;
+        group->data_received_mask |= bit;
+        group->channels = header.channels();
+        group->sample_rate = header.sample_rate();
+        esp2_fec_accumulate(group->accumulator, header, payload, payload_bytes);
+    }
+    if (block_bytes > group->block_bytes) group->block_bytes = block_bytes;
+
+    int data_received = count_set_bits(group->data_received_mask);
+    if (data_received == packets_in_group) {
+        group->finished = true;
+        return nullptr;
+    }
+    if (data_received == packets_in_group - 1 && group->parity_received) {
+        return rebuild_missing_packet(*group, recovered_bytes);
+    }
+    return nullptr;
+}
@@ -0,0 +1,63 @@
+// udp_fec.h
+// Rebuilds lost packets of one UDP stream from its XOR parity packets (FEC layout in
+// include/esp2_wire_header.h). Single-loss-per-group recovery, the common case on
+// Wi-Fi where losses are isolated; a group that lost more is left to the jitter
+// buffer, which records the gap.
+//
+// A few groups are tracked at once, so parity that arrives after packets of the
+// next group still counts. Every received block of a group is XORed into one
+// accumulator; once all but one of a group's packets (parity included) are in, the
+// accumulator is exactly the missing data packet's block.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "esp2_wire_header.h"
+
+class fec_group_decoder {
+public:
+    static constexpr size_t TRACKED_GROUPS = 4;
+
+    // Allocate the accumulators for blocks of up to max_payload_bytes (stream setup only)
+    bool initialize(size_t max_payload_bytes);
+    bool is_initialized() const { return block_capacity_ != 0; }
+
+    // Feed one validated packet that carries an FEC extension. If it completes a group
+    // with one data packet missing, that packet is rebuilt (current-version header, no
+    // FEC extension, followed by its payload; format, length flag and length are the
+    // lost packet's own, from its block) and returned with its size in
+    // *recovered_bytes; otherwise nullptr. The rebuilt packet stays valid until the
+    // next call.
+    const uint8_t* add_packet(const esp2_wire_header& header, const esp2_fec_extension& fec, const uint8_t* payload,
+                              size_t payload_bytes, size_t* recovered_bytes);
+
+    uint64_t recovered_packets() const { return recovered_packets_; }
+    uint64_t unrecoverable_packets() const { return unrecoverable_packets_; } // data packets of groups that lost 2+
+
+private:
+    struct group_state {
+        bool in_use = false;
+        bool finished = false;          // every data packet present or rebuilt
+        uint32_t first_sequence = 0;
+        uint8_t packets_in_group = 0;
+        uint32_t data_received_mask = 0;
+        bool parity_received = false;
+        size_t block_bytes = 0;         // longest block XORed in so far
+        uint8_t channels = 0;           // fixed per stream, from the group's data packets
+        uint32_t sample_rate = 0;
+        uint8_t* accumulator = nullptr; // block_capacity_ bytes, zero beyond block_bytes
+    };
+
+    group_state* find_or_claim_group(uint32_t first_sequence, uint8_t packets_in_group);
+    void retire_group(group_state& group);
+    const uint8_t* rebuild_missing_packet(group_state& group, size_t* recovered_bytes);
+
+    size_t block_capacity_ = 0;
+    std::vector<uint8_t> accumulator_storage_;
+    std::vector<uint8_t> recovered_packet_;
+    group_state groups_[TRACKED_GROUPS];
+    uint64_t recovered_packets_ = 0;
+    uint64_t unrecoverable_packets_ = 0;
+};
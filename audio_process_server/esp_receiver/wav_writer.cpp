@@ -0,0 +1,380 @@
+// wav_writer.cpp
+// Batched pwrite()/io_uring WAV sink (see wav_writer.h).
+#include "wav_writer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+
+#include "trace_spans.h"
+
+#if defined(ESP_RECEIVER_HAVE_LIBURING)
+#include <liburing.h>
+#endif
+
+// page-aligned batches keep the kernel copy on whole pages
+static const size_t WAV_BATCH_BUFFER_ALIGNMENT = 4096;
+// 32-bit RIFF size fields; beyond this the header must be RF64
+static const uint64_t WAV_RIFF_MAX_CHUNK_BYTES = 0xFFFFFFFFull;
+// how many "_rN" suffixes to try when a segment name already exists on disk
+static const int WAV_SEGMENT_NAME_MAX_RETRIES = 1000;
+
+static wav_writer_statistics global_wav_writer_statistics;
+
+const wav_writer_statistics& wav_writer_stats() {
+    return global_wav_writer_statistics;
+}
+
+// ----------------- Header layout -----------------
+
+static void put_u16_le(uint8_t* destination, uint16_t value) {
+    destination[0] = (uint8_t)(value & 0xFF);
+    destination[1] = (uint8_t)((value >> 8) & 0xFF);
+}
+
+static void put_u32_le(uint8_t* destination, uint32_t value) {
+    destination[0] = (uint8_t)(value & 0xFF);
+    destination[1] = (uint8_t)((value >> 8) & 0xFF);
+    destination[2] = (uint8_t)((value >> 16) & 0xFF);
+    destination[3] = (uint8_t)((value >> 24) & 0xFF);
+}
+
+static void put_u64_le(uint8_t* destination, uint64_t value) {
+    put_u32_le(destination, (uint32_t)(value & 0xFFFFFFFFu));
+    put_u32_le(destination + 4, (uint32_t)(value >> 32));
+}
+
+size_t build_wav_header(uint8_t header_out[WAV_MAX_HEADER_BYTES], uint32_t sample_rate, uint16_t channels,
+                        uint16_t bytes_per_sample, uint64_t data_bytes, bool reserve_ds64) {
+    size_t header_bytes = reserve_ds64 ? WAV_RF64_CAPABLE_HEADER_BYTES : WAV_HEADER_BYTES;
+    // riff size = everything after the 8-byte RIFF chunk header
+    uint64_t riff_bytes = (uint64_t)header_bytes - 8 + data_bytes;
+    bool needs_rf64 = reserve_ds64 && riff_bytes > WAV_RIFF_MAX_CHUNK_BYTES;
+
+    // RIFF (or RF64) chunk; 0xFFFFFFFF means "see ds64"
+    memcpy(header_out + 0, needs_rf64 ? "RF64" : "RIFF", 4);
+    put_u32_le(header_out + 4, (uint32_t)std::min(riff_bytes, WAV_RIFF_MAX_CHUNK_BYTES));
+    memcpy(header_out + 8, "WAVE", 4);
+
+    size_t offset = 12;
+    if (reserve_ds64) {
+        // ds64: riff size, data size, sample count, empty chunk table. Written as JUNK
+        // (ignored by readers) until the file actually needs it.
+        memcpy(header_out + offset, needs_rf64 ? "ds64" : "JUNK", 4);
+        put_u32_le(header_out + offset + 4, (uint32_t)(WAV_DS64_CHUNK_BYTES - 8));
+        uint32_t frame_bytes = (uint32_t)channels * bytes_per_sample;
+        put_u64_le(header_out + offset + 8, needs_rf64 ? riff_bytes : 0);
+        put_u64_le(header_out + offset + 16, needs_rf64 ? data_bytes : 0);
+        put_u64_le(header_out + offset + 24, needs_rf64 && frame_bytes ? data_bytes / frame_bytes : 0);
+        put_u32_le(header_out + offset + 32, 0);
+        offset += WAV_DS64_CHUNK_BYTES;
+    }
+
+    // fmt chunk (PCM)
+    uint8_t* fmt_chunk = header_out + offset;
+    memcpy(fmt_chunk + 0, "fmt ", 4);                                    // note the trailing space
+    put_u32_le(fmt_chunk + 4, 16);                                       // fmt chunk size
+    put_u16_le(fmt_chunk + 8, 1);                                        // audio format 1 = PCM
+    put_u16_le(fmt_chunk + 10, channels);                                // number of channels
+    put_u32_le(fmt_chunk + 12, sample_rate);                             // sample rate
+    put_u32_le(fmt_chunk + 16, sample_rate * channels * bytes_per_sample); // byte rate
+    put_u16_le(fmt_chunk + 20, (uint16_t)(channels * bytes_per_sample)); // block align
+    put_u16_le(fmt_chunk + 22, (uint16_t)(bytes_per_sample * 8));        // bits per sample
+    offset += 8 + 16;
+
+    // data chunk header; a plain WAV that outgrew 32 bits is clamped (readers fall back to file size)
+    memcpy(header_out + offset, "data", 4);
+    put_u32_le(header_out + offset + 4, (uint32_t)std::min(data_bytes, WAV_RIFF_MAX_CHUNK_BYTES));
+    return header_bytes;
+}
+
+// ----------------- Write backend -----------------
+
+#if defined(ESP_RECEIVER_HAVE_LIBURING)
+
+// One ring per writer thread; each batch is submitted and reaped synchronously, which
+// still turns a whole batch into a single submission.
+struct writer_thread_io_uring {
+    struct io_uring ring;
+    bool initialized = false;
+    bool failed = false;
+    ~writer_thread_io_uring() {
+        if (initialized) io_uring_queue_exit(&ring);
+    }
+};
+static thread_local writer_thread_io_uring thread_io_uring;
+
+static struct io_uring* writer_thread_ring() {
+    if (!thread_io_uring.initialized && !thread_io_uring.failed) {
+        int rc = io_uring_queue_init(8, &thread_io_uring.ring, 0);
+        if (rc < 0) {
+            std::cerr << "[WAV] io_uring_queue_init failed (" << strerror(-rc) << "), using pwrite\n";
+            thread_io_uring.failed = true;
+        } else {
+            thread_io_uring.initialized = true;
+        }
+    }
+    return thread_io_uring.initialized ? &thread_io_uring.ring : nullptr;
+}
+
+// Returns bytes written or -errno, like pwrite()
+static ssize_t backend_write_at(int file_descriptor, const uint8_t* bytes, size_t byte_count, off_t file_offset) {
+    struct io_uring* ring = writer_thread_ring();
+    if (!ring) {
+        ssize_t written = pwrite(file_descriptor, bytes, byte_count, file_offset);
+        return written < 0 ? -errno : written;
+    }
+    struct io_uring_sqe* submission = io_uring_get_sqe(ring);
+    if (!submission) return -EBUSY;
+    io_uring_prep_write(submission, file_descriptor, bytes, (unsigned)byte_count, (uint64_t)file_offset);
+    int rc = io_uring_submit(ring);
+    if (rc < 0) return rc;
+    struct io_uring_cqe* completion = nullptr;
+    rc = io_uring_wait_cqe(ring, &completion);
+    if (rc < 0) return rc;
+    ssize_t result = completion->res;
+    io_uring_cqe_seen(ring, completion);
+    return result;
+}
+
+const char* wav_writer_backend_name() {
+    return "io_uring";
+}
+
+#else
+
+static ssize_t backend_write_at(int file_descriptor, const uint8_t* bytes, size_t byte_count, off_t file_offset) {
+    ssize_t written = pwrite(file_descriptor, bytes, byte_count, file_offset);
+    return written < 0 ? -errno : written;
+}
+
+const char* wav_writer_backend_name() {
+    return "pwrite";
+}
+
+#endif
+
+// ----------------- batched_wav_sink -----------------
+
+bool batched_wav_sink::open(const std::string& filename, uint32_t sample_rate, uint16_t channels,
+                            uint16_t bytes_per_sample, const wav_writer_policy& policy) {
+    close();
+    filename_ = filename;
+    policy_ = policy;
+    sample_rate_ = sample_rate;
+    channels_ = channels;
+    bytes_per_sample_ = bytes_per_sample;
+
+    // keep batches a whole number of pages (and at least one)
+    batch_capacity_ = (policy.batch_bytes + WAV_BATCH_BUFFER_ALIGNMENT - 1) / WAV_BATCH_BUFFER_ALIGNMENT * WAV_BATCH_BUFFER_ALIGNMENT;
+    if (batch_capacity_ == 0) batch_capacity_ = WAV_BATCH_BUFFER_ALIGNMENT;
+    batch_buffer_ = static_cast<uint8_t*>(std::aligned_alloc(WAV_BATCH_BUFFER_ALIGNMENT, batch_capacity_));
+    if (!batch_buffer_) {
+        std::cerr << "[WAV] could not allocate " << batch_capacity_ << " byte batch buffer\n";
+        return false;
+    }
+
+    file_descriptor_ = ::open(filename.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (file_descriptor_ < 0) {
+        open_errno_ = errno;
+        if (open_errno_ != EEXIST) perror("open");
+        std::free(batch_buffer_);
+        batch_buffer_ = nullptr;
+        return false;
+    }
+
+    open_errno_ = 0;
+    batch_fill_ = 0;
+    data_bytes_ = 0;
+    header_bytes_ = policy.allow_rf64 ? WAV_RF64_CAPABLE_HEADER_BYTES : WAV_HEADER_BYTES;
+    next_file_offset_ = (off_t)header_bytes_;
+    last_durability_sync_time_ = clock::now();
+    if (!patch_header()) {
+        std::cerr << "[WAV] header write failed\n";
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool batched_wav_sink::append(const uint8_t* bytes, size_t byte_count, clock::time_point now) {
+    if (!is_open()) return false;
+    if (batch_fill_ == 0) oldest_buffered_time_ = now;
+    data_bytes_ += byte_count;
+
+    bool ok = true;
+    while (byte_count > 0) {
+        size_t space_left = batch_capacity_ - batch_fill_;
+        size_t chunk_bytes = byte_count < space_left ? byte_count : space_left;
+        memcpy(batch_buffer_ + batch_fill_, bytes, chunk_bytes);
+        batch_fill_ += chunk_bytes;
+        bytes += chunk_bytes;
+        byte_count -= chunk_bytes;
+        if (batch_fill_ == batch_capacity_) {
+            ok = flush() && ok;
+            if (byte_count > 0) oldest_buffered_time_ = now;
+        }
+    }
+    return ok;
+}
+
+void batched_wav_sink::service_timers(clock::time_point now) {
+    if (!is_open()) return;
+    if (batch_fill_ > 0 && now - oldest_buffered_time_ >= std::chrono::milliseconds(policy_.flush_interval_ms)) {
+        flush();
+    }
+    if (policy_.durability_interval_ms > 0 &&
+        now - last_durability_sync_time_ >= std::chrono::milliseconds(policy_.durability_interval_ms)) {
+        // the on-disk file becomes a complete, readable WAV up to this point
+        flush();
+        patch_header();
+        sync_to_disk();
+        last_durability_sync_time_ = now;
+    }
+}
+
+bool batched_wav_sink::flush() {
+    if (!is_open() || batch_fill_ == 0) return true;
+    ESP_TRACE_SPAN(flush, 0, batch_fill_);
+    bool ok = write_all_at(batch_buffer_, batch_fill_, next_file_offset_);
+    // on failure the batch is dropped rather than retried forever; the error is counted
+    next_file_offset_ += (off_t)batch_fill_;
+    batch_fill_ = 0;
+    return ok;
+}
+
+void batched_wav_sink::close() {
+    if (is_open()) {
+        flush();
+        patch_header();
+        sync_to_disk();
+        ::close(file_descriptor_);
+        file_descriptor_ = -1;
+    }
+    std::free(batch_buffer_);
+    batch_buffer_ = nullptr;
+    batch_fill_ = 0;
+}
+
+bool batched_wav_sink::write_all_at(const uint8_t* bytes, size_t byte_count, off_t file_offset) {
+    while (byte_count > 0) {
+        uint64_t write_start_us = host_monotonic_us();
+        ssize_t written = backend_write_at(file_descriptor_, bytes, byte_count, file_offset);
+        global_wav_writer_statistics.write_latency_us.record(host_monotonic_us() - write_start_us);
+        if (written == -EINTR || written == -EAGAIN) continue;
+        if (written <= 0) {
+            global_wav_writer_statistics.write_errors.fetch_add(1, std::memory_order_relaxed);
+            std::cerr << "[WAV] write to " << filename_ << " failed: " << (written < 0 ? strerror((int)-written) : "no progress") << "\n";
+            return false;
+        }
+        global_wav_writer_statistics.write_syscalls.fetch_add(1, std::memory_order_relaxed);
+        global_wav_writer_statistics.bytes_written.fetch_add((uint64_t)written, std::memory_order_relaxed);
+        bytes += written;
+        byte_count -= (size_t)written;
+        file_offset += written;
+    }
+    return true;
+}
+
+// Rewrite the header for the bytes that are actually on disk (buffered audio is not counted)
+bool batched_wav_sink::patch_header() {
+    uint8_t header[WAV_MAX_HEADER_BYTES];
+    uint64_t bytes_on_disk = (uint64_t)next_file_offset_ - header_bytes_;
+    size_t header_bytes = build_wav_header(header, sample_rate_, channels_, bytes_per_sample_, bytes_on_disk,
+                                           policy_.allow_rf64);
+    global_wav_writer_statistics.header_patches.fetch_add(1, std::memory_order_relaxed);
+    return write_all_at(header, header_bytes, 0);
+}
+
+bool batched_wav_sink::sync_to_disk() {
+    ESP_TRACE_SPAN(sync, 0, 0);
+    global_wav_writer_statistics.fdatasync_calls.fetch_add(1, std::memory_order_relaxed);
+    uint64_t sync_start_us = host_monotonic_us();
+    int sync_result = fdatasync(file_descriptor_);
+    global_wav_writer_statistics.fdatasync_latency_us.record(host_monotonic_us() - sync_start_us);
+    if (sync_result != 0) {
+        perror("fdatasync");
+        return false;
+    }
+    return true;
+}
+
+// ----------------- segmented_wav_recorder -----------------
+
+void segmented_wav_recorder::configure(const std::string& path_prefix, uint32_t sample_rate, uint16_t channels,
+                                       uint16_t bytes_per_sample, const wav_writer_policy& writer_policy,
+                                       const wav_segment_policy& segment_policy) {
+    close_segment();
+    path_prefix_ = path_prefix;
+    sample_rate_ = sample_rate;
+    channels_ = channels;
+    bytes_per_sample_ = bytes_per_sample;
+    writer_policy_ = writer_policy;
+    segment_policy_ = segment_policy;
+    if (!writer_policy_.allow_rf64) {
+        // a plain RIFF file must roll over before its 32-bit sizes overflow
+        uint64_t riff_limit = WAV_RIFF_MAX_CHUNK_BYTES - WAV_HEADER_BYTES;
+        if (segment_policy_.max_segment_bytes == 0 || segment_policy_.max_segment_bytes > riff_limit) {
+            segment_policy_.max_segment_bytes = riff_limit;
+        }
+    }
+}
+
+bool segmented_wav_recorder::open_segment(uint64_t first_sample_index) {
+    // zero-padded so segments of one device sort by time
+    char index_text[32];
+    snprintf(index_text, sizeof(index_text), "%012llu", (unsigned long long)first_sample_index);
+    std::string base_name = path_prefix_ + "_" + index_text;
+
+    // never clobber an earlier recording (e.g. a device that restarted its sample counter)
+    for (int attempt = 0; attempt <= WAV_SEGMENT_NAME_MAX_RETRIES; ++attempt) {
+        std::ostringstream filename;
+        filename << base_name;
+        if (attempt > 0) filename << "_r" << attempt;
+        filename << ".wav";
+        if (segment_sink_.open(filename.str(), sample_rate_, channels_, bytes_per_sample_, writer_policy_)) {
+            segment_frames_ = 0;
+            std::cout << "[WAV] opened segment " << filename.str() << "\n";
+            return true;
+        }
+        if (segment_sink_.open_errno() != EEXIST) break;
+    }
+    std::cerr << "[WAV] could not open a segment file for " << base_name << "\n";
+    return false;
+}
+
+bool segmented_wav_recorder::append_packet(uint64_t first_sample_index, const uint8_t* bytes, size_t byte_count,
+                                           size_t frame_count, clock::time_point now) {
+    if (segment_sink_.is_open() && segment_frames_ > 0) {
+        bool duration_reached = segment_policy_.max_segment_frames > 0 &&
+                                segment_frames_ + frame_count > segment_policy_.max_segment_frames;
+        bool size_reached = segment_policy_.max_segment_bytes > 0 &&
+                            segment_sink_.data_bytes() + byte_count > segment_policy_.max_segment_bytes;
+        bool index_discontinuity = first_sample_index != next_sample_index_;
+        if (duration_reached || size_reached || index_discontinuity) close_segment();
+    }
+    if (!segment_sink_.is_open() && !open_segment(first_sample_index)) return false;
+
+    segment_frames_ += frame_count;
+    next_sample_index_ = first_sample_index + frame_count;
+    return segment_sink_.append(bytes, byte_count, now);
+}
+
+void segmented_wav_recorder::close_segment() {
+    if (!segment_sink_.is_open()) return;
+    std::string closed_filename = segment_sink_.filename();
+    uint64_t closed_bytes = segment_sink_.data_bytes();
+    segment_sink_.close();
+    ++segments_closed_;
+    global_wav_writer_statistics.segments_closed.fetch_add(1, std::memory_order_relaxed);
+    std::cout << "[WAV] finalized segment " << closed_filename << " (" << segment_frames_ << " frames, "
+              << closed_bytes << " bytes)\n";
+    segment_frames_ = 0;
+}
@@ -0,0 +1,176 @@
+// wav_writer.h
+// Batched WAV sink used by the writer stage.
+//
+// Converted audio is appended into a large page-aligned buffer and written with
+// pwrite() (or io_uring when built with ESP_RECEIVER_HAVE_LIBURING) only when the
+// buffer fills or the flush interval expires, instead of fwrite+fflush per packet.
+// A durability interval bounds how much audio a crash can lose: every N ms the
+// buffer is flushed, the RIFF/data sizes are patched to the current length and
+// the file is fdatasync()ed, so the file on disk is always a readable WAV.
+//
+// Files are written as plain RIFF/WAVE with a 28-byte JUNK chunk reserved after the
+// RIFF header. If a file grows past the 4 GiB RIFF limit, the header is rewritten
+// as RF64/BW64: RIFF becomes RF64 and JUNK becomes the ds64 chunk with 64-bit sizes.
+// Files under 4 GiB stay ordinary WAVs that any reader accepts.
+//
+// segmented_wav_recorder rolls a stream over to a new file by duration or size,
+// naming each segment <prefix>_<device>_<first_sample_index>.wav. It finalizes
+// each segment's header as soon as the segment closes. A sample index that does not
+// continue the current segment also starts a new one, so a frame's position in a
+// segment is always sample_index - <first_sample_index>.
+//
+// Sinks and recorders are owned by exactly one thread (the writer stage); only the
+// statistics are shared.
+#pragma once
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "stream_timing.h"
+
+struct wav_writer_policy {
+    size_t batch_bytes = 256 * 1024;       // flush once this much audio is buffered
+    uint32_t flush_interval_ms = 1000;     // ...or once the oldest buffered byte is this old
+    uint32_t durability_interval_ms = 5000; // header patch + fdatasync period; 0 = only at close
+    bool allow_rf64 = true;                // reserve a ds64 chunk so files may exceed 4 GiB
+};
+
+struct wav_segment_policy {
+    uint64_t max_segment_frames = 0;       // roll after this many frames (0 = no duration limit)
+    uint64_t max_segment_bytes = 0;        // roll after this many audio bytes (0 = no size limit)
+};
+
+// Process-wide writer counters (all sinks, all writer threads)
+struct wav_writer_statistics {
+    std::atomic<uint64_t> write_syscalls{0};
+    std::atomic<uint64_t> bytes_written{0};
+    std::atomic<uint64_t> header_patches{0};
+    std::atomic<uint64_t> fdatasync_calls{0};
+    std::atomic<uint64_t> write_errors{0};
+    std::atomic<uint64_t> segments_closed{0};
+    latency_histogram write_latency_us;      // per write syscall (pwrite, or io_uring submit+wait)
+    latency_histogram fdatasync_latency_us;
+};
+const wav_writer_statistics& wav_writer_stats();
+const char* wav_writer_backend_name();
+
+// Canonical PCM header (RIFF + fmt + data) and the RF64-capable variant with the
+// 36-byte JUNK/ds64 reservation between RIFF and fmt
+static constexpr size_t WAV_HEADER_BYTES = 44;
+static constexpr size_t WAV_DS64_CHUNK_BYTES = 8 + 28;
+static constexpr size_t WAV_RF64_CAPABLE_HEADER_BYTES = WAV_HEADER_BYTES + WAV_DS64_CHUNK_BYTES;
+static constexpr size_t WAV_MAX_HEADER_BYTES = WAV_RF64_CAPABLE_HEADER_BYTES;
+
+// Build the header for data_bytes of PCM audio; returns its size. With reserve_ds64 the
+// JUNK chunk is emitted, and promoted to RF64/ds64 once the sizes no longer fit in 32 bits.
+size_t build_wav_header(uint8_t header_out[WAV_MAX_HEADER_BYTES], uint32_t sample_rate, uint16_t channels,
+                        uint16_t bytes_per_sample, uint64_t data_bytes, bool reserve_ds64);
+
+class batched_wav_sink {
+public:
+    using clock = std::chrono::steady_clock;
+
+    batched_wav_sink() = default;
+    ~batched_wav_sink() { close(); }
+
+    batched_wav_sink(const batched_wav_sink&) = delete;
+    batched_wav_sink& operator=(const batched_wav_sink&) = delete;
+
+    // Create the file (never overwrites an existing one) and write the placeholder header.
+    // On failure open_errno() tells EEXIST apart from real errors.
+    bool open(const std::string& filename, uint32_t sample_rate, uint16_t channels, uint16_t bytes_per_sample,
+              const wav_writer_policy& policy);
+    int open_errno() const { return open_errno_; }
+
+    // Buffer audio bytes; flushes when the batch is full
+    bool append(const uint8_t* bytes, size_t byte_count, clock::time_point now);
+
+    // Time-driven part of the policy; call periodically even when no audio arrives
+    void service_timers(clock::time_point now);
+
+    // Write out everything buffered so far
+    bool flush();
+
+    // Flush, patch the final header, fdatasync and close. Safe to call twice.
+    void close();
+
+    bool is_open() const { return file_descriptor_ >= 0; }
+    uint64_t data_bytes() const { return data_bytes_; }
+    const std::string& filename() const { return filename_; }
+
+private:
+    bool write_all_at(const uint8_t* bytes, size_t byte_count, off_t file_offset);
+    bool patch_header();
+    bool sync_to_disk();
+
+    int file_descriptor_ = -1;
+    int open_errno_ = 0;
+    std::string filename_;
+    wav_writer_policy policy_;
+    uint32_t sample_rate_ = 0;
+    uint16_t channels_ = 0;
+    uint16_t bytes_per_sample_ = 0;
+    size_t header_bytes_ = WAV_HEADER_BYTES;
+
+    uint8_t* batch_buffer_ = nullptr;
+    size_t batch_capacity_ = 0;
+    size_t batch_fill_ = 0;
+    off_t next_file_offset_ = 0;   // where the batch buffer goes on disk
+    uint64_t data_bytes_ = 0;      // audio bytes appended (buffered + on disk)
+
+    clock::time_point oldest_buffered_time_;
+    clock::time_point last_durability_sync_time_;
+};
+
+// A stream's recording as a series of WAV segments (see top of file)
+class segmented_wav_recorder {
+public:
+    using clock = batched_wav_sink::clock;
+
+    segmented_wav_recorder() = default;
+    ~segmented_wav_recorder() { close(); }
+
+    segmented_wav_recorder(const segmented_wav_recorder&) = delete;
+    segmented_wav_recorder& operator=(const segmented_wav_recorder&) = delete;
+
+    // path_prefix already includes the device part, e.g. "received_audio_esp32_10.0.0.7"
+    void configure(const std::string& path_prefix, uint32_t sample_rate, uint16_t channels, uint16_t bytes_per_sample,
+                   const wav_writer_policy& writer_policy, const wav_segment_policy& segment_policy);
+
+    // Append one packet's converted audio. A new segment (named after first_sample_index)
+    // is started first if none is open, if the index does not continue the current one,
+    // or if the packet would push it past its duration/size limit; packets are never
+    // split across segments.
+    bool append_packet(uint64_t first_sample_index, const uint8_t* bytes, size_t byte_count, size_t frame_count,
+                       clock::time_point now);
+
+    void service_timers(clock::time_point now) { segment_sink_.service_timers(now); }
+
+    // Finalize the current segment (header patched, fdatasync'ed). The next packet opens a new one.
+    void close_segment();
+    void close() { close_segment(); }
+
+    bool is_open() const { return segment_sink_.is_open(); }
+    const std::string& current_segment_filename() const { return segment_sink_.filename(); }
+    uint64_t segments_closed() const { return segments_closed_; }
+
+private:
+    bool open_segment(uint64_t first_sample_index);
+
+    std::string path_prefix_;
+    uint32_t sample_rate_ = 0;
+    uint16_t channels_ = 0;
+    uint16_t bytes_per_sample_ = 0;
+    wav_writer_policy writer_policy_;
+    wav_segment_policy segment_policy_;
+
+    batched_wav_sink segment_sink_;
+    uint64_t segment_frames_ = 0;
+    uint64_t next_sample_index_ = 0;   // index that continues the open segment
+    uint64_t segments_closed_ = 0;
+};
@@ -0,0 +1,803 @@
+// esp_load_generator.cpp
+// Synthetic ESP2 streamers for stressing esp_receiver_combined without hardware.
+//
+// Each simulated device opens its own TCP connection and sends exactly what
+// sendPacketTCP() on the ESP sends: the ESP2 header (include/esp2_wire_header.h)
+// followed by frames x int32 left-aligned 24-bit samples (a per-device sine). With
+// --udp each packet is one datagram instead, optionally with the firmware's XOR parity
+// packet after every --fec-group packets (--loss then drops datagrams after the parity
+// has covered them, as the network would). --format sends a coded payload
+// (include/esp2_payload_codec.h) the way the firmware's encoder does. Devices are
+// spread over worker threads and paced in real time by default; options add send
+// jitter, packet loss (sample-index gaps, as after an I2S overrun), per-device clock
+// drift, random reconnects and reconnect storms. --activity makes the tone come and
+// go in bursts over a quiet noise floor, like a mostly idle site. --session opens every
+// connection with the session hello, so reconnects resume the receiver's stream; the
+// generator keeps nothing to replay, so what was in flight at a reconnect is lost.
+//
+// At the end it reports what was sent, how late sends ran against their schedule
+// (a full socket buffer shows up here first), its own CPU use and, given the
+// receiver's pid and web port, the receiver's CPU%, the implied streams per core,
+// and the receiver's drop counters and tail latency scraped from /metrics.
+//
+//   esp_load_generator --devices 64 --duration 30 --receiver-pid $(pidof esp_receiver_combined)
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "esp2_payload_codec.h"
+#include "esp2_wire_header.h"
+#include "stream_timing.h"
+
+// ----------------- Wire format (include/esp2_wire_header.h) -----------------
+
+static const uint8_t BYTES_PER_SAMPLE = 4;
+static const uint8_t MAX_CHANNELS = 8;  // above the receiver's 2, to exercise its format rejection
+static const double ACTIVITY_BURST_SECONDS = 1.0;   // --activity burst length
+static const int ACTIVITY_NOISE_SHIFT_BITS = 10;    // noise between bursts: uniform, ~-65 dBFS RMS
+static const int SESSION_WELCOME_TIMEOUT_MS = 2000;
+
+static void put_le(uint8_t* destination, uint64_t value, int byte_count) {
+    esp2_store_le(destination, value, (size_t)byte_count);
+}
+
+// Writes the current header; a legacy header is its first 34 bytes with version 0
+static size_t build_esp2_header(uint8_t* header, bool legacy_header, uint32_t sequence, uint64_t first_sample_index,
+                                uint64_t timestamp_us, uint16_t frames, uint8_t channels, uint32_t sample_rate,
+                                uint8_t format_id) {
+    esp2_wire_header* wire = reinterpret_cast<esp2_wire_header*>(header);
+    wire->set(sequence, first_sample_index, timestamp_us, frames, channels, esp2_format_bytes_per_sample(format_id),
+              sample_rate, format_id);
+    if (!legacy_header) return ESP2_WIRE_HEADER_BYTES;
+    wire->header_version_byte = ESP2_WIRE_HEADER_VERSION_LEGACY;
+    return ESP2_WIRE_LEGACY_HEADER_BYTES;
+}
+
+// Writes a current header followed by an FEC extension; is_parity marks the group's parity packet
+static size_t build_esp2_fec_header(uint8_t* header, uint32_t sequence, uint64_t first_sample_index, uint64_t timestamp_us,
+                                    uint16_t frames, uint8_t channels, uint8_t bytes_per_sample, uint32_t sample_rate,
+                                    uint8_t format_id, uint32_t group_first_sequence, uint8_t group_packets,
+                                    uint8_t index_in_group, bool is_parity) {
+    esp2_wire_header* wire = reinterpret_cast<esp2_wire_header*>(header);
+    uint16_t flags = is_parity ? (ESP2_FLAG_FEC | ESP2_FLAG_FEC_PARITY) : ESP2_FLAG_FEC;
+    wire->set(sequence, first_sample_index, timestamp_us, frames, channels, bytes_per_sample, sample_rate, format_id, flags);
+    esp2_store_le(wire->header_bytes_bytes, ESP2_WIRE_FEC_HEADER_BYTES, 2);
+    reinterpret_cast<esp2_fec_extension*>(header + ESP2_WIRE_HEADER_BYTES)->set(group_first_sequence, group_packets, index_in_group);
+    return ESP2_WIRE_FEC_HEADER_BYTES;
+}
+
+// ----------------- Options -----------------
+
+struct load_generator_options {
+    std::string host = "127.0.0.1";
+    uint16_t port = 7000;             // receiver TCP_LISTEN_PORT
+    uint16_t metrics_port = 8080;     // receiver WEB_HTTP_PORT (0 = don't scrape)
+    int devices = 8;
+    int threads = 0;                  // 0 = min(devices, hardware threads)
+    uint16_t frames_per_packet = 1024; // firmware FRAMES_PER_PACKET
+    uint8_t channels = 1;             // interleaved; channel 0 carries the tone, the others its inverse
+    uint32_t sample_rate = 48000;
+    double duration_seconds = 10.0;
+    double jitter_ms = 0.0;           // each send is delayed by up to this much (exponential, capped)
+    double loss_fraction = 0.0;       // packets skipped (sample index and sequence still advance)
+    double drift_ppm = 0.0;           // each device's sample clock is off by a random +-drift_ppm
+    double reconnect_mean_seconds = 0.0; // mean time between random reconnects per device (0 = never)
+    double storm_interval_seconds = 0.0; // every device reconnects at once this often (0 = never)
+    bool unpaced = false;             // send as fast as the sockets accept (throughput mode)
+    bool legacy_header = false;       // send the pre-versioning 34-byte header
+    bool udp = false;                 // one datagram per packet to the receiver's UDP port
+    int fec_group_packets = 0;        // XOR parity after every N datagrams (0 = no FEC)
+    uint8_t format_id = ESP2_FORMAT_INT32_LEFT24; // payload format (--format)
+    double activity_fraction = 1.0;   // share of time the tone sounds, in ACTIVITY_BURST_SECONDS bursts
+    int receiver_pid = 0;             // sample this process's CPU time (0 = don't)
+    bool session = false;             // TCP session handshake, reconnects resume
+};
+
+static void print_usage(const char* program) {
+    std::cout << "usage: " << program << " [options]\n"
+              << "  --host ADDR              receiver address (127.0.0.1)\n"
+              << "  --port N                 receiver ESP2 TCP port (7000)\n"
+              << "  --metrics-port N         receiver web port for /metrics, 0 = off (8080)\n"
+              << "  --devices N              simulated ESP32 streamers (8)\n"
+              << "  --threads N              sender threads (min(devices, cores))\n"
+              << "  --frames N               frames per packet (1024)\n"
+              << "  --channels N             channels per frame, 1.." << int(MAX_CHANNELS) << " (1)\n"
+              << "  --rate HZ                sample rate (48000)\n"
+              << "  --duration S             run time in seconds (10)\n"
+              << "  --jitter-ms MS           random send delay, exponential, capped at 4x (0)\n"
+              << "  --loss FRACTION          fraction of packets skipped, leaving gaps (0)\n"
+              << "  --drift-ppm PPM          per-device sample clock error, uniform +-PPM (0)\n"
+              << "  --reconnect-mean S       mean seconds between random reconnects per device (0 = off)\n"
+              << "  --storm-interval S       all devices reconnect together every S seconds (0 = off)\n"
+              << "  --unpaced                ignore real time, send as fast as possible\n"
+              << "  --legacy-header          send the 34-byte version-0 header of older firmware\n"
+              << "  --udp                    send one datagram per packet to the UDP port (same number)\n"
+              << "  --fec-group N            with --udp, a parity packet after every N packets (0 = off)\n"
+              << "  --format NAME            payload: int32, packed24, rice (lossless), adpcm, int16 (int32)\n"
+              << "  --activity FRACTION      tone only this share of the time, in 1 s bursts over quiet noise (1)\n"
+              << "  --session                open each TCP connection with the session hello (reconnects resume)\n"
+              << "  --receiver-pid PID       measure the receiver's CPU use\n";
+}
+
+static bool parse_format_name(const std::string& name, uint8_t& format_id) {
+    if (name == "int32") format_id = ESP2_FORMAT_INT32_LEFT24;
+    else if (name == "packed24") format_id = ESP2_FORMAT_PACKED24;
+    else if (name == "rice") format_id = ESP2_FORMAT_RICE24;
+    else if (name == "adpcm") format_id = ESP2_FORMAT_IMA_ADPCM;
+    else if (name == "int16") format_id = ESP2_FORMAT_INT16;
+    else return false;
+    return true;
+}
+
+static const char* format_name(uint8_t format_id) {
+    switch (format_id) {
+    case ESP2_FORMAT_PACKED24: return "packed24";
+    case ESP2_FORMAT_RICE24: return "rice";
+    case ESP2_FORMAT_IMA_ADPCM: return "adpcm";
+    case ESP2_FORMAT_INT16: return "int16";
+    default: return "int32";
+    }
+}
+
+static bool parse_options(int argc, char** argv, load_generator_options& options) {
+    enum option_id { host = 1, port, metrics_port, devices, threads, frames, channels, rate, duration, jitter, loss, drift,
+                     reconnect, storm, unpaced, legacy_header, udp, fec_group, format, activity, receiver_pid, session, help };
+    static const struct option long_options[] = {
+        {"host", required_argument, nullptr, host},
+        {"port", required_argument, nullptr, port},
+        {"metrics-port", required_argument, nullptr, metrics_port},
+        {"devices", required_argument, nullptr, devices},
+        {"threads", required_argument, nullptr, threads},
+        {"frames", required_argument, nullptr, frames},
+        {"channels", required_argument, nullptr, channels},
+        {"rate", required_argument, nullptr, rate},
+        {"duration", required_argument, nullptr, duration},
+        {"jitter-ms", required_argument, nullptr, jitter},
+        {"loss", required_argument, nullptr, loss},
+        {"drift-ppm", required_argument, nullptr, drift},
+        {"reconnect-mean", required_argument, nullptr, reconnect},
+        {"storm-interval", required_argument, nullptr, storm},
+        {"unpaced", no_argument, nullptr, unpaced},
+        {"legacy-header", no_argument, nullptr, legacy_header},
+        {"udp", no_argument, nullptr, udp},
+        {"fec-group", required_argument, nullptr, fec_group},
+        {"format", required_argument, nullptr, format},
+        {"activity", required_argument, nullptr, activity},
+        {"receiver-pid", required_argument, nullptr, receiver_pid},
+        {"session", no_argument, nullptr, session},
+        {"help", no_argument, nullptr, help},
+        {nullptr, 0, nullptr, 0},
+    };
+    int option;
+    while ((option = getopt_long(argc, argv, "", long_options, nullptr)) != -1) {
+        switch (option) {
+        case host: options.host = optarg; break;
+        case port: options.port = (uint16_t)std::atoi(optarg); break;
+        case metrics_port: options.metrics_port = (uint16_t)std::atoi(optarg); break;
+        case devices: options.devices = std::atoi(optarg); break;
+        case threads: options.threads = std::atoi(optarg); break;
+        case frames: options.frames_per_packet = (uint16_t)std::atoi(optarg); break;
+        case channels: options.channels = (uint8_t)std::atoi(optarg); break;
+        case rate: options.sample_rate = (uint32_t)std::atoi(optarg); break;
+        case duration: options.duration_seconds = std::atof(optarg); break;
+        case jitter: options.jitter_ms = std::atof(optarg); break;
+        case loss: options.loss_fraction = std::atof(optarg); break;
+        case drift: options.drift_ppm = std::atof(optarg); break;
+        case reconnect: options.reconnect_mean_seconds = std::atof(optarg); break;
+        case storm: options.storm_interval_seconds = std::atof(optarg); break;
+        case unpaced: options.unpaced = true; break;
+        case legacy_header: options.legacy_header = true; break;
+        case udp: options.udp = true; break;
+        case fec_group: options.fec_group_packets = std::atoi(optarg); break;
+        case format:
+            if (!parse_format_name(optarg, options.format_id)) {
+                std::cerr << "[LOAD] unknown format " << optarg << "\n";
+                return false;
+            }
+            break;
+        case activity: options.activity_fraction = std::atof(optarg); break;
+        case receiver_pid: options.receiver_pid = std::atoi(optarg); break;
+        case session: options.session = true; break;
+        default: print_usage(argv[0]); return false;
+        }
+    }
+    if (options.devices <= 0 || options.frames_per_packet == 0 || options.sample_rate == 0 || options.duration_seconds <= 0.0) {
+        std::cerr << "[LOAD] devices, frames, rate and duration must be positive\n";
+        return false;
+    }
+    if (options.activity_fraction <= 0.0 || options.activity_fraction > 1.0) {
+        std::cerr << "[LOAD] --activity must be in (0, 1]\n";
+        return false;
+    }
+    if (options.channels == 0 || options.channels > MAX_CHANNELS) {
+        std::cerr << "[LOAD] --channels must be 1.." << int(MAX_CHANNELS) << "\n";
+        return false;
+    }
+    if (options.fec_group_packets != 0 &&
+        (!options.udp || options.legacy_header || options.fec_group_packets < 2 || options.fec_group_packets > ESP2_FEC_MAX_GROUP_PACKETS)) {
+        std::cerr << "[LOAD] --fec-group needs --udp, the current header and 2.." << int(ESP2_FEC_MAX_GROUP_PACKETS) << " packets\n";
+        return false;
+    }
+    if (options.legacy_header && (options.format_id != ESP2_FORMAT_INT32_LEFT24 || options.channels != 1)) {
+        std::cerr << "[LOAD] --legacy-header only carries the mono int32 format\n";
+        return false;
+    }
+    if (options.session && (options.udp || options.legacy_header)) {
+        std::cerr << "[LOAD] --session needs TCP and the current header\n";
+        return false;
+    }
+    if (options.threads <= 0) {
+        options.threads = std::min(options.devices, (int)std::max(1u, std::thread::hardware_concurrency()));
+    }
+    options.threads = std::min(options.threads, options.devices);
+    return true;
+}
+
+// ----------------- Simulated devices -----------------
+
+using load_clock = std::chrono::steady_clock;
+
+struct simulated_device {
+    int device_index = 0;
+    int socket_fd = -1;
+    uint32_t sequence = 1;
+    uint64_t next_sample_index = 0;
+    double sample_rate_actual = 48000.0;   // nominal rate with this device's drift applied
+    uint64_t device_clock_origin_us = 0;   // esp_timer value at the start of the run
+    load_clock::time_point next_capture_time; // when the next packet's first sample is "captured"
+    load_clock::time_point next_send_time;    // ...plus this packet's jitter
+    load_clock::time_point next_reconnect_time = load_clock::time_point::max();
+    uint64_t storm_generation = 0;         // last storm this device took part in
+    uint64_t session_device_id = 0;        // --session
+    uint32_t session_id = 0;
+    std::vector<int32_t> tone_table;       // one period of this device's test tone
+    size_t tone_phase = 0;
+    uint64_t activity_cycle_frames = 0;    // --activity: one burst per cycle, 0 = always on
+    uint64_t activity_offset_frames = 0;   // where in the cycle this device's bursts start
+    uint32_t noise_state = 1;              // between bursts: xorshift noise at ACTIVITY_NOISE_LEVEL
+    std::vector<int32_t> samples;          // one packet of int32-left24 words, before coding
+    std::vector<uint8_t> coded_payload;    // Rice output, copied behind the header once its length is known
+    esp2_ima_adpcm_state adpcm_state[MAX_CHANNELS]; // per channel, carried across packets
+    std::vector<uint8_t> packet;           // header + payload, rebuilt per send
+    size_t packet_bytes = 0;
+    uint32_t fec_group_first_sequence = 0;
+    int fec_packets_in_group = 0;          // data packets of the open group so far
+    size_t fec_block_bytes = 0;            // longest block of the open group
+    std::vector<uint8_t> fec_parity_packet; // parity header + the group's XORed blocks
+};
+
+struct sender_statistics {
+    uint64_t packets_sent = 0;
+    uint64_t packets_lost = 0;     // skipped on purpose (--loss)
+    uint64_t parity_packets_sent = 0;
+    uint64_t payload_bytes_sent = 0;  // data packets only, for the compression ratio
+    uint64_t bytes_sent = 0;
+    uint64_t reconnects = 0;
+    uint64_t sessions_resumed = 0;
+    uint64_t connect_failures = 0;
+    uint64_t send_failures = 0;
+};
+
+static std::atomic<bool> global_load_should_run{true};
+
+// A connected TCP socket, or with --udp a UDP socket connected to the receiver (a new
+// source port, so the receiver sees a new stream)
+static int connect_to_receiver(const load_generator_options& options) {
+    int fd = socket(AF_INET, (options.udp ? SOCK_DGRAM : SOCK_STREAM) | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    int one = 1;
+    if (!options.udp) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // like WiFiClient: one write per packet part
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(options.port);
+    if (inet_pton(AF_INET, options.host.c_str(), &address.sin_addr) != 1) {
+        std::cerr << "[LOAD] bad host address " << options.host << "\n";
+        close(fd);
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool send_all(int fd, const uint8_t* bytes, size_t byte_count) {
+    while (byte_count > 0) {
+        ssize_t sent = send(fd, bytes, byte_count, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        bytes += sent;
+        byte_count -= (size_t)sent;
+    }
+    return true;
+}
+
+// Send the hello and wait for the welcome. False if the receiver did not accept the session.
+static bool open_device_session(simulated_device& device, const load_generator_options& options, bool& resumed) {
+    esp2_session_hello hello;
+    hello.set(device.session_device_id, device.session_id, options.sample_rate, options.channels,
+              esp2_session_format_bit(options.format_id), options.format_id, device.next_sample_index, device.next_sample_index);
+    if (!send_all(device.socket_fd, reinterpret_cast<const uint8_t*>(&hello), sizeof(hello))) return false;
+
+    struct timeval timeout = {SESSION_WELCOME_TIMEOUT_MS / 1000, 0};
+    setsockopt(device.socket_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    esp2_session_welcome welcome;
+    size_t received_bytes = 0;
+    while (received_bytes < sizeof(welcome)) {
+        ssize_t r = recv(device.socket_fd, reinterpret_cast<uint8_t*>(&welcome) + received_bytes, sizeof(welcome) - received_bytes, 0);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return false;
+        received_bytes += (size_t)r;
+    }
+    if (welcome.magic() != ESP2_SESSION_WELCOME_MAGIC || welcome.result() == ESP2_SESSION_REJECTED ||
+        welcome.format() != options.format_id) {
+        std::cerr << "[LOAD] device " << device.device_index << " session refused (result " << int(welcome.result()) << ")\n";
+        return false;
+    }
+    resumed = welcome.result() == ESP2_SESSION_RESUMED;
+    return true;
+}
+
+// The receiver's acks are only read to keep its send queue empty
+static void discard_session_acks(int socket_fd) {
+    uint8_t acks[16 * sizeof(esp2_session_ack)];
+    while (recv(socket_fd, acks, sizeof(acks), MSG_DONTWAIT) > 0) {
+    }
+}
+
+static void initialize_device(simulated_device& device, int device_index, const load_generator_options& options, std::mt19937_64& rng) {
+    device.device_index = device_index;
+    device.session_device_id = rng() | 1;
+    device.session_id = (uint32_t)rng();
+    std::uniform_real_distribution<double> drift(-options.drift_ppm, options.drift_ppm);
+    device.sample_rate_actual = options.sample_rate * (1.0 + drift(rng) * 1e-6);
+    device.device_clock_origin_us = 1000000ull + (rng() % 60000000ull); // ESPs booted at different times
+
+    // a distinct tone per device (200 Hz .. ~5 kHz, whole samples per period), -12 dBFS
+    size_t period_samples = options.sample_rate / (200 + 37 * (uint32_t)(device_index % 128));
+    if (period_samples < 2) period_samples = 2;
+    device.tone_table.resize(period_samples);
+    for (size_t i = 0; i < period_samples; ++i) {
+        double value = 0.25 * std::sin(2.0 * M_PI * (double)i / (double)period_samples);
+        device.tone_table[i] = (int32_t)std::lround(value * 8388607.0) * 256; // left-aligned 24-bit
+    }
+    if (options.activity_fraction < 1.0) {
+        device.activity_cycle_frames = (uint64_t)(ACTIVITY_BURST_SECONDS / options.activity_fraction * options.sample_rate);
+        device.activity_offset_frames = rng() % device.activity_cycle_frames;
+        device.noise_state = (uint32_t)rng() | 1u;
+    }
+    size_t sample_count = (size_t)options.frames_per_packet * options.channels;
+    size_t max_payload_bytes = sample_count * BYTES_PER_SAMPLE; // int32 is the largest format
+    device.samples.resize(sample_count);
+    device.coded_payload.resize(sample_count * 3);
+    device.packet.resize(ESP2_WIRE_HEADER_MAX_BYTES + max_payload_bytes);
+    if (options.fec_group_packets > 0) device.fec_parity_packet.assign(ESP2_WIRE_FEC_HEADER_BYTES + ESP2_FEC_BLOCK_PREFIX_BYTES + max_payload_bytes, 0);
+}
+
+static void schedule_random_reconnect(simulated_device& device, const load_generator_options& options, std::mt19937_64& rng,
+                                      load_clock::time_point now) {
+    if (options.reconnect_mean_seconds <= 0.0) return;
+    std::exponential_distribution<double> interval(1.0 / options.reconnect_mean_seconds);
+    device.next_reconnect_time = now + std::chrono::microseconds((int64_t)(interval(rng) * 1e6));
+}
+
+// Fill in this packet's header and coded samples (and fold it into the open FEC group)
+static void build_device_packet(simulated_device& device, const load_generator_options& options, uint64_t capture_time_us) {
+    uint16_t frames = options.frames_per_packet;
+    const uint8_t channels = options.channels;
+    for (uint16_t frame = 0; frame < frames; ++frame) {
+        int32_t tone_sample = device.tone_table[device.tone_phase];
+        if (device.activity_cycle_frames != 0 &&
+            (device.next_sample_index + frame + device.activity_offset_frames) % device.activity_cycle_frames >=
+                (uint64_t)(ACTIVITY_BURST_SECONDS * options.sample_rate)) {
+            device.noise_state ^= device.noise_state << 13;
+            device.noise_state ^= device.noise_state >> 17;
+            device.noise_state ^= device.noise_state << 5;
+            tone_sample = (int32_t)((uint32_t)((int32_t)device.noise_state >> ACTIVITY_NOISE_SHIFT_BITS) & 0xFFFFFF00u);
+        }
+        device.samples[(size_t)frame * channels] = tone_sample;
+        for (uint8_t channel = 1; channel < channels; ++channel) device.samples[(size_t)frame * channels + channel] = -tone_sample;
+        if (++device.tone_phase == device.tone_table.size()) device.tone_phase = 0;
+    }
+    // like the firmware: a Rice packet that would not beat packed 24-bit goes out as packed 24-bit
+    uint8_t format_id = options.format_id;
+    size_t coded_bytes = 0;
+    if (format_id == ESP2_FORMAT_RICE24) {
+        coded_bytes = esp2_rice24_encode(device.samples.data(), frames, channels, device.coded_payload.data(), device.coded_payload.size());
+        if (coded_bytes == 0) format_id = ESP2_FORMAT_PACKED24;
+    }
+
+    uint8_t* packet = device.packet.data();
+    size_t header_bytes;
+    if (options.fec_group_packets > 0) {
+        if (device.fec_packets_in_group == 0) device.fec_group_first_sequence = device.sequence;
+        header_bytes = build_esp2_fec_header(packet, device.sequence, device.next_sample_index, capture_time_us, frames,
+                                             channels, esp2_format_bytes_per_sample(format_id), options.sample_rate, format_id,
+                                             device.fec_group_first_sequence, (uint8_t)options.fec_group_packets,
+                                             (uint8_t)device.fec_packets_in_group, false);
+    } else {
+        header_bytes = build_esp2_header(packet, options.legacy_header, device.sequence, device.next_sample_index,
+                                         capture_time_us, frames, channels, options.sample_rate, format_id);
+    }
+    if (format_id == ESP2_FORMAT_RICE24) header_bytes = esp2_append_payload_length(packet, (uint32_t)coded_bytes);
+
+    uint8_t* payload = packet + header_bytes; // a legacy header's unused tail is overwritten here
+    size_t payload_bytes = 0;
+    switch (format_id) {
+    case ESP2_FORMAT_PACKED24:
+        payload_bytes = esp2_packed24_encode(device.samples.data(), device.samples.size(), payload);
+        break;
+    case ESP2_FORMAT_RICE24:
+        memcpy(payload, device.coded_payload.data(), coded_bytes);
+        payload_bytes = coded_bytes;
+        break;
+    case ESP2_FORMAT_IMA_ADPCM:
+        payload_bytes = esp2_ima_adpcm_encode(device.samples.data(), frames, channels, device.adpcm_state, payload);
+        break;
+    case ESP2_FORMAT_INT16:
+        payload_bytes = esp2_int16_encode(device.samples.data(), device.samples.size(), payload);
+        break;
+    default:
+        for (size_t i = 0; i < device.samples.size(); ++i) put_le(payload + i * BYTES_PER_SAMPLE, (uint32_t)device.samples[i], 4);
+        payload_bytes = device.samples.size() * BYTES_PER_SAMPLE;
+        break;
+    }
+    device.packet_bytes = header_bytes + payload_bytes;
+
+    if (options.fec_group_packets > 0) {
+        esp2_fec_accumulate(device.fec_parity_packet.data() + ESP2_WIRE_FEC_HEADER_BYTES,
+                            *reinterpret_cast<const esp2_wire_header*>(packet), payload, payload_bytes);
+        device.fec_block_bytes = std::max(device.fec_block_bytes, ESP2_FEC_BLOCK_PREFIX_BYTES + payload_bytes);
+        device.fec_packets_in_group++;
+    }
+}
+
+// Once the open FEC group is full, fill in its parity packet's header and start the next group.
+// Returns the parity packet's length if it is ready to send, else 0.
+static size_t finish_fec_group(simulated_device& device, const load_generator_options& options) {
+    if (options.fec_group_packets == 0 || device.fec_packets_in_group < options.fec_group_packets) return 0;
+    size_t block_bytes = device.fec_block_bytes;
+    build_esp2_fec_header(device.fec_parity_packet.data(), device.fec_group_first_sequence, 0, 0, (uint16_t)block_bytes, 1, 1,
+                          options.sample_rate, ESP2_FORMAT_INT32_LEFT24, device.fec_group_first_sequence,
+                          (uint8_t)options.fec_group_packets, (uint8_t)options.fec_group_packets, true);
+    device.fec_packets_in_group = 0;
+    device.fec_block_bytes = 0;
+    return ESP2_WIRE_FEC_HEADER_BYTES + block_bytes;
+}
+
+static void reset_fec_group(simulated_device& device) {
+    device.fec_packets_in_group = 0;
+    device.fec_block_bytes = 0;
+    std::fill(device.fec_parity_packet.begin(), device.fec_parity_packet.end(), 0);
+}
+
+static void sender_thread_loop(std::vector<simulated_device>* devices, const load_generator_options* options_ptr,
+                               load_clock::time_point start_time, load_clock::time_point end_time, uint64_t seed,
+                               sender_statistics* statistics, latency_histogram* lateness_us) {
+    const load_generator_options& options = *options_ptr;
+    std::mt19937_64 rng(seed);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::exponential_distribution<double> jitter(options.jitter_ms > 0.0 ? 1.0 / options.jitter_ms : 1.0);
+
+    auto jittered = [&](load_clock::time_point capture_time) {
+        if (options.jitter_ms <= 0.0) return capture_time;
+        double delay_ms = std::min(jitter(rng), 4.0 * options.jitter_ms);
+        return capture_time + std::chrono::microseconds((int64_t)(delay_ms * 1000.0));
+    };
+    for (simulated_device& device : *devices) {
+        device.next_capture_time = start_time;
+        device.next_send_time = jittered(start_time);
+        schedule_random_reconnect(device, options, rng, start_time);
+    }
+
+    while (global_load_should_run.load(std::memory_order_relaxed)) {
+        // the device due soonest
+        simulated_device* due_device = &devices->front();
+        for (simulated_device& device : *devices) {
+            if (device.next_send_time < due_device->next_send_time) due_device = &device;
+        }
+        simulated_device& device = *due_device;
+        if (device.next_capture_time >= end_time) break;
+
+        // capture time runs on the device's (drifting) sample clock, the send trails it by the jitter
+        double packet_seconds = (double)options.frames_per_packet / device.sample_rate_actual;
+        auto capture_time = device.next_capture_time;
+        auto send_time = device.next_send_time;
+        if (!options.unpaced) std::this_thread::sleep_until(send_time);
+        auto now = load_clock::now();
+
+        // reconnects: storms hit every device at the same wall-clock instants
+        bool reconnect = device.socket_fd < 0 || now >= device.next_reconnect_time;
+        if (options.storm_interval_seconds > 0.0) {
+            uint64_t storm_generation = (uint64_t)(std::chrono::duration<double>(now - start_time).count() / options.storm_interval_seconds);
+            if (storm_generation > device.storm_generation) {
+                device.storm_generation = storm_generation;
+                reconnect = true;
+            }
+        }
+        if (reconnect) {
+            if (device.socket_fd >= 0) {
+                close(device.socket_fd);
+                device.socket_fd = -1;
+                statistics->reconnects++;
+            }
+            device.socket_fd = connect_to_receiver(options);
+            bool resumed = false;
+            if (device.socket_fd >= 0 && options.session && !open_device_session(device, options, resumed)) {
+                close(device.socket_fd);
+                device.socket_fd = -1;
+            }
+            if (device.socket_fd < 0) statistics->connect_failures++;
+            if (resumed) statistics->sessions_resumed++;
+            reset_fec_group(device); // a new socket is a new stream to the receiver
+            schedule_random_reconnect(device, options, rng, now);
+        }
+
+        uint64_t capture_time_us = device.device_clock_origin_us +
+                                   (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(capture_time - start_time).count();
+        if (device.socket_fd >= 0) {
+            build_device_packet(device, options, capture_time_us);
+            bool sent = true;
+            if (options.loss_fraction > 0.0 && unit(rng) < options.loss_fraction) {
+                statistics->packets_lost++;
+            } else if ((sent = send_all(device.socket_fd, device.packet.data(), device.packet_bytes))) {
+                statistics->packets_sent++;
+                statistics->bytes_sent += device.packet_bytes;
+                statistics->payload_bytes_sent += device.packet_bytes - reinterpret_cast<const esp2_wire_header*>(device.packet.data())->header_bytes();
+                if (!options.unpaced) {
+                    auto lateness = load_clock::now() - send_time;
+                    lateness_us->record((uint64_t)std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::microseconds>(lateness).count()));
+                }
+            }
+            size_t parity_bytes = sent ? finish_fec_group(device, options) : 0;
+            if (parity_bytes) {
+                if (options.loss_fraction > 0.0 && unit(rng) < options.loss_fraction) {
+                    statistics->packets_lost++;
+                } else if ((sent = send_all(device.socket_fd, device.fec_parity_packet.data(), parity_bytes))) {
+                    statistics->parity_packets_sent++;
+                    statistics->bytes_sent += parity_bytes;
+                }
+                std::fill(device.fec_parity_packet.begin() + ESP2_WIRE_FEC_HEADER_BYTES, device.fec_parity_packet.begin() + parity_bytes, 0);
+            }
+            if (sent && options.session) discard_session_acks(device.socket_fd);
+            if (!sent) {
+                statistics->send_failures++;
+                close(device.socket_fd);
+                device.socket_fd = -1;
+            }
+        }
+
+        // the firmware's index and sequence advance whether or not the packet made it out
+        device.sequence++;
+        device.next_sample_index += options.frames_per_packet;
+        device.next_capture_time = options.unpaced ? now : capture_time + std::chrono::nanoseconds((int64_t)(packet_seconds * 1e9));
+        device.next_send_time = options.unpaced ? now : jittered(device.next_capture_time);
+    }
+
+    for (simulated_device& device : *devices) {
+        if (device.socket_fd >= 0) close(device.socket_fd);
+        device.socket_fd = -1;
+    }
+}
+
+// ----------------- Measurement helpers -----------------
+
+// utime + stime of a process in seconds (from /proc/<pid>/stat), or -1
+static double process_cpu_seconds(int pid) {
+    std::ifstream stat_file("/proc/" + std::to_string(pid) + "/stat");
+    std::string contents;
+    if (!stat_file || !std::getline(stat_file, contents)) return -1.0;
+    size_t command_end = contents.rfind(')'); // the command name may contain spaces
+    if (command_end == std::string::npos) return -1.0;
+    std::istringstream fields(contents.substr(command_end + 2));
+    std::string field;
+    unsigned long long utime = 0, stime = 0;
+    for (int index = 3; fields >> field; ++index) { // field 3 is the state
+        if (index == 14) utime = std::strtoull(field.c_str(), nullptr, 10);
+        if (index == 15) {
+            stime = std::strtoull(field.c_str(), nullptr, 10);
+            break;
+        }
+    }
+    return (double)(utime + stime) / (double)sysconf(_SC_CLK_TCK);
+}
+
+static double own_cpu_seconds() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (double)usage.ru_utime.tv_sec + (double)usage.ru_utime.tv_usec * 1e-6 + (double)usage.ru_stime.tv_sec +
+           (double)usage.ru_stime.tv_usec * 1e-6;
+}
+
+// GET /metrics from the receiver; returns the body ("" on failure)
+static std::string fetch_receiver_metrics(const load_generator_options& options) {
+    if (options.metrics_port == 0) return "";
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return "";
+    struct timeval timeout = {2, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(options.metrics_port);
+    inet_pton(AF_INET, options.host.c_str(), &address.sin_addr);
+    std::string response;
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) == 0) {
+        std::string request = "GET /metrics HTTP/1.0\r\nHost: " + options.host + "\r\nConnection: close\r\n\r\n";
+        if (send_all(fd, (const uint8_t*)request.data(), request.size())) {
+            char buffer[16384];
+            ssize_t received;
+            while ((received = recv(fd, buffer, sizeof(buffer), 0)) > 0) response.append(buffer, (size_t)received);
+        }
+    }
+    close(fd);
+    size_t body_start = response.find("\r\n\r\n");
+    return body_start == std::string::npos ? "" : response.substr(body_start + 4);
+}
+
+// Sum of every sample of a metric family whose labels contain label_filter ("" = all)
+static double sum_metric(const std::string& metrics_text, const std::string& name, const std::string& label_filter = "") {
+    std::istringstream lines(metrics_text);
+    std::string line;
+    double total = 0.0;
+    while (std::getline(lines, line)) {
+        if (line.compare(0, name.size(), name) != 0) continue;
+        char after_name = line.size() > name.size() ? line[name.size()] : '\0';
+        if (after_name != ' ' && after_name != '{') continue;
+        if (!label_filter.empty() && line.find(label_filter) == std::string::npos) continue;
+        size_t value_start = line.rfind(' ');
+        if (value_start != std::string::npos) total += std::atof(line.c_str() + value_start + 1);
+    }
+    return total;
+}
+
+// Largest sample of a metric family whose labels contain label_filter
+static double max_metric(const std::string& metrics_text, const std::string& name, const std::string& label_filter) {
+    std::istringstream lines(metrics_text);
+    std::string line;
+    double largest = 0.0;
+    while (std::getline(lines, line)) {
+        if (line.compare(0, name.size() + 1, name + "{") != 0) continue;
+        if (line.find(label_filter) == std::string::npos) continue;
+        size_t value_start = line.rfind(' ');
+        if (value_start != std::string::npos) largest = std::max(largest, std::atof(line.c_str() + value_start + 1));
+    }
+    return largest;
+}
+
+// ----------------- main -----------------
+
+int main(int argc, char** argv) {
+    load_generator_options options;
+    if (!parse_options(argc, argv, options)) return 2;
+
+    std::mt19937_64 rng(12345);
+    std::vector<std::vector<simulated_device>> devices_by_thread(options.threads);
+    for (int device_index = 0; device_index < options.devices; ++device_index) {
+        devices_by_thread[device_index % options.threads].emplace_back();
+        initialize_device(devices_by_thread[device_index % options.threads].back(), device_index, options, rng);
+    }
+
+    std::cout << "[LOAD] " << options.devices << " devices on " << options.threads << " threads -> " << options.host << ":"
+              << options.port << ", " << options.frames_per_packet << " frames/packet at " << options.sample_rate << " Hz, "
+              << options.duration_seconds << " s" << (options.udp ? " over UDP" : "") << (options.unpaced ? " (unpaced)" : "") << std::endl;
+
+    std::string metrics_before = fetch_receiver_metrics(options);
+    double receiver_cpu_before = options.receiver_pid > 0 ? process_cpu_seconds(options.receiver_pid) : -1.0;
+    double own_cpu_before = own_cpu_seconds();
+
+    std::vector<sender_statistics> statistics(options.threads);
+    std::vector<std::unique_ptr<latency_histogram>> lateness_us(options.threads);
+    for (auto& histogram : lateness_us) histogram.reset(new latency_histogram());
+
+    auto start_time = load_clock::now() + std::chrono::milliseconds(100);
+    auto end_time = start_time + std::chrono::microseconds((int64_t)(options.duration_seconds * 1e6));
+    std::vector<std::thread> threads;
+    for (int thread_index = 0; thread_index < options.threads; ++thread_index) {
+        threads.emplace_back(sender_thread_loop, &devices_by_thread[thread_index], &options, start_time, end_time,
+                             rng(), &statistics[thread_index], lateness_us[thread_index].get());
+    }
+    for (std::thread& thread : threads) thread.join();
+    double elapsed_seconds = std::chrono::duration<double>(load_clock::now() - start_time).count();
+
+    double receiver_cpu_seconds = options.receiver_pid > 0 ? process_cpu_seconds(options.receiver_pid) - receiver_cpu_before : -1.0;
+    double own_cpu_used = own_cpu_seconds() - own_cpu_before;
+    // let the receiver drain its jitter buffers before reading its counters
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    std::string metrics_after = fetch_receiver_metrics(options);
+
+    // ---- report ----
+    sender_statistics total;
+    uint64_t lateness_p50 = 0, lateness_p99 = 0, lateness_max = 0;
+    for (int thread_index = 0; thread_index < options.threads; ++thread_index) {
+        total.packets_sent += statistics[thread_index].packets_sent;
+        total.packets_lost += statistics[thread_index].packets_lost;
+        total.parity_packets_sent += statistics[thread_index].parity_packets_sent;
+        total.payload_bytes_sent += statistics[thread_index].payload_bytes_sent;
+        total.bytes_sent += statistics[thread_index].bytes_sent;
+        total.reconnects += statistics[thread_index].reconnects;
+        total.sessions_resumed += statistics[thread_index].sessions_resumed;
+        total.connect_failures += statistics[thread_index].connect_failures;
+        total.send_failures += statistics[thread_index].send_failures;
+        // worst thread, not a merged distribution: one stuck socket should stand out
+        lateness_p50 = std::max(lateness_p50, lateness_us[thread_index]->percentile(0.50));
+        lateness_p99 = std::max(lateness_p99, lateness_us[thread_index]->percentile(0.99));
+        lateness_max = std::max(lateness_max, lateness_us[thread_index]->max());
+    }
+    double audio_seconds_sent = (double)total.packets_sent * options.frames_per_packet / options.sample_rate;
+    double realtime_streams = audio_seconds_sent / elapsed_seconds;
+
+    std::printf("[LOAD] sent %llu packets (%.1f MB, %.1f MB/s), skipped %llu, reconnects %llu, connect failures %llu, send failures %llu\n",
+                (unsigned long long)total.packets_sent, total.bytes_sent / 1e6, total.bytes_sent / 1e6 / elapsed_seconds,
+                (unsigned long long)total.packets_lost, (unsigned long long)total.reconnects,
+                (unsigned long long)total.connect_failures, (unsigned long long)total.send_failures);
+    if (options.session) std::printf("[LOAD] %llu sessions resumed\n", (unsigned long long)total.sessions_resumed);
+    if (options.fec_group_packets > 0) std::printf("[LOAD] sent %llu FEC parity packets\n", (unsigned long long)total.parity_packets_sent);
+    if (options.format_id != ESP2_FORMAT_INT32_LEFT24 && total.packets_sent > 0) {
+        double int32_payload_bytes = (double)total.packets_sent * options.frames_per_packet * options.channels * BYTES_PER_SAMPLE;
+        std::printf("[LOAD] %s payload is %.1f%% of int32\n", format_name(options.format_id),
+                    100.0 * (double)total.payload_bytes_sent / int32_payload_bytes);
+    }
+    std::printf("[LOAD] %.1f real-time streams sustained on average\n", realtime_streams);
+    if (!options.unpaced) {
+        std::printf("[LOAD] send lateness vs schedule (worst thread): p50 %llu us, p99 %llu us, max %llu us\n",
+                    (unsigned long long)lateness_p50, (unsigned long long)lateness_p99, (unsigned long long)lateness_max);
+    }
+    std::printf("[LOAD] generator CPU %.1f%% of one core\n", 100.0 * own_cpu_used / elapsed_seconds);
+    if (receiver_cpu_seconds >= 0.0) {
+        double receiver_cores = receiver_cpu_seconds / elapsed_seconds;
+        std::printf("[LOAD] receiver CPU %.2f%% of one core -> %.0f streams per core\n", 100.0 * receiver_cores,
+                    receiver_cores > 0.0 ? realtime_streams / receiver_cores : 0.0);
+    }
+    if (!metrics_after.empty()) {
+        double dropped = sum_metric(metrics_after, "esp_receiver_packets_dropped_total") - sum_metric(metrics_before, "esp_receiver_packets_dropped_total");
+        double header_errors = sum_metric(metrics_after, "esp_receiver_header_errors_total") - sum_metric(metrics_before, "esp_receiver_header_errors_total");
+        double received = sum_metric(metrics_after, "esp_receiver_packets_received_total") - sum_metric(metrics_before, "esp_receiver_packets_received_total");
+        std::printf("[LOAD] receiver: %.0f packets received, %.0f dropped, %.0f header errors\n", received, dropped, header_errors);
+        if (options.fec_group_packets > 0) {
+            std::printf("[LOAD] receiver FEC: %.0f packets recovered, %.0f unrecoverable\n",
+                        sum_metric(metrics_after, "esp_receiver_fec_packets_recovered_total") - sum_metric(metrics_before, "esp_receiver_fec_packets_recovered_total"),
+                        sum_metric(metrics_after, "esp_receiver_fec_packets_unrecoverable_total") - sum_metric(metrics_before, "esp_receiver_fec_packets_unrecoverable_total"));
+        }
+        // per-stream tails of the streams still open when the run ended (reconnects reset them)
+        std::printf("[LOAD] receiver capture->writer latency above best-case path (worst stream): p99 %.0f us, max %.0f us\n",
+                    max_metric(metrics_after, "esp_stream_latency_p99_us", "stage=\"capture_to_writer\""),
+                    max_metric(metrics_after, "esp_stream_latency_max_us", "stage=\"capture_to_writer\""));
+        double write_count = sum_metric(metrics_after, "esp_wav_write_latency_us_count");
+        if (write_count > 0.0) {
+            std::printf("[LOAD] receiver WAV write latency mean %.0f us over %.0f writes\n",
+                        sum_metric(metrics_after, "esp_wav_write_latency_us_sum") / write_count, write_count);
+        }
+    } else if (options.metrics_port != 0) {
+        std::printf("[LOAD] receiver /metrics not reachable on port %u\n", options.metrics_port);
+    }
+    return total.send_failures == 0 || options.reconnect_mean_seconds > 0.0 || options.storm_interval_seconds > 0.0 ? 0 : 1;
+}
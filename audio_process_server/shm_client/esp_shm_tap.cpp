@@ -0,0 +1,191 @@
+// esp_shm_tap.cpp
+// Example consumer of the receiver's shared-memory export (esp_receiver/shm_audio_ring.h).
+//
+// Attaches to one stream's ring and, once per second, reports what it read: blocks
+// and frames, blocks lost to being overtaken, sample-index gaps, peak level, and how
+// old the audio was when it was read (from the packet's receive time and from the
+// estimated capture time, both on CLOCK_MONOTONIC). The samples are measured in
+// place, straight from the mapping. With --raw it writes the audio to stdout instead
+// (packed 24-bit little-endian mono), e.g. into sox or ffmpeg. It follows the device
+// across reconnects by reopening the name when the ring is closed.
+//
+//   esp_shm_tap --device 10.0.0.7
+//   esp_shm_tap --device 10.0.0.7 --raw | ffmpeg -f s24le -ar 48000 -ac 1 -i - out.flac
+#include <getopt.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "shm_audio_ring.h"
+
+static const int TAP_POLL_INTERVAL_US = 2000;
+static const int TAP_REOPEN_INTERVAL_MS = 500;
+static const uint64_t TAP_REPORT_INTERVAL_US = 1000000;
+
+struct tap_options {
+    std::string segment_name;
+    double duration_seconds = 0.0;   // 0 = until interrupted
+    bool raw = false;
+};
+
+static void print_usage(const char* program) {
+    std::cout << "usage: " << program << " (--device LABEL | --segment NAME) [options]\n"
+              << "  --device LABEL           device as shown in /status, e.g. 10.0.0.7\n"
+              << "  --segment NAME           shared-memory name, e.g. /esp_audio_10.0.0.7\n"
+              << "  --duration S             stop after S seconds (0 = run until interrupted)\n"
+              << "  --raw                    write the audio to stdout, packed 24-bit little-endian\n";
+}
+
+static bool parse_options(int argc, char** argv, tap_options& options) {
+    enum option_id { device = 1, segment, duration, raw, help };
+    static const struct option long_options[] = {
+        {"device", required_argument, nullptr, device},
+        {"segment", required_argument, nullptr, segment},
+        {"duration", required_argument, nullptr, duration},
+        {"raw", no_argument, nullptr, raw},
+        {"help", no_argument, nullptr, help},
+        {nullptr, 0, nullptr, 0},
+    };
+    int option;
+    while ((option = getopt_long(argc, argv, "", long_options, nullptr)) != -1) {
+        switch (option) {
+        case device: {
+            char name[160];
+            if (!shm_audio_segment_name(optarg, name, sizeof(name))) {
+                std::cerr << "[TAP] device label too long\n";
+                return false;
+            }
+            options.segment_name = name;
+            break;
+        }
+        case segment: options.segment_name = optarg; break;
+        case duration: options.duration_seconds = std::atof(optarg); break;
+        case raw: options.raw = true; break;
+        default: print_usage(argv[0]); return false;
+        }
+    }
+    if (options.segment_name.empty()) {
+        print_usage(argv[0]);
+        return false;
+    }
+    return true;
+}
+
+// What one report interval saw
+struct tap_interval_totals {
+    uint64_t blocks = 0;
+    uint64_t frames = 0;
+    uint64_t gaps = 0;
+    int32_t peak_abs = 0;
+    uint64_t receive_age_sum_us = 0;
+    uint64_t capture_age_sum_us = 0;
+    uint64_t capture_age_blocks = 0;
+};
+
+int main(int argc, char** argv) {
+    tap_options options;
+    if (!parse_options(argc, argv, options)) return 2;
+
+    const uint64_t start_us = shm_audio_monotonic_us();
+    const uint64_t stop_us = options.duration_seconds > 0.0 ? start_us + (uint64_t)(options.duration_seconds * 1e6) : 0;
+    shm_audio_tap tap;
+    bool waiting_reported = false;
+    uint64_t next_sample_index = 0;
+    bool have_next_sample_index = false;
+    uint64_t skipped_at_last_report = 0;
+    uint64_t next_report_us = start_us + TAP_REPORT_INTERVAL_US;
+    tap_interval_totals totals;
+    std::vector<uint8_t> raw_copy;
+    bool output_failed = false;
+
+    while (!output_failed && (stop_us == 0 || shm_audio_monotonic_us() < stop_us)) {
+        // a closed ring is read to its end before following the device to its next one
+        if (!tap.reader().is_open() ||
+            (tap.reader().producer_closed() && tap.next_block() >= tap.reader().published_blocks())) {
+            if (!tap.open(options.segment_name.c_str())) {
+                if (!waiting_reported) std::cerr << "[TAP] waiting for " << options.segment_name << "\n";
+                waiting_reported = true;
+                std::this_thread::sleep_for(std::chrono::milliseconds(TAP_REOPEN_INTERVAL_MS));
+                continue;
+            }
+            const shm_audio_ring_header& ring = tap.reader().header();
+            if (ring.bytes_per_sample != 3 || ring.channels != 1) {
+                std::cerr << "[TAP] " << options.segment_name << " carries " << ring.channels << " x "
+                          << ring.bytes_per_sample << "-byte samples; only packed 24-bit mono is supported\n";
+                return 1;
+            }
+            std::cerr << "[TAP] attached to " << options.segment_name << " (stream " << ring.stream_id << ", "
+                      << ring.sample_rate << " Hz, pid " << ring.producer_pid << ")\n";
+            waiting_reported = false;
+            have_next_sample_index = false;
+            skipped_at_last_report = 0;
+        }
+
+        // drain everything published so far. Whatever the consumer computes only counts
+        // once next() has confirmed the block was intact throughout.
+        if (options.raw) raw_copy.resize((size_t)tap.reader().header().max_block_frames * 3);
+        shm_audio_block block;
+        int32_t block_peak_abs = 0;
+        shm_audio_read_status status;
+        while ((status = tap.next([&](const shm_audio_block& published) {
+                    block = published;
+                    block_peak_abs = 0;
+                    if (options.raw) {
+                        memcpy(raw_copy.data(), published.samples, (size_t)published.frame_count * 3);
+                        return;
+                    }
+                    for (uint32_t i = 0; i < published.frame_count; ++i) {
+                        int32_t sample = shm_audio_sample_s24(published.samples + 3 * (size_t)i);
+                        int32_t sample_abs = sample < 0 ? -sample : sample;
+                        if (sample_abs > block_peak_abs) block_peak_abs = sample_abs;
+                    }
+                })) == shm_audio_read_status::ok) {
+            if (options.raw && fwrite(raw_copy.data(), 3, block.frame_count, stdout) != block.frame_count) {
+                output_failed = true;
+                break;
+            }
+            uint64_t now_us = shm_audio_monotonic_us();
+            if (have_next_sample_index && block.first_sample_index != next_sample_index) ++totals.gaps;
+            next_sample_index = block.first_sample_index + block.frame_count;
+            have_next_sample_index = true;
+            ++totals.blocks;
+            totals.frames += block.frame_count;
+            if (block_peak_abs > totals.peak_abs) totals.peak_abs = block_peak_abs;
+            totals.receive_age_sum_us += now_us - block.host_receive_us;
+            if (block.flags & SHM_AUDIO_BLOCK_HAS_CAPTURE_TIME) {
+                totals.capture_age_sum_us += now_us - block.host_capture_us;
+                ++totals.capture_age_blocks;
+            }
+        }
+
+        uint64_t now_us = shm_audio_monotonic_us();
+        if (now_us >= next_report_us) {
+            uint64_t skipped = tap.blocks_skipped() - skipped_at_last_report;
+            skipped_at_last_report = tap.blocks_skipped();
+            double peak_dbfs = totals.peak_abs > 0 ? 20.0 * std::log10((double)totals.peak_abs / 8388608.0) : -200.0;
+            std::cerr << "[TAP] blocks=" << totals.blocks << " frames=" << totals.frames << " skipped=" << skipped
+                      << " gaps=" << totals.gaps << " peak_dbfs=" << (int)std::lround(peak_dbfs);
+            if (totals.blocks > 0) std::cerr << " receive_age_us=" << totals.receive_age_sum_us / totals.blocks;
+            if (totals.capture_age_blocks > 0) {
+                std::cerr << " capture_age_us=" << totals.capture_age_sum_us / totals.capture_age_blocks;
+            }
+            std::cerr << "\n";
+            totals = tap_interval_totals();
+            next_report_us = now_us + TAP_REPORT_INTERVAL_US;
+        }
+        if (status == shm_audio_read_status::not_yet_published) {
+            std::this_thread::sleep_for(std::chrono::microseconds(TAP_POLL_INTERVAL_US));
+        }
+    }
+    if (output_failed) std::cerr << "[TAP] output closed\n";
+    return output_failed ? 1 : 0;
+}
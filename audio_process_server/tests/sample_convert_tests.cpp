@@ -0,0 +1,195 @@
+// sample_convert_tests.cpp
+// Bit-exactness test of the DSP stage's conversion paths against the double/llround
+// reference (convert_int32_left24_to_packed24_reference):
+//
+//   kernels     every packed-24 kernel this build and CPU runs (available_packed24_
+//               convert_kernels(), scalar included) over the self check's input and
+//               gains: edge values, rounding ties, saturation, xorshift noise
+//   converters  every STREAM_CONVERTERS entry with every kernel: a payload of each
+//               format and channel count built from the same input, whose channel 0
+//               (decoded by the portable codecs of esp2_payload_codec.h) must come out
+//               exactly as the reference converts it
+//
+// Exits non-zero on the first mismatch, with the case and the first differing sample.
+//
+//   ctest --test-dir build --output-on-failure
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "esp2_payload_codec.h"
+#include "esp2_wire_header.h"
+#include "sample_convert.h"
+
+static constexpr size_t TEST_MAX_KERNELS = 8;
+static constexpr size_t TEST_SECOND_CHANNEL_OFFSET = 517;   // channel 1 carries a shifted copy
+
+static int global_failures = 0;
+static int global_cases = 0;
+
+// Compare a conversion against the reference output; report the first differing sample
+static void expect_identical(const std::string& name, const std::vector<uint8_t>& expected, const std::vector<uint8_t>& actual) {
+    ++global_cases;
+    for (size_t byte_index = 0; byte_index < expected.size(); ++byte_index) {
+        if (expected[byte_index] == actual[byte_index]) continue;
+        size_t sample_index = byte_index / 3;
+        std::printf("FAIL %s: sample %zu is %02x%02x%02x, reference %02x%02x%02x\n", name.c_str(), sample_index,
+                    actual[sample_index * 3 + 2], actual[sample_index * 3 + 1], actual[sample_index * 3],
+                    expected[sample_index * 3 + 2], expected[sample_index * 3 + 1], expected[sample_index * 3]);
+        ++global_failures;
+        return;
+    }
+}
+
+// ----------------- kernels -----------------
+
+static void test_packed24_kernels(const std::vector<int32_t>& samples, const int32_t* gains_q16, size_t gain_count) {
+    packed24_convert_kernel_info kernels[TEST_MAX_KERNELS];
+    size_t kernel_count = available_packed24_convert_kernels(kernels, TEST_MAX_KERNELS);
+    const uint8_t* input = reinterpret_cast<const uint8_t*>(samples.data()); // native order, read as LE
+    std::vector<uint8_t> expected(samples.size() * 3);
+    std::vector<uint8_t> actual(samples.size() * 3);
+    for (size_t kernel_index = 0; kernel_index < kernel_count; ++kernel_index) {
+        for (size_t gain_index = 0; gain_index < gain_count; ++gain_index) {
+            convert_int32_left24_to_packed24_reference(input, expected.data(), samples.size(), gains_q16[gain_index]);
+            // also the prefixes below one vector, so each kernel's tail handling is compared on its own
+            for (size_t sample_count : {samples.size(), (size_t)7, (size_t)3, (size_t)1}) {
+                std::fill(actual.begin(), actual.end(), 0xA5);
+                kernels[kernel_index].kernel(input, actual.data(), sample_count, gains_q16[gain_index]);
+                std::vector<uint8_t> expected_prefix(expected.begin(), expected.begin() + (ptrdiff_t)(sample_count * 3));
+                std::vector<uint8_t> actual_prefix(actual.begin(), actual.begin() + (ptrdiff_t)(sample_count * 3));
+                expect_identical(std::string("kernel ") + kernels[kernel_index].name + " gain_q16=" +
+                                     std::to_string(gains_q16[gain_index]) + " samples=" + std::to_string(sample_count),
+                                 expected_prefix, actual_prefix);
+            }
+        }
+        std::printf("kernel %-10s checked against the reference\n", kernels[kernel_index].name);
+    }
+}
+
+// ----------------- per-stream converters -----------------
+
+// Encode interleaved frames in a converter's format; false if the format has no encoder here
+static bool encode_test_payload(const stream_converter_info& converter, const std::vector<int32_t>& interleaved,
+                                size_t frames, std::vector<uint8_t>& payload) {
+    size_t sample_count = frames * converter.channels;
+    switch (converter.format_id) {
+    case ESP2_FORMAT_INT32_LEFT24:
+        payload.resize(sample_count * 4);
+        for (size_t i = 0; i < sample_count; ++i) esp2_store_le(payload.data() + 4 * i, (uint32_t)interleaved[i], 4);
+        return true;
+    case ESP2_FORMAT_PACKED24:
+        payload.resize(sample_count * 3);
+        esp2_packed24_encode(interleaved.data(), sample_count, payload.data());
+        return true;
+    case ESP2_FORMAT_INT16:
+        payload.resize(sample_count * 2);
+        esp2_int16_encode(interleaved.data(), sample_count, payload.data());
+        return true;
+    case ESP2_FORMAT_RICE24: {
+        payload.resize(sample_count * 4 + 64);
+        size_t payload_bytes = esp2_rice24_encode(interleaved.data(), frames, converter.channels, payload.data(), payload.size());
+        payload.resize(payload_bytes);
+        return payload_bytes > 0;
+    }
+    case ESP2_FORMAT_IMA_ADPCM: {
+        esp2_ima_adpcm_state states[2];
+        payload.resize(esp2_ima_adpcm_payload_bytes(frames, converter.channels));
+        esp2_ima_adpcm_encode(interleaved.data(), frames, converter.channels, states, payload.data());
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+// Channel 0 of a payload as int32-left24, through the portable codecs (not the receiver's dispatch)
+static bool decode_test_channel0(const stream_converter_info& converter, const std::vector<uint8_t>& payload,
+                                 size_t frames, std::vector<int32_t>& channel0) {
+    std::vector<int32_t> interleaved(frames * converter.channels);
+    switch (converter.format_id) {
+    case ESP2_FORMAT_INT32_LEFT24:
+        for (size_t i = 0; i < interleaved.size(); ++i) interleaved[i] = (int32_t)esp2_load_le32(payload.data() + 4 * i);
+        break;
+    case ESP2_FORMAT_PACKED24: esp2_packed24_decode(payload.data(), interleaved.size(), interleaved.data()); break;
+    case ESP2_FORMAT_INT16: esp2_int16_decode(payload.data(), interleaved.size(), interleaved.data()); break;
+    case ESP2_FORMAT_RICE24:
+        if (!esp2_rice24_decode(payload.data(), payload.size(), frames, converter.channels, interleaved.data())) return false;
+        break;
+    case ESP2_FORMAT_IMA_ADPCM:
+        if (!esp2_ima_adpcm_decode(payload.data(), payload.size(), frames, converter.channels, interleaved.data())) return false;
+        break;
+    default:
+        return false;
+    }
+    channel0.resize(frames);
+    for (size_t frame_index = 0; frame_index < frames; ++frame_index) channel0[frame_index] = interleaved[frame_index * converter.channels];
+    return true;
+}
+
+static void test_stream_converters(const std::vector<int32_t>& samples, const int32_t* gains_q16, size_t gain_count) {
+    packed24_convert_kernel_info kernels[TEST_MAX_KERNELS];
+    size_t kernel_count = available_packed24_convert_kernels(kernels, TEST_MAX_KERNELS);
+    size_t converter_count = 0;
+    const stream_converter_info* converters = available_stream_converters(converter_count);
+    const size_t frames = samples.size();
+
+    for (size_t converter_index = 0; converter_index < converter_count; ++converter_index) {
+        const stream_converter_info& converter = converters[converter_index];
+        std::vector<int32_t> interleaved(frames * converter.channels);
+        for (size_t frame_index = 0; frame_index < frames; ++frame_index) {
+            for (size_t channel = 0; channel < converter.channels; ++channel) {
+                interleaved[frame_index * converter.channels + channel] =
+                    samples[(frame_index + channel * TEST_SECOND_CHANNEL_OFFSET) % frames];
+            }
+        }
+        std::vector<uint8_t> payload;
+        std::vector<int32_t> channel0;
+        if (!encode_test_payload(converter, interleaved, frames, payload) ||
+            !decode_test_channel0(converter, payload, frames, channel0)) {
+            std::printf("FAIL converter %s: no test payload for format %d\n", converter.name, (int)converter.format_id);
+            ++global_failures;
+            continue;
+        }
+
+        std::vector<int32_t> scratch(frames * converter.channels);
+        std::vector<uint8_t> expected(frames * 3);
+        std::vector<uint8_t> actual(frames * 3);
+        for (size_t kernel_index = 0; kernel_index < kernel_count; ++kernel_index) {
+            for (size_t gain_index = 0; gain_index < gain_count; ++gain_index) {
+                convert_int32_left24_to_packed24_reference(reinterpret_cast<const uint8_t*>(channel0.data()), expected.data(),
+                                                           frames, gains_q16[gain_index]);
+                std::fill(actual.begin(), actual.end(), 0xA5);
+                std::string name = std::string("converter ") + converter.name + " kernel " + kernels[kernel_index].name +
+                                   " gain_q16=" + std::to_string(gains_q16[gain_index]);
+                ++global_cases;
+                if (!converter.convert(payload.data(), payload.size(), frames, gains_q16[gain_index],
+                                       kernels[kernel_index].kernel, scratch.data(), actual.data())) {
+                    std::printf("FAIL %s: rejected a valid payload\n", name.c_str());
+                    ++global_failures;
+                    continue;
+                }
+                expect_identical(name, expected, actual);
+            }
+        }
+        std::printf("converter %-18s checked against the reference\n", converter.name);
+    }
+}
+
+int main() {
+    std::vector<int32_t> samples(PACKED24_CHECK_SAMPLE_COUNT);
+    fill_packed24_check_samples(samples.data(), samples.size());
+    const int32_t* gains_q16 = nullptr;
+    size_t gain_count = packed24_check_gains_q16(&gains_q16);
+
+    test_packed24_kernels(samples, gains_q16, gain_count);
+    test_stream_converters(samples, gains_q16, gain_count);
+
+    std::printf("%d cases, %d failed (selected kernel: %s)\n", global_cases, global_failures,
+                selected_packed24_convert_kernel_name());
+    return global_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,175 @@
+// udp_fec_tests.cpp
+// Recovery test of fec_group_decoder (udp_fec.h) on groups built the way the firmware's
+// sendPacketsUDP builds them:
+//
+//   uniform   every packet PACKED24
+//   mixed     RICE24 packets (variable length, ESP2_FLAG_PAYLOAD_LENGTH) and PACKED24 ones
+//             in one group, as when encodePayload falls back per datagram
+//
+// Each data packet of a group is lost in turn, with the parity sent last and first; the
+// rebuilt packet must carry the lost packet's own format, flags and length, and its
+// payload byte for byte.
+//
+// Exits non-zero if any case fails.
+//
+//   ctest --test-dir build --output-on-failure
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "esp2_payload_codec.h"
+#include "esp2_wire_header.h"
+#include "udp_fec.h"
+
+static constexpr uint16_t TEST_FRAMES = 128;
+static constexpr uint8_t TEST_CHANNELS = 2;
+static constexpr uint32_t TEST_SAMPLE_RATE = 48000;
+static constexpr uint32_t TEST_FIRST_SEQUENCE = 1000;
+static constexpr size_t TEST_MAX_PAYLOAD_BYTES = (size_t)TEST_FRAMES * TEST_CHANNELS * 4;
+
+static int global_failures = 0;
+static int global_cases = 0;
+
+static void expect(bool condition, const std::string& name, const char* what) {
+    if (condition) return;
+    std::printf("FAIL %s: %s\n", name.c_str(), what);
+    ++global_failures;
+}
+
+// One data packet of the group as the sender put it on the air
+static std::vector<uint8_t> build_data_packet(uint32_t sequence, uint8_t index_in_group, uint8_t packets_in_group,
+                                              uint8_t format_id, uint32_t noise_seed) {
+    std::vector<int32_t> samples((size_t)TEST_FRAMES * TEST_CHANNELS);
+    uint32_t noise = noise_seed | 1u;
+    for (size_t frame = 0; frame < TEST_FRAMES; ++frame) {
+        for (size_t channel = 0; channel < TEST_CHANNELS; ++channel) {
+            noise ^= noise << 13;
+            noise ^= noise >> 17;
+            noise ^= noise << 5;
+            double tone = 0.4 * std::sin(0.05 * (double)(sequence * TEST_FRAMES + frame) * (double)(channel + 1));
+            int32_t value = (int32_t)(tone * 8388607.0) + (int32_t)(noise & 0xFF) - 128;
+            samples[frame * TEST_CHANNELS + channel] = (int32_t)((uint32_t)value << 8);
+        }
+    }
+
+    std::vector<uint8_t> packet(ESP2_WIRE_HEADER_MAX_BYTES + TEST_MAX_PAYLOAD_BYTES + 64);
+    esp2_wire_header* header = reinterpret_cast<esp2_wire_header*>(packet.data());
+    uint64_t first_sample_index = (uint64_t)(sequence - TEST_FIRST_SEQUENCE) * TEST_FRAMES;
+    header->set(sequence, first_sample_index, 5000000 + first_sample_index * 1000000 / TEST_SAMPLE_RATE, TEST_FRAMES,
+                TEST_CHANNELS, esp2_format_bytes_per_sample(format_id), TEST_SAMPLE_RATE, format_id, ESP2_FLAG_FEC);
+    esp2_store_le(header->header_bytes_bytes, ESP2_WIRE_FEC_HEADER_BYTES, 2);
+    reinterpret_cast<esp2_fec_extension*>(packet.data() + ESP2_WIRE_HEADER_BYTES)
+        ->set(TEST_FIRST_SEQUENCE, packets_in_group, index_in_group);
+
+    std::vector<uint8_t> payload(TEST_MAX_PAYLOAD_BYTES + 64);
+    size_t payload_bytes = 0;
+    size_t header_bytes = ESP2_WIRE_FEC_HEADER_BYTES;
+    if (format_id == ESP2_FORMAT_RICE24) {
+        payload_bytes = esp2_rice24_encode(samples.data(), TEST_FRAMES, TEST_CHANNELS, payload.data(), payload.size());
+        header_bytes = esp2_append_payload_length(packet.data(), (uint32_t)payload_bytes);
+    } else {
+        payload_bytes = esp2_packed24_encode(samples.data(), samples.size(), payload.data());
+    }
+    std::memcpy(packet.data() + header_bytes, payload.data(), payload_bytes);
+    packet.resize(header_bytes + payload_bytes);
+    return packet;
+}
+
+// The group's parity packet over every data packet
+static std::vector<uint8_t> build_parity_packet(const std::vector<std::vector<uint8_t>>& data_packets) {
+    std::vector<uint8_t> block(ESP2_FEC_BLOCK_PREFIX_BYTES + TEST_MAX_PAYLOAD_BYTES, 0);
+    size_t block_bytes = 0;
+    for (const std::vector<uint8_t>& packet : data_packets) {
+        const esp2_wire_header* header = esp2_wire_header_view(packet.data(), packet.size());
+        esp2_fec_accumulate(block.data(), *header, packet.data() + header->header_bytes(), header->payload_bytes());
+        block_bytes = std::max(block_bytes, ESP2_FEC_BLOCK_PREFIX_BYTES + header->payload_bytes());
+    }
+    uint8_t packets_in_group = (uint8_t)data_packets.size();
+    std::vector<uint8_t> packet(ESP2_WIRE_FEC_HEADER_BYTES + block_bytes);
+    esp2_wire_header* header = reinterpret_cast<esp2_wire_header*>(packet.data());
+    header->set(TEST_FIRST_SEQUENCE, 0, 0, (uint16_t)block_bytes, 1, 1, TEST_SAMPLE_RATE, ESP2_FORMAT_INT32_LEFT24,
+                ESP2_FLAG_FEC | ESP2_FLAG_FEC_PARITY);
+    esp2_store_le(header->header_bytes_bytes, ESP2_WIRE_FEC_HEADER_BYTES, 2);
+    reinterpret_cast<esp2_fec_extension*>(packet.data() + ESP2_WIRE_HEADER_BYTES)
+        ->set(TEST_FIRST_SEQUENCE, packets_in_group, packets_in_group);
+    std::memcpy(packet.data() + ESP2_WIRE_FEC_HEADER_BYTES, block.data(), block_bytes);
+    return packet;
+}
+
+// Feed one packet as the receiver does; returns the rebuilt packet if this one completed the group
+static std::vector<uint8_t> feed_packet(fec_group_decoder& decoder, const std::vector<uint8_t>& packet) {
+    const esp2_wire_header* header = esp2_wire_header_view(packet.data(), packet.size());
+    const esp2_fec_extension* fec = header ? esp2_fec_extension_of(*header) : nullptr;
+    if (!fec) return {};
+    size_t payload_bytes = packet.size() - header->header_bytes();
+    size_t recovered_bytes = 0;
+    const uint8_t* recovered = decoder.add_packet(*header, *fec, packet.data() + header->header_bytes(), payload_bytes,
+                                                  &recovered_bytes);
+    return recovered ? std::vector<uint8_t>(recovered, recovered + recovered_bytes) : std::vector<uint8_t>();
+}
+
+static void expect_same_packet(const std::string& name, const std::vector<uint8_t>& lost, const std::vector<uint8_t>& rebuilt) {
+    const esp2_wire_header* expected = esp2_wire_header_view(lost.data(), lost.size());
+    const esp2_wire_header* actual = esp2_wire_header_view(rebuilt.data(), rebuilt.size());
+    expect(actual != nullptr, name, "rebuilt packet does not parse");
+    if (!actual) return;
+    expect(actual->sequence() == expected->sequence(), name, "sequence");
+    expect(actual->first_sample_index() == expected->first_sample_index(), name, "first_sample_index");
+    expect(actual->timestamp_us() == expected->timestamp_us(), name, "timestamp_us");
+    expect(actual->frames() == expected->frames(), name, "frames");
+    expect(actual->channels() == expected->channels(), name, "channels");
+    expect(actual->bytes_per_sample() == expected->bytes_per_sample(), name, "bytes_per_sample");
+    expect(actual->sample_rate() == expected->sample_rate(), name, "sample_rate");
+    expect(actual->format_id() == expected->format_id(), name, "format_id");
+    expect((actual->flags() & ESP2_FLAG_PAYLOAD_LENGTH) == (expected->flags() & ESP2_FLAG_PAYLOAD_LENGTH), name,
+           "payload length flag");
+    expect(actual->payload_bytes() == expected->payload_bytes(), name, "payload_bytes");
+    expect(rebuilt.size() == actual->header_bytes() + actual->payload_bytes(), name, "packet size");
+    if (actual->payload_bytes() == expected->payload_bytes() && rebuilt.size() >= actual->header_bytes() + actual->payload_bytes()) {
+        expect(std::memcmp(rebuilt.data() + actual->header_bytes(), lost.data() + expected->header_bytes(),
+                           expected->payload_bytes()) == 0,
+               name, "payload bytes");
+    }
+}
+
+static void test_group(const char* group_name, const std::vector<uint8_t>& formats) {
+    uint8_t packets_in_group = (uint8_t)formats.size();
+    std::vector<std::vector<uint8_t>> data_packets;
+    for (uint8_t index = 0; index < packets_in_group; ++index) {
+        data_packets.push_back(build_data_packet(TEST_FIRST_SEQUENCE + index, index, packets_in_group, formats[index], 0x9E3779B9u * (index + 1)));
+    }
+    std::vector<uint8_t> parity = build_parity_packet(data_packets);
+
+    for (uint8_t lost_index = 0; lost_index < packets_in_group; ++lost_index) {
+        for (bool parity_first : {false, true}) {
+            std::string name = std::string(group_name) + " lost=" + std::to_string(lost_index) + (parity_first ? " parity first" : " parity last");
+            ++global_cases;
+            fec_group_decoder decoder;
+            decoder.initialize(TEST_MAX_PAYLOAD_BYTES);
+            std::vector<uint8_t> rebuilt;
+            if (parity_first) rebuilt = feed_packet(decoder, parity);
+            for (uint8_t index = 0; index < packets_in_group; ++index) {
+                if (index == lost_index) continue;
+                std::vector<uint8_t> recovered = feed_packet(decoder, data_packets[index]);
+                if (!recovered.empty()) rebuilt = recovered;
+            }
+            if (!parity_first) rebuilt = feed_packet(decoder, parity);
+            expect(!rebuilt.empty(), name, "nothing rebuilt");
+            if (!rebuilt.empty()) expect_same_packet(name, data_packets[lost_index], rebuilt);
+            expect(decoder.recovered_packets() == 1 && decoder.unrecoverable_packets() == 0, name, "counters");
+        }
+    }
+    std::printf("group %-8s checked, every data packet lost in turn\n", group_name);
+}
+
+int main() {
+    test_group("uniform", {ESP2_FORMAT_PACKED24, ESP2_FORMAT_PACKED24, ESP2_FORMAT_PACKED24, ESP2_FORMAT_PACKED24});
+    test_group("mixed", {ESP2_FORMAT_RICE24, ESP2_FORMAT_PACKED24, ESP2_FORMAT_RICE24, ESP2_FORMAT_PACKED24, ESP2_FORMAT_RICE24});
+
+    std::printf("%d cases, %d failed\n", global_cases, global_failures);
+    return global_failures == 0 ? 0 : 1;
+}
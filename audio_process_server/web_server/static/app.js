@@ -1,11 +1,16 @@
 // static/app.js
 (function(){
-  const ws = new WebSocket((location.protocol === 'https:' ? 'wss://' : 'ws://') + location.host + '/ws');
+  const wsBase = (location.protocol === 'https:' ? 'wss://' : 'ws://') + location.host;
+  const wsUrl = wsBase + '/ws';
+  let ws = null;
+  // last full status; /ws deltas are merged into it
+  let status = {};
   const runningEl = document.getElementById('running');
   const gainValEl = document.getElementById('gainVal');
   const lastSeqEl = document.getElementById('last_seq');
   const highestEl = document.getElementById('highest');
   const samplesEl = document.getElementById('samples');
+  const activeStreamsEl = document.getElementById('active_streams');
   const gainSlider = document.getElementById('gain');
   const gainNumber = document.getElementById('gainNumber');
   const applyBtn = document.getElementById('apply');
@@ -25,6 +30,7 @@
 
   function applyGainWS(g) {
     // Send via WebSocket as JSON
+    if (!ws || ws.readyState !== WebSocket.OPEN) { log('WS not open'); return; }
     const m = {cmd:'set', gain: g};
     ws.send(JSON.stringify(m));
     log('Sent gain via WS: ' + g);
@@ -33,21 +39,81 @@
   function updateStatus(j) {
     runningEl.textContent = j.running ? 'yes' : 'no';
     gainValEl.textContent = Number(j.gain).toFixed(2);
-    lastSeqEl.textContent = j.last_seq;
+    lastSeqEl.textContent = j.last_sequence;
     highestEl.textContent = j.highest_sample_index;
     samplesEl.textContent = j.samples_written;
-    gainSlider.value = j.gain;
-    gainNumber.value = j.gain;
+    // pushes arrive several times a second: don't fight the user while they edit the gain
+    if (document.activeElement !== gainSlider && document.activeElement !== gainNumber) {
+      gainSlider.value = j.gain;
+      gainNumber.value = j.gain;
+    }
+    if (j.active_streams !== undefined) activeStreamsEl.textContent = j.active_streams;
+    if (j.pipeline) updatePipeline(j.pipeline);
+    if (j.streams) updateStreams(j.streams);
   }
 
-  ws.onopen = () => log('WS open');
-  ws.onclose = () => log('WS closed');
-  ws.onmessage = (evt) => {
-    try {
-      const j = JSON.parse(evt.data);
-      updateStatus(j);
-    } catch(e) { log('ws parse err: ' + e); }
-  };
+  // nested objects in a delta carry only their changed members; arrays arrive whole
+  function mergeDelta(target, delta) {
+    for (const k in delta) {
+      const v = delta[k];
+      if (v && typeof v === 'object' && !Array.isArray(v) && target[k] && typeof target[k] === 'object') mergeDelta(target[k], v);
+      else target[k] = v;
+    }
+  }
+
+  // -120..0 dBFS -> 0..100 %
+  function meterPercent(db) { return Math.max(0, Math.min(100, (db + 60) / 60 * 100)); }
+
+  function updateStreams(streams) {
+    const rows = document.getElementById('stream_rows');
+    if (!rows) return;
+    rows.textContent = '';
+    for (const st of streams) {
+      const tr = document.createElement('tr');
+      const level = st.level || {peak_dbfs: -120, rms_dbfs: -120};
+      const gaps = st.timeline ? st.timeline.gap_frames : 0;
+      for (const v of [st.stream_id, st.peer, st.packets_received, st.packets_dropped, gaps,
+                       Number(level.peak_dbfs).toFixed(1), Number(level.rms_dbfs).toFixed(1)]) {
+        const td = document.createElement('td'); td.textContent = v; tr.appendChild(td);
+      }
+      const meterTd = document.createElement('td');
+      const meter = document.createElement('div'); meter.className = 'meter';
+      const rms = document.createElement('div'); rms.className = 'rms'; rms.style.width = meterPercent(level.rms_dbfs) + '%';
+      const peak = document.createElement('div'); peak.className = 'peak'; peak.style.left = meterPercent(level.peak_dbfs) + '%';
+      meter.appendChild(rms); meter.appendChild(peak); meterTd.appendChild(meter); tr.appendChild(meterTd);
+      rows.appendChild(tr);
+    }
+  }
+
+  function setText(id, v) { const el = document.getElementById(id); if (el) el.textContent = v; }
+
+  function updatePipeline(p) {
+    setText('dsp_depth', p.dsp_queue.depth);
+    setText('dsp_hw', p.dsp_queue.high_water);
+    setText('dsp_cap', p.dsp_queue.capacity);
+    setText('writer_depth', p.writer_queue.depth);
+    setText('writer_hw', p.writer_queue.high_water);
+    setText('writer_cap', p.writer_queue.capacity);
+    setText('free_slots', p.free_slots);
+    setText('slot_count', p.slot_count);
+    setText('dropped', p.dropped_packets);
+  }
+
+  function connectWS() {
+    ws = new WebSocket(wsUrl);
+    ws.onopen = () => log('WS open');
+    ws.onclose = () => { log('WS closed, retrying'); setTimeout(connectWS, 2000); };
+    ws.onmessage = (evt) => {
+      try {
+        const j = JSON.parse(evt.data);
+        if (j.type === 'full') { status = j; updateStatus(status); }
+        else if (j.type === 'delta') { mergeDelta(status, j); updateStatus(status); }
+        else if (j.type === 'ack') log('WS ack: ' + j.cmd);
+        else if (j.type === 'error') log('WS error: ' + j.message);
+      } catch(e) { log('ws parse err: ' + e); }
+    };
+  }
+  connectWS();
 
   // On UI actions
   gainSlider.addEventListener('input', (e) => { gainNumber.value = e.target.value; });
@@ -56,6 +122,206 @@
   applyBtn.addEventListener('click', () => { applyGain(parseFloat(gainNumber.value)); });
   applyWSBtn.addEventListener('click', () => { applyGainWS(parseFloat(gainNumber.value)); });
 
-  // Initial status fetch (fallback if WS doesn't update)
-  fetch('/status').then(r => r.json()).then(j => updateStatus(j)).catch(e => log('status fetch failed: '+e));
+  // ----- Live listen (/listen): binary "MON1" frames played through Web Audio -----
+  const LISTEN_FRAME_MAGIC = 0x314E4F4D;
+  const LISTEN_LEAD_SECONDS = 0.06;   // scheduling headroom for network jitter
+  const LISTEN_MAX_AHEAD_SECONDS = 0.2; // beyond this, drop blocks instead of adding latency
+  let listenWs = null;
+  let audioCtx = null;
+  let playHead = 0;
+  let listenReceived = 0;
+
+  function playListenFrame(data) {
+    const view = new DataView(data);
+    if (data.byteLength < 24 || view.getUint32(0, true) !== LISTEN_FRAME_MAGIC) return;
+    const rate = view.getUint32(16, true);
+    const format = view.getUint16(20, true); // 1 = s16, 2 = s24
+    const bytesPerSample = format === 2 ? 3 : 2;
+    const n = Math.floor((data.byteLength - 24) / bytesPerSample);
+    if (n === 0) return;
+    const now = audioCtx.currentTime;
+    if (playHead < now) playHead = now + LISTEN_LEAD_SECONDS; // underrun or first block
+    if (playHead > now + LISTEN_MAX_AHEAD_SECONDS) return;    // fell behind: skip ahead
+    const buffer = audioCtx.createBuffer(1, n, rate);
+    const samples = buffer.getChannelData(0);
+    for (let i = 0; i < n; i++) {
+      const o = 24 + i * bytesPerSample;
+      samples[i] = format === 2
+        ? (view.getUint8(o) | (view.getUint8(o + 1) << 8) | (view.getInt8(o + 2) << 16)) / 8388608
+        : view.getInt16(o, true) / 32768;
+    }
+    const source = audioCtx.createBufferSource();
+    source.buffer = buffer;
+    source.connect(audioCtx.destination);
+    source.start(playHead);
+    playHead += buffer.duration;
+  }
+
+  function stopListen() {
+    if (listenWs) { listenWs.onclose = null; listenWs.close(); listenWs = null; }
+  }
+
+  function startListen() {
+    stopListen();
+    const q = new URLSearchParams({rate: document.getElementById('listenRate').value,
+                                   format: document.getElementById('listenFormat').value});
+    const streamId = document.getElementById('listenStream').value;
+    if (streamId) q.set('stream', streamId);
+    audioCtx = audioCtx || new AudioContext();
+    audioCtx.resume();
+    playHead = 0;
+    listenReceived = 0;
+    listenWs = new WebSocket(wsBase + '/listen?' + q.toString());
+    listenWs.binaryType = 'arraybuffer';
+    listenWs.onopen = () => log('Listening');
+    listenWs.onclose = () => log('Listen closed');
+    listenWs.onmessage = (evt) => {
+      if (typeof evt.data === 'string') {
+        try { const j = JSON.parse(evt.data); log('listen: ' + (j.message || j.type)); } catch(e) {}
+        return;
+      }
+      playListenFrame(evt.data);
+      // flow-control ack: the server skips us ahead if too many go unacknowledged
+      listenReceived++;
+      listenWs.send(JSON.stringify({received: listenReceived}));
+    };
+  }
+
+  document.getElementById('listenStart').addEventListener('click', startListen);
+  document.getElementById('listenStop').addEventListener('click', stopListen);
+
+  // Archive overview: drawn from /archive/overview tiles, never from the audio
+  const OVERVIEW_RECORD_BYTES = 24;     // overview_bin_record
+  const overviewDeviceEl = document.getElementById('overviewDevice');
+  const overviewSpanEl = document.getElementById('overviewSpan');
+  const overviewWave = document.getElementById('overviewWave');
+  const overviewBands = document.getElementById('overviewBands');
+  // tiles the server marked final, by "device/level/tile"
+  const overviewTiles = new Map();
+  let overviewMeta = null;
+  // archive index at the right edge; null follows the end of the archive
+  let overviewEndIndex = null;
+
+  function loadOverviewDevices() {
+    fetch('/archive').then(r => r.json()).then(j => {
+      const selected = overviewDeviceEl.value;
+      overviewDeviceEl.innerHTML = '';
+      (j.devices || []).forEach(d => {
+        const o = document.createElement('option');
+        o.value = o.textContent = d.device;
+        overviewDeviceEl.appendChild(o);
+      });
+      if (selected) overviewDeviceEl.value = selected;
+      refreshOverview();
+    }).catch(e => log('archive list failed: ' + e));
+  }
+
+  function fetchOverviewTile(device, level, tile) {
+    const key = device + '/' + level + '/' + tile;
+    if (overviewTiles.has(key)) return Promise.resolve(overviewTiles.get(key));
+    const q = new URLSearchParams({device: device, level: level, tile: tile});
+    return fetch('/archive/overview/tile?' + q.toString()).then(r => {
+      if (r.status === 404) return null;
+      if (!r.ok) throw new Error('tile HTTP ' + r.status);
+      const final = (r.headers.get('Cache-Control') || 'no-cache').indexOf('no-cache') < 0;
+      return r.arrayBuffer().then(b => {
+        const view = new DataView(b);
+        if (final) overviewTiles.set(key, view);
+        return view;
+      });
+    });
+  }
+
+  function overviewSpanFrames(meta) { return Number(overviewSpanEl.value) * meta.sample_rate; }
+
+  function refreshOverview() {
+    const device = overviewDeviceEl.value;
+    if (!device) return;
+    fetch('/archive/overview?' + new URLSearchParams({device: device}).toString())
+      .then(r => r.ok ? r.json() : null).then(meta => {
+        if (!meta || !meta.levels.length) return;
+        overviewMeta = meta;
+        const spanFrames = overviewSpanFrames(meta);
+        const end = overviewEndIndex === null ? meta.end_sample_index : Math.min(overviewEndIndex, meta.end_sample_index);
+        const start = end - spanFrames;
+        // the finest level with at most two bins per pixel
+        let level = meta.levels[meta.levels.length - 1];
+        for (const l of meta.levels) {
+          if (spanFrames / l.bin_frames <= 2 * overviewWave.width) { level = l; break; }
+        }
+        const firstBin = Math.max(0, Math.floor(start / level.bin_frames));
+        const endBin = Math.max(firstBin + 1, Math.ceil(end / level.bin_frames));
+        const firstTile = Math.floor(firstBin / meta.tile_bins);
+        const lastTile = Math.floor((endBin - 1) / meta.tile_bins);
+        const fetches = [];
+        for (let t = firstTile; t <= lastTile; t++) fetches.push(fetchOverviewTile(device, level.level, t));
+        return Promise.all(fetches).then(views => drawOverview(meta, level, firstTile, views, start, end));
+      }).catch(e => log('overview failed: ' + e));
+  }
+
+  function drawOverview(meta, level, firstTile, views, start, end) {
+    const wave = overviewWave.getContext('2d');
+    const bands = overviewBands.getContext('2d');
+    const w = overviewWave.width, h = overviewWave.height;
+    const bandHeight = overviewBands.height / meta.band_count;
+    wave.clearRect(0, 0, w, h);
+    bands.clearRect(0, 0, w, overviewBands.height);
+    wave.fillStyle = '#4c4';
+    const framesPerPixel = (end - start) / w;
+    const bandLevels = new Array(meta.band_count);
+    for (let x = 0; x < w; x++) {
+      const b0 = Math.floor((start + x * framesPerPixel) / level.bin_frames);
+      const b1 = Math.max(b0 + 1, Math.floor((start + (x + 1) * framesPerPixel) / level.bin_frames));
+      let min = 0, max = 0, any = false;
+      bandLevels.fill(0);
+      for (let b = Math.max(0, b0); b < b1; b++) {
+        const view = views[Math.floor(b / meta.tile_bins) - firstTile];
+        const o = (b % meta.tile_bins) * OVERVIEW_RECORD_BYTES;
+        if (!view || o + OVERVIEW_RECORD_BYTES > view.byteLength || view.getUint8(o + 6) === 0) continue; // gap
+        const lo = view.getInt16(o, true), hi = view.getInt16(o + 2, true);
+        min = any ? Math.min(min, lo) : lo;
+        max = any ? Math.max(max, hi) : hi;
+        any = true;
+        for (let k = 0; k < meta.band_count; k++) bandLevels[k] = Math.max(bandLevels[k], view.getUint8(o + 8 + k));
+      }
+      if (!any) continue;
+      const top = h / 2 - max / 32768 * h / 2, bottom = h / 2 - min / 32768 * h / 2;
+      wave.fillRect(x, top, 1, Math.max(1, bottom - top));
+      for (let k = 0; k < meta.band_count; k++) {
+        // 255 + 2 dB per step; 90 dB of range from dark blue to yellow
+        const t = Math.max(0, Math.min(1, ((bandLevels[k] - 255) / 2 + 90) / 90));
+        bands.fillStyle = 'hsl(' + (240 - 180 * t) + ',100%,' + (8 + 50 * t) + '%)';
+        bands.fillRect(x, overviewBands.height - (k + 1) * bandHeight, 1, bandHeight);
+      }
+    }
+    // times assume no gaps between here and the end of the archive
+    const toTime = index => new Date(meta.end_unix_ms - (meta.end_sample_index - index) * 1000 / meta.sample_rate);
+    document.getElementById('overviewRange').textContent =
+      toTime(start).toLocaleString() + ' \u2013 ' + toTime(end).toLocaleString() +
+      ' (level ' + level.level + ', ' + level.bin_seconds.toFixed(3) + ' s bins)';
+  }
+
+  function moveOverview(halfSpans) {
+    if (!overviewMeta) return;
+    const end = overviewEndIndex === null ? overviewMeta.end_sample_index : overviewEndIndex;
+    const moved = end + halfSpans * overviewSpanFrames(overviewMeta) / 2;
+    overviewEndIndex = moved >= overviewMeta.end_sample_index ? null : Math.max(overviewSpanFrames(overviewMeta), moved);
+    refreshOverview();
+  }
+
+  overviewDeviceEl.addEventListener('change', () => { overviewEndIndex = null; refreshOverview(); });
+  overviewSpanEl.addEventListener('change', refreshOverview);
+  document.getElementById('overviewEarlier').addEventListener('click', () => moveOverview(-1));
+  document.getElementById('overviewLater').addEventListener('click', () => moveOverview(1));
+  document.getElementById('overviewLatest').addEventListener('click', () => { overviewEndIndex = null; refreshOverview(); });
+  loadOverviewDevices();
+  setInterval(() => { if (overviewEndIndex === null) refreshOverview(); }, 5000);
+
+  // Status polling (fallback while the WS is down)
+  function pollStatus() {
+    if (ws && ws.readyState === WebSocket.OPEN) return;
+    fetch('/status').then(r => r.json()).then(j => { status = j; updateStatus(j); }).catch(e => log('status fetch failed: '+e));
+  }
+  pollStatus();
+  setInterval(pollStatus, 1000);
 })();
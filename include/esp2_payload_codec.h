@@ -0,0 +1,327 @@
+// esp2_payload_codec.h
+// Coded ESP2 payload formats (format_id 2..5, see esp2_wire_header.h), shared by the
+// firmware encoders and the receiver decoders. Header-only, C++11 and allocation-free
+// so the ESP toolchain builds it and audioTask can call it; the caller owns every buffer.
+//
+// Encoders take one packet of int32 left-aligned 24-bit words (format 1, what the
+// I2S driver delivers), interleaved by channel. Decoders write the same layout, so
+// the receiver's format-1 conversion kernels run on every format's output.
+//
+//   ESP2_FORMAT_PACKED24   3 bytes per sample, little-endian. 25% smaller, no CPU cost.
+//
+//   ESP2_FORMAT_INT16      the top 16 bits, 2 bytes per sample little-endian (16-bit nodes).
+//
+//   ESP2_FORMAT_RICE24     lossless, FLAC-style fixed predictor + Rice codes. Per channel:
+//                            [order u8][order warm-up samples, 3 bytes LE each]
+//                            [MSB-first bitstream, padded to a byte]
+//                          The bitstream holds the frames - order residuals in partitions
+//                          of up to ESP2_RICE_PARTITION_SAMPLES: [k, 5 bits], then per
+//                          zigzagged residual u: (u >> k) zeros, a one, the low k bits of u.
+//                          A quotient of ESP2_RICE_ESCAPE_ZEROS or more is sent as that
+//                          many zeros followed by u in ESP2_RICE_RAW_BITS bits. Variable
+//                          length: the packet carries ESP2_FLAG_PAYLOAD_LENGTH.
+//
+//   ESP2_FORMAT_IMA_ADPCM  lossy 4:1 of the top 16 bits, for monitoring feeds. Per channel:
+//                            [predictor int16 LE][step index u8][0]
+//                            [(frames + 1) / 2 bytes of nibbles, low nibble first]
+//                          The block header is the encoder state entering the packet, so
+//                          the encoder adapts across packets and every packet decodes alone.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp2_wire_header.h"
+
+// ----------------- Packed 24-bit -----------------
+
+inline size_t esp2_packed24_encode(const int32_t* samples_left24, size_t sample_count, uint8_t* out) {
+    for (size_t i = 0; i < sample_count; ++i) esp2_store_le(out + 3 * i, (uint32_t)(samples_left24[i] >> 8), 3);
+    return sample_count * 3;
+}
+
+// Branch-free so the receiver's compiler can vectorize it
+inline void esp2_packed24_decode(const uint8_t* payload, size_t sample_count, int32_t* out_left24) {
+    for (size_t i = 0; i < sample_count; ++i) {
+        const uint8_t* bytes = payload + 3 * i;
+        out_left24[i] = (int32_t)(((uint32_t)bytes[0] << 8) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 24));
+    }
+}
+
+// ----------------- 16-bit PCM -----------------
+
+inline size_t esp2_int16_encode(const int32_t* samples_left24, size_t sample_count, uint8_t* out) {
+    for (size_t i = 0; i < sample_count; ++i) esp2_store_le(out + 2 * i, (uint32_t)(samples_left24[i] >> 16), 2);
+    return sample_count * 2;
+}
+
+inline void esp2_int16_decode(const uint8_t* payload, size_t sample_count, int32_t* out_left24) {
+    for (size_t i = 0; i < sample_count; ++i) out_left24[i] = (int32_t)((uint32_t)esp2_load_le16(payload + 2 * i) << 16);
+}
+
+// ----------------- Lossless fixed predictor + Rice -----------------
+
+static const size_t ESP2_RICE_PARTITION_SAMPLES = 256;
+static const uint8_t ESP2_RICE_MAX_ORDER = 3;
+static const unsigned ESP2_RICE_PARAMETER_BITS = 5;
+static const unsigned ESP2_RICE_MAX_PARAMETER = 27;
+static const unsigned ESP2_RICE_ESCAPE_ZEROS = 32;
+static const unsigned ESP2_RICE_RAW_BITS = 28;       // order-3 residuals of 24-bit audio, zigzagged
+
+// Residual of fixed polynomial predictor `order` at frame i (i >= order), 24-bit samples
+inline int32_t esp2_rice_residual(const int32_t* x, size_t stride, size_t i, uint8_t order) {
+    int32_t x0 = x[i * stride] >> 8;
+    if (order == 0) return x0;
+    int32_t x1 = x[(i - 1) * stride] >> 8;
+    if (order == 1) return x0 - x1;
+    int32_t x2 = x[(i - 2) * stride] >> 8;
+    if (order == 2) return x0 - 2 * x1 + x2;
+    int32_t x3 = x[(i - 3) * stride] >> 8;
+    return x0 - 3 * x1 + 3 * x2 - x3;
+}
+
+inline uint32_t esp2_zigzag(int32_t value) { return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31); }
+inline int32_t esp2_unzigzag(uint32_t value) { return (int32_t)(value >> 1) ^ -(int32_t)(value & 1u); }
+
+struct esp2_bit_writer {
+    uint8_t* out;
+    size_t capacity;
+    size_t position;
+    uint64_t bits;
+    unsigned bit_count;   // pending bits in `bits`, < 8 between calls
+    bool overflow;
+
+    void write(uint32_t value, unsigned count) { // count <= 32
+        if (count == 0) return;
+        bits = (bits << count) | (value & (uint32_t)(((uint64_t)1 << count) - 1));
+        bit_count += count;
+        while (bit_count >= 8) {
+            bit_count -= 8;
+            if (position < capacity) out[position] = (uint8_t)(bits >> bit_count);
+            else overflow = true;
+            ++position;
+        }
+    }
+    void pad_to_byte() {
+        if (bit_count) write(0, 8 - bit_count);
+    }
+};
+
+struct esp2_bit_reader {
+    const uint8_t* bytes;
+    size_t size;
+    size_t position;      // next byte to load; may run past size (loads zeros)
+    uint64_t window;      // unread bits, left-aligned
+    unsigned available;
+
+    void refill() {
+        while (available <= 56) {
+            uint64_t next = position < size ? bytes[position] : 0;
+            window |= next << (56 - available);
+            available += 8;
+            ++position;
+        }
+    }
+    uint32_t read(unsigned count) { // count <= 32
+        if (count == 0) return 0;
+        if (available < count) refill();
+        uint32_t value = (uint32_t)(window >> (64 - count));
+        window <<= count;
+        available -= count;
+        return value;
+    }
+    // Quotient of one Rice code, or ESP2_RICE_ESCAPE_ZEROS for an escaped value
+    unsigned read_zeros_and_one() {
+        if (available <= ESP2_RICE_ESCAPE_ZEROS) refill();
+        unsigned zeros = window ? (unsigned)__builtin_clzll(window) : 64;
+        if (zeros >= ESP2_RICE_ESCAPE_ZEROS) {
+            read(ESP2_RICE_ESCAPE_ZEROS);
+            return ESP2_RICE_ESCAPE_ZEROS;
+        }
+        window <<= zeros + 1;
+        available -= zeros + 1;
+        return zeros;
+    }
+    size_t bytes_consumed() const { return (position * 8 - available + 7) / 8; }
+};
+
+// FLAC's fixed-predictor choice: the order with the smallest sum of |residual|
+inline uint8_t esp2_rice_choose_order(const int32_t* x, size_t stride, size_t frames) {
+    uint64_t totals[ESP2_RICE_MAX_ORDER + 1] = {0, 0, 0, 0};
+    for (size_t i = ESP2_RICE_MAX_ORDER; i < frames; ++i) {
+        for (uint8_t order = 0; order <= ESP2_RICE_MAX_ORDER; ++order) {
+            int32_t residual = esp2_rice_residual(x, stride, i, order);
+            totals[order] += (uint64_t)(residual < 0 ? -(int64_t)residual : residual);
+        }
+    }
+    uint8_t best = 0;
+    for (uint8_t order = 1; order <= ESP2_RICE_MAX_ORDER; ++order) {
+        if (totals[order] < totals[best]) best = order;
+    }
+    return frames > best ? best : 0;
+}
+
+// Encode one packet; returns the payload length, or 0 if it does not fit `capacity`
+// (send ESP2_FORMAT_PACKED24 instead, which is never larger than worth coding).
+inline size_t esp2_rice24_encode(const int32_t* samples_left24, size_t frames, size_t channels, uint8_t* out, size_t capacity) {
+    size_t position = 0;
+    for (size_t channel = 0; channel < channels; ++channel) {
+        const int32_t* x = samples_left24 + channel;
+        uint8_t order = esp2_rice_choose_order(x, channels, frames);
+        if (position + 1 + 3 * (size_t)order > capacity) return 0;
+        out[position++] = order;
+        for (uint8_t i = 0; i < order; ++i, position += 3) esp2_store_le(out + position, (uint32_t)(x[i * channels] >> 8), 3);
+
+        esp2_bit_writer writer = {out, capacity, position, 0, 0, false};
+        for (size_t start = order; start < frames; start += ESP2_RICE_PARTITION_SAMPLES) {
+            size_t end = start + ESP2_RICE_PARTITION_SAMPLES < frames ? start + ESP2_RICE_PARTITION_SAMPLES : frames;
+            uint64_t sum = 0;
+            for (size_t i = start; i < end; ++i) sum += esp2_zigzag(esp2_rice_residual(x, channels, i, order));
+            unsigned k = 0;
+            while (k < ESP2_RICE_MAX_PARAMETER && ((uint64_t)(end - start) << (k + 1)) < sum) ++k;
+            writer.write(k, ESP2_RICE_PARAMETER_BITS);
+            for (size_t i = start; i < end; ++i) {
+                uint32_t value = esp2_zigzag(esp2_rice_residual(x, channels, i, order));
+                uint32_t quotient = value >> k;
+                if (quotient >= ESP2_RICE_ESCAPE_ZEROS) {
+                    writer.write(0, ESP2_RICE_ESCAPE_ZEROS);
+                    writer.write(value, ESP2_RICE_RAW_BITS);
+                    continue;
+                }
+                writer.write(1, quotient + 1);
+                writer.write(value, k);
+            }
+            if (writer.overflow) return 0;
+        }
+        writer.pad_to_byte();
+        if (writer.overflow) return 0;
+        position = writer.position;
+    }
+    return position;
+}
+
+// Decode one packet into frames * channels int32-left24 words; false if the payload is
+// malformed (wrong order, samples outside 24 bits, or codes running past payload_bytes)
+inline bool esp2_rice24_decode(const uint8_t* payload, size_t payload_bytes, size_t frames, size_t channels, int32_t* out_left24) {
+    size_t position = 0;
+    for (size_t channel = 0; channel < channels; ++channel) {
+        int32_t* out = out_left24 + channel;
+        if (position >= payload_bytes) return false;
+        uint8_t order = payload[position++];
+        if (order > ESP2_RICE_MAX_ORDER || order > frames || position + 3 * (size_t)order > payload_bytes) return false;
+        int64_t history[ESP2_RICE_MAX_ORDER] = {0, 0, 0}; // x[n-1], x[n-2], x[n-3]
+        for (uint8_t i = 0; i < order; ++i, position += 3) {
+            const uint8_t* bytes = payload + position;
+            int32_t sample = (int32_t)(((uint32_t)bytes[0] << 8) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 24)) >> 8;
+            out[i * channels] = (int32_t)((uint32_t)sample << 8);
+            history[2] = history[1];
+            history[1] = history[0];
+            history[0] = sample;
+        }
+
+        esp2_bit_reader reader = {payload + position, payload_bytes - position, 0, 0, 0};
+        unsigned k = 0;
+        for (size_t i = order; i < frames; ++i) {
+            if ((i - order) % ESP2_RICE_PARTITION_SAMPLES == 0) k = reader.read(ESP2_RICE_PARAMETER_BITS);
+            if (k > ESP2_RICE_MAX_PARAMETER) return false;
+            unsigned quotient = reader.read_zeros_and_one();
+            uint32_t value = quotient == ESP2_RICE_ESCAPE_ZEROS ? reader.read(ESP2_RICE_RAW_BITS)
+                                                                 : ((uint32_t)quotient << k) | reader.read(k);
+            int64_t residual = esp2_unzigzag(value);
+            int64_t prediction = order == 0 ? 0
+                               : order == 1 ? history[0]
+                               : order == 2 ? 2 * history[0] - history[1]
+                                            : 3 * history[0] - 3 * history[1] + history[2];
+            int64_t sample = prediction + residual;
+            if (sample < -8388608 || sample > 8388607) return false;
+            out[i * channels] = (int32_t)((uint32_t)sample << 8);
+            history[2] = history[1];
+            history[1] = history[0];
+            history[0] = sample;
+        }
+        if (reader.bytes_consumed() > reader.size) return false;
+        position += reader.bytes_consumed();
+    }
+    return true;
+}
+
+// ----------------- IMA ADPCM -----------------
+
+static const int16_t ESP2_IMA_STEP_TABLE[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45, 50, 55, 60, 66, 73, 80, 88, 97,
+    107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+    876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871,
+    5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623,
+    27086, 29794, 32767};
+static const int8_t ESP2_IMA_INDEX_TABLE[16] = {-1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8};
+
+// One channel's coder state; the encoder keeps it across packets
+struct esp2_ima_adpcm_state {
+    int32_t predictor = 0;   // last reconstructed 16-bit sample
+    int32_t step_index = 0;  // 0..88
+};
+
+// Apply one nibble to the state (encoder and decoder stay in lockstep through this)
+inline void esp2_ima_adpcm_apply(esp2_ima_adpcm_state& state, uint8_t nibble) {
+    int32_t step = ESP2_IMA_STEP_TABLE[state.step_index];
+    int32_t delta = step >> 3;
+    if (nibble & 4) delta += step;
+    if (nibble & 2) delta += step >> 1;
+    if (nibble & 1) delta += step >> 2;
+    int32_t predictor = (nibble & 8) ? state.predictor - delta : state.predictor + delta;
+    state.predictor = predictor < -32768 ? -32768 : predictor > 32767 ? 32767 : predictor;
+    int32_t step_index = state.step_index + ESP2_IMA_INDEX_TABLE[nibble];
+    state.step_index = step_index < 0 ? 0 : step_index > 88 ? 88 : step_index;
+}
+
+inline uint8_t esp2_ima_adpcm_encode_sample(esp2_ima_adpcm_state& state, int32_t sample16) {
+    int32_t difference = sample16 - state.predictor;
+    uint8_t nibble = 0;
+    if (difference < 0) {
+        nibble = 8;
+        difference = -difference;
+    }
+    int32_t step = ESP2_IMA_STEP_TABLE[state.step_index];
+    if (difference >= step) { nibble |= 4; difference -= step; }
+    if (difference >= step >> 1) { nibble |= 2; difference -= step >> 1; }
+    if (difference >= step >> 2) nibble |= 1;
+    esp2_ima_adpcm_apply(state, nibble);
+    return nibble;
+}
+
+// Encode one packet with one state per channel; returns esp2_ima_adpcm_payload_bytes()
+inline size_t esp2_ima_adpcm_encode(const int32_t* samples_left24, size_t frames, size_t channels,
+                                    esp2_ima_adpcm_state* states, uint8_t* out) {
+    size_t position = 0;
+    for (size_t channel = 0; channel < channels; ++channel) {
+        esp2_ima_adpcm_state& state = states[channel];
+        esp2_store_le(out + position, (uint16_t)(int16_t)state.predictor, 2);
+        out[position + 2] = (uint8_t)state.step_index;
+        out[position + 3] = 0;
+        position += 4;
+        for (size_t i = 0; i < frames; i += 2) {
+            uint8_t low = esp2_ima_adpcm_encode_sample(state, samples_left24[i * channels + channel] >> 16);
+            uint8_t high = i + 1 < frames ? esp2_ima_adpcm_encode_sample(state, samples_left24[(i + 1) * channels + channel] >> 16) : 0;
+            out[position++] = (uint8_t)(low | (high << 4));
+        }
+    }
+    return position;
+}
+
+inline bool esp2_ima_adpcm_decode(const uint8_t* payload, size_t payload_bytes, size_t frames, size_t channels, int32_t* out_left24) {
+    if (payload_bytes < esp2_ima_adpcm_payload_bytes(frames, channels)) return false;
+    const size_t block_bytes = 4 + (frames + 1) / 2;
+    for (size_t channel = 0; channel < channels; ++channel) {
+        const uint8_t* block = payload + channel * block_bytes;
+        if (block[2] > 88) return false;
+        esp2_ima_adpcm_state state;
+        state.predictor = (int16_t)esp2_load_le16(block);
+        state.step_index = block[2];
+        for (size_t i = 0; i < frames; ++i) {
+            uint8_t nibble = (uint8_t)((block[4 + i / 2] >> ((i & 1) * 4)) & 0x0F);
+            esp2_ima_adpcm_apply(state, nibble);
+            out_left24[i * channels + channel] = (int32_t)((uint32_t)state.predictor << 16);
+        }
+    }
+    return true;
+}
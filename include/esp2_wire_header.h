@@ -0,0 +1,427 @@
+// esp2_wire_header.h
+// ESP2 packet header wire format, shared by the ESP firmware (sendPacketTCP) and the
+// receivers. Every packet is this header followed by payload_bytes() of payload:
+// frames * channels * bytes_per_sample for the sample formats, see
+// esp2_payload_codec.h for the coded ones. All fields are little-endian.
+//
+//   [0..3]   uint32 magic               'E' 'S' 'P' '2' (0x45535032)
+//   [4..7]   uint32 sequence
+//   [8..15]  uint64 first_sample_index  index of the first frame in the payload
+//   [16..23] uint64 timestamp_us        device esp_timer_get_time() of the first frame
+//   [24..25] uint16 frames
+//   [26]     uint8  channels
+//   [27]     uint8  bytes_per_sample
+//   [28..31] uint32 sample_rate
+//   [32]     uint8  format_id
+//   [33]     uint8  header_version      0 = legacy 34-byte header, ends here
+//   [34..35] uint16 flags               version >= 1, ESP2_FLAG_*
+//   [36..37] uint16 header_bytes        version >= 1: total header length, >= 38
+//
+// Legacy senders wrote format_id as a uint16, so their version byte is always 0 and
+// they still parse. New fields are appended after byte 38 and counted in header_bytes;
+// a receiver skips trailing bytes it does not know, so adding a field needs neither a
+// new magic nor new offsets for the existing ones. Appended fields, in this order when
+// their flag is set: esp2_fec_extension (ESP2_FLAG_FEC), uint32 payload length
+// (ESP2_FLAG_PAYLOAD_LENGTH), uint32 capture overrun frames (ESP2_FLAG_CAPTURE_OVERRUN).
+//
+// The struct is made of byte arrays, so it has no padding and alignment 1 and can be
+// laid over a recv buffer in place. The accessors compose bytes explicitly (one load
+// on little-endian targets) and are C++11 constexpr so the firmware toolchain takes it.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+static const uint32_t ESP2_WIRE_MAGIC = 0x45535032;      // ASCII 'E' 'S' 'P' '2'
+static const uint8_t ESP2_WIRE_HEADER_VERSION_LEGACY = 0;
+static const uint8_t ESP2_WIRE_HEADER_VERSION = 1;        // what current senders write
+static const size_t ESP2_WIRE_LEGACY_HEADER_BYTES = 34;
+static const size_t ESP2_WIRE_HEADER_BYTES = 38;          // version 1 fixed part
+static const size_t ESP2_WIRE_HEADER_MAX_BYTES = 64;      // room for appended fields
+
+static const uint8_t ESP2_FORMAT_INT32_LEFT24 = 1;        // int32 words, 24-bit audio left-aligned
+static const uint8_t ESP2_FORMAT_PACKED24 = 2;            // 3-byte 24-bit samples (bytes_per_sample 3)
+static const uint8_t ESP2_FORMAT_RICE24 = 3;              // lossless predictor + Rice codes of 24-bit audio (bytes_per_sample 3)
+static const uint8_t ESP2_FORMAT_IMA_ADPCM = 4;           // 4-bit IMA ADPCM of 16-bit audio (bytes_per_sample 2)
+static const uint8_t ESP2_FORMAT_INT16 = 5;               // 16-bit PCM, little-endian (bytes_per_sample 2)
+
+static const uint16_t ESP2_FLAG_FEC = 0x0001;             // an esp2_fec_extension follows the fixed header
+static const uint16_t ESP2_FLAG_FEC_PARITY = 0x0002;      // payload is the XOR parity of an FEC group
+static const uint16_t ESP2_FLAG_PAYLOAD_LENGTH = 0x0004;  // a uint32 payload length follows (after any FEC extension)
+static const uint16_t ESP2_FLAG_CAPTURE_OVERRUN = 0x0008; // the sender dropped captured frames just before this packet;
+                                                          // a uint32 count of them follows (after the payload length)
+
+static const size_t ESP2_FEC_EXTENSION_BYTES = 8;
+static const size_t ESP2_PAYLOAD_LENGTH_EXTENSION_BYTES = 4;
+static const size_t ESP2_CAPTURE_OVERRUN_EXTENSION_BYTES = 4;
+
+// ----------------- Little-endian byte access -----------------
+
+constexpr uint16_t esp2_load_le16(const uint8_t* bytes) {
+    return (uint16_t)((uint16_t)bytes[0] | ((uint16_t)bytes[1] << 8));
+}
+constexpr uint32_t esp2_load_le32(const uint8_t* bytes) {
+    return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+constexpr uint64_t esp2_load_le64(const uint8_t* bytes) {
+    return (uint64_t)esp2_load_le32(bytes) | ((uint64_t)esp2_load_le32(bytes + 4) << 32);
+}
+
+inline void esp2_store_le(uint8_t* bytes, uint64_t value, size_t byte_count) {
+    for (size_t i = 0; i < byte_count; ++i) bytes[i] = (uint8_t)(value >> (8 * i));
+}
+
+// IMA ADPCM payload: per channel a 4-byte block header and one nibble per frame
+constexpr size_t esp2_ima_adpcm_payload_bytes(size_t frames, size_t channels) { return channels * (4 + (frames + 1) / 2); }
+
+// ----------------- Wire struct -----------------
+
+struct esp2_wire_header {
+    uint8_t magic_bytes[4];
+    uint8_t sequence_bytes[4];
+    uint8_t first_sample_index_bytes[8];
+    uint8_t timestamp_us_bytes[8];
+    uint8_t frames_bytes[2];
+    uint8_t channels_byte;
+    uint8_t bytes_per_sample_byte;
+    uint8_t sample_rate_bytes[4];
+    uint8_t format_id_byte;
+    uint8_t header_version_byte;
+    uint8_t flags_bytes[2];
+    uint8_t header_bytes_bytes[2];
+
+    constexpr uint32_t magic() const { return esp2_load_le32(magic_bytes); }
+    constexpr uint32_t sequence() const { return esp2_load_le32(sequence_bytes); }
+    constexpr uint64_t first_sample_index() const { return esp2_load_le64(first_sample_index_bytes); }
+    constexpr uint64_t timestamp_us() const { return esp2_load_le64(timestamp_us_bytes); }
+    constexpr uint16_t frames() const { return esp2_load_le16(frames_bytes); }
+    constexpr uint8_t channels() const { return channels_byte; }
+    constexpr uint8_t bytes_per_sample() const { return bytes_per_sample_byte; }
+    constexpr uint32_t sample_rate() const { return esp2_load_le32(sample_rate_bytes); }
+    constexpr uint8_t format_id() const { return format_id_byte; }
+    constexpr uint8_t header_version() const { return header_version_byte; }
+    // Fields past the legacy 34 bytes read as defaults on legacy headers
+    constexpr uint16_t flags() const {
+        return header_version_byte == ESP2_WIRE_HEADER_VERSION_LEGACY ? (uint16_t)0 : esp2_load_le16(flags_bytes);
+    }
+    constexpr size_t header_bytes() const {
+        return header_version_byte == ESP2_WIRE_HEADER_VERSION_LEGACY ? ESP2_WIRE_LEGACY_HEADER_BYTES
+                                                                      : (size_t)esp2_load_le16(header_bytes_bytes);
+    }
+    // Offset of an appended field: past the fixed part and every field before it in the
+    // documented order whose flag is set
+    size_t extension_offset(uint16_t flag) const {
+        size_t offset = ESP2_WIRE_HEADER_BYTES;
+        if (flag > ESP2_FLAG_FEC && (flags() & ESP2_FLAG_FEC)) offset += ESP2_FEC_EXTENSION_BYTES;
+        if (flag > ESP2_FLAG_PAYLOAD_LENGTH && (flags() & ESP2_FLAG_PAYLOAD_LENGTH)) offset += ESP2_PAYLOAD_LENGTH_EXTENSION_BYTES;
+        return offset;
+    }
+    // A uint32 appended field, or 0 if its flag is clear or the header is too short for it
+    uint32_t load_u32_extension(uint16_t flag) const {
+        if (!(flags() & flag)) return 0;
+        size_t offset = extension_offset(flag);
+        if (header_bytes() < offset + 4) return 0;
+        return esp2_load_le32(reinterpret_cast<const uint8_t*>(this) + offset);
+    }
+    // Payload length: announced by ESP2_FLAG_PAYLOAD_LENGTH (variable-length formats),
+    // else fixed by the format. 0 if the announced length is missing from the header.
+    size_t payload_bytes() const {
+        if (flags() & ESP2_FLAG_PAYLOAD_LENGTH) return load_u32_extension(ESP2_FLAG_PAYLOAD_LENGTH);
+        if (format_id_byte == ESP2_FORMAT_IMA_ADPCM) return esp2_ima_adpcm_payload_bytes(frames(), channels_byte);
+        return (size_t)frames() * (size_t)channels_byte * (size_t)bytes_per_sample_byte;
+    }
+    // Frames the sender lost between the previous packet and this one (its capture ring
+    // was full); first_sample_index already skips them
+    uint32_t capture_overrun_frames() const { return load_u32_extension(ESP2_FLAG_CAPTURE_OVERRUN); }
+
+    // Sender side: fills a current-version header with no appended fields
+    void set(uint32_t sequence_number, uint64_t first_sample, uint64_t capture_timestamp_us, uint16_t frame_count,
+             uint8_t channel_count, uint8_t sample_bytes, uint32_t rate, uint8_t format, uint16_t header_flags = 0) {
+        esp2_store_le(magic_bytes, ESP2_WIRE_MAGIC, 4);
+        esp2_store_le(sequence_bytes, sequence_number, 4);
+        esp2_store_le(first_sample_index_bytes, first_sample, 8);
+        esp2_store_le(timestamp_us_bytes, capture_timestamp_us, 8);
+        esp2_store_le(frames_bytes, frame_count, 2);
+        channels_byte = channel_count;
+        bytes_per_sample_byte = sample_bytes;
+        esp2_store_le(sample_rate_bytes, rate, 4);
+        format_id_byte = format;
+        header_version_byte = ESP2_WIRE_HEADER_VERSION;
+        esp2_store_le(flags_bytes, header_flags, 2);
+        esp2_store_le(header_bytes_bytes, ESP2_WIRE_HEADER_BYTES, 2);
+    }
+};
+
+// Sender side: append a uint32 field after the ones already written (callers append in
+// the documented order) and set its flag; returns the new header length
+inline size_t esp2_append_u32_extension(uint8_t* packet, uint16_t flag, uint32_t value) {
+    esp2_wire_header* header = reinterpret_cast<esp2_wire_header*>(packet);
+    size_t header_bytes = header->header_bytes();
+    esp2_store_le(packet + header_bytes, value, 4);
+    header_bytes += 4;
+    esp2_store_le(header->flags_bytes, header->flags() | flag, 2);
+    esp2_store_le(header->header_bytes_bytes, header_bytes, 2);
+    return header_bytes;
+}
+
+// Append the payload length extension after any FEC extension already written
+inline size_t esp2_append_payload_length(uint8_t* packet, uint32_t payload_bytes) {
+    return esp2_append_u32_extension(packet, ESP2_FLAG_PAYLOAD_LENGTH, payload_bytes);
+}
+
+// Append the capture overrun count after any payload length already written
+inline size_t esp2_append_capture_overrun(uint8_t* packet, uint32_t dropped_frames) {
+    return esp2_append_u32_extension(packet, ESP2_FLAG_CAPTURE_OVERRUN, dropped_frames);
+}
+
+// Decoded sample width a format's bytes_per_sample field carries, 0 for an unknown format
+constexpr uint8_t esp2_format_bytes_per_sample(uint8_t format_id) {
+    return format_id == ESP2_FORMAT_INT32_LEFT24 ? 4
+         : format_id == ESP2_FORMAT_PACKED24 || format_id == ESP2_FORMAT_RICE24 ? 3
+         : format_id == ESP2_FORMAT_IMA_ADPCM || format_id == ESP2_FORMAT_INT16 ? 2 : 0;
+}
+
+static_assert(sizeof(esp2_wire_header) == ESP2_WIRE_HEADER_BYTES, "esp2_wire_header must have no padding");
+static_assert(alignof(esp2_wire_header) == 1, "esp2_wire_header must be readable at any buffer offset");
+static_assert(offsetof(esp2_wire_header, first_sample_index_bytes) == 8, "ESP2 layout: first_sample_index");
+static_assert(offsetof(esp2_wire_header, timestamp_us_bytes) == 16, "ESP2 layout: timestamp_us");
+static_assert(offsetof(esp2_wire_header, frames_bytes) == 24, "ESP2 layout: frames");
+static_assert(offsetof(esp2_wire_header, sample_rate_bytes) == 28, "ESP2 layout: sample_rate");
+static_assert(offsetof(esp2_wire_header, header_version_byte) == 33, "ESP2 layout: header_version");
+static_assert(offsetof(esp2_wire_header, header_bytes_bytes) == 36, "ESP2 layout: header_bytes");
+
+// ----------------- Receive side -----------------
+
+enum class esp2_header_status {
+    complete,             // header_bytes() bytes are present; the view is valid
+    need_more_bytes,      // collect *required_bytes in total, then check again
+    bad_magic,
+    unsupported_version,
+    bad_length            // header_bytes outside [ESP2_WIRE_HEADER_BYTES, ESP2_WIRE_HEADER_MAX_BYTES]
+};
+
+// Check the first `size` received bytes of a header. *required_bytes is set to the total
+// header length known so far, so an incremental reader can collect exactly that much
+// (never past the header into the payload) and call again.
+inline esp2_header_status esp2_check_wire_header(const uint8_t* bytes, size_t size, size_t* required_bytes) {
+    *required_bytes = ESP2_WIRE_LEGACY_HEADER_BYTES;
+    if (size < ESP2_WIRE_LEGACY_HEADER_BYTES) return esp2_header_status::need_more_bytes;
+    if (esp2_load_le32(bytes) != ESP2_WIRE_MAGIC) return esp2_header_status::bad_magic;
+
+    uint8_t version = bytes[offsetof(esp2_wire_header, header_version_byte)];
+    if (version == ESP2_WIRE_HEADER_VERSION_LEGACY) return esp2_header_status::complete;
+    if (version > ESP2_WIRE_HEADER_VERSION) return esp2_header_status::unsupported_version;
+
+    *required_bytes = ESP2_WIRE_HEADER_BYTES;
+    if (size < ESP2_WIRE_HEADER_BYTES) return esp2_header_status::need_more_bytes;
+    size_t header_bytes = esp2_load_le16(bytes + offsetof(esp2_wire_header, header_bytes_bytes));
+    if (header_bytes < ESP2_WIRE_HEADER_BYTES || header_bytes > ESP2_WIRE_HEADER_MAX_BYTES) return esp2_header_status::bad_length;
+    *required_bytes = header_bytes;
+    return size < header_bytes ? esp2_header_status::need_more_bytes : esp2_header_status::complete;
+}
+
+// Bounds-checked view over a receive buffer: non-null only when the buffer holds a
+// complete, valid header. The buffer must outlive the view.
+inline const esp2_wire_header* esp2_wire_header_view(const uint8_t* bytes, size_t size) {
+    size_t required_bytes = 0;
+    if (esp2_check_wire_header(bytes, size, &required_bytes) != esp2_header_status::complete) return nullptr;
+    return reinterpret_cast<const esp2_wire_header*>(bytes);
+}
+
+// ----------------- UDP transport and FEC -----------------
+//
+// Over UDP every datagram is one complete packet, header and payload. A sender with
+// FEC on sets ESP2_FLAG_FEC and appends an esp2_fec_extension (header_bytes =
+// ESP2_WIRE_FEC_HEADER_BYTES). Data packets are grouped by packets_in_group
+// consecutive sequence numbers; after each group the sender emits one parity packet
+// (ESP2_FLAG_FEC | ESP2_FLAG_FEC_PARITY, sequence = the group's first) whose payload is
+// the XOR of the group's FEC blocks:
+//
+//   [first_sample_index u64][timestamp_us u64][frames u16][format_id u8]
+//   [bytes_per_sample u8][flags u16][payload_bytes u32][payload, zero padded]
+//
+// flags keeps only ESP2_FLAG_PAYLOAD_LENGTH. A sender may change format from one packet
+// to the next (RICE24 falls back to PACKED24 when it would not shrink), so a rebuilt
+// packet takes its format, length flag and exact length from its own block, not from
+// the group's other packets. A parity packet describes its payload in bytes:
+// channels = bytes_per_sample = 1
+// and frames = the block length (ESP2_FEC_BLOCK_PREFIX_BYTES + the longest payload),
+// with format_id ESP2_FORMAT_INT32_LEFT24.
+// Parity packets do not advance the sequence. A receiver holding every packet of a
+// group but one rebuilds the missing one as the XOR of everything it has.
+
+static const size_t ESP2_FEC_BLOCK_PREFIX_BYTES = 26;
+static const uint8_t ESP2_FEC_MAX_GROUP_PACKETS = 32;
+
+struct esp2_fec_extension {
+    uint8_t group_first_sequence_bytes[4];
+    uint8_t packets_in_group_byte;
+    uint8_t index_in_group_byte;          // packets_in_group on the parity packet
+    uint8_t reserved_bytes[2];
+
+    constexpr uint32_t group_first_sequence() const { return esp2_load_le32(group_first_sequence_bytes); }
+    constexpr uint8_t packets_in_group() const { return packets_in_group_byte; }
+    constexpr uint8_t index_in_group() const { return index_in_group_byte; }
+
+    void set(uint32_t first_sequence, uint8_t group_packets, uint8_t index) {
+        esp2_store_le(group_first_sequence_bytes, first_sequence, 4);
+        packets_in_group_byte = group_packets;
+        index_in_group_byte = index;
+        reserved_bytes[0] = reserved_bytes[1] = 0;
+    }
+};
+
+static const size_t ESP2_WIRE_FEC_HEADER_BYTES = ESP2_WIRE_HEADER_BYTES + sizeof(esp2_fec_extension);
+static_assert(sizeof(esp2_fec_extension) == ESP2_FEC_EXTENSION_BYTES, "esp2_fec_extension must have no padding");
+static_assert(ESP2_WIRE_FEC_HEADER_BYTES <= ESP2_WIRE_HEADER_MAX_BYTES, "FEC header must fit the header limit");
+
+// The FEC extension of a validated header view, or nullptr if it carries none
+inline const esp2_fec_extension* esp2_fec_extension_of(const esp2_wire_header& header) {
+    if (!(header.flags() & ESP2_FLAG_FEC) || header.header_bytes() < ESP2_WIRE_FEC_HEADER_BYTES) return nullptr;
+    return reinterpret_cast<const esp2_fec_extension*>(reinterpret_cast<const uint8_t*>(&header) + ESP2_WIRE_HEADER_BYTES);
+}
+
+inline void esp2_xor_bytes(uint8_t* accumulator, const uint8_t* bytes, size_t byte_count) {
+    for (size_t i = 0; i < byte_count; ++i) accumulator[i] ^= bytes[i];
+}
+
+// XOR one data packet's FEC block into a parity accumulator (zeroed at group start and
+// at least ESP2_FEC_BLOCK_PREFIX_BYTES + payload_bytes long). The header is the packet's
+// own, complete with any payload length extension.
+inline void esp2_fec_accumulate(uint8_t* parity_block, const esp2_wire_header& header, const uint8_t* payload,
+                                size_t payload_bytes) {
+    uint8_t prefix[ESP2_FEC_BLOCK_PREFIX_BYTES];
+    esp2_store_le(prefix, header.first_sample_index(), 8);
+    esp2_store_le(prefix + 8, header.timestamp_us(), 8);
+    esp2_store_le(prefix + 16, header.frames(), 2);
+    prefix[18] = header.format_id();
+    prefix[19] = header.bytes_per_sample();
+    esp2_store_le(prefix + 20, (uint16_t)(header.flags() & ESP2_FLAG_PAYLOAD_LENGTH), 2);
+    esp2_store_le(prefix + 22, (uint32_t)payload_bytes, 4);
+    esp2_xor_bytes(parity_block, prefix, sizeof(prefix));
+    esp2_xor_bytes(parity_block + ESP2_FEC_BLOCK_PREFIX_BYTES, payload, payload_bytes);
+}
+
+// ----------------- TCP session handshake -----------------
+//
+// Over TCP a session-capable device opens every connection with an esp2_session_hello
+// and sends nothing more until the receiver has answered with an esp2_session_welcome.
+// After that, packets flow as usual, and the receiver sends an esp2_session_ack now
+// and then on the same connection. A device without sessions sends packets straight
+// away, and the receiver tells the two apart by the first four bytes.
+//
+//   hello    device_id (stable, e.g. the Wi-Fi MAC), session_id (new at every boot,
+//            i.e. whenever the sample index restarts), the formats it can send,
+//            and acked_end_index, the oldest frame it still holds: everything before it
+//            was acknowledged.
+//   welcome  the result (a new session, or the resumption of the stream whose
+//            connection dropped), the format to send, and resume_sample_index. The
+//            device sends what it holds from there on, then continues live.
+//   ack      acked_end_index: the receiver has every frame before it. The device
+//            may free them.
+//
+// A hello whose device and session match a stream the receiver still holds, whether
+// its connection is already gone or not yet noticed as dead, continues that stream
+// and its files instead of starting new ones.
+
+static const uint32_t ESP2_SESSION_HELLO_MAGIC = 0x45535048;    // ASCII 'E' 'S' 'P' 'H'
+static const uint32_t ESP2_SESSION_WELCOME_MAGIC = 0x45535057;  // ASCII 'E' 'S' 'P' 'W'
+static const uint32_t ESP2_SESSION_ACK_MAGIC = 0x45535041;      // ASCII 'E' 'S' 'P' 'A'
+static const uint8_t ESP2_SESSION_VERSION = 1;
+
+static const uint8_t ESP2_SESSION_NEW = 1;        // welcome result: a new stream
+static const uint8_t ESP2_SESSION_RESUMED = 2;    // the previous stream continues
+static const uint8_t ESP2_SESSION_REJECTED = 3;   // no usable format; the receiver closes the connection
+
+constexpr uint32_t esp2_session_format_bit(uint8_t format_id) { return (uint32_t)1 << format_id; }
+
+struct esp2_session_hello {
+    uint8_t magic_bytes[4];
+    uint8_t version_byte;
+    uint8_t channels_byte;
+    uint8_t preferred_format_byte;
+    uint8_t reserved_byte;
+    uint8_t device_id_bytes[8];
+    uint8_t session_id_bytes[4];
+    uint8_t sample_rate_bytes[4];
+    uint8_t format_mask_bytes[4];          // esp2_session_format_bit() of every format it can send
+    uint8_t reserved_bytes[4];
+    uint8_t acked_end_index_bytes[8];
+    uint8_t next_sample_index_bytes[8];    // the next frame it will capture
+
+    constexpr uint32_t magic() const { return esp2_load_le32(magic_bytes); }
+    constexpr uint8_t version() const { return version_byte; }
+    constexpr uint8_t channels() const { return channels_byte; }
+    constexpr uint8_t preferred_format() const { return preferred_format_byte; }
+    constexpr uint64_t device_id() const { return esp2_load_le64(device_id_bytes); }
+    constexpr uint32_t session_id() const { return esp2_load_le32(session_id_bytes); }
+    constexpr uint32_t sample_rate() const { return esp2_load_le32(sample_rate_bytes); }
+    constexpr uint32_t format_mask() const { return esp2_load_le32(format_mask_bytes); }
+    constexpr uint64_t acked_end_index() const { return esp2_load_le64(acked_end_index_bytes); }
+    constexpr uint64_t next_sample_index() const { return esp2_load_le64(next_sample_index_bytes); }
+
+    void set(uint64_t device, uint32_t session, uint32_t rate, uint8_t channel_count, uint32_t formats,
+             uint8_t preferred, uint64_t acked_end, uint64_t next_sample) {
+        esp2_store_le(magic_bytes, ESP2_SESSION_HELLO_MAGIC, 4);
+        version_byte = ESP2_SESSION_VERSION;
+        channels_byte = channel_count;
+        preferred_format_byte = preferred;
+        reserved_byte = 0;
+        esp2_store_le(device_id_bytes, device, 8);
+        esp2_store_le(session_id_bytes, session, 4);
+        esp2_store_le(sample_rate_bytes, rate, 4);
+        esp2_store_le(format_mask_bytes, formats, 4);
+        esp2_store_le(reserved_bytes, 0, 4);
+        esp2_store_le(acked_end_index_bytes, acked_end, 8);
+        esp2_store_le(next_sample_index_bytes, next_sample, 8);
+    }
+};
+
+struct esp2_session_welcome {
+    uint8_t magic_bytes[4];
+    uint8_t version_byte;
+    uint8_t result_byte;                   // ESP2_SESSION_NEW / _RESUMED / _REJECTED
+    uint8_t format_byte;                   // payload format to send
+    uint8_t reserved_byte;
+    uint8_t resume_sample_index_bytes[8];
+    uint8_t stream_id_bytes[4];            // the receiver's stream, for logs
+    uint8_t ack_interval_ms_bytes[4];
+
+    constexpr uint32_t magic() const { return esp2_load_le32(magic_bytes); }
+    constexpr uint8_t version() const { return version_byte; }
+    constexpr uint8_t result() const { return result_byte; }
+    constexpr uint8_t format() const { return format_byte; }
+    constexpr uint64_t resume_sample_index() const { return esp2_load_le64(resume_sample_index_bytes); }
+    constexpr uint32_t stream_id() const { return esp2_load_le32(stream_id_bytes); }
+    constexpr uint32_t ack_interval_ms() const { return esp2_load_le32(ack_interval_ms_bytes); }
+
+    void set(uint8_t result, uint8_t format, uint64_t resume_sample, uint32_t stream, uint32_t ack_interval) {
+        esp2_store_le(magic_bytes, ESP2_SESSION_WELCOME_MAGIC, 4);
+        version_byte = ESP2_SESSION_VERSION;
+        result_byte = result;
+        format_byte = format;
+        reserved_byte = 0;
+        esp2_store_le(resume_sample_index_bytes, resume_sample, 8);
+        esp2_store_le(stream_id_bytes, stream, 4);
+        esp2_store_le(ack_interval_ms_bytes, ack_interval, 4);
+    }
+};
+
+struct esp2_session_ack {
+    uint8_t magic_bytes[4];
+    uint8_t reserved_bytes[4];
+    uint8_t acked_end_index_bytes[8];
+
+    constexpr uint32_t magic() const { return esp2_load_le32(magic_bytes); }
+    constexpr uint64_t acked_end_index() const { return esp2_load_le64(acked_end_index_bytes); }
+
+    void set(uint64_t acked_end) {
+        esp2_store_le(magic_bytes, ESP2_SESSION_ACK_MAGIC, 4);
+        esp2_store_le(reserved_bytes, 0, 4);
+        esp2_store_le(acked_end_index_bytes, acked_end, 8);
+    }
+};
+
+static_assert(sizeof(esp2_session_hello) == 48, "esp2_session_hello must have no padding");
+static_assert(sizeof(esp2_session_welcome) == 24, "esp2_session_welcome must have no padding");
+static_assert(sizeof(esp2_session_ack) == 16, "esp2_session_ack must have no padding");
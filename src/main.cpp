@@ -2,6 +2,7 @@
 #include <WiFi.h>
 #include <WiFiManager.h>   // Install via Library Manager (look for "WiFiManager")
 #include "driver/i2s.h"
+#include "esp2_wire_header.h"   // ESP2 packet header shared with the receiver
 
 // wifi configuration (defaults - will be overridden by WiFiManager if you set new creds)
 const char* WIFI_SSID = "94 Pembroke Street - 2";
@@ -20,10 +21,6 @@ const uint8_t NUMBER_CHANNELS = 1;
 const uint16_t FRAMES_PER_PACKET = 1024;
 const uint8_t BYTES_PER_SAMPLE = 4;
 
-const uint8_t HEADER_SIZE = 34;
-const uint32_t HEADER_MAGIC = 0x45535032;
-const uint8_t FORMAT_INT32_LEFT24 =1;
-
 WiFiClient TCPCLIENT;
 
 volatile uint32_t sequense_counter = 0;